@@ -24,24 +24,10 @@ const uint8_t cyw55500_fw[] = {
 };
 const uint32_t cyw55500_fw_len = sizeof(cyw55500_fw);
 
-/* Placeholder NVRAM - replace with actual NVRAM data */
-/* NVRAM contains calibration data and configuration for the WiFi chip */
-const uint8_t cyw55500_nvram[] = {
-    /* Typical NVRAM format (null-terminated key=value pairs):
-     * "manfid=0x2d0"
-     * "prodid=0x0726"
-     * "vendid=0x14e4"
-     * "devid=0x43e2"
-     * "boardtype=0x0726"
-     * "boardrev=0x1100"
-     * "boardnum=22"
-     * "macaddr=00:90:4c:c5:12:38"
-     * "sromrev=11"
-     * "boardflags=0x00000400"
-     * "xtalfreq=37400"
-     * etc...
-     */
-    /* TODO: Insert actual NVRAM data here */
-    0x00
+/* Packed NVRAM, generated from the board NVRAM text by CMakeLists.txt
+ * (nvram_pack.py): NUL-separated key=value pairs + size token, downloaded
+ * verbatim by cyw_load_firmware() */
+const uint8_t cyw55500_nvram[] __attribute__((aligned(4))) = {
+#include "cyw55500_nvram.inc"
 };
 const uint32_t cyw55500_nvram_len = sizeof(cyw55500_nvram);
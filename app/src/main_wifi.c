@@ -0,0 +1,67 @@
+/**
+ * CYW55500 WiFi - Network Interface Bring-up
+ * Built instead of main.c with -DEXTRA_CONF_FILE=wifi.conf
+ *
+ * Powers the chip up through the board's SDIO host, downloads the images
+ * from firmware/fw_blob.c and attaches the network interface; scanning,
+ * connecting and traffic then go through the wifi/net shell.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include "cyw55500_sdio.h"
+#include "cyw55500_netif.h"
+#include "sdio_host.h"
+
+LOG_MODULE_REGISTER(main, CONFIG_LOG_DEFAULT_LEVEL);
+
+/* firmware/fw_blob.c */
+extern const uint8_t cyw55500_fw[];
+extern const uint32_t cyw55500_fw_len;
+extern const uint8_t cyw55500_nvram[];
+extern const uint32_t cyw55500_nvram_len;
+
+static const sdio_host_ops_t *board_sdio_ops(void)
+{
+#if defined(CONFIG_SOC_SERIES_RP2350)
+    return rp2350_get_sdio_ops();
+#else
+    return litex_get_sdio_ops();
+#endif
+}
+
+int main(void)
+{
+    cyw_err_t err;
+    int ret;
+
+    LOG_INF("CYW55500 WiFi bring-up");
+
+    err = cyw_init(board_sdio_ops());
+    if (err != CYW_OK) {
+        LOG_ERR("Driver init failed: %d", err);
+        return 0;
+    }
+
+    err = cyw_load_firmware(cyw55500_fw, cyw55500_fw_len,
+                            cyw55500_nvram, cyw55500_nvram_len);
+    if (err != CYW_OK) {
+        LOG_ERR("Firmware load failed: %d", err);
+        return 0;
+    }
+
+    err = cyw_up();
+    if (err != CYW_OK) {
+        LOG_ERR("WiFi up failed: %d", err);
+        return 0;
+    }
+
+    ret = cyw_netif_start();
+    if (ret < 0) {
+        LOG_ERR("Network interface start failed: %d", ret);
+        return 0;
+    }
+
+    LOG_INF("WiFi interface up: use 'wifi scan' / 'wifi connect'");
+    return 0;
+}
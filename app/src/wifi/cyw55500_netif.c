@@ -0,0 +1,542 @@
+/**
+ * CYW55500 WiFi - Zephyr Network Interface
+ * Ethernet L2 + wifi_mgmt offload on top of the SDIO driver
+ *
+ * TX: the stack's net_pkt is queued and sent from the TX work queue, its
+ * net_buf fragments gathered straight onto the bus.
+ * RX: the RX work queue polls the bus; frames are read directly into
+ * net_bufs from a driver pool and handed to the stack without copying.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/logging/log.h>
+#include <zephyr/net/net_if.h>
+#include <zephyr/net/net_pkt.h>
+#include <zephyr/net/ethernet.h>
+#include <zephyr/net/wifi_mgmt.h>
+#include <string.h>
+#include "cyw55500_sdio.h"
+#include "cyw55500_netif.h"
+
+LOG_MODULE_REGISTER(cyw55500_netif, LOG_LEVEL_INF);
+
+/* Contiguous RX buffers sized per frame */
+NET_BUF_POOL_VAR_DEFINE(cyw_rx_pool, CYW_NETIF_RX_BUF_COUNT,
+                        CYW_NETIF_RX_BUF_COUNT * RX_BUF_SIZE, 0, NULL);
+
+K_THREAD_STACK_DEFINE(cyw_rx_wq_stack, CYW_NETIF_STACK_SIZE);
+K_THREAD_STACK_DEFINE(cyw_tx_wq_stack, CYW_NETIF_STACK_SIZE);
+
+/*============================================================================
+ * Private Data
+ *============================================================================*/
+
+static struct {
+    struct net_if *iface;
+    uint8_t mac[6];
+    bool connected;
+
+    /* RX polling and long management requests; the driver lock orders
+     * their bus access against the TX queue's */
+    struct k_work_q rx_wq;
+    struct k_work_delayable rx_work;
+    struct k_work scan_work;
+    struct k_work connect_work;
+
+    /* TX: sending never waits behind a poll or a connect */
+    struct k_work_q tx_wq;
+    struct k_work_delayable tx_work;
+
+    /* Frames from the stack, each holding a reference */
+    struct k_fifo tx_fifo;
+    atomic_t tx_queued;
+
+    /* Frames with more than CYW_NETIF_TX_MAX_FRAGS fragments (TX work) */
+    uint8_t tx_copy[NET_ETH_MAX_FRAME_SIZE];
+
+    /* Pending management requests */
+    scan_result_cb_t scan_cb;
+    cyw_scan_params_t scan_params;
+    char ssid[WIFI_SSID_MAX_LEN + 1];
+    uint8_t ssid_len;
+    char psk[WIFI_PSK_MAX_LEN + 1];
+
+    /* Statistics */
+    uint32_t tx_pkts;
+    uint32_t tx_bytes;
+    uint32_t tx_errors;
+    uint32_t rx_pkts;
+    uint32_t rx_bytes;
+    uint32_t rx_errors;
+} g_netif;
+
+/*============================================================================
+ * RX: net_buf Provider
+ *============================================================================*/
+
+static uint8_t *netif_rx_alloc(void *ctx, uint32_t len, void **handle)
+{
+    struct net_buf *buf = net_buf_alloc_len(&cyw_rx_pool, len, K_NO_WAIT);
+
+    ARG_UNUSED(ctx);
+
+    if (buf == NULL) {
+        g_netif.rx_errors++;
+        return NULL;
+    }
+
+    *handle = buf;
+    return buf->data;
+}
+
+static void netif_rx_recv(void *ctx, void *handle, uint32_t off, uint32_t len,
+                          uint8_t prio, uint8_t ifidx)
+{
+    struct net_buf *buf = handle;
+    struct net_pkt *pkt;
+
+    ARG_UNUSED(ctx);
+    ARG_UNUSED(ifidx);
+
+    /* The driver filled the storage: expose the Ethernet frame */
+    net_buf_add(buf, off + len);
+    net_buf_pull(buf, off);
+
+    pkt = net_pkt_rx_alloc_on_iface(g_netif.iface, K_NO_WAIT);
+    if (pkt == NULL) {
+        g_netif.rx_errors++;
+        net_buf_unref(buf);
+        return;
+    }
+
+    net_pkt_append_buffer(pkt, buf);
+    net_pkt_set_priority(pkt, prio);
+
+    if (net_recv_data(g_netif.iface, pkt) < 0) {
+        g_netif.rx_errors++;
+        net_pkt_unref(pkt);
+        return;
+    }
+
+    g_netif.rx_pkts++;
+    g_netif.rx_bytes += len;
+}
+
+static void netif_rx_free(void *ctx, void *handle)
+{
+    ARG_UNUSED(ctx);
+    net_buf_unref(handle);
+}
+
+static const cyw_rx_ops_t g_netif_rx_ops = {
+    .alloc = netif_rx_alloc,
+    .recv = netif_rx_recv,
+    .free = netif_rx_free,
+};
+
+/*============================================================================
+ * Work Handlers
+ *============================================================================*/
+
+/*
+ * Poll the bus; busy means come straight back, idle means the poll period.
+ * Received frames may have brought TX credit. Background scan slices
+ * (only with the TX queue empty) and roams to a BSS table candidate
+ * start from here, and the bus sleeps once idle.
+ */
+static void netif_rx_work(struct k_work *work)
+{
+    int n = cyw_rx_poll(CYW_NETIF_RX_BUDGET);
+
+    ARG_UNUSED(work);
+
+    k_work_reschedule_for_queue(&g_netif.rx_wq, &g_netif.rx_work,
+                                (n == CYW_NETIF_RX_BUDGET) ? K_NO_WAIT :
+                                K_MSEC(CYW_NETIF_POLL_MS));
+
+    if (n > 0 && !k_fifo_is_empty(&g_netif.tx_fifo)) {
+        k_work_reschedule_for_queue(&g_netif.tx_wq, &g_netif.tx_work, K_NO_WAIT);
+    }
+
+    cyw_bgscan_poll(atomic_get(&g_netif.tx_queued) == 0);
+    cyw_roam_poll();
+    cyw_pm_poll(atomic_get(&g_netif.tx_queued) == 0);
+}
+
+/*
+ * Gather a frame from its fragments; a longer chain is copied into one
+ * buffer instead
+ * @return Number of segments, 0 if the frame does not fit
+ */
+static uint32_t netif_tx_gather(struct net_pkt *pkt, sdio_sg_t *sg)
+{
+    struct net_buf *frag;
+    uint32_t n = 0;
+    size_t len;
+
+    for (frag = pkt->buffer; frag != NULL && n < CYW_NETIF_TX_MAX_FRAGS;
+         frag = frag->frags) {
+        if (frag->len > 0) {
+            sg[n].data = frag->data;
+            sg[n].len = frag->len;
+            n++;
+        }
+    }
+    if (frag == NULL) {
+        return n;
+    }
+
+    len = net_pkt_get_len(pkt);
+    if (len > sizeof(g_netif.tx_copy)) {
+        return 0;
+    }
+    sg[0].data = g_netif.tx_copy;
+    sg[0].len = net_buf_linearize(g_netif.tx_copy, sizeof(g_netif.tx_copy),
+                                  pkt->buffer, 0, len);
+    return 1;
+}
+
+/*
+ * Send queued frames, each gathered from its fragments. Without credit the
+ * frame stays at the head and is retried after the next RX poll.
+ */
+static void netif_tx_work(struct k_work *work)
+{
+    sdio_sg_t sg[CYW_NETIF_TX_MAX_FRAGS];
+    struct net_pkt *pkt;
+
+    ARG_UNUSED(work);
+
+    while ((pkt = k_fifo_peek_head(&g_netif.tx_fifo)) != NULL) {
+        uint32_t n = netif_tx_gather(pkt, sg);
+        uint32_t len = net_pkt_get_len(pkt);
+        cyw_err_t err;
+
+        err = (n > 0) ? cyw_tx_frame_sg(0, net_pkt_priority(pkt), sg, n)
+                      : CYW_ERR_INVALID;
+        if (err == CYW_ERR_BUSY) {
+            k_work_reschedule_for_queue(&g_netif.rx_wq, &g_netif.rx_work, K_NO_WAIT);
+            k_work_reschedule_for_queue(&g_netif.tx_wq, &g_netif.tx_work,
+                                        K_MSEC(CYW_NETIF_POLL_MS));
+            return;
+        }
+
+        (void)k_fifo_get(&g_netif.tx_fifo, K_NO_WAIT);
+        atomic_dec(&g_netif.tx_queued);
+
+        if (err == CYW_OK) {
+            g_netif.tx_pkts++;
+            g_netif.tx_bytes += len;
+        } else {
+            LOG_DBG("TX dropped: %d", err);
+            g_netif.tx_errors++;
+        }
+        net_pkt_unref(pkt);
+    }
+}
+
+static enum wifi_security_type netif_security(uint8_t sec)
+{
+    switch (sec) {
+        case CYW_SEC_WEP:       return WIFI_SECURITY_TYPE_WEP;
+        case CYW_SEC_WPA_PSK:   return WIFI_SECURITY_TYPE_WPA_PSK;
+        case CYW_SEC_WPA2_PSK:  return WIFI_SECURITY_TYPE_PSK;
+        case CYW_SEC_WPA3_SAE:  return WIFI_SECURITY_TYPE_SAE;
+        default:                return WIFI_SECURITY_TYPE_NONE;
+    }
+}
+
+/* Scan result, reported to the stack as it arrives (from the RX work) */
+static void netif_scan_result(void *ctx, const cyw_scan_result_t *bss)
+{
+    struct wifi_scan_result entry;
+
+    ARG_UNUSED(ctx);
+
+    memset(&entry, 0, sizeof(entry));
+    entry.ssid_length = MIN(bss->ssid_len, sizeof(entry.ssid));
+    memcpy(entry.ssid, bss->ssid, entry.ssid_length);
+    entry.channel = bss->channel;
+    entry.band = (bss->channel <= 14) ? WIFI_FREQ_BAND_2_4_GHZ
+                                      : WIFI_FREQ_BAND_5_GHZ;
+    entry.security = netif_security(bss->security);
+    entry.rssi = bss->rssi;
+    memcpy(entry.mac, bss->bssid, sizeof(bss->bssid));
+    entry.mac_length = sizeof(bss->bssid);
+
+    g_netif.scan_cb(g_netif.iface, 0, &entry);
+}
+
+static void netif_scan_done(void *ctx, cyw_err_t status)
+{
+    scan_result_cb_t cb = g_netif.scan_cb;
+
+    ARG_UNUSED(ctx);
+
+    g_netif.scan_cb = NULL;
+    cb(g_netif.iface, (status == CYW_OK) ? 0 : -EIO, NULL);
+}
+
+static void netif_scan_work(struct k_work *work)
+{
+    scan_result_cb_t cb = g_netif.scan_cb;
+
+    ARG_UNUSED(work);
+
+    if (cyw_scan_start(&g_netif.scan_params) != CYW_OK) {
+        g_netif.scan_cb = NULL;
+        cb(g_netif.iface, -EIO, NULL);
+    }
+}
+
+/*
+ * Link change from the firmware events (from the RX work). A link lost
+ * without netif_disconnect() (AP gone, deauthenticated) is reported to
+ * the stack as a disconnect.
+ */
+static void netif_link_changed(void *ctx, bool up, uint32_t reason)
+{
+    ARG_UNUSED(ctx);
+
+    if (up) {
+        g_netif.connected = true;
+        net_eth_carrier_on(g_netif.iface);
+    } else if (g_netif.connected) {
+        LOG_WRN("Link lost (%u)", reason);
+        g_netif.connected = false;
+        net_eth_carrier_off(g_netif.iface);
+        wifi_mgmt_raise_disconnect_result_event(g_netif.iface, 0);
+    }
+}
+
+/* The link callback has the carrier up by the time cyw_connect() returns */
+static void netif_connect_work(struct k_work *work)
+{
+    cyw_err_t err;
+
+    ARG_UNUSED(work);
+
+    err = cyw_connect(g_netif.ssid, g_netif.psk[0] ? g_netif.psk : NULL);
+
+    wifi_mgmt_raise_connect_result_event(g_netif.iface, (err == CYW_OK) ? 0 : -EIO);
+}
+
+/*============================================================================
+ * Ethernet API
+ *============================================================================*/
+
+static int netif_send(const struct device *dev, struct net_pkt *pkt)
+{
+    ARG_UNUSED(dev);
+
+    if (!g_netif.connected) {
+        return -ENETDOWN;
+    }
+    if (atomic_get(&g_netif.tx_queued) >= CYW_NETIF_TX_QUEUE_LEN) {
+        g_netif.tx_errors++;
+        return -ENOBUFS;
+    }
+
+    /* L2 drops its reference once we return */
+    net_pkt_ref(pkt);
+    atomic_inc(&g_netif.tx_queued);
+    k_fifo_put(&g_netif.tx_fifo, pkt);
+    k_work_reschedule_for_queue(&g_netif.tx_wq, &g_netif.tx_work, K_NO_WAIT);
+
+    return 0;
+}
+
+static void netif_iface_init(struct net_if *iface)
+{
+    struct ethernet_context *eth_ctx = net_if_l2_data(iface);
+
+    g_netif.iface = iface;
+    eth_ctx->eth_if_type = L2_ETH_IF_TYPE_WIFI;
+    ethernet_init(iface);
+
+    /* Up once the firmware runs and the MAC address is known */
+    net_if_flag_set(iface, NET_IF_NO_AUTO_START);
+    net_if_carrier_off(iface);
+}
+
+/*============================================================================
+ * wifi_mgmt API
+ *============================================================================*/
+
+static int netif_scan(const struct device *dev, struct wifi_scan_params *params,
+                      scan_result_cb_t cb)
+{
+    ARG_UNUSED(dev);
+
+    if (g_netif.scan_cb != NULL) {
+        return -EINPROGRESS;
+    }
+
+    memset(&g_netif.scan_params, 0, sizeof(g_netif.scan_params));
+    if (params != NULL) {
+        g_netif.scan_params.passive = (params->scan_type == WIFI_SCAN_TYPE_PASSIVE);
+        g_netif.scan_params.active_time = params->dwell_time_active;
+        g_netif.scan_params.passive_time = params->dwell_time_passive;
+    }
+    g_netif.scan_params.on_result = netif_scan_result;
+    g_netif.scan_params.on_done = netif_scan_done;
+
+    g_netif.scan_cb = cb;
+    k_work_submit_to_queue(&g_netif.rx_wq, &g_netif.scan_work);
+    return 0;
+}
+
+static int netif_connect(const struct device *dev,
+                         struct wifi_connect_req_params *params)
+{
+    ARG_UNUSED(dev);
+
+    if (params->ssid_length == 0 || params->ssid_length > WIFI_SSID_MAX_LEN ||
+        params->psk_length > WIFI_PSK_MAX_LEN) {
+        return -EINVAL;
+    }
+    if (k_work_busy_get(&g_netif.connect_work)) {
+        return -EINPROGRESS;
+    }
+
+    memcpy(g_netif.ssid, params->ssid, params->ssid_length);
+    g_netif.ssid[params->ssid_length] = '\0';
+    g_netif.ssid_len = params->ssid_length;
+    memcpy(g_netif.psk, params->psk, params->psk_length);
+    g_netif.psk[params->psk_length] = '\0';
+
+    k_work_submit_to_queue(&g_netif.rx_wq, &g_netif.connect_work);
+    return 0;
+}
+
+static int netif_disconnect(const struct device *dev)
+{
+    cyw_err_t err;
+
+    ARG_UNUSED(dev);
+
+    /* Before the link goes down, so the link callback stays quiet */
+    g_netif.connected = false;
+    net_eth_carrier_off(g_netif.iface);
+    err = cyw_disconnect();
+
+    wifi_mgmt_raise_disconnect_result_event(g_netif.iface, (err == CYW_OK) ? 0 : -EIO);
+    return (err == CYW_OK) ? 0 : -EIO;
+}
+
+static int netif_iface_status(const struct device *dev,
+                              struct wifi_iface_status *status)
+{
+    ARG_UNUSED(dev);
+
+    status->state = g_netif.connected ? WIFI_STATE_COMPLETED
+                                      : WIFI_STATE_DISCONNECTED;
+    status->iface_mode = WIFI_MODE_INFRA;
+    status->link_mode = WIFI_LINK_MODE_UNKNOWN;
+
+    if (g_netif.connected) {
+        status->ssid_len = g_netif.ssid_len;
+        memcpy(status->ssid, g_netif.ssid, g_netif.ssid_len);
+        status->rssi = cyw_get_rssi();
+    }
+
+    return 0;
+}
+
+#if defined(CONFIG_NET_STATISTICS_WIFI)
+static int netif_get_stats(const struct device *dev, struct net_stats_wifi *stats)
+{
+    ARG_UNUSED(dev);
+
+    stats->pkts.tx = g_netif.tx_pkts;
+    stats->pkts.rx = g_netif.rx_pkts;
+    stats->bytes.sent = g_netif.tx_bytes;
+    stats->bytes.received = g_netif.rx_bytes;
+    stats->errors.tx = g_netif.tx_errors;
+    stats->errors.rx = g_netif.rx_errors;
+
+    return 0;
+}
+#endif
+
+static const struct wifi_mgmt_ops cyw_wifi_mgmt = {
+    .scan = netif_scan,
+    .connect = netif_connect,
+    .disconnect = netif_disconnect,
+    .iface_status = netif_iface_status,
+#if defined(CONFIG_NET_STATISTICS_WIFI)
+    .get_stats = netif_get_stats,
+#endif
+};
+
+static const struct net_wifi_mgmt_offload cyw_wifi_api = {
+    .wifi_iface.iface_api.init = netif_iface_init,
+    .wifi_iface.send = netif_send,
+    .wifi_mgmt_api = &cyw_wifi_mgmt,
+};
+
+/*============================================================================
+ * Device
+ *============================================================================*/
+
+static int netif_dev_init(const struct device *dev)
+{
+    struct k_work_queue_config rx_cfg = { .name = "cyw55500_rx" };
+    struct k_work_queue_config tx_cfg = { .name = "cyw55500_tx" };
+
+    ARG_UNUSED(dev);
+
+    k_fifo_init(&g_netif.tx_fifo);
+    k_work_init_delayable(&g_netif.tx_work, netif_tx_work);
+    k_work_init_delayable(&g_netif.rx_work, netif_rx_work);
+    k_work_init(&g_netif.scan_work, netif_scan_work);
+    k_work_init(&g_netif.connect_work, netif_connect_work);
+
+    k_work_queue_start(&g_netif.rx_wq, cyw_rx_wq_stack,
+                       K_THREAD_STACK_SIZEOF(cyw_rx_wq_stack),
+                       CYW_NETIF_PRIORITY, &rx_cfg);
+    k_work_queue_start(&g_netif.tx_wq, cyw_tx_wq_stack,
+                       K_THREAD_STACK_SIZEOF(cyw_tx_wq_stack),
+                       CYW_NETIF_PRIORITY, &tx_cfg);
+
+    return 0;
+}
+
+ETH_NET_DEVICE_INIT(cyw55500_wifi, "cyw55500", netif_dev_init, NULL, NULL, NULL,
+                    CONFIG_WIFI_INIT_PRIORITY, &cyw_wifi_api, NET_ETH_MTU);
+
+/*============================================================================
+ * Public API
+ *============================================================================*/
+
+int cyw_netif_start(void)
+{
+    if (g_netif.iface == NULL) {
+        return -ENODEV;
+    }
+    if (cyw_get_state() < CYW_STATE_UP) {
+        return -EAGAIN;
+    }
+
+    if (cyw_get_mac(g_netif.mac) != CYW_OK) {
+        LOG_ERR("Cannot read MAC address");
+        return -EIO;
+    }
+    net_if_set_link_addr(g_netif.iface, g_netif.mac, sizeof(g_netif.mac),
+                         NET_LINK_ETHERNET);
+
+    cyw_set_rx_ops(&g_netif_rx_ops);
+    cyw_set_link_callback(netif_link_changed, NULL);
+    k_work_reschedule_for_queue(&g_netif.rx_wq, &g_netif.rx_work, K_NO_WAIT);
+
+    LOG_INF("MAC %02x:%02x:%02x:%02x:%02x:%02x",
+            g_netif.mac[0], g_netif.mac[1], g_netif.mac[2],
+            g_netif.mac[3], g_netif.mac[4], g_netif.mac[5]);
+
+    return net_if_up(g_netif.iface);
+}
+
+struct net_if *cyw_netif_get(void)
+{
+    return g_netif.iface;
+}
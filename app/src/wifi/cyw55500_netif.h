@@ -0,0 +1,70 @@
+/**
+ * CYW55500 WiFi - Zephyr Network Interface
+ * Ethernet L2 + wifi_mgmt offload on top of the SDIO driver
+ */
+
+#ifndef CYW55500_NETIF_H
+#define CYW55500_NETIF_H
+
+#include <zephyr/net/net_if.h>
+
+/*============================================================================
+ * Configuration
+ *============================================================================*/
+
+/* RX frames in flight towards the IP stack (one net_buf each) */
+#ifndef CYW_NETIF_RX_BUF_COUNT
+#define CYW_NETIF_RX_BUF_COUNT      8
+#endif
+
+/* Frames queued by the stack but not yet on the bus */
+#ifndef CYW_NETIF_TX_QUEUE_LEN
+#define CYW_NETIF_TX_QUEUE_LEN      16
+#endif
+
+/* net_buf fragments gathered per TX frame (1514 bytes / 128-byte buffers
+ * + slack); longer chains are copied into one buffer */
+#ifndef CYW_NETIF_TX_MAX_FRAGS
+#define CYW_NETIF_TX_MAX_FRAGS      16
+#endif
+
+/* Frames handled per RX work run before yielding */
+#ifndef CYW_NETIF_RX_BUDGET
+#define CYW_NETIF_RX_BUDGET         8
+#endif
+
+/* Bus poll period while idle (no host-wake interrupt) */
+#ifndef CYW_NETIF_POLL_MS
+#define CYW_NETIF_POLL_MS           2
+#endif
+
+/* Driver work queues, one each for RX polling and TX */
+#ifndef CYW_NETIF_STACK_SIZE
+#define CYW_NETIF_STACK_SIZE        2048
+#endif
+#ifndef CYW_NETIF_PRIORITY
+#define CYW_NETIF_PRIORITY          5
+#endif
+
+/*============================================================================
+ * Public API
+ *============================================================================*/
+
+/**
+ * Attach the interface to the running firmware
+ *
+ * Call once cyw_up() has succeeded: reads the MAC address, starts bus
+ * polling and brings the interface up. The carrier stays off until a
+ * connect request succeeds.
+ *
+ * @return 0 on success, negative errno otherwise
+ */
+int cyw_netif_start(void);
+
+/**
+ * Get the network interface
+ * @return Interface, or NULL before network initialization
+ */
+struct net_if *cyw_netif_get(void);
+
+#endif /* CYW55500_NETIF_H */
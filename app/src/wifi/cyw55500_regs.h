@@ -117,6 +117,12 @@
 #define SBSDIO_FUNC1_WAKEUPCTRL     0x1001E
 #define SBSDIO_FUNC1_SLEEPCSR       0x1001F
 
+/* FRAMECTRL bits */
+#define SFC_RF_TERM                 (1 << 0)    /* Read frame terminate */
+#define SFC_WF_TERM                 (1 << 1)    /* Write frame terminate */
+#define SFC_CRC4WOOS                (1 << 2)
+#define SFC_ABORTALL                (1 << 3)
+
 /* Secure mode register (rev27+) */
 #define SBSDIO_FUNC1_SECURE_MODE    0x10001
 
@@ -146,6 +152,10 @@
 #define SBSDIO_SLEEPCSR_KSO         0x01    /* Keep SDIO On */
 #define SBSDIO_SLEEPCSR_DEVON       0x02    /* Device On */
 
+/* WAKEUPCTRL bits: what a wakeup waits for before the core answers */
+#define SBSDIO_WCTRL_ALPWAIT        0x01
+#define SBSDIO_WCTRL_HTWAIT         0x02
+
 /* MESBUSYCTRL bits */
 #define SBSDIO_MESBUSY_RXFIFO_WM_MASK   0x7F
 #define SBSDIO_MESBUSYCTRL_ENAB         0x80
@@ -160,6 +170,9 @@
  * SDIO Core Registers
  *============================================================================*/
 
+/* Backplane address of the core; the offsets below are relative to it */
+#define SDIO_CORE_BASE_ADDR         0x18002000
+
 /* Core control */
 #define SDIO_CORE_CORECONTROL       0x000
 #define SDIO_CORE_CORESTATUS        0x004
@@ -207,6 +220,9 @@
 #define I_HMB_FRAME_IND             (1 << 9)
 #define I_HMB_HOST_INT              (1 << 10)
 
+/* Interrupts routed to the host (HOSTINTMASK) */
+#define SDIO_HOSTINTMASK            (I_HMB_FC_CHANGE | I_HMB_FRAME_IND)
+
 /* Host mailbox data bits */
 #define HMB_DATA_NAKHANDLED         0x0001
 #define HMB_DATA_DEVREADY           0x0002
@@ -431,6 +447,128 @@
 #define WLC_REASSOC                 53
 #define WLC_GET_RSSI                127
 #define WLC_GET_BSSID               23
+#define WLC_SET_WSEC_PMK            268
+#define WLC_GET_VALID_CHANNELS      217
+#define WLC_SET_PM                  86
+#define WLC_GET_PM                  85
+#define WLC_SET_ROAM_TRIGGER        55
+#define WLC_GET_ROAM_TRIGGER        54
+#define WLC_SET_ROAM_DELTA          57
+#define WLC_GET_ROAM_DELTA          56
+#define WLC_SET_ROAM_SCAN_PERIOD    79
+#define WLC_GET_ROAM_SCAN_PERIOD    78
+
+/* WLC_SET_ROAM_TRIGGER/DELTA: value, then band */
+#define WLC_BAND_ALL                3
+
+/* rssi_event iovar: most RSSI levels */
+#define WL_RSSI_EVENT_MAX_LEVELS    8
+
+/* WLC_SET_PM */
+#define PM_OFF                      0
+#define PM_MAX                      1       /* PS-Poll */
+#define PM_FAST                     2       /* Awake while traffic flows */
+
+/* WLC_SET_WSEC */
+#define WSEC_NONE                   0x00
+#define WSEC_TKIP_ENABLED           0x02
+#define WSEC_AES_ENABLED            0x04
+
+/* wpa_auth */
+#define WPA_AUTH_DISABLED           0x0000
+#define WPA2_AUTH_PSK               0x0080
+
+/* WLC_SET_WSEC_PMK flags */
+#define WSEC_PASSPHRASE             0x01
+
+/*============================================================================
+ * Firmware Events
+ *============================================================================*/
+
+/* Event frames: Ethernet header, Broadcom header, event message */
+#define ETHER_TYPE_BRCM             0x886C
+#define BCMILCP_SUBTYPE_VENDOR_LONG 0x8001
+#define BCMILCP_BCM_SUBTYPE_EVENT   1
+#define BRCM_OUI                    "\x00\x10\x18"
+
+/* event_msgs iovar: one bit per event type */
+#define WL_EVENTING_MASK_LEN        16
+
+/* Event message flags */
+#define WLC_EVENT_MSG_LINK          0x01
+#define WLC_EVENT_MSG_FLUSHTXQ      0x02
+#define WLC_EVENT_MSG_GROUP         0x04
+
+/* Event types */
+#define WLC_E_SET_SSID              0
+#define WLC_E_JOIN                  1
+#define WLC_E_START                 2
+#define WLC_E_AUTH                  3
+#define WLC_E_AUTH_IND              4
+#define WLC_E_DEAUTH                5
+#define WLC_E_DEAUTH_IND            6
+#define WLC_E_ASSOC                 7
+#define WLC_E_ASSOC_IND             8
+#define WLC_E_REASSOC               9
+#define WLC_E_REASSOC_IND           10
+#define WLC_E_DISASSOC              11
+#define WLC_E_DISASSOC_IND          12
+#define WLC_E_LINK                  16
+#define WLC_E_MIC_ERROR             17
+#define WLC_E_ROAM                  19
+#define WLC_E_PMKID_CACHE           21
+#define WLC_E_PRUNE                 23
+#define WLC_E_EAPOL_MSG             25
+#define WLC_E_SCAN_COMPLETE         26
+#define WLC_E_BCNLOST_MSG           31
+#define WLC_E_PFN_NET_FOUND         33
+#define WLC_E_PFN_NET_LOST          34
+#define WLC_E_PSK_SUP               46
+#define WLC_E_COUNTRY_CODE_CHANGED  47
+#define WLC_E_IF                    54
+#define WLC_E_RSSI                  56
+#define WLC_E_ESCAN_RESULT          69
+
+/* Event status */
+#define WLC_E_STATUS_SUCCESS        0
+#define WLC_E_STATUS_FAIL           1
+#define WLC_E_STATUS_TIMEOUT        2
+#define WLC_E_STATUS_NO_NETWORKS    3
+#define WLC_E_STATUS_ABORT          4
+#define WLC_E_STATUS_NO_ACK         5
+#define WLC_E_STATUS_UNSOLICITED    6
+#define WLC_E_STATUS_ATTEMPT        7
+#define WLC_E_STATUS_PARTIAL        8
+#define WLC_E_STATUS_NEWSCAN        9
+#define WLC_E_STATUS_NEWASSOC       10
+
+/*============================================================================
+ * Scan
+ *============================================================================*/
+
+/* escan iovar */
+#define ESCAN_REQ_VERSION           1
+#define WL_SCAN_ACTION_START        1
+#define WL_SCAN_ACTION_ABORT        3
+#define DOT11_BSSTYPE_ANY           2
+#define WL_SCANFLAGS_PASSIVE        0x01
+
+/* Chanspec: channel number, bandwidth, band */
+#define WL_CHANSPEC_CHAN_MASK       0x00FF
+#define WL_CHANSPEC_BW_20           0x1000
+#define WL_CHANSPEC_BAND_2G         0x0000
+#define WL_CHANSPEC_BAND_5G         0xC000
+
+/* BSS capability and information elements */
+#define DOT11_CAP_PRIVACY           0x0010
+#define DOT11_MNG_RSN_ID            48
+#define DOT11_MNG_VS_ID             221
+#define WPA_OUI                     "\x00\x50\xF2"
+#define WPA_OUI_TYPE                1
+#define RSN_OUI                     "\x00\x0F\xAC"
+#define RSN_AKM_PSK                 2
+#define RSN_AKM_SHA256_PSK          6
+#define RSN_AKM_SAE                 8
 
 /*============================================================================
  * Utility Macros
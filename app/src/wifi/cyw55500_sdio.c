@@ -5,15 +5,36 @@
 
 #include <zephyr/kernel.h>
 #include <zephyr/logging/log.h>
+#include <zephyr/sys/byteorder.h>
 #include <string.h>
 #include "cyw55500_sdio.h"
 
 LOG_MODULE_REGISTER(cyw55500, LOG_LEVEL_DBG);
 
+/* IOCTL arena: one control frame of the largest IOCTL, word padded */
+#define IOCTL_BUF_SIZE  ALIGN(SDPCM_HEADER_SIZE + BCDC_HEADER_SIZE + CYW_IOCTL_MAX_LEN, 4)
+
 /*============================================================================
  * Driver Context
  *============================================================================*/
 
+/* Outstanding IOCTL, matched to its response by BCDC reqid */
+typedef struct {
+    bool busy;
+    volatile bool done;
+    uint16_t reqid;
+    cyw_err_t err;
+    void *resp;
+    uint32_t resp_len;
+    struct k_sem sem;               /* Given when done */
+} cyw_ioctl_req_t;
+
+/* Registered event handler */
+typedef struct {
+    cyw_event_cb_t cb;              /* NULL: free */
+    void *ctx;
+} cyw_event_handler_t;
+
 typedef struct {
     cyw_state_t state;
     cyw_chip_info_t chip;
@@ -23,22 +44,81 @@ typedef struct {
     uint8_t rx_seq;
     uint8_t tx_max;
     uint8_t flow_ctrl;
+    bool rx_irq_more;               /* Interrupt acknowledged, frames left to read */
     uint16_t reqid;
+    cyw_ioctl_req_t ioctl[CYW_IOCTL_MAX_PENDING];
+    struct k_sem ioctl_slots;       /* Free entries in ioctl[] */
+    struct k_mutex lock;            /* Bus, SDPCM and IOCTL state */
+    const cyw_rx_ops_t *rx_ops;
+    uint32_t rx_dropped;
+    /* Events: handlers, and per type a bitmap of the handlers subscribed */
+    cyw_event_handler_t ev_handler[CYW_EVENT_HANDLERS];
+    uint8_t ev_subs[CYW_EVENT_MAX];
+    uint8_t ev_mask[WL_EVENTING_MASK_LEN];  /* As last programmed */
+    bool ev_mask_valid;
+    struct k_mutex ev_lock;         /* Programming ev_mask */
+    /* Link, as the firmware reports it (under lock) */
+    volatile bool link_up;
+    uint8_t link_bssid[6];
+    volatile cyw_err_t join_status; /* CYW_ERR_BUSY while joining */
+    cyw_link_cb_t link_cb;
+    void *link_cb_ctx;
+    cyw_join_cache_t join_cache;
     uint8_t tx_buf[TX_BUF_SIZE] __attribute__((aligned(4)));
     uint8_t rx_buf[RX_BUF_SIZE] __attribute__((aligned(4)));
+    /* Requests built in place, responses too large for rx_buf (under lock) */
+    uint8_t ioctl_buf[IOCTL_BUF_SIZE] __attribute__((aligned(4)));
     const sdio_host_ops_t *ops;
 } cyw_dev_t;
 
 static cyw_dev_t g_cyw_dev;
 
-/* Scan state */
+/* Scan: BSS table, its BSSID hash and its heap, weakest on top (under lock) */
 static struct {
-    bool in_progress;
+    cyw_scan_result_t bss[CYW_SCAN_MAX_BSS];
+    uint8_t hash[CYW_SCAN_HASH_SIZE];
+    uint8_t heap[CYW_SCAN_MAX_BSS];
+    uint8_t pos[CYW_SCAN_MAX_BSS];      /* Heap index of each entry */
+    uint32_t count;
+    uint32_t gen;                       /* Scans started */
+    uint32_t heard;                     /* BSS records received */
     uint16_t sync_id;
-    cyw_scan_result_t results[16];
-    int count;
+    volatile bool busy;
+    cyw_scan_params_t req;              /* Callbacks of the scan running */
 } g_scan_state;
 
+/* Background scan: channel plan and where the sweep is (under lock) */
+static struct {
+    volatile bool on;
+    bool slice;                         /* The scan running is a slice */
+    cyw_bgscan_params_t params;         /* Defaults filled in */
+    uint16_t ch[CYW_SCAN_MAX_CHANNELS];
+    uint32_t pos;                       /* First channel of the next slice */
+    int64_t next;                       /* k_uptime_get() of the next slice */
+} g_bgscan;
+
+/* Roaming: settings, RSSI and the reassociation in flight (under lock) */
+static struct {
+    volatile bool on;
+    cyw_roam_params_t params;           /* Defaults filled in */
+    int16_t rssi;                       /* Last RSSI (dBm), 0: unknown */
+    bool resync;                        /* New BSS: RSSI and join cache to refresh */
+    bool busy;                          /* Reassociation in flight */
+    uint8_t bssid[6];                   /* Where the last roam went */
+    uint32_t seen;                      /* g_scan_state.heard at the last lookup */
+    int64_t start;                      /* k_uptime_get() of the last reassociation */
+    cyw_roam_stats_t stats;
+} g_roam;
+
+/* Power save: settings and bus sleep (under lock) */
+static struct {
+    cyw_pm_params_t params;             /* Defaults filled in */
+    bool asleep;                        /* KSO cleared: the next access wakes it */
+    bool used;                          /* Accessed since the last idle check */
+    int64_t idle_since;                 /* k_uptime_get() of the last access seen */
+    cyw_pm_stats_t stats;
+} g_pm;
+
 /*============================================================================
  * Helper Functions
  *============================================================================*/
@@ -65,11 +145,23 @@ static inline void delay_ms(uint32_t ms)
  * SDIO Low-level Access
  *============================================================================*/
 
+static cyw_err_t pm_wake(void);
+
+/* Every access goes through here: wake the bus first if it sleeps */
+static inline void bus_wake(void)
+{
+    g_pm.used = true;
+    if (g_pm.asleep) {
+        pm_wake();
+    }
+}
+
 cyw_err_t cyw_sdio_read8(uint8_t func, uint32_t addr, uint8_t *val)
 {
     if (!g_cyw_dev.ops || !g_cyw_dev.ops->cmd52_read) {
         return CYW_ERR_INVALID;
     }
+    bus_wake();
     int ret = g_cyw_dev.ops->cmd52_read(func, addr, val);
     return (ret == 0) ? CYW_OK : CYW_ERR_IO;
 }
@@ -79,18 +171,43 @@ cyw_err_t cyw_sdio_write8(uint8_t func, uint32_t addr, uint8_t val)
     if (!g_cyw_dev.ops || !g_cyw_dev.ops->cmd52_write) {
         return CYW_ERR_INVALID;
     }
+    bus_wake();
     int ret = g_cyw_dev.ops->cmd52_write(func, addr, val);
     return (ret == 0) ? CYW_OK : CYW_ERR_IO;
 }
 
+/* Largest CMD53 the host can do for a function, 0 = no limit */
+static inline uint32_t xfer_max(uint8_t func)
+{
+    return g_cyw_dev.ops->max_xfer ? g_cyw_dev.ops->max_xfer(func) : 0;
+}
+
+/*
+ * Byte transfers are split into host-sized CMD53s. F1 addresses advance
+ * with the data; F2 is a FIFO and keeps its address.
+ */
 static cyw_err_t sdio_read_bytes(uint8_t func, uint32_t addr,
                                   uint8_t *data, uint32_t len, bool incr)
 {
     if (!g_cyw_dev.ops || !g_cyw_dev.ops->cmd53_read) {
         return CYW_ERR_INVALID;
     }
-    int ret = g_cyw_dev.ops->cmd53_read(func, addr, data, len, incr);
-    return (ret == 0) ? CYW_OK : CYW_ERR_IO;
+    bus_wake();
+
+    uint32_t max = xfer_max(func);
+    do {
+        uint32_t n = (max != 0) ? MIN(len, max) : len;
+
+        if (g_cyw_dev.ops->cmd53_read(func, addr, data, n, incr) != 0) {
+            return CYW_ERR_IO;
+        }
+        data += n;
+        len -= n;
+        if (incr && func != SDIO_FUNC_2) {
+            addr += n;
+        }
+    } while (len > 0);
+    return CYW_OK;
 }
 
 static cyw_err_t sdio_write_bytes(uint8_t func, uint32_t addr,
@@ -99,8 +216,67 @@ static cyw_err_t sdio_write_bytes(uint8_t func, uint32_t addr,
     if (!g_cyw_dev.ops || !g_cyw_dev.ops->cmd53_write) {
         return CYW_ERR_INVALID;
     }
-    int ret = g_cyw_dev.ops->cmd53_write(func, addr, data, len, incr);
-    return (ret == 0) ? CYW_OK : CYW_ERR_IO;
+    bus_wake();
+
+    uint32_t max = xfer_max(func);
+    do {
+        uint32_t n = (max != 0) ? MIN(len, max) : len;
+
+        if (g_cyw_dev.ops->cmd53_write(func, addr, data, n, incr) != 0) {
+            return CYW_ERR_IO;
+        }
+        data += n;
+        len -= n;
+        if (incr && func != SDIO_FUNC_2) {
+            addr += n;
+        }
+    } while (len > 0);
+    return CYW_OK;
+}
+
+/* Gathered write, split like sdio_write_bytes() */
+static cyw_err_t sdio_write_sg(uint8_t func, uint32_t addr,
+                               const sdio_sg_t *sg, uint32_t count, bool incr)
+{
+    if (!g_cyw_dev.ops || !g_cyw_dev.ops->cmd53_write_sg) {
+        return CYW_ERR_INVALID;
+    }
+    bus_wake();
+
+    uint32_t max = xfer_max(func);
+    if (max == 0) {
+        int ret = g_cyw_dev.ops->cmd53_write_sg(func, addr, sg, count, incr);
+        return (ret == 0) ? CYW_OK : CYW_ERR_IO;
+    }
+
+    sdio_sg_t part[CYW_TX_MAX_SEGS];
+    uint32_t i = 0, off = 0;
+
+    while (i < count) {
+        uint32_t n = 0, len = 0;
+
+        while (i < count && len < max && n < ARRAY_SIZE(part)) {
+            uint32_t take = MIN(sg[i].len - off, max - len);
+
+            part[n].data = sg[i].data + off;
+            part[n].len = take;
+            n++;
+            len += take;
+            off += take;
+            if (off == sg[i].len) {
+                i++;
+                off = 0;
+            }
+        }
+
+        if (g_cyw_dev.ops->cmd53_write_sg(func, addr, part, n, incr) != 0) {
+            return CYW_ERR_IO;
+        }
+        if (incr && func != SDIO_FUNC_2) {
+            addr += len;
+        }
+    }
+    return CYW_OK;
 }
 
 /*============================================================================
@@ -289,10 +465,14 @@ static cyw_err_t detect_chip(void)
  * SDPCM Frame Handling
  *============================================================================*/
 
-static cyw_err_t send_sdpcm_frame(uint8_t channel, const uint8_t *data, uint32_t len)
+/*
+ * Send a frame built in place: the payload follows SDPCM_HEADER_SIZE
+ * bytes of headroom, and the buffer has room for the word padding.
+ */
+static cyw_err_t send_sdpcm_frame(uint8_t channel, uint8_t *frame, uint32_t len)
 {
     cyw_dev_t *dev = &g_cyw_dev;
-    sdpcm_header_t *hdr = (sdpcm_header_t *)dev->tx_buf;
+    sdpcm_header_t *hdr = (sdpcm_header_t *)frame;
     uint32_t total_len;
 
     total_len = SDPCM_HEADER_SIZE + len;
@@ -304,134 +484,447 @@ static cyw_err_t send_sdpcm_frame(uint8_t channel, const uint8_t *data, uint32_t
     hdr->channel = channel;
     hdr->data_offset = SDPCM_HEADER_SIZE;
 
-    if (len > 0 && data != NULL) {
-        memcpy(dev->tx_buf + SDPCM_HEADER_SIZE, data, len);
+    total_len = ALIGN(total_len, 4);
+
+    return sdio_write_bytes(SDIO_FUNC_2, 0, frame, total_len, true);
+}
+
+/*
+ * Frames the firmware still accepts: tx_seq must stay behind tx_max.
+ */
+static inline uint32_t tx_credits(void)
+{
+    uint8_t window = g_cyw_dev.tx_max - g_cyw_dev.tx_seq;
+
+    return (window & 0x80) ? 0 : window;
+}
+
+/*
+ * Drop the rest of the current F2 frame after a bad header, so the next
+ * read starts on a frame boundary again.
+ */
+static void rx_abort(void)
+{
+    cyw_sdio_write8(SDIO_FUNC_0, CCCR_IO_ABORT, SDIO_FUNC_2);
+    cyw_sdio_write8(SDIO_FUNC_1, SBSDIO_FUNC1_FRAMECTRL, SFC_RF_TERM);
+}
+
+/*
+ * Data frame read into a provider buffer: strip the SDPCM padding and the
+ * BDC header and pass the Ethernet frame on.
+ */
+static void rx_data(void *handle, uint8_t *buf, uint32_t off, uint32_t len)
+{
+    const cyw_rx_ops_t *rx = g_cyw_dev.rx_ops;
+    const bdc_header_t *bdc = (const bdc_header_t *)(buf + off);
+    uint32_t skip;
+
+    if (len < BDC_HEADER_SIZE ||
+        ((bdc->flags & BCDC_FLAG_VER_MASK) >> BCDC_FLAG_VER_SHIFT) != BCDC_PROTO_VER) {
+        goto drop;
     }
 
-    total_len = ALIGN(total_len, 4);
+    skip = BDC_HEADER_SIZE + bdc->data_offset * 4;
+    if (len < skip + CYW_ETH_HDR_LEN) {
+        goto drop;
+    }
 
-    return sdio_write_bytes(SDIO_FUNC_2, 0, dev->tx_buf, total_len, true);
+    rx->recv(rx->ctx, handle, off + skip, len - skip,
+             bdc->priority & 7, bdc->flags2 & BCDC_FLAG2_IF_MASK);
+    return;
+
+drop:
+    g_cyw_dev.rx_dropped++;
+    rx->free(rx->ctx, handle);
 }
 
-static cyw_err_t recv_sdpcm_frame(uint8_t *channel, uint8_t *data, uint32_t *len)
+/*
+ * Read one SDPCM frame: the length word, the rest of the header, then the
+ * payload. Data frames go straight into a buffer from the RX provider and
+ * are delivered from here (*len = 0); anything else lands in rx_buf, or
+ * in the IOCTL arena when too large for it.
+ * Returns CYW_ERR_NOT_READY when no frame is pending.
+ */
+static cyw_err_t recv_sdpcm_frame(uint8_t *channel, uint8_t **payload, uint32_t *len)
 {
     cyw_dev_t *dev = &g_cyw_dev;
-    sdpcm_header_t *hdr;
+    uint8_t *frame = dev->rx_buf;
+    sdpcm_header_t *hdr = (sdpcm_header_t *)frame;
     cyw_err_t err;
-    uint8_t frame_hdr[4];
+    uint32_t rest;
 
-    err = sdio_read_bytes(SDIO_FUNC_2, 0, frame_hdr, 4, true);
+    err = sdio_read_bytes(SDIO_FUNC_2, 0, frame, 4, true);
     if (err != CYW_OK) return err;
 
-    uint16_t frame_len = frame_hdr[0] | (frame_hdr[1] << 8);
-    if (frame_len == 0 || frame_len > RX_BUF_SIZE) {
+    if (hdr->len == 0 && hdr->len_check == 0) {
+        return CYW_ERR_NOT_READY;
+    }
+    if ((hdr->len ^ hdr->len_check) != 0xFFFF ||
+        hdr->len < SDPCM_HEADER_SIZE || hdr->len > MAX(RX_BUF_SIZE, IOCTL_BUF_SIZE)) {
+        LOG_ERR("SDPCM header checksum error");
+        rx_abort();
         return CYW_ERR_INVALID;
     }
+    if (hdr->len > RX_BUF_SIZE) {
+        /* Response to a large IOCTL */
+        memcpy(dev->ioctl_buf, frame, 4);
+        frame = dev->ioctl_buf;
+        hdr = (sdpcm_header_t *)frame;
+    }
 
-    err = sdio_read_bytes(SDIO_FUNC_2, 0, dev->rx_buf, frame_len, true);
+    err = sdio_read_bytes(SDIO_FUNC_2, 0, frame + 4,
+                          SDPCM_HEADER_SIZE - 4, true);
     if (err != CYW_OK) return err;
 
-    hdr = (sdpcm_header_t *)dev->rx_buf;
+    dev->flow_ctrl = hdr->flow_control;
+    dev->tx_max = hdr->max_seq;
+    dev->rx_seq = hdr->seq;
+
+    *channel = hdr->channel & 0x0F;
+    rest = hdr->len - SDPCM_HEADER_SIZE;
 
-    if ((hdr->len ^ hdr->len_check) != 0xFFFF) {
-        LOG_ERR("SDPCM header checksum error");
+    if (hdr->data_offset < SDPCM_HEADER_SIZE || hdr->data_offset > hdr->len) {
+        rx_abort();
         return CYW_ERR_INVALID;
     }
 
-    dev->flow_ctrl = hdr->flow_control;
-    dev->tx_max = hdr->max_seq;
-    dev->rx_seq = hdr->seq;
+    if (*channel == SDPCM_DATA_CHANNEL && dev->rx_ops != NULL && rest > 0) {
+        void *handle;
+        uint8_t *buf = dev->rx_ops->alloc(dev->rx_ops->ctx, rest, &handle);
 
-    *channel = hdr->channel;
-    *len = hdr->len - hdr->data_offset;
-    if (*len > 0) {
-        memcpy(data, dev->rx_buf + hdr->data_offset, *len);
+        if (buf != NULL) {
+            err = sdio_read_bytes(SDIO_FUNC_2, 0, buf, rest, true);
+            if (err != CYW_OK) {
+                dev->rx_ops->free(dev->rx_ops->ctx, handle);
+                return err;
+            }
+            rx_data(handle, buf, hdr->data_offset - SDPCM_HEADER_SIZE,
+                    hdr->len - hdr->data_offset);
+            *payload = NULL;
+            *len = 0;
+            return CYW_OK;
+        }
+
+        /* No buffer: read it here and drop it */
+        dev->rx_dropped++;
+    }
+
+    if (rest > 0) {
+        err = sdio_read_bytes(SDIO_FUNC_2, 0, frame + SDPCM_HEADER_SIZE,
+                              rest, true);
+        if (err != CYW_OK) return err;
     }
 
+    *payload = frame + hdr->data_offset;
+    *len = hdr->len - hdr->data_offset;
     return CYW_OK;
 }
 
+/*
+ * IOCTL response to the request with its reqid, whoever is waiting
+ */
+static void rx_ctrl(const uint8_t *payload, uint32_t len)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    const bcdc_header_t *bcdc = (const bcdc_header_t *)payload;
+    cyw_ioctl_req_t *req = NULL;
+
+    if (len < BCDC_HEADER_SIZE) {
+        return;
+    }
+
+    for (int i = 0; i < CYW_IOCTL_MAX_PENDING; i++) {
+        if (dev->ioctl[i].busy && !dev->ioctl[i].done &&
+            dev->ioctl[i].reqid == (uint16_t)(bcdc->flags >> 16)) {
+            req = &dev->ioctl[i];
+            break;
+        }
+    }
+    if (req == NULL) {
+        /* Timed out already */
+        LOG_DBG("IOCTL response %u unclaimed", (unsigned int)(bcdc->flags >> 16));
+        return;
+    }
+
+    if (bcdc->status != 0) {
+        LOG_ERR("IOCTL error: %d", bcdc->status);
+        req->err = CYW_ERROR;
+    } else {
+        if (req->resp != NULL) {
+            memcpy(req->resp, payload + BCDC_HEADER_SIZE,
+                   MIN(len - BCDC_HEADER_SIZE, MIN(bcdc->len, req->resp_len)));
+        }
+        req->err = CYW_OK;
+    }
+
+    req->done = true;
+    k_sem_give(&req->sem);
+}
+
+/*
+ * Event frame to the handlers subscribed to its type
+ */
+static void rx_event(const uint8_t *payload, uint32_t len)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    const bdc_header_t *bdc = (const bdc_header_t *)payload;
+    const uint8_t *eth;
+    const bcmeth_header_t *bh;
+    const wl_event_msg_t *msg;
+    cyw_event_t ev;
+    uint32_t skip, datalen;
+
+    if (len < BDC_HEADER_SIZE) {
+        return;
+    }
+    skip = BDC_HEADER_SIZE + bdc->data_offset * 4;
+    if (len < skip + CYW_EVENT_HDR_LEN) {
+        LOG_DBG("Short event frame, len=%u", len);
+        return;
+    }
+    len -= skip;
+
+    eth = payload + skip;
+    bh = (const bcmeth_header_t *)(eth + CYW_ETH_HDR_LEN);
+    msg = (const wl_event_msg_t *)(bh + 1);
+    if (sys_get_be16(&eth[12]) != ETHER_TYPE_BRCM ||
+        sys_be16_to_cpu(bh->subtype) != BCMILCP_SUBTYPE_VENDOR_LONG ||
+        memcmp(bh->oui, BRCM_OUI, sizeof(bh->oui)) != 0 ||
+        sys_be16_to_cpu(bh->usr_subtype) != BCMILCP_BCM_SUBTYPE_EVENT) {
+        return;
+    }
+
+    ev.type = sys_be32_to_cpu(msg->event_type);
+    datalen = sys_be32_to_cpu(msg->datalen);
+    if (ev.type >= CYW_EVENT_MAX || dev->ev_subs[ev.type] == 0 ||
+        datalen > len - CYW_EVENT_HDR_LEN) {
+        return;
+    }
+
+    ev.status = sys_be32_to_cpu(msg->status);
+    ev.reason = sys_be32_to_cpu(msg->reason);
+    ev.auth_type = sys_be32_to_cpu(msg->auth_type);
+    ev.flags = sys_be16_to_cpu(msg->flags);
+    memcpy(ev.addr, msg->addr, sizeof(ev.addr));
+    ev.ifidx = msg->ifidx;
+    ev.bsscfgidx = msg->bsscfgidx;
+
+    for (uint8_t subs = dev->ev_subs[ev.type]; subs != 0; subs &= subs - 1) {
+        uint32_t i = __builtin_ctz(subs);
+
+        dev->ev_handler[i].cb(dev->ev_handler[i].ctx, &ev,
+                              eth + CYW_EVENT_HDR_LEN, datalen);
+    }
+}
+
+/*
+ * Received frame to its consumer (data frames are delivered already)
+ */
+static void rx_dispatch(uint8_t channel, const uint8_t *payload, uint32_t len)
+{
+    switch (channel) {
+        case SDPCM_CONTROL_CHANNEL:
+            rx_ctrl(payload, len);
+            break;
+
+        case SDPCM_EVENT_CHANNEL:
+            rx_event(payload, len);
+            break;
+
+        case SDPCM_DATA_CHANNEL:
+            /* Delivered already, or nobody to take it */
+            break;
+
+        default:
+            break;
+    }
+}
+
 /*============================================================================
  * IOCTL Commands
  *============================================================================*/
 
-cyw_err_t cyw_ioctl(uint32_t cmd, void *data, uint32_t len, bool set)
+/*
+ * Claim a request slot and send the request, built in the IOCTL arena:
+ * BCDC header, the iovar name if any, then the value. GET requests carry
+ * their input too; the response is copied back to data (an iovar value
+ * comes back at offset 0).
+ */
+static cyw_err_t ioctl_send(uint32_t cmd, const char *name, void *data,
+                            uint32_t len, bool set, cyw_ioctl_req_t **out)
 {
     cyw_dev_t *dev = &g_cyw_dev;
     cyw_err_t err;
-    bcdc_header_t *bcdc_tx, *bcdc_rx;
-    uint8_t buf[512];
-    uint32_t total_len;
+    cyw_ioctl_req_t *req = NULL;
+    bcdc_header_t *bcdc_tx;
+    uint8_t *buf = dev->ioctl_buf + SDPCM_HEADER_SIZE;
+    uint32_t name_len = (name != NULL) ? strlen(name) + 1 : 0;
+    uint32_t total_len = BCDC_HEADER_SIZE + name_len + len;
 
     if (dev->state < CYW_STATE_FW_READY) {
         return CYW_ERR_NOT_READY;
     }
 
+    if (name_len + len > CYW_IOCTL_MAX_LEN) {
+        return CYW_ERR_NOMEM;
+    }
+
+    if (k_sem_take(&dev->ioctl_slots, K_MSEC(CYW_IOCTL_TIMEOUT_MS)) != 0) {
+        return CYW_ERR_BUSY;
+    }
+
+    k_mutex_lock(&dev->lock, K_FOREVER);
+
+    for (int i = 0; i < CYW_IOCTL_MAX_PENDING; i++) {
+        if (!dev->ioctl[i].busy) {
+            req = &dev->ioctl[i];
+            break;
+        }
+    }
+
+    /* Credit comes back with received frames */
+    for (int wait = 100; tx_credits() == 0 && wait > 0; wait--) {
+        if (cyw_rx_poll(1) == 0) {
+            delay_ms(1);
+        }
+    }
+
+    req->reqid = dev->reqid++;
+    req->resp = set ? NULL : data;
+    req->resp_len = (data != NULL) ? len : 0;
+    req->done = false;
+    req->busy = true;
+    k_sem_reset(&req->sem);
+
+    /* Only now: frames received above may have passed through the arena */
     bcdc_tx = (bcdc_header_t *)buf;
     bcdc_tx->cmd = cmd;
-    bcdc_tx->len = len;
+    bcdc_tx->len = name_len + len;
     bcdc_tx->flags = (BCDC_PROTO_VER << BCDC_FLAG_VER_SHIFT) |
                      (set ? 0x02 : 0) |
-                     (dev->reqid++ << 16);
+                     ((uint32_t)req->reqid << 16);
     bcdc_tx->status = 0;
 
-    if (set && len > 0 && data != NULL) {
-        memcpy(buf + BCDC_HEADER_SIZE, data, len);
+    if (name_len > 0) {
+        memcpy(buf + BCDC_HEADER_SIZE, name, name_len);
+    }
+    if (len > 0) {
+        if (data != NULL) {
+            memcpy(buf + BCDC_HEADER_SIZE + name_len, data, len);
+        } else {
+            memset(buf + BCDC_HEADER_SIZE + name_len, 0, len);
+        }
     }
 
-    total_len = BCDC_HEADER_SIZE + len;
+    err = send_sdpcm_frame(SDPCM_CONTROL_CHANNEL, dev->ioctl_buf, total_len);
+    if (err != CYW_OK) {
+        req->busy = false;
+        k_mutex_unlock(&dev->lock);
+        k_sem_give(&dev->ioctl_slots);
+        return err;
+    }
+    k_mutex_unlock(&dev->lock);
 
-    err = send_sdpcm_frame(SDPCM_CONTROL_CHANNEL, buf, total_len);
-    if (err != CYW_OK) return err;
+    *out = req;
+    return CYW_OK;
+}
 
-    int timeout = 100;
-    while (timeout-- > 0) {
-        uint8_t channel;
-        uint32_t rx_len = sizeof(buf);
-
-        err = recv_sdpcm_frame(&channel, buf, &rx_len);
-        if (err == CYW_OK && channel == SDPCM_CONTROL_CHANNEL) {
-            bcdc_rx = (bcdc_header_t *)buf;
-
-            if ((bcdc_rx->flags >> 16) == (uint32_t)(dev->reqid - 1)) {
-                if (bcdc_rx->status != 0) {
-                    LOG_ERR("IOCTL error: %d", bcdc_rx->status);
-                    return CYW_ERROR;
-                }
-
-                if (!set && len > 0 && data != NULL) {
-                    memcpy(data, buf + BCDC_HEADER_SIZE,
-                           (bcdc_rx->len < len) ? bcdc_rx->len : len);
-                }
-                return CYW_OK;
-            }
+/*
+ * Wait for the response to a sent request and free its slot
+ */
+static cyw_err_t ioctl_wait(cyw_ioctl_req_t *req)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_err_t err;
+    int64_t end;
+
+    /*
+     * Whoever reads the response wakes us. Read ourselves while the bus
+     * is busy, and sleep on the request while it is quiet (another thread
+     * may be receiving).
+     */
+    end = k_uptime_get() + CYW_IOCTL_TIMEOUT_MS;
+    while (!req->done && k_uptime_get() < end) {
+        if (cyw_rx_poll(1) == 0) {
+            (void)k_sem_take(&req->sem, K_USEC(CYW_IOCTL_POLL_US));
         }
-        delay_ms(1);
     }
 
-    return CYW_ERR_TIMEOUT;
+    k_mutex_lock(&dev->lock, K_FOREVER);
+    if (req->done) {
+        err = req->err;
+    } else {
+        LOG_WRN("IOCTL %u timed out", req->reqid);
+        err = CYW_ERR_TIMEOUT;
+    }
+    req->busy = false;
+    k_mutex_unlock(&dev->lock);
+    k_sem_give(&dev->ioctl_slots);
+
+    return err;
+}
+
+cyw_err_t cyw_ioctl(uint32_t cmd, void *data, uint32_t len, bool set)
+{
+    cyw_ioctl_req_t *req;
+    cyw_err_t err = ioctl_send(cmd, NULL, data, len, set, &req);
+
+    if (err != CYW_OK) {
+        return err;
+    }
+    return ioctl_wait(req);
 }
 
 cyw_err_t cyw_iovar(const char *name, void *data, uint32_t len, bool set)
 {
-    uint8_t buf[256];
-    uint32_t name_len = strlen(name) + 1;
-    uint32_t total_len = name_len + len;
+    cyw_ioctl_req_t *req;
+    cyw_err_t err = ioctl_send(set ? WLC_SET_VAR : WLC_GET_VAR, name,
+                               data, len, set, &req);
 
-    if (total_len > sizeof(buf)) {
-        return CYW_ERR_NOMEM;
+    if (err != CYW_OK) {
+        return err;
     }
+    return ioctl_wait(req);
+}
 
-    memcpy(buf, name, name_len);
-    if (len > 0 && data != NULL) {
-        memcpy(buf + name_len, data, len);
+cyw_err_t cyw_ioctl_batch(cyw_ioctl_op_t *ops, uint32_t count)
+{
+    cyw_ioctl_req_t *fly[CYW_IOCTL_PIPELINE];
+    uint32_t head = 0;              /* ops[head..sent) are in flight */
+    uint32_t sent = 0;
+    cyw_err_t err = CYW_OK;
+
+    for (uint32_t i = 0; i < count; i++) {
+        ops[i].status = CYW_ERR_NOT_READY;
     }
 
-    cyw_err_t err = cyw_ioctl(set ? WLC_SET_VAR : WLC_GET_VAR,
-                              buf, total_len, set);
+    for (;;) {
+        /* Keep the pipe full until the first failure */
+        while (err == CYW_OK && sent < count && sent - head < CYW_IOCTL_PIPELINE) {
+            cyw_ioctl_op_t *op = &ops[sent];
+
+            op->status = ioctl_send(op->cmd, op->name, op->data, op->len,
+                                    op->set, &fly[sent % CYW_IOCTL_PIPELINE]);
+            if (op->status != CYW_OK) {
+                err = op->status;
+                break;
+            }
+            op->status = CYW_ERR_BUSY;
+            sent++;
+        }
+
+        if (head == sent) {
+            break;
+        }
 
-    if (err == CYW_OK && !set && data != NULL && len > 0) {
-        memcpy(data, buf + name_len, len);
+        /* Responses are collected in order */
+        ops[head].status = ioctl_wait(fly[head % CYW_IOCTL_PIPELINE]);
+        if (ops[head].status != CYW_OK && err == CYW_OK) {
+            LOG_WRN("IOCTL batch: op %u failed (%d)", (unsigned int)head,
+                    ops[head].status);
+            err = ops[head].status;
+        }
+        head++;
     }
 
     return err;
@@ -502,6 +995,10 @@ static cyw_err_t sdio_init_card(void)
     return CYW_OK;
 }
 
+static void scan_init(void);
+static void link_init(void);
+static void link_set(bool up, const uint8_t *bssid, uint32_t reason);
+
 cyw_err_t cyw_init(const sdio_host_ops_t *ops)
 {
     cyw_err_t err;
@@ -512,6 +1009,15 @@ cyw_err_t cyw_init(const sdio_host_ops_t *ops)
 
     memset(&g_cyw_dev, 0, sizeof(g_cyw_dev));
     memset(&g_scan_state, 0, sizeof(g_scan_state));
+    memset(&g_bgscan, 0, sizeof(g_bgscan));
+    k_mutex_init(&g_cyw_dev.lock);
+    k_mutex_init(&g_cyw_dev.ev_lock);
+    k_sem_init(&g_cyw_dev.ioctl_slots, CYW_IOCTL_MAX_PENDING, CYW_IOCTL_MAX_PENDING);
+    for (int i = 0; i < CYW_IOCTL_MAX_PENDING; i++) {
+        k_sem_init(&g_cyw_dev.ioctl[i].sem, 0, 1);
+    }
+    scan_init();
+    link_init();
     g_cyw_dev.ops = ops;
     g_cyw_dev.state = CYW_STATE_OFF;
 
@@ -559,6 +1065,21 @@ void cyw_deinit(void)
  * Firmware Loading
  *============================================================================*/
 
+static bool nvram_is_packed(const uint8_t *data, uint32_t size)
+{
+    uint32_t words, token;
+
+    if (size < 8 || (size & 3)) {
+        return false;
+    }
+
+    words = (size - 4) / 4;
+    token = data[size - 4] | (data[size - 3] << 8) |
+            (data[size - 2] << 16) | ((uint32_t)data[size - 1] << 24);
+
+    return token == ((~words << 16) | (words & 0xFFFF));
+}
+
 cyw_err_t cyw_load_firmware(const uint8_t *fw_data, uint32_t fw_size,
                             const uint8_t *nvram_data, uint32_t nvram_size)
 {
@@ -591,11 +1112,14 @@ cyw_err_t cyw_load_firmware(const uint8_t *fw_data, uint32_t fw_size,
             goto error;
         }
 
-        uint32_t nvram_sz_words = nvram_size / 4;
-        nvram_sz_words = (~nvram_sz_words << 16) | nvram_sz_words;
-        addr += nvram_size;
-        err = cyw_sdio_write32(addr, nvram_sz_words);
-        if (err != CYW_OK) goto error;
+        /* Packed blobs (nvram_pack.py) already end in the size token */
+        if (!nvram_is_packed(nvram_data, nvram_size)) {
+            uint32_t nvram_sz_words = ALIGN(nvram_size, 4) / 4;
+            nvram_sz_words = (~nvram_sz_words << 16) | nvram_sz_words;
+            addr += ALIGN(nvram_size, 4);
+            err = cyw_sdio_write32(addr, nvram_sz_words);
+            if (err != CYW_OK) goto error;
+        }
 
         LOG_DBG("NVRAM downloaded (%u bytes)", nvram_size);
     }
@@ -626,6 +1150,9 @@ cyw_err_t cyw_load_firmware(const uint8_t *fw_data, uint32_t fw_size,
 
         if (mbox & HMB_DATA_FWREADY) {
             LOG_INF("Firmware ready!");
+            /* Room for a few frames until the first header grants credit */
+            dev->tx_seq = 0;
+            dev->tx_max = 4;
             dev->state = CYW_STATE_FW_READY;
             return CYW_OK;
         }
@@ -641,258 +1168,1823 @@ error:
 }
 
 /*============================================================================
- * WiFi Operations
+ * Firmware Events
  *============================================================================*/
 
-cyw_err_t cyw_up(void)
+/*
+ * Program the union of all subscriptions into the firmware, unless it
+ * has it already. ev_lock keeps concurrent updates in order.
+ */
+static cyw_err_t event_mask_program(void)
 {
     cyw_dev_t *dev = &g_cyw_dev;
+    uint8_t mask[WL_EVENTING_MASK_LEN];
+    cyw_err_t err = CYW_OK;
 
-    if (dev->state < CYW_STATE_FW_READY) {
-        return CYW_ERR_NOT_READY;
+    k_mutex_lock(&dev->ev_lock, K_FOREVER);
+
+    memset(mask, 0, sizeof(mask));
+    k_mutex_lock(&dev->lock, K_FOREVER);
+    for (uint32_t e = 0; e < CYW_EVENT_MAX; e++) {
+        if (dev->ev_subs[e] != 0) {
+            mask[e >> 3] |= 1u << (e & 7);
+        }
     }
+    k_mutex_unlock(&dev->lock);
 
-    cyw_err_t err = cyw_ioctl(WLC_UP, NULL, 0, true);
-    if (err == CYW_OK) {
-        dev->state = CYW_STATE_UP;
+    if (!dev->ev_mask_valid || memcmp(mask, dev->ev_mask, sizeof(mask)) != 0) {
+        err = cyw_iovar("event_msgs", mask, sizeof(mask), true);
+        if (err == CYW_OK) {
+            memcpy(dev->ev_mask, mask, sizeof(mask));
+            dev->ev_mask_valid = true;
+        }
     }
+
+    k_mutex_unlock(&dev->ev_lock);
     return err;
 }
 
-cyw_err_t cyw_down(void)
+/* Subscriptions changed: before the interface is up, cyw_up() programs them */
+static cyw_err_t event_mask_sync(void)
 {
-    cyw_dev_t *dev = &g_cyw_dev;
-
-    if (dev->state < CYW_STATE_FW_READY) {
-        return CYW_ERR_NOT_READY;
-    }
-
-    cyw_err_t err = cyw_ioctl(WLC_DOWN, NULL, 0, true);
-    if (err == CYW_OK) {
-        dev->state = CYW_STATE_FW_READY;
+    if (g_cyw_dev.state < CYW_STATE_UP) {
+        return CYW_OK;
     }
-    return err;
+    return event_mask_program();
 }
 
-cyw_err_t cyw_get_chip_info(cyw_chip_info_t *info)
+static int event_find(cyw_event_cb_t cb, void *ctx)
 {
-    if (info == NULL) {
-        return CYW_ERR_INVALID;
+    for (int i = 0; i < CYW_EVENT_HANDLERS; i++) {
+        if (g_cyw_dev.ev_handler[i].cb == cb && g_cyw_dev.ev_handler[i].ctx == ctx) {
+            return i;
+        }
     }
-    memcpy(info, &g_cyw_dev.chip, sizeof(cyw_chip_info_t));
-    return CYW_OK;
+    return -1;
 }
 
-cyw_state_t cyw_get_state(void)
+cyw_err_t cyw_event_register(const uint16_t *events, uint32_t count,
+                             cyw_event_cb_t cb, void *ctx)
 {
-    return g_cyw_dev.state;
-}
+    cyw_dev_t *dev = &g_cyw_dev;
+    int slot;
 
-/*============================================================================
- * Scan
+    if (cb == NULL || (events == NULL && count > 0)) {
+        return CYW_ERR_INVALID;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (events[i] >= CYW_EVENT_MAX) {
+            return CYW_ERR_INVALID;
+        }
+    }
+
+    k_mutex_lock(&dev->lock, K_FOREVER);
+
+    slot = event_find(cb, ctx);
+    if (slot < 0) {
+        slot = event_find(NULL, NULL);
+        if (slot < 0) {
+            k_mutex_unlock(&dev->lock);
+            return CYW_ERR_NOMEM;
+        }
+        dev->ev_handler[slot].cb = cb;
+        dev->ev_handler[slot].ctx = ctx;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        dev->ev_subs[events[i]] |= 1u << slot;
+    }
+
+    k_mutex_unlock(&dev->lock);
+    return event_mask_sync();
+}
+
+cyw_err_t cyw_event_unregister(cyw_event_cb_t cb, void *ctx)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    int slot;
+
+    if (cb == NULL) {
+        return CYW_ERR_INVALID;
+    }
+
+    k_mutex_lock(&dev->lock, K_FOREVER);
+
+    slot = event_find(cb, ctx);
+    if (slot < 0) {
+        k_mutex_unlock(&dev->lock);
+        return CYW_ERR_INVALID;
+    }
+
+    for (uint32_t e = 0; e < CYW_EVENT_MAX; e++) {
+        dev->ev_subs[e] &= ~(1u << slot);
+    }
+    dev->ev_handler[slot].cb = NULL;
+    dev->ev_handler[slot].ctx = NULL;
+
+    k_mutex_unlock(&dev->lock);
+    return event_mask_sync();
+}
+
+/*============================================================================
+ * WiFi Operations
+ *============================================================================*/
+
+cyw_err_t cyw_up(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    if (dev->state < CYW_STATE_FW_READY) {
+        return CYW_ERR_NOT_READY;
+    }
+
+    /*
+     * Let frames and flow-control changes raise the host's SDIO interrupt;
+     * anything queued before that is read without one
+     */
+    if (dev->ops->irq_pending) {
+        k_mutex_lock(&dev->lock, K_FOREVER);
+        if (cyw_sdio_write32(SDIO_CORE_BASE_ADDR + SDIO_CORE_HOSTINTMASK,
+                             SDIO_HOSTINTMASK) != CYW_OK) {
+            LOG_ERR("HOSTINTMASK write failed");
+        }
+        dev->rx_irq_more = true;
+        k_mutex_unlock(&dev->lock);
+    }
+
+    /* A freshly started firmware reports everything: narrow it down first */
+    dev->ev_mask_valid = false;
+    if (event_mask_program() != CYW_OK) {
+        LOG_ERR("event_msgs failed");
+    }
+
+    cyw_err_t err = cyw_ioctl(WLC_UP, NULL, 0, true);
+    if (err == CYW_OK) {
+        dev->state = CYW_STATE_UP;
+    }
+    return err;
+}
+
+cyw_err_t cyw_down(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    if (dev->state < CYW_STATE_FW_READY) {
+        return CYW_ERR_NOT_READY;
+    }
+
+    cyw_err_t err = cyw_ioctl(WLC_DOWN, NULL, 0, true);
+    if (err == CYW_OK) {
+        dev->state = CYW_STATE_FW_READY;
+        k_mutex_lock(&dev->lock, K_FOREVER);
+        link_set(false, NULL, 0);
+        k_mutex_unlock(&dev->lock);
+    }
+    return err;
+}
+
+cyw_err_t cyw_get_chip_info(cyw_chip_info_t *info)
+{
+    if (info == NULL) {
+        return CYW_ERR_INVALID;
+    }
+    memcpy(info, &g_cyw_dev.chip, sizeof(cyw_chip_info_t));
+    return CYW_OK;
+}
+
+cyw_state_t cyw_get_state(void)
+{
+    return g_cyw_dev.state;
+}
+
+/*============================================================================
+ * Scan
+ *============================================================================*/
+
+#define SCAN_SLOT_FREE      0xFF
+
+/* BSSID hash: FNV-1a */
+static uint32_t scan_hash(const uint8_t *bssid)
+{
+    uint32_t h = 2166136261u;
+
+    for (int i = 0; i < 6; i++) {
+        h = (h ^ bssid[i]) * 16777619u;
+    }
+    return h & (CYW_SCAN_HASH_SIZE - 1);
+}
+
+/* Hash slot holding the BSSID, or the free slot it would go to */
+static uint32_t scan_lookup(const uint8_t *bssid)
+{
+    uint32_t h = scan_hash(bssid);
+
+    while (g_scan_state.hash[h] != SCAN_SLOT_FREE &&
+           memcmp(g_scan_state.bss[g_scan_state.hash[h]].bssid, bssid, 6) != 0) {
+        h = (h + 1) & (CYW_SCAN_HASH_SIZE - 1);
+    }
+    return h;
+}
+
+/* Free a hash slot, moving later entries of its probe run back into it */
+static void scan_unhash(uint32_t h)
+{
+    uint32_t j = h;
+
+    g_scan_state.hash[h] = SCAN_SLOT_FREE;
+    for (;;) {
+        uint32_t home;
+
+        j = (j + 1) & (CYW_SCAN_HASH_SIZE - 1);
+        if (g_scan_state.hash[j] == SCAN_SLOT_FREE) {
+            return;
+        }
+        home = scan_hash(g_scan_state.bss[g_scan_state.hash[j]].bssid);
+        if ((j > h) ? (home <= h || home > j) : (home <= h && home > j)) {
+            g_scan_state.hash[h] = g_scan_state.hash[j];
+            g_scan_state.hash[j] = SCAN_SLOT_FREE;
+            h = j;
+        }
+    }
+}
+
+/* Heap order: heard in an earlier scan, or weaker in the same one */
+static bool scan_weaker(const cyw_scan_result_t *a, const cyw_scan_result_t *b)
+{
+    if (a->scan != b->scan) {
+        return a->scan < b->scan;
+    }
+    return a->rssi < b->rssi;
+}
+
+static void scan_heap_set(uint32_t pos, uint8_t idx)
+{
+    g_scan_state.heap[pos] = idx;
+    g_scan_state.pos[idx] = pos;
+}
+
+static void scan_sift_up(uint32_t pos)
+{
+    uint8_t idx = g_scan_state.heap[pos];
+
+    while (pos > 0) {
+        uint32_t parent = (pos - 1) / 2;
+
+        if (!scan_weaker(&g_scan_state.bss[idx],
+                         &g_scan_state.bss[g_scan_state.heap[parent]])) {
+            break;
+        }
+        scan_heap_set(pos, g_scan_state.heap[parent]);
+        pos = parent;
+    }
+    scan_heap_set(pos, idx);
+}
+
+static void scan_sift_down(uint32_t pos)
+{
+    const cyw_scan_result_t *bss = g_scan_state.bss;
+    const uint8_t *heap = g_scan_state.heap;
+    uint8_t idx = heap[pos];
+
+    for (;;) {
+        uint32_t child = 2 * pos + 1;
+
+        if (child >= g_scan_state.count) {
+            break;
+        }
+        if (child + 1 < g_scan_state.count &&
+            scan_weaker(&bss[heap[child + 1]], &bss[heap[child]])) {
+            child++;
+        }
+        if (!scan_weaker(&bss[heap[child]], &bss[idx])) {
+            break;
+        }
+        scan_heap_set(pos, heap[child]);
+        pos = child;
+    }
+    scan_heap_set(pos, idx);
+}
+
+/*
+ * Merge a BSS record into the table. New BSSes take a free entry or
+ * replace the weakest one, if weaker themselves. Returns the entry to
+ * report (first heard in this scan), or NULL.
+ */
+static const cyw_scan_result_t *scan_add(const cyw_scan_result_t *r)
+{
+    cyw_scan_result_t *b;
+    uint32_t h = scan_lookup(r->bssid);
+    uint8_t idx = g_scan_state.hash[h];
+
+    if (idx != SCAN_SLOT_FREE) {
+        /* Seen before: keep the strongest sighting of this scan */
+        b = &g_scan_state.bss[idx];
+        if (b->scan == r->scan) {
+            if (r->rssi > b->rssi) {
+                b->rssi = r->rssi;
+                scan_sift_down(g_scan_state.pos[idx]);
+            }
+            if (b->ssid_len == 0 && r->ssid_len > 0) {
+                memcpy(b->ssid, r->ssid, sizeof(b->ssid));
+                b->ssid_len = r->ssid_len;
+            }
+            return NULL;
+        }
+
+        /* From an earlier scan: hidden networks keep the SSID learned then */
+        if (r->ssid_len == 0 && b->ssid_len > 0) {
+            cyw_scan_result_t tmp = *r;
+
+            memcpy(tmp.ssid, b->ssid, sizeof(tmp.ssid));
+            tmp.ssid_len = b->ssid_len;
+            *b = tmp;
+        } else {
+            *b = *r;
+        }
+        scan_sift_down(g_scan_state.pos[idx]);
+        return b;
+    }
+
+    if (g_scan_state.count < CYW_SCAN_MAX_BSS) {
+        idx = g_scan_state.count++;
+        g_scan_state.bss[idx] = *r;
+        g_scan_state.hash[h] = idx;
+        scan_heap_set(g_scan_state.count - 1, idx);
+        scan_sift_up(g_scan_state.count - 1);
+        return &g_scan_state.bss[idx];
+    }
+
+    /* Table full: the weakest entry goes, unless this one is weaker */
+    idx = g_scan_state.heap[0];
+    if (!scan_weaker(&g_scan_state.bss[idx], r)) {
+        return NULL;
+    }
+    scan_unhash(scan_lookup(g_scan_state.bss[idx].bssid));
+    g_scan_state.bss[idx] = *r;
+    g_scan_state.hash[scan_lookup(r->bssid)] = idx;
+    scan_sift_down(0);
+    return &g_scan_state.bss[idx];
+}
+
+/* RSN element body: WPA2-PSK, unless SAE is the only key management */
+static uint8_t scan_rsn(const uint8_t *rsn, uint32_t len)
+{
+    uint32_t off = 2 + 4;               /* Version, group cipher */
+    uint32_t n;
+    bool psk = false;
+    bool sae = false;
+
+    if (len < off + 2) {
+        return CYW_SEC_WPA2_PSK;
+    }
+    n = sys_get_le16(&rsn[off]);
+    off += 2 + 4 * n;                   /* Pairwise ciphers */
+    if (len < off + 2) {
+        return CYW_SEC_WPA2_PSK;
+    }
+    n = sys_get_le16(&rsn[off]);
+    off += 2;
+
+    for (; n > 0 && off + 4 <= len; n--, off += 4) {
+        if (memcmp(&rsn[off], RSN_OUI, 3) == 0) {
+            psk |= rsn[off + 3] == RSN_AKM_PSK || rsn[off + 3] == RSN_AKM_SHA256_PSK;
+            sae |= rsn[off + 3] == RSN_AKM_SAE;
+        }
+    }
+
+    return (sae && !psk) ? CYW_SEC_WPA3_SAE : CYW_SEC_WPA2_PSK;
+}
+
+/* Security from the privacy bit and the RSN/WPA elements */
+static uint8_t scan_security(uint16_t capability, const uint8_t *ie, uint32_t len)
+{
+    uint8_t sec = (capability & DOT11_CAP_PRIVACY) ? CYW_SEC_WEP : CYW_SEC_OPEN;
+
+    while (len >= 2 && ie[1] + 2u <= len) {
+        if (ie[0] == DOT11_MNG_RSN_ID) {
+            return scan_rsn(ie + 2, ie[1]);
+        }
+        if (ie[0] == DOT11_MNG_VS_ID && ie[1] >= 4 &&
+            memcmp(ie + 2, WPA_OUI, 3) == 0 && ie[5] == WPA_OUI_TYPE) {
+            sec = CYW_SEC_WPA_PSK;
+        }
+        len -= ie[1] + 2u;
+        ie += ie[1] + 2u;
+    }
+    return sec;
+}
+
+/* BSS record to a table entry; false if malformed */
+static bool scan_parse(const wl_bss_info_t *bi, uint32_t len, cyw_scan_result_t *r)
+{
+    if (len < sizeof(*bi) || bi->ie_offset > len || bi->ie_length > len - bi->ie_offset) {
+        return false;
+    }
+
+    memset(r, 0, sizeof(*r));
+    memcpy(r->bssid, bi->bssid, sizeof(r->bssid));
+    r->ssid_len = MIN(bi->ssid_len, sizeof(bi->ssid));
+    memcpy(r->ssid, bi->ssid, r->ssid_len);
+    r->rssi = bi->rssi;
+    r->chanspec = bi->chanspec;
+    r->channel = (bi->ctl_ch != 0) ? bi->ctl_ch : (bi->chanspec & WL_CHANSPEC_CHAN_MASK);
+    r->capability = bi->capability;
+    r->security = scan_security(bi->capability, (const uint8_t *)bi + bi->ie_offset,
+                                bi->ie_length);
+    r->scan = g_scan_state.gen;
+    return true;
+}
+
+/* Called with the bus lock held */
+static void scan_finish(cyw_err_t status)
+{
+    cyw_scan_done_cb_t done = g_scan_state.req.on_done;
+    void *ctx = g_scan_state.req.ctx;
+
+    g_scan_state.busy = false;
+    memset(&g_scan_state.req, 0, sizeof(g_scan_state.req));
+
+    LOG_INF("Scan complete (%d), %u BSSes", status, g_scan_state.count);
+    if (done != NULL) {
+        done(ctx, status);
+    }
+}
+
+/*
+ * WLC_E_ESCAN_RESULT: partial results carry BSS records, anything else
+ * ends the scan
+ */
+static void scan_event(void *ctx, const cyw_event_t *ev, const uint8_t *data, uint32_t len)
+{
+    const wl_escan_result_t *res = (const wl_escan_result_t *)data;
+    uint32_t off = sizeof(*res);
+
+    ARG_UNUSED(ctx);
+
+    if (!g_scan_state.busy ||
+        (len >= sizeof(*res) && res->sync_id != g_scan_state.sync_id)) {
+        return;
+    }
+
+    if (ev->status != WLC_E_STATUS_PARTIAL) {
+        scan_finish((ev->status == WLC_E_STATUS_SUCCESS) ? CYW_OK :
+                    (ev->status == WLC_E_STATUS_ABORT ||
+                     ev->status == WLC_E_STATUS_NEWSCAN) ? CYW_ERR_BUSY : CYW_ERROR);
+        return;
+    }
+
+    for (uint32_t i = 0; len >= sizeof(*res) && i < res->bss_count; i++) {
+        const wl_bss_info_t *bi = (const wl_bss_info_t *)(data + off);
+        const cyw_scan_result_t *b;
+        cyw_scan_result_t r;
+
+        if (len - off < sizeof(*bi) || bi->length > len - off ||
+            !scan_parse(bi, bi->length, &r)) {
+            break;
+        }
+        off += bi->length;
+        g_scan_state.heard++;
+
+        b = scan_add(&r);
+        if (b != NULL && g_scan_state.req.on_result != NULL) {
+            g_scan_state.req.on_result(g_scan_state.req.ctx, b);
+        }
+    }
+}
+
+static void scan_init(void)
+{
+    static const uint16_t events[] = { WLC_E_ESCAN_RESULT };
+
+    memset(g_scan_state.hash, SCAN_SLOT_FREE, sizeof(g_scan_state.hash));
+    cyw_event_register(events, ARRAY_SIZE(events), scan_event, NULL);
+}
+
+/* Channel number to a 20 MHz chanspec */
+static uint16_t scan_chanspec(uint16_t channel)
+{
+    return channel | WL_CHANSPEC_BW_20 |
+           ((channel <= 14) ? WL_CHANSPEC_BAND_2G : WL_CHANSPEC_BAND_5G);
+}
+
+/*
+ * Start an escan. new_gen: false for a background slice continuing a
+ * sweep, which ranks together with the slices before it.
+ */
+static cyw_err_t scan_start(const cyw_scan_params_t *params, bool new_gen)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    wl_escan_params_t esc;
+    uint16_t sync_id;
+    cyw_err_t err;
+
+    if (dev->state < CYW_STATE_UP) {
+        return CYW_ERR_NOT_READY;
+    }
+    if (params == NULL || params->channel_count > CYW_SCAN_MAX_CHANNELS ||
+        (params->channels == NULL && params->channel_count > 0)) {
+        return CYW_ERR_INVALID;
+    }
+    if (new_gen && g_scan_state.busy && g_bgscan.slice) {
+        cyw_scan_abort();                   /* The caller comes first */
+    }
+
+    /* Results may come in while the request is still being answered */
+    k_mutex_lock(&dev->lock, K_FOREVER);
+    if (g_scan_state.busy) {
+        k_mutex_unlock(&dev->lock);
+        return CYW_ERR_BUSY;
+    }
+    g_scan_state.req = *params;
+    g_scan_state.busy = true;
+    if (new_gen) {
+        g_scan_state.gen++;
+    }
+    sync_id = ++g_scan_state.sync_id;
+    k_mutex_unlock(&dev->lock);
+
+    memset(&esc, 0, sizeof(esc));
+    esc.version = ESCAN_REQ_VERSION;
+    esc.action = WL_SCAN_ACTION_START;
+    esc.sync_id = sync_id;
+    if (params->ssid != NULL) {
+        esc.ssid_len = MIN(strlen(params->ssid), sizeof(esc.ssid));
+        memcpy(esc.ssid, params->ssid, esc.ssid_len);
+    }
+    memset(esc.bssid, 0xFF, sizeof(esc.bssid));
+    esc.bss_type = DOT11_BSSTYPE_ANY;
+    esc.scan_type = params->passive ? WL_SCANFLAGS_PASSIVE : 0;
+    esc.nprobes = params->nprobes ? params->nprobes : -1;
+    esc.active_time = params->active_time ? params->active_time : -1;
+    esc.passive_time = params->passive_time ? params->passive_time : -1;
+    esc.home_time = params->home_time ? params->home_time : -1;
+    esc.channel_num = params->channel_count;
+    for (uint32_t i = 0; i < params->channel_count; i++) {
+        esc.channel_list[i] = scan_chanspec(params->channels[i]);
+    }
+
+    LOG_INF("Starting scan, %u channels", params->channel_count);
+
+    err = cyw_iovar("escan", &esc, offsetof(wl_escan_params_t, channel_list) +
+                    params->channel_count * sizeof(esc.channel_list[0]), true);
+    if (err != CYW_OK) {
+        LOG_ERR("escan failed: %d", err);
+        k_mutex_lock(&dev->lock, K_FOREVER);
+        if (g_scan_state.busy && g_scan_state.sync_id == sync_id) {
+            g_scan_state.busy = false;
+            memset(&g_scan_state.req, 0, sizeof(g_scan_state.req));
+        }
+        k_mutex_unlock(&dev->lock);
+    }
+    return err;
+}
+
+cyw_err_t cyw_scan_start(const cyw_scan_params_t *params)
+{
+    return scan_start(params, true);
+}
+
+cyw_err_t cyw_scan_abort(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    wl_escan_params_t esc;
+    cyw_err_t err;
+
+    k_mutex_lock(&dev->lock, K_FOREVER);
+    if (!g_scan_state.busy) {
+        k_mutex_unlock(&dev->lock);
+        return CYW_OK;
+    }
+    memset(&esc, 0, sizeof(esc));
+    esc.version = ESCAN_REQ_VERSION;
+    esc.action = WL_SCAN_ACTION_ABORT;
+    esc.sync_id = g_scan_state.sync_id;
+    k_mutex_unlock(&dev->lock);
+
+    err = cyw_iovar("escan", &esc, offsetof(wl_escan_params_t, channel_list), true);
+
+    /* Whatever the firmware still reports is ignored */
+    k_mutex_lock(&dev->lock, K_FOREVER);
+    if (g_scan_state.busy && g_scan_state.sync_id == esc.sync_id) {
+        scan_finish(CYW_ERR_BUSY);
+    }
+    k_mutex_unlock(&dev->lock);
+    return err;
+}
+
+bool cyw_scan_busy(void)
+{
+    return g_scan_state.busy;
+}
+
+int cyw_scan_results(cyw_scan_result_t *results, int max_results)
+{
+    uint8_t order[CYW_SCAN_MAX_BSS];
+    uint32_t n;
+
+    if (results == NULL || max_results <= 0) {
+        return 0;
+    }
+
+    k_mutex_lock(&g_cyw_dev.lock, K_FOREVER);
+
+    /* Insertion sort, best first: the table is small */
+    n = g_scan_state.count;
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t j = i;
+
+        while (j > 0 && scan_weaker(&g_scan_state.bss[order[j - 1]], &g_scan_state.bss[i])) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    n = MIN(n, (uint32_t)max_results);
+    for (uint32_t i = 0; i < n; i++) {
+        results[i] = g_scan_state.bss[order[i]];
+    }
+
+    k_mutex_unlock(&g_cyw_dev.lock);
+    return n;
+}
+
+static void scan_wait_done(void *ctx, cyw_err_t status)
+{
+    *(cyw_err_t *)ctx = status;
+}
+
+int cyw_scan(cyw_scan_result_t *results, int max_results)
+{
+    cyw_scan_params_t params;
+    cyw_err_t status = CYW_ERR_BUSY;
+    cyw_err_t err;
+    uint32_t gen;
+    int n;
+
+    memset(&params, 0, sizeof(params));
+    params.on_done = scan_wait_done;
+    params.ctx = &status;
+
+    err = cyw_scan_start(&params);
+    if (err != CYW_OK) {
+        return err;
+    }
+    gen = g_scan_state.gen;
+
+    for (int elapsed = 0; g_scan_state.busy && elapsed < CYW_SCAN_TIMEOUT_MS; ) {
+        if (cyw_rx_poll(8) == 0) {
+            delay_ms(10);
+            elapsed += 10;
+        }
+    }
+
+    if (g_scan_state.busy) {
+        LOG_WRN("Scan timeout");
+        cyw_scan_abort();
+        status = CYW_ERR_TIMEOUT;
+    }
+    if (status != CYW_OK) {
+        return status;
+    }
+
+    /* Only what this scan heard: it sorts first */
+    n = cyw_scan_results(results, max_results);
+    while (n > 0 && results[n - 1].scan != gen) {
+        n--;
+    }
+    return n;
+}
+
+/*============================================================================
+ * Background Scan
+ *============================================================================*/
+
+/* Called with dev->lock held */
+static void bgscan_done(void *ctx, cyw_err_t status)
+{
+    uint32_t n = (uint32_t)(uintptr_t)ctx;
+    uint32_t pause = g_bgscan.params.slice_interval;
+
+    g_bgscan.slice = false;
+
+    /* Aborted or failed: the same slice again after the pause */
+    if (status == CYW_OK) {
+        g_bgscan.pos += n;
+        if (g_bgscan.pos >= g_bgscan.params.channel_count) {
+            g_bgscan.pos = 0;
+            pause = g_bgscan.params.sweep_interval;
+            LOG_DBG("Background sweep done");
+        }
+    }
+
+    g_bgscan.next = k_uptime_get() + pause;
+}
+
+void cyw_bgscan_poll(bool tx_idle)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    const cyw_bgscan_params_t *bg = &g_bgscan.params;
+    cyw_scan_params_t params;
+    bool new_gen;
+    uint32_t n;
+
+    if (!g_bgscan.on) {
+        return;
+    }
+
+    /* Traffic first: no off-channel time while frames wait */
+    if (!tx_idle) {
+        bool abort;
+
+        k_mutex_lock(&dev->lock, K_FOREVER);
+        abort = g_bgscan.slice && g_scan_state.busy;
+        k_mutex_unlock(&dev->lock);
+
+        /* The slice running gives the channel back; bgscan_done() retries it */
+        if (abort) {
+            cyw_scan_abort();
+        }
+        return;
+    }
+
+    k_mutex_lock(&dev->lock, K_FOREVER);
+    if (!g_bgscan.on || dev->state < CYW_STATE_UP || g_scan_state.busy ||
+        dev->join_status == CYW_ERR_BUSY || k_uptime_get() < g_bgscan.next) {
+        k_mutex_unlock(&dev->lock);
+        return;
+    }
+
+    n = MIN(bg->slice, bg->channel_count - g_bgscan.pos);
+
+    memset(&params, 0, sizeof(params));
+    params.channels = &g_bgscan.ch[g_bgscan.pos];
+    params.channel_count = n;
+    params.passive = bg->passive;
+    params.active_time = bg->active_time;
+    params.passive_time = bg->passive_time;
+    params.home_time = bg->home_time;
+    params.on_done = bgscan_done;
+    params.ctx = (void *)(uintptr_t)n;
+
+    /* Set first: the slice may end while the request is being answered */
+    g_bgscan.slice = true;
+    new_gen = (g_bgscan.pos == 0);
+    k_mutex_unlock(&dev->lock);
+
+    if (scan_start(&params, new_gen) != CYW_OK) {
+        k_mutex_lock(&dev->lock, K_FOREVER);
+        g_bgscan.slice = false;
+        g_bgscan.next = k_uptime_get() + bg->slice_interval;
+        k_mutex_unlock(&dev->lock);
+    }
+}
+
+/* Channels the firmware allows in this country */
+static cyw_err_t bgscan_valid_channels(uint16_t *ch, uint32_t *count)
+{
+    uint32_t list[1 + CYW_SCAN_MAX_CHANNELS];
+    cyw_err_t err;
+
+    memset(list, 0, sizeof(list));
+    list[0] = CYW_SCAN_MAX_CHANNELS;
+    err = cyw_ioctl(WLC_GET_VALID_CHANNELS, list, sizeof(list), false);
+    if (err != CYW_OK) {
+        return err;
+    }
+
+    *count = MIN(list[0], CYW_SCAN_MAX_CHANNELS);
+    for (uint32_t i = 0; i < *count; i++) {
+        ch[i] = list[1 + i];
+    }
+    return (*count > 0) ? CYW_OK : CYW_ERR_FW;
+}
+
+cyw_err_t cyw_bgscan_start(const cyw_bgscan_params_t *params)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_bgscan_params_t bg;
+    uint16_t ch[CYW_SCAN_MAX_CHANNELS];
+    cyw_err_t err;
+
+    if (params != NULL && (params->channel_count > CYW_SCAN_MAX_CHANNELS ||
+                           (params->channels == NULL && params->channel_count > 0))) {
+        return CYW_ERR_INVALID;
+    }
+
+    if (params != NULL) {
+        bg = *params;
+    } else {
+        memset(&bg, 0, sizeof(bg));
+    }
+    bg.slice = bg.slice ? bg.slice : CYW_BGSCAN_SLICE;
+    bg.home_time = bg.home_time ? bg.home_time : CYW_BGSCAN_HOME_TIME_MS;
+    bg.slice_interval = bg.slice_interval ? bg.slice_interval : CYW_BGSCAN_SLICE_INTERVAL_MS;
+    bg.sweep_interval = bg.sweep_interval ? bg.sweep_interval : CYW_BGSCAN_SWEEP_INTERVAL_MS;
+
+    if (bg.channels != NULL) {
+        memcpy(ch, bg.channels, bg.channel_count * sizeof(ch[0]));
+    } else {
+        err = bgscan_valid_channels(ch, &bg.channel_count);
+        if (err != CYW_OK) {
+            return err;
+        }
+    }
+
+    cyw_bgscan_stop();
+
+    k_mutex_lock(&dev->lock, K_FOREVER);
+    memcpy(g_bgscan.ch, ch, bg.channel_count * sizeof(ch[0]));
+    bg.channels = g_bgscan.ch;
+    g_bgscan.params = bg;
+    g_bgscan.pos = 0;
+    g_bgscan.next = k_uptime_get();
+    g_bgscan.on = true;
+    k_mutex_unlock(&dev->lock);
+
+    LOG_INF("Background scan: %u channels, %u per slice", bg.channel_count, bg.slice);
+    return CYW_OK;
+}
+
+void cyw_bgscan_stop(void)
+{
+    bool slice;
+
+    k_mutex_lock(&g_cyw_dev.lock, K_FOREVER);
+    g_bgscan.on = false;
+    slice = g_bgscan.slice;
+    k_mutex_unlock(&g_cyw_dev.lock);
+
+    if (slice) {
+        cyw_scan_abort();
+    }
+}
+
+/*============================================================================
+ * Link State
+ *============================================================================*/
+
+/* Called with dev->lock held */
+static void link_set(bool up, const uint8_t *bssid, uint32_t reason)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    if (up) {
+        memcpy(dev->link_bssid, bssid, sizeof(dev->link_bssid));
+    }
+    if (dev->link_up == up) {
+        return;
+    }
+
+    dev->link_up = up;
+    if (!up) {
+        memset(dev->link_bssid, 0, sizeof(dev->link_bssid));
+    }
+    LOG_INF("Link %s (%u)", up ? "up" : "down", reason);
+
+    if (dev->link_cb != NULL) {
+        dev->link_cb(dev->link_cb_ctx, up, reason);
+    }
+}
+
+static void link_event(void *ctx, const cyw_event_t *ev, const uint8_t *data, uint32_t len)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    ARG_UNUSED(ctx);
+    ARG_UNUSED(data);
+    ARG_UNUSED(len);
+
+    switch (ev->type) {
+        case WLC_E_LINK:
+            link_set((ev->flags & WLC_EVENT_MSG_LINK) != 0, ev->addr, ev->reason);
+            break;
+
+        case WLC_E_SET_SSID:
+            /* Join result: a failure ends the wait in cyw_connect() */
+            if (ev->status == WLC_E_STATUS_ABORT || ev->status == WLC_E_STATUS_NEWASSOC) {
+                break;                      /* Superseded by a newer join */
+            }
+            if (ev->status == WLC_E_STATUS_SUCCESS) {
+                dev->join_status = CYW_OK;
+            } else {
+                dev->join_status = (ev->status == WLC_E_STATUS_TIMEOUT) ? CYW_ERR_TIMEOUT
+                                                                        : CYW_ERROR;
+                link_set(false, NULL, 0);   /* A status, not an 802.11 reason */
+            }
+            break;
+
+        default:
+            /* Deauthenticated or disassociated, by us or the AP (not an old one) */
+            if (memcmp(ev->addr, dev->link_bssid, sizeof(dev->link_bssid)) == 0) {
+                link_set(false, NULL, ev->reason);
+            }
+            break;
+    }
+}
+
+static void link_init(void)
+{
+    static const uint16_t events[] = {
+        WLC_E_LINK, WLC_E_SET_SSID, WLC_E_DEAUTH, WLC_E_DEAUTH_IND,
+        WLC_E_DISASSOC, WLC_E_DISASSOC_IND,
+    };
+
+    cyw_event_register(events, ARRAY_SIZE(events), link_event, NULL);
+}
+
+void cyw_set_link_callback(cyw_link_cb_t cb, void *ctx)
+{
+    k_mutex_lock(&g_cyw_dev.lock, K_FOREVER);
+    g_cyw_dev.link_cb = cb;
+    g_cyw_dev.link_cb_ctx = ctx;
+    k_mutex_unlock(&g_cyw_dev.lock);
+}
+
+bool cyw_is_connected(void)
+{
+    return g_cyw_dev.link_up;
+}
+
+/*============================================================================
+ * Join
+ *============================================================================*/
+
+/* Wait for the join result and the link, polling the bus until the deadline */
+static cyw_err_t join_wait(int timeout_ms)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    int64_t deadline = k_uptime_get() + timeout_ms;
+
+    while (k_uptime_get() < deadline) {
+        if (dev->join_status == CYW_OK && dev->link_up) {
+            return CYW_OK;
+        }
+        if (dev->join_status != CYW_OK && dev->join_status != CYW_ERR_BUSY) {
+            return dev->join_status;
+        }
+        if (cyw_rx_poll(8) == 0) {
+            delay_ms(1);
+        }
+    }
+
+    dev->join_status = CYW_ERR_TIMEOUT;
+    return CYW_ERR_TIMEOUT;
+}
+
+/*
+ * Directed join: the join scan covers only the cached channel and the
+ * association only the cached BSSID
+ */
+static cyw_err_t join_fast(const cyw_join_cache_t *jc)
+{
+    wl_extjoin_params_t join;
+    cyw_err_t err;
+
+    memset(&join, 0, sizeof(join));
+    join.ssid_len = jc->ssid_len;
+    memcpy(join.ssid, jc->ssid, jc->ssid_len);
+    join.scan_type = -1;
+    join.nprobes = -1;
+    join.active_time = -1;
+    join.passive_time = -1;
+    join.home_time = -1;
+    memcpy(join.bssid, jc->bssid, sizeof(join.bssid));
+    join.chanspec_num = 1;
+    join.chanspec_list[0] = jc->chanspec;
+
+    g_cyw_dev.join_status = CYW_ERR_BUSY;
+    err = cyw_iovar("join", &join, sizeof(join), true);
+    if (err != CYW_OK) {
+        return err;
+    }
+
+    return join_wait(CYW_FAST_JOIN_TIMEOUT_MS);
+}
+
+/* Remember the BSS just joined; emptied if its channel cannot be read */
+static void join_cache_update(const char *ssid, uint32_t ssid_len,
+                              uint32_t wpa_auth, uint32_t wsec)
+{
+    cyw_join_cache_t jc;
+    uint32_t chanspec = 0;
+
+    memset(&jc, 0, sizeof(jc));
+    if (cyw_iovar("chanspec", &chanspec, sizeof(chanspec), false) == CYW_OK) {
+        memcpy(jc.ssid, ssid, ssid_len);
+        jc.ssid_len = ssid_len;
+        memcpy(jc.bssid, g_cyw_dev.link_bssid, sizeof(jc.bssid));
+        jc.chanspec = chanspec;
+        jc.wpa_auth = wpa_auth;
+        jc.wsec = wsec;
+    }
+
+    cyw_set_join_cache(&jc);
+}
+
+cyw_err_t cyw_get_join_cache(cyw_join_cache_t *cache)
+{
+    if (cache == NULL) {
+        return CYW_ERR_INVALID;
+    }
+
+    k_mutex_lock(&g_cyw_dev.lock, K_FOREVER);
+    *cache = g_cyw_dev.join_cache;
+    k_mutex_unlock(&g_cyw_dev.lock);
+
+    return (cache->ssid_len != 0) ? CYW_OK : CYW_ERROR;
+}
+
+void cyw_set_join_cache(const cyw_join_cache_t *cache)
+{
+    cyw_join_cache_t *jc = &g_cyw_dev.join_cache;
+
+    k_mutex_lock(&g_cyw_dev.lock, K_FOREVER);
+    if (cache == NULL || cache->ssid_len > sizeof(jc->ssid)) {
+        memset(jc, 0, sizeof(*jc));
+    } else {
+        *jc = *cache;
+    }
+    k_mutex_unlock(&g_cyw_dev.lock);
+}
+
+/*============================================================================
+ * Connect/Disconnect
+ *============================================================================*/
+
+cyw_err_t cyw_connect(const char *ssid, const char *passphrase)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_join_cache_t jc;
+    uint32_t infra = 1;
+    uint32_t auth = 0;                  /* Open System */
+    uint32_t wpa_auth = WPA_AUTH_DISABLED;
+    uint32_t wsec = WSEC_NONE;
+    cyw_err_t err;
+
+    struct __attribute__((packed)) {
+        uint16_t key_len;
+        uint16_t flags;
+        uint8_t key[64];
+    } pmk;
+
+    struct __attribute__((packed)) {
+        uint32_t ssid_len;
+        char ssid[32];
+    } wlc_ssid;
+
+    if (dev->state < CYW_STATE_UP) {
+        return CYW_ERR_NOT_READY;
+    }
+    if (ssid == NULL) {
+        return CYW_ERR_INVALID;
+    }
+
+    memset(&pmk, 0, sizeof(pmk));
+    if (passphrase != NULL && passphrase[0] != '\0') {
+        pmk.key_len = strlen(passphrase);
+        if (pmk.key_len < 8 || pmk.key_len > 63) {
+            return CYW_ERR_INVALID;
+        }
+        pmk.flags = WSEC_PASSPHRASE;
+        memcpy(pmk.key, passphrase, pmk.key_len);
+        wpa_auth = WPA2_AUTH_PSK;
+        wsec = WSEC_AES_ENABLED;
+    }
+
+    /* Security profile in one round of the pipe; the PMK only with a key */
+    cyw_ioctl_op_t profile[] = {
+        CYW_IOCTL_SET(WLC_SET_INFRA, &infra, sizeof(infra)),
+        CYW_IOCTL_SET(WLC_SET_AUTH, &auth, sizeof(auth)),
+        CYW_IOVAR_SET("wpa_auth", &wpa_auth, sizeof(wpa_auth)),
+        CYW_IOCTL_SET(WLC_SET_WSEC, &wsec, sizeof(wsec)),
+        CYW_IOCTL_SET(WLC_SET_WSEC_PMK, &pmk, sizeof(pmk)),
+    };
+
+    err = cyw_ioctl_batch(profile, (pmk.key_len > 0) ? ARRAY_SIZE(profile)
+                                                     : ARRAY_SIZE(profile) - 1);
+    if (err != CYW_OK) return err;
+
+    /* The join goes last, only once the whole profile is in */
+    memset(&wlc_ssid, 0, sizeof(wlc_ssid));
+    wlc_ssid.ssid_len = strlen(ssid);
+    if (wlc_ssid.ssid_len > sizeof(wlc_ssid.ssid)) {
+        wlc_ssid.ssid_len = sizeof(wlc_ssid.ssid);
+    }
+    memcpy(wlc_ssid.ssid, ssid, wlc_ssid.ssid_len);
+
+    LOG_INF("Connecting to %s...", ssid);
+
+    /* Same network and security as last time: straight to the cached BSS */
+    if (cyw_get_join_cache(&jc) == CYW_OK && jc.ssid_len == wlc_ssid.ssid_len &&
+        memcmp(jc.ssid, wlc_ssid.ssid, wlc_ssid.ssid_len) == 0 &&
+        jc.wpa_auth == wpa_auth && jc.wsec == wsec) {
+        err = join_fast(&jc);
+        if (err == CYW_OK) {
+            LOG_INF("Connected (cached BSS)");
+            return CYW_OK;
+        }
+        LOG_INF("Directed join failed (%d), scanning", err);
+    }
+
+    dev->join_status = CYW_ERR_BUSY;
+    err = cyw_ioctl(WLC_SET_SSID, &wlc_ssid, sizeof(wlc_ssid), true);
+    if (err != CYW_OK) return err;
+
+    err = join_wait(CYW_CONNECT_TIMEOUT_MS);
+    if (err != CYW_OK) {
+        LOG_ERR("Join failed: %d", err);
+        return err;
+    }
+
+    join_cache_update(wlc_ssid.ssid, wlc_ssid.ssid_len, wpa_auth, wsec);
+    LOG_INF("Connected!");
+    return CYW_OK;
+}
+
+cyw_err_t cyw_disconnect(void)
+{
+    return cyw_ioctl(WLC_DISASSOC, NULL, 0, true);
+}
+
+int cyw_get_rssi(void)
+{
+    int32_t rssi = 0;
+    cyw_err_t err = cyw_ioctl(WLC_GET_RSSI, &rssi, sizeof(rssi), false);
+    return (err == CYW_OK) ? rssi : 0;
+}
+
+/*============================================================================
+ * Roaming
  *============================================================================*/
 
-int cyw_scan(cyw_scan_result_t *results, int max_results)
+/*
+ * New RSSI in dBm, clamped to what an int8 trigger compares with. Called
+ * with dev->lock held.
+ */
+static void roam_rssi_set(int32_t rssi)
+{
+    int8_t trigger = g_roam.params.trigger;
+
+    rssi = CLAMP(rssi, INT8_MIN, 0);
+    if (rssi < trigger && (g_roam.rssi == 0 || g_roam.rssi >= trigger)) {
+        g_roam.stats.low++;
+    }
+    g_roam.rssi = rssi;
+}
+
+/* Called with dev->lock held */
+static void roam_fail(void)
+{
+    if (g_roam.busy) {
+        g_roam.busy = false;
+        g_roam.stats.fail++;
+    }
+}
+
+/*
+ * Roam over, successful: the firmware's own or the reassociation asked
+ * for. Called with dev->lock held.
+ */
+static void roam_done(const uint8_t *bssid)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    bool directed = g_roam.busy;
+
+    if (directed) {
+        g_roam.busy = false;
+        g_roam.stats.last_ms = k_uptime_get() - g_roam.start;
+    } else if (memcmp(bssid, g_roam.bssid, sizeof(g_roam.bssid)) != 0) {
+        g_roam.stats.fw++;
+    } else {
+        return;                             /* Same roam, reported twice */
+    }
+
+    LOG_INF("Roamed (%s)", directed ? "directed" : "firmware");
+    memcpy(g_roam.bssid, bssid, sizeof(g_roam.bssid));
+    if (dev->link_up) {
+        memcpy(dev->link_bssid, bssid, sizeof(dev->link_bssid));
+    }
+    g_roam.rssi = 0;
+    g_roam.resync = true;
+}
+
+static void roam_event(void *ctx, const cyw_event_t *ev, const uint8_t *data, uint32_t len)
+{
+    ARG_UNUSED(ctx);
+
+    switch (ev->type) {
+        case WLC_E_RSSI:
+            /* int32 in network byte order, like the event header */
+            if (len >= sizeof(int32_t)) {
+                roam_rssi_set((int32_t)sys_get_be32(data));
+            }
+            break;
+
+        case WLC_E_LINK:
+            /* New link: its RSSI is unknown until read */
+            g_roam.rssi = 0;
+            if (ev->flags & WLC_EVENT_MSG_LINK) {
+                g_roam.resync = true;
+            } else {
+                roam_fail();
+                memset(g_roam.bssid, 0, sizeof(g_roam.bssid));
+            }
+            break;
+
+        default:
+            /* WLC_E_ROAM, WLC_E_REASSOC */
+            if (ev->status == WLC_E_STATUS_SUCCESS) {
+                roam_done(ev->addr);
+            } else {
+                roam_fail();
+            }
+            break;
+    }
+}
+
+/* New BSS: its RSSI, and the join cache moved over to it */
+static void roam_resync(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_join_cache_t *jc = &dev->join_cache;
+    uint32_t chanspec = 0;
+    bool moved;
+    int rssi;
+
+    rssi = cyw_get_rssi();
+
+    k_mutex_lock(&dev->lock, K_FOREVER);
+    if (rssi != 0 && g_roam.rssi == 0) {
+        roam_rssi_set(rssi);
+    }
+    moved = jc->ssid_len != 0 && memcmp(jc->bssid, dev->link_bssid, sizeof(jc->bssid)) != 0;
+    k_mutex_unlock(&dev->lock);
+
+    if (moved && cyw_iovar("chanspec", &chanspec, sizeof(chanspec), false) == CYW_OK) {
+        k_mutex_lock(&dev->lock, K_FOREVER);
+        memcpy(jc->bssid, dev->link_bssid, sizeof(jc->bssid));
+        jc->chanspec = chanspec;
+        k_mutex_unlock(&dev->lock);
+    }
+}
+
+/*
+ * Strongest BSS of the network joined, heard in the latest scan or sweep,
+ * at least delta above the current RSSI; NULL if none. Called with
+ * dev->lock held.
+ */
+static const cyw_scan_result_t *roam_candidate(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    const cyw_join_cache_t *jc = &dev->join_cache;
+    uint8_t sec = (jc->wpa_auth == WPA_AUTH_DISABLED) ? CYW_SEC_OPEN : CYW_SEC_WPA2_PSK;
+    int32_t floor = g_roam.rssi + g_roam.params.delta;
+    const cyw_scan_result_t *best = NULL;
+
+    if (jc->ssid_len == 0) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < g_scan_state.count; i++) {
+        const cyw_scan_result_t *b = &g_scan_state.bss[i];
+
+        if (b->scan + 1 < g_scan_state.gen || b->rssi < floor || b->security != sec ||
+            b->ssid_len != jc->ssid_len || memcmp(b->ssid, jc->ssid, jc->ssid_len) != 0 ||
+            memcmp(b->bssid, dev->link_bssid, sizeof(b->bssid)) == 0) {
+            continue;
+        }
+        if (best == NULL || b->rssi > best->rssi) {
+            best = b;
+        }
+    }
+    return best;
+}
+
+void cyw_roam_poll(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    const cyw_roam_params_t *rp = &g_roam.params;
+    const cyw_scan_result_t *best;
+    wl_reassoc_params_t reassoc;
+    bool resync;
+    int64_t now;
+
+    if (!g_roam.on) {
+        return;
+    }
+
+    k_mutex_lock(&dev->lock, K_FOREVER);
+    if (!g_roam.on || dev->state < CYW_STATE_UP || dev->join_status == CYW_ERR_BUSY) {
+        k_mutex_unlock(&dev->lock);
+        return;
+    }
+    if (!dev->link_up) {
+        roam_fail();
+        k_mutex_unlock(&dev->lock);
+        return;
+    }
+    resync = g_roam.resync;
+    g_roam.resync = false;
+    k_mutex_unlock(&dev->lock);
+
+    if (resync) {
+        roam_resync();
+    }
+
+    k_mutex_lock(&dev->lock, K_FOREVER);
+    now = k_uptime_get();
+    if (g_roam.busy) {
+        /* A reassociation takes no longer than a directed join */
+        if (now - g_roam.start > CYW_FAST_JOIN_TIMEOUT_MS) {
+            roam_fail();
+        }
+        k_mutex_unlock(&dev->lock);
+        return;
+    }
+
+    /* Below the trigger, past the holdoff, and news in the BSS table */
+    if (rp->fw_only || g_roam.rssi == 0 || g_roam.rssi >= rp->trigger ||
+        now - g_roam.start < rp->holdoff || g_roam.seen == g_scan_state.heard) {
+        k_mutex_unlock(&dev->lock);
+        return;
+    }
+    g_roam.seen = g_scan_state.heard;
+
+    best = roam_candidate();
+    if (best == NULL) {
+        k_mutex_unlock(&dev->lock);
+        return;
+    }
+
+    memset(&reassoc, 0, sizeof(reassoc));
+    memcpy(reassoc.bssid, best->bssid, sizeof(reassoc.bssid));
+    reassoc.chanspec_num = 1;
+    reassoc.chanspec_list[0] = best->chanspec;
+
+    LOG_INF("Roaming: %d dBm, candidate %d dBm on channel %u",
+            g_roam.rssi, best->rssi, best->channel);
+
+    /* Busy first: the answer may come while the request is being sent */
+    g_roam.busy = true;
+    g_roam.start = now;
+    g_roam.stats.host++;
+    k_mutex_unlock(&dev->lock);
+
+    if (cyw_ioctl(WLC_REASSOC, &reassoc, sizeof(reassoc), true) != CYW_OK) {
+        k_mutex_lock(&dev->lock, K_FOREVER);
+        roam_fail();
+        k_mutex_unlock(&dev->lock);
+    }
+}
+
+cyw_err_t cyw_roam_start(const cyw_roam_params_t *params)
 {
+    static const uint16_t events[] = {
+        WLC_E_LINK, WLC_E_ROAM, WLC_E_REASSOC, WLC_E_RSSI,
+    };
     cyw_dev_t *dev = &g_cyw_dev;
+    cyw_roam_params_t rp;
+    uint32_t roam_off = 0;
+    int32_t trigger[2];
+    int32_t delta[2];
+    uint32_t period;
+    wl_rssi_event_t rssi_ev;
+    cyw_err_t err;
 
     if (dev->state < CYW_STATE_UP) {
         return CYW_ERR_NOT_READY;
     }
 
-    memset(&g_scan_state, 0, sizeof(g_scan_state));
-    g_scan_state.sync_id = (uint16_t)(dev->reqid & 0xFFFF);
-    g_scan_state.in_progress = true;
-
-    struct __attribute__((packed)) {
-        uint32_t version;
-        uint16_t action;
-        uint16_t sync_id;
-        uint32_t ssid_len;
-        char ssid[32];
-        uint8_t bssid[6];
-        int8_t bss_type;
-        uint8_t scan_type;
-        int32_t nprobes;
-        int32_t active_time;
-        int32_t passive_time;
-        int32_t home_time;
-        int32_t channel_num;
-        uint16_t channel_list[1];
-    } params;
+    if (params != NULL) {
+        rp = *params;
+    } else {
+        memset(&rp, 0, sizeof(rp));
+    }
+    rp.trigger = rp.trigger ? rp.trigger : CYW_ROAM_TRIGGER;
+    rp.delta = rp.delta ? rp.delta : CYW_ROAM_DELTA;
+    rp.scan_period = rp.scan_period ? rp.scan_period : CYW_ROAM_SCAN_PERIOD;
+    rp.holdoff = rp.holdoff ? rp.holdoff : CYW_ROAM_HOLDOFF_MS;
+
+    trigger[0] = rp.trigger;
+    trigger[1] = WLC_BAND_ALL;
+    delta[0] = rp.delta;
+    delta[1] = WLC_BAND_ALL;
+    period = rp.scan_period;
+
+    /* An event at the trigger, and one more delta below it */
+    memset(&rssi_ev, 0, sizeof(rssi_ev));
+    rssi_ev.rate_limit_msec = 1000;
+    rssi_ev.num_rssi_levels = 2;
+    rssi_ev.rssi_levels[0] = MAX(rp.trigger - rp.delta, -127);
+    rssi_ev.rssi_levels[1] = rp.trigger;
+
+    cyw_ioctl_op_t ops[] = {
+        CYW_IOCTL_SET(WLC_SET_ROAM_TRIGGER, trigger, sizeof(trigger)),
+        CYW_IOCTL_SET(WLC_SET_ROAM_DELTA, delta, sizeof(delta)),
+        CYW_IOCTL_SET(WLC_SET_ROAM_SCAN_PERIOD, &period, sizeof(period)),
+        CYW_IOVAR_SET("rssi_event", &rssi_ev, sizeof(rssi_ev)),
+    };
+
+    /* Some firmware only takes roam_off while down; roaming is on by default */
+    if (cyw_iovar("roam_off", &roam_off, sizeof(roam_off), true) != CYW_OK) {
+        LOG_DBG("roam_off not supported");
+    }
 
-    memset(&params, 0, sizeof(params));
-    params.version = 1;
-    params.action = 1;
-    params.sync_id = g_scan_state.sync_id;
-    memset(params.bssid, 0xFF, 6);
-    params.bss_type = 2;
-    params.scan_type = 0;
-    params.nprobes = 2;
-    params.active_time = 40;
-    params.passive_time = 110;
-    params.home_time = 45;
-    params.channel_num = 0;
-
-    LOG_INF("Starting scan...");
-
-    cyw_err_t err = cyw_iovar("escan", &params, sizeof(params), true);
+    err = cyw_ioctl_batch(ops, ARRAY_SIZE(ops));
     if (err != CYW_OK) {
-        g_scan_state.in_progress = false;
-        LOG_ERR("escan failed: %d", err);
         return err;
     }
 
-    /* Wait for scan to complete */
-    int timeout = 10000;
-    while (g_scan_state.in_progress && timeout > 0) {
-        cyw_poll();
-        delay_ms(10);
-        timeout -= 10;
+    k_mutex_lock(&dev->lock, K_FOREVER);
+    g_roam.params = rp;
+    g_roam.rssi = 0;
+    g_roam.resync = dev->link_up;
+    g_roam.busy = false;
+    g_roam.seen = g_scan_state.heard - 1;
+    g_roam.start = k_uptime_get() - rp.holdoff;
+    g_roam.on = true;
+    k_mutex_unlock(&dev->lock);
+
+    err = cyw_event_register(events, ARRAY_SIZE(events), roam_event, NULL);
+    if (err != CYW_OK) {
+        g_roam.on = false;
+        return err;
     }
 
-    if (g_scan_state.in_progress) {
-        g_scan_state.in_progress = false;
-        LOG_WRN("Scan timeout");
-    }
+    LOG_INF("Roaming: below %d dBm, %u dB better", rp.trigger, rp.delta);
+    return CYW_OK;
+}
+
+cyw_err_t cyw_roam_stop(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint32_t roam_off = 1;
+    wl_rssi_event_t rssi_ev;
 
-    int count = g_scan_state.count;
-    if (count > max_results) count = max_results;
+    k_mutex_lock(&dev->lock, K_FOREVER);
+    g_roam.on = false;
+    g_roam.busy = false;
+    k_mutex_unlock(&dev->lock);
 
-    if (results && count > 0) {
-        memcpy(results, g_scan_state.results, count * sizeof(cyw_scan_result_t));
+    cyw_event_unregister(roam_event, NULL);
+
+    if (dev->state < CYW_STATE_UP) {
+        return CYW_OK;
     }
 
-    LOG_INF("Scan complete, found %d networks", count);
-    return count;
+    memset(&rssi_ev, 0, sizeof(rssi_ev));
+    cyw_ioctl_op_t ops[] = {
+        CYW_IOVAR_SET("rssi_event", &rssi_ev, sizeof(rssi_ev)),
+        CYW_IOVAR_SET("roam_off", &roam_off, sizeof(roam_off)),
+    };
+
+    return cyw_ioctl_batch(ops, ARRAY_SIZE(ops));
+}
+
+void cyw_roam_get_stats(cyw_roam_stats_t *stats)
+{
+    k_mutex_lock(&g_cyw_dev.lock, K_FOREVER);
+    *stats = g_roam.stats;
+    stats->rssi = g_roam.rssi;
+    k_mutex_unlock(&g_cyw_dev.lock);
 }
 
 /*============================================================================
- * Connect/Disconnect
+ * Power Save
  *============================================================================*/
 
-cyw_err_t cyw_connect(const char *ssid, const char *passphrase)
+/* Poll a F1 register until the bits are set, within *budget_us */
+static bool pm_wait(uint32_t addr, uint8_t bits, uint8_t set, uint32_t *budget_us)
 {
-    cyw_dev_t *dev = &g_cyw_dev;
-    cyw_err_t err;
+    uint8_t val;
 
-    if (dev->state < CYW_STATE_UP) {
-        return CYW_ERR_NOT_READY;
+    for (;;) {
+        if (set != 0) {
+            cyw_sdio_write8(SDIO_FUNC_1, addr, set);    /* Unanswered until the core is up */
+        }
+        if (cyw_sdio_read8(SDIO_FUNC_1, addr, &val) == CYW_OK && (val & bits) == bits) {
+            return true;
+        }
+        if (*budget_us < 100) {
+            return false;
+        }
+        delay_us(100);
+        *budget_us -= 100;
     }
+}
 
-    uint32_t infra = 1;
-    err = cyw_ioctl(WLC_SET_INFRA, &infra, sizeof(infra), true);
-    if (err != CYW_OK) return err;
+/*
+ * Set KSO until the SDIO core reports itself on, then take the HT clock
+ * back; bounded by CYW_PM_WAKE_TIMEOUT_MS
+ */
+static cyw_err_t pm_wake(void)
+{
+    uint32_t budget = CYW_PM_WAKE_TIMEOUT_MS * 1000;
+    uint32_t start = k_cycle_get_32();
+    uint32_t lat;
+
+    /* From here on accesses go straight to the bus */
+    g_pm.asleep = false;
+
+    if (!pm_wait(SBSDIO_FUNC1_SLEEPCSR, SBSDIO_SLEEPCSR_KSO | SBSDIO_SLEEPCSR_DEVON,
+                 SBSDIO_SLEEPCSR_KSO, &budget) ||
+        cyw_sdio_write8(SDIO_FUNC_1, SBSDIO_FUNC1_CHIPCLKCSR, SBSDIO_HT_AVAIL_REQ) != CYW_OK ||
+        !pm_wait(SBSDIO_FUNC1_CHIPCLKCSR, SBSDIO_HT_AVAIL, 0, &budget)) {
+        g_pm.asleep = true;
+        g_pm.stats.wake_fail++;
+        LOG_ERR("Bus wake timeout");
+        return CYW_ERR_TIMEOUT;
+    }
 
-    uint32_t auth = 0;
-    err = cyw_ioctl(WLC_SET_AUTH, &auth, sizeof(auth), true);
-    if (err != CYW_OK) return err;
+    lat = k_cyc_to_us_floor32(k_cycle_get_32() - start);
+    g_pm.stats.wakes++;
+    g_pm.stats.wake_last_us = lat;
+    g_pm.stats.wake_max_us = MAX(g_pm.stats.wake_max_us, lat);
+    g_pm.stats.wake_total_us += lat;
+    return CYW_OK;
+}
 
-    uint32_t wpa_auth = 0x80;
-    err = cyw_iovar("wpa_auth", &wpa_auth, sizeof(wpa_auth), true);
-    if (err != CYW_OK) return err;
+/* Drop the clock request, then KSO: the SDIO core may power down */
+static void pm_sleep(void)
+{
+    if (cyw_sdio_write8(SDIO_FUNC_1, SBSDIO_FUNC1_CHIPCLKCSR, 0) != CYW_OK) {
+        return;
+    }
+    if (cyw_sdio_write8(SDIO_FUNC_1, SBSDIO_FUNC1_SLEEPCSR, 0) != CYW_OK) {
+        cyw_sdio_write8(SDIO_FUNC_1, SBSDIO_FUNC1_CHIPCLKCSR, SBSDIO_HT_AVAIL_REQ);
+        return;
+    }
 
-    uint32_t wsec = 4;
-    err = cyw_ioctl(WLC_SET_WSEC, &wsec, sizeof(wsec), true);
-    if (err != CYW_OK) return err;
+    g_pm.asleep = true;
+    g_cyw_dev.sbwad_valid = false;          /* Window set again after the wake */
+    g_pm.stats.sleeps++;
+}
 
-    if (passphrase && strlen(passphrase) > 0) {
-        struct __attribute__((packed)) {
-            uint16_t key_len;
-            uint16_t flags;
-            uint8_t key[64];
-        } pmk;
+/*
+ * Nothing queued for TX, no IOCTL awaited, no interrupt pending, and no
+ * access for bus_idle: the bus may sleep
+ */
+void cyw_pm_poll(bool tx_idle)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    int64_t now;
 
-        memset(&pmk, 0, sizeof(pmk));
-        pmk.key_len = strlen(passphrase);
-        memcpy(pmk.key, passphrase, pmk.key_len);
+    if (!g_pm.params.bus_sleep) {
+        return;
+    }
 
-        err = cyw_ioctl(268, &pmk, sizeof(pmk), true);
-        if (err != CYW_OK) return err;
+    k_mutex_lock(&dev->lock, K_FOREVER);
+    if (!g_pm.params.bus_sleep || g_pm.asleep || dev->state < CYW_STATE_UP) {
+        k_mutex_unlock(&dev->lock);
+        return;
     }
 
-    struct __attribute__((packed)) {
-        uint32_t ssid_len;
-        char ssid[32];
-    } wlc_ssid;
+    now = k_uptime_get();
+    if (g_pm.used || !tx_idle ||
+        k_sem_count_get(&dev->ioctl_slots) < CYW_IOCTL_MAX_PENDING) {
+        g_pm.used = false;
+        g_pm.idle_since = now;
+    } else if (now - g_pm.idle_since >= g_pm.params.bus_idle &&
+               !dev->ops->irq_pending()) {
+        pm_sleep();
+    }
+    k_mutex_unlock(&dev->lock);
+}
 
-    memset(&wlc_ssid, 0, sizeof(wlc_ssid));
-    wlc_ssid.ssid_len = strlen(ssid);
-    if (wlc_ssid.ssid_len > 32) wlc_ssid.ssid_len = 32;
-    memcpy(wlc_ssid.ssid, ssid, wlc_ssid.ssid_len);
+cyw_err_t cyw_set_power_save(const cyw_pm_params_t *params)
+{
+    static const uint32_t pm_modes[] = { PM_OFF, PM_MAX, PM_FAST };
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_pm_params_t pm;
+    uint32_t mode;
+    uint32_t sleep_ret;
+    uint8_t wake;
+    cyw_err_t err;
 
-    LOG_INF("Connecting to %s...", ssid);
-    err = cyw_ioctl(WLC_SET_SSID, &wlc_ssid, sizeof(wlc_ssid), true);
-    if (err != CYW_OK) return err;
+    if (params != NULL) {
+        pm = *params;
+    } else {
+        memset(&pm, 0, sizeof(pm));
+    }
+    if (dev->state < CYW_STATE_UP || (pm.bus_sleep && dev->ops->irq_pending == NULL)) {
+        return CYW_ERR_NOT_READY;
+    }
+    if ((uint32_t)pm.mode >= ARRAY_SIZE(pm_modes)) {
+        return CYW_ERR_INVALID;
+    }
+    pm.sleep_ret = pm.sleep_ret ? pm.sleep_ret : CYW_PM2_SLEEP_RET_MS;
+    pm.bus_idle = pm.bus_idle ? pm.bus_idle : CYW_PM_BUS_IDLE_MS;
 
-    int timeout = 10000;
-    while (timeout > 0) {
-        cyw_poll();
-        if (cyw_is_connected()) {
-            LOG_INF("Connected!");
-            return CYW_OK;
+    mode = pm_modes[pm.mode];
+    sleep_ret = pm.sleep_ret;
+
+    /* The return-to-sleep time only means something in PM2 */
+    cyw_ioctl_op_t ops[] = {
+        CYW_IOCTL_SET(WLC_SET_PM, &mode, sizeof(mode)),
+        CYW_IOVAR_SET("pm2_sleep_ret", &sleep_ret, sizeof(sleep_ret)),
+    };
+
+    err = cyw_ioctl_batch(ops, (pm.mode == CYW_PM_PM2) ? ARRAY_SIZE(ops)
+                                                       : ARRAY_SIZE(ops) - 1);
+    if (err != CYW_OK) {
+        return err;
+    }
+
+    k_mutex_lock(&dev->lock, K_FOREVER);
+
+    /* A KSO wake answers only once the HT clock is up */
+    if (pm.bus_sleep) {
+        err = cyw_sdio_read8(SDIO_FUNC_1, SBSDIO_FUNC1_WAKEUPCTRL, &wake);
+        if (err == CYW_OK) {
+            err = cyw_sdio_write8(SDIO_FUNC_1, SBSDIO_FUNC1_WAKEUPCTRL,
+                                  wake | SBSDIO_WCTRL_HTWAIT);
         }
-        delay_ms(100);
-        timeout -= 100;
+    }
+    if (err == CYW_OK) {
+        g_pm.params = pm;
+        g_pm.used = true;
     }
 
-    LOG_ERR("Connection timeout");
-    return CYW_ERR_TIMEOUT;
+    k_mutex_unlock(&dev->lock);
+
+    if (err == CYW_OK) {
+        LOG_INF("Power save: PM%u, bus sleep %s", (unsigned int)mode,
+                pm.bus_sleep ? "on" : "off");
+    }
+    return err;
 }
 
-cyw_err_t cyw_disconnect(void)
+void cyw_pm_get_stats(cyw_pm_stats_t *stats)
 {
-    return cyw_ioctl(WLC_DISASSOC, NULL, 0, true);
+    k_mutex_lock(&g_cyw_dev.lock, K_FOREVER);
+    *stats = g_pm.stats;
+    stats->bus_asleep = g_pm.asleep;
+    k_mutex_unlock(&g_cyw_dev.lock);
 }
 
-bool cyw_is_connected(void)
+/*============================================================================
+ * Data Path
+ *============================================================================*/
+
+static const uint8_t g_zero_pad[4];
+
+cyw_err_t cyw_tx_frame_sg(uint8_t ifidx, uint8_t prio,
+                          const sdio_sg_t *sg, uint32_t count)
 {
-    uint8_t bssid[6] = {0};
-    cyw_err_t err = cyw_ioctl(WLC_GET_BSSID, bssid, sizeof(bssid), false);
+    cyw_dev_t *dev = &g_cyw_dev;
+    struct __attribute__((packed, aligned(4))) {
+        sdpcm_header_t sdpcm;
+        bdc_header_t bdc;
+    } hdr;
+    uint32_t frame_len = sizeof(hdr), pad;
+    cyw_err_t err;
+
+    for (uint32_t i = 0; i < count; i++) {
+        frame_len += sg[i].len;
+    }
+    if (frame_len < sizeof(hdr) + CYW_ETH_HDR_LEN || frame_len > TX_BUF_SIZE) {
+        return CYW_ERR_INVALID;
+    }
+    pad = ALIGN(frame_len, 4) - frame_len;
+
+    k_mutex_lock(&dev->lock, K_FOREVER);
+
+    if (dev->state < CYW_STATE_UP) {
+        err = CYW_ERR_NOT_READY;
+        goto out;
+    }
+    if (tx_credits() == 0 || (dev->flow_ctrl & (1u << (prio & 7)))) {
+        err = CYW_ERR_BUSY;
+        goto out;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    hdr.sdpcm.len = frame_len;
+    hdr.sdpcm.len_check = ~frame_len;
+    hdr.sdpcm.seq = dev->tx_seq;
+    hdr.sdpcm.channel = SDPCM_DATA_CHANNEL;
+    hdr.sdpcm.data_offset = SDPCM_HEADER_SIZE;
+    hdr.bdc.flags = BCDC_PROTO_VER << BCDC_FLAG_VER_SHIFT;
+    hdr.bdc.priority = prio & 7;
+    hdr.bdc.flags2 = ifidx & BCDC_FLAG2_IF_MASK;
+
+    if (dev->ops->cmd53_write_sg && count + 2 <= CYW_TX_MAX_SEGS) {
+        /* Header, the caller's segments in place, word padding */
+        sdio_sg_t segs[CYW_TX_MAX_SEGS];
+        uint32_t n = 0;
+
+        segs[n].data = (const uint8_t *)&hdr;
+        segs[n++].len = sizeof(hdr);
+        for (uint32_t i = 0; i < count; i++) {
+            segs[n++] = sg[i];
+        }
+        if (pad) {
+            segs[n].data = g_zero_pad;
+            segs[n++].len = pad;
+        }
+
+        err = sdio_write_sg(SDIO_FUNC_2, 0, segs, n, true);
+    } else {
+        uint8_t *p = dev->tx_buf;
+
+        memcpy(p, &hdr, sizeof(hdr));
+        p += sizeof(hdr);
+        for (uint32_t i = 0; i < count; i++) {
+            memcpy(p, sg[i].data, sg[i].len);
+            p += sg[i].len;
+        }
+        memset(p, 0, pad);
+
+        err = sdio_write_bytes(SDIO_FUNC_2, 0, dev->tx_buf, frame_len + pad, true);
+    }
 
-    if (err != CYW_OK) return false;
+    if (err == CYW_OK) {
+        dev->tx_seq++;
+    }
 
-    return (bssid[0] | bssid[1] | bssid[2] |
-            bssid[3] | bssid[4] | bssid[5]) != 0;
+out:
+    k_mutex_unlock(&dev->lock);
+    return err;
 }
 
-int cyw_get_rssi(void)
+void cyw_set_rx_ops(const cyw_rx_ops_t *ops)
 {
-    int32_t rssi = 0;
-    cyw_err_t err = cyw_ioctl(WLC_GET_RSSI, &rssi, sizeof(rssi), false);
-    return (err == CYW_OK) ? rssi : 0;
+    k_mutex_lock(&g_cyw_dev.lock, K_FOREVER);
+    g_cyw_dev.rx_ops = ops;
+    k_mutex_unlock(&g_cyw_dev.lock);
+}
+
+cyw_err_t cyw_get_mac(uint8_t *mac)
+{
+    return cyw_iovar("cur_etheraddr", mac, 6, false);
 }
 
 /*============================================================================
  * Event Polling
  *============================================================================*/
 
-void cyw_poll(void)
+/*
+ * Acknowledge the SDIO core interrupt (write 1 to clear) before reading:
+ * frames arriving meanwhile raise it again. Those already queued are read
+ * while rx_irq_more holds. Called under lock.
+ */
+static void rx_irq_ack(void)
 {
     cyw_dev_t *dev = &g_cyw_dev;
+    const uint32_t reg = SDIO_CORE_BASE_ADDR + SDIO_CORE_INTSTATUS;
+    uint32_t intstatus;
 
-    if (dev->state < CYW_STATE_FW_READY) {
+    if (cyw_sdio_read32(reg, &intstatus) != CYW_OK) {
         return;
     }
+    if (intstatus != 0) {
+        cyw_sdio_write32(reg, intstatus);
+    }
+    if (intstatus & I_HMB_FRAME_IND) {
+        dev->rx_irq_more = true;
+    }
+}
 
-    uint8_t channel;
-    uint32_t len = sizeof(dev->rx_buf);
+int cyw_rx_poll(int budget)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    int n = 0;
 
-    if (recv_sdpcm_frame(&channel, dev->rx_buf, &len) != CYW_OK) {
-        return;
+    if (dev->state < CYW_STATE_FW_READY) {
+        return 0;
     }
 
-    switch (channel) {
-        case SDPCM_EVENT_CHANNEL:
-            LOG_DBG("Event received, len=%u", len);
-            /* TODO: Parse events */
-            break;
+    k_mutex_lock(&dev->lock, K_FOREVER);
 
-        case SDPCM_DATA_CHANNEL:
-            LOG_DBG("Data received, len=%u", len);
-            break;
+    if (dev->ops->irq_pending && dev->ops->irq_pending()) {
+        rx_irq_ack();
+    }
 
-        default:
+    /* With bus sleep, read only what the interrupt announces */
+    if (g_pm.params.bus_sleep && !dev->rx_irq_more) {
+        k_mutex_unlock(&dev->lock);
+        return 0;
+    }
+
+    while (n < budget) {
+        uint8_t channel;
+        uint8_t *payload;
+        uint32_t len;
+
+        if (recv_sdpcm_frame(&channel, &payload, &len) != CYW_OK) {
+            dev->rx_irq_more = false;
             break;
+        }
+        rx_dispatch(channel, payload, len);
+        n++;
     }
+
+    k_mutex_unlock(&dev->lock);
+    return n;
+}
+
+void cyw_poll(void)
+{
+    cyw_rx_poll(1);
 }
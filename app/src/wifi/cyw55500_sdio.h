@@ -22,6 +22,136 @@
 #define TX_BUF_SIZE                 2048
 #define RX_BUF_SIZE                 2048
 
+/* Most gather segments in one data frame (header and padding included) */
+#ifndef CYW_TX_MAX_SEGS
+#define CYW_TX_MAX_SEGS             20
+#endif
+
+/* IOCTLs in flight at once, from any number of threads */
+#ifndef CYW_IOCTL_MAX_PENDING
+#define CYW_IOCTL_MAX_PENDING       4
+#endif
+
+/* IOCTL response timeout */
+#ifndef CYW_IOCTL_TIMEOUT_MS
+#define CYW_IOCTL_TIMEOUT_MS        100
+#endif
+
+/* Sleep of a waiting IOCTL between its own polls while the bus is idle */
+#ifndef CYW_IOCTL_POLL_US
+#define CYW_IOCTL_POLL_US           100
+#endif
+
+/* Requests of one batch in flight at once (1: one round trip each) */
+#ifndef CYW_IOCTL_PIPELINE
+#define CYW_IOCTL_PIPELINE          CYW_IOCTL_MAX_PENDING
+#endif
+#if CYW_IOCTL_PIPELINE > CYW_IOCTL_MAX_PENDING
+#error "CYW_IOCTL_PIPELINE exceeds CYW_IOCTL_MAX_PENDING"
+#endif
+
+/*
+ * Largest IOCTL buffer (the firmware's WLC_IOCTL_MAXLEN). Requests are
+ * built in, and responses too large for the RX buffer read into, one
+ * preallocated arena of this size instead of the caller's stack.
+ */
+#ifndef CYW_IOCTL_MAX_LEN
+#define CYW_IOCTL_MAX_LEN           8192
+#endif
+
+/* Event handlers registered at once (one bit each in the per-type table) */
+#ifndef CYW_EVENT_HANDLERS
+#define CYW_EVENT_HANDLERS          8
+#endif
+#if CYW_EVENT_HANDLERS > 8
+#error "CYW_EVENT_HANDLERS exceeds 8"
+#endif
+
+/*
+ * Scan engine: strongest BSSes kept (the BSS table, newest scan first),
+ * and BSSID hash slots (power of two, at least twice the table)
+ */
+#ifndef CYW_SCAN_MAX_BSS
+#define CYW_SCAN_MAX_BSS            32
+#endif
+#ifndef CYW_SCAN_HASH_SIZE
+#define CYW_SCAN_HASH_SIZE          64
+#endif
+#if CYW_SCAN_MAX_BSS > 254 || CYW_SCAN_HASH_SIZE < 2 * CYW_SCAN_MAX_BSS || \
+    (CYW_SCAN_HASH_SIZE & (CYW_SCAN_HASH_SIZE - 1)) != 0
+#error "Bad CYW_SCAN_MAX_BSS/CYW_SCAN_HASH_SIZE"
+#endif
+
+/* Most channels in one scan request */
+#ifndef CYW_SCAN_MAX_CHANNELS
+#define CYW_SCAN_MAX_CHANNELS       64
+#endif
+
+/* Longest cyw_scan() waits for the scan to end */
+#ifndef CYW_SCAN_TIMEOUT_MS
+#define CYW_SCAN_TIMEOUT_MS         10000
+#endif
+
+/*
+ * Background scan defaults: channels per slice, time back on the home
+ * channel between them (ms), pause after a slice and after a sweep over
+ * all channels (ms)
+ */
+#ifndef CYW_BGSCAN_SLICE
+#define CYW_BGSCAN_SLICE            3
+#endif
+#ifndef CYW_BGSCAN_HOME_TIME_MS
+#define CYW_BGSCAN_HOME_TIME_MS     100
+#endif
+#ifndef CYW_BGSCAN_SLICE_INTERVAL_MS
+#define CYW_BGSCAN_SLICE_INTERVAL_MS 500
+#endif
+#ifndef CYW_BGSCAN_SWEEP_INTERVAL_MS
+#define CYW_BGSCAN_SWEEP_INTERVAL_MS 30000
+#endif
+
+/* Longest cyw_connect() waits for the link */
+#ifndef CYW_CONNECT_TIMEOUT_MS
+#define CYW_CONNECT_TIMEOUT_MS      10000
+#endif
+
+/* Longest a directed join to the cached BSS may take before the full join */
+#ifndef CYW_FAST_JOIN_TIMEOUT_MS
+#define CYW_FAST_JOIN_TIMEOUT_MS    3000
+#endif
+
+/*
+ * Roaming defaults: RSSI that starts a roam (dBm), how much stronger a
+ * candidate must be (dB), firmware roam scan period below the trigger
+ * (s), least time between two roams started by the driver (ms)
+ */
+#ifndef CYW_ROAM_TRIGGER
+#define CYW_ROAM_TRIGGER            (-75)
+#endif
+#ifndef CYW_ROAM_DELTA
+#define CYW_ROAM_DELTA              10
+#endif
+#ifndef CYW_ROAM_SCAN_PERIOD
+#define CYW_ROAM_SCAN_PERIOD        10
+#endif
+#ifndef CYW_ROAM_HOLDOFF_MS
+#define CYW_ROAM_HOLDOFF_MS         5000
+#endif
+
+/*
+ * Power save defaults: PM2 time awake after the last frame (ms), bus idle
+ * time before host sleep (ms); longest a bus wake may take (ms)
+ */
+#ifndef CYW_PM2_SLEEP_RET_MS
+#define CYW_PM2_SLEEP_RET_MS        200
+#endif
+#ifndef CYW_PM_BUS_IDLE_MS
+#define CYW_PM_BUS_IDLE_MS          50
+#endif
+#ifndef CYW_PM_WAKE_TIMEOUT_MS
+#define CYW_PM_WAKE_TIMEOUT_MS      10
+#endif
+
 /*============================================================================
  * Error Codes
  *============================================================================*/
@@ -68,15 +198,25 @@ typedef struct {
 
 /*============================================================================
  * Scan Results
+ *
+ * escan results are parsed as they arrive, one WLC_E_ESCAN_RESULT at a
+ * time, into a bounded BSS table: a BSSID hash merges repeated sightings,
+ * and a heap keeps the CYW_SCAN_MAX_BSS strongest of the latest scan
+ * (entries of earlier scans go first when room is needed). Each BSS is
+ * reported to the caller once per scan on arrival, so results show up
+ * long before the scan ends however many BSSes are around.
  *============================================================================*/
 
 typedef struct {
     uint8_t bssid[6];
     uint8_t ssid[33];
-    uint8_t ssid_len;
-    int16_t rssi;
+    uint8_t ssid_len;           /* 0: hidden */
+    int16_t rssi;               /* dBm, strongest heard in that scan */
     uint16_t channel;
-    uint8_t security;
+    uint8_t security;           /* CYW_SEC_* */
+    uint16_t chanspec;          /* Channel, band and bandwidth */
+    uint16_t capability;        /* 802.11 capability field */
+    uint32_t scan;              /* Scan that last heard it */
 } cyw_scan_result_t;
 
 #define CYW_SEC_OPEN        0
@@ -85,6 +225,130 @@ typedef struct {
 #define CYW_SEC_WPA2_PSK    3
 #define CYW_SEC_WPA3_SAE    4
 
+/*
+ * Scan callbacks, called like the data path callbacks (bus lock held, no
+ * calls back into the driver). on_result: BSS heard for the first time in
+ * this scan (borrowed for the call). on_done: CYW_OK, CYW_ERR_BUSY if
+ * aborted (cyw_scan_abort(), a join, a newer scan), CYW_ERROR if the
+ * firmware failed it.
+ */
+typedef void (*cyw_scan_result_cb_t)(void *ctx, const cyw_scan_result_t *bss);
+typedef void (*cyw_scan_done_cb_t)(void *ctx, cyw_err_t status);
+
+/* Scan request; zero fields take the firmware defaults */
+typedef struct {
+    const uint16_t *channels;   /* 2.4/5 GHz channel numbers; NULL: all */
+    uint32_t channel_count;
+    const char *ssid;           /* Directed probes; NULL: broadcast */
+    bool passive;               /* Listen only, no probe requests */
+    uint8_t nprobes;            /* Probe requests per channel */
+    uint16_t active_time;       /* Dwell per channel (ms), active scan */
+    uint16_t passive_time;      /* ... passive scan */
+    uint16_t home_time;         /* Back on the home channel between channels (ms) */
+    cyw_scan_result_cb_t on_result;
+    cyw_scan_done_cb_t on_done;
+    void *ctx;
+} cyw_scan_params_t;
+
+/*
+ * Background scan settings; zero fields take the CYW_BGSCAN_* defaults.
+ * The channels are swept a few at a time, back on the home channel
+ * between them; slices only start while no TX frame waits, and results
+ * land in the BSS table (one sweep ranks as one scan).
+ */
+typedef struct {
+    const uint16_t *channels;   /* Channel numbers; NULL: all valid here */
+    uint32_t channel_count;
+    uint8_t slice;              /* Channels per slice */
+    bool passive;               /* Listen only, no probe requests */
+    uint16_t active_time;       /* Dwell per channel (ms); 0: firmware default */
+    uint16_t passive_time;      /* ... passive scan */
+    uint16_t home_time;         /* On the home channel between channels (ms) */
+    uint32_t slice_interval;    /* Pause after a slice (ms) */
+    uint32_t sweep_interval;    /* Pause after a sweep (ms) */
+} cyw_bgscan_params_t;
+
+/*
+ * Link up or down, as the firmware events report it; called like the
+ * data path callbacks (bus lock held, no calls back into the driver).
+ * reason: 802.11 reason code when the link went down, or the
+ * WLC_E_STATUS_* of a failed join.
+ */
+typedef void (*cyw_link_cb_t)(void *ctx, bool up, uint32_t reason);
+
+/*
+ * Last BSS joined, kept for a directed join that skips the full-band
+ * scan. Plain data: it may be saved across power cycles (settings, flash)
+ * and given back with cyw_set_join_cache().
+ */
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t ssid_len;           /* 0: empty */
+    uint8_t bssid[6];
+    uint16_t chanspec;
+    uint32_t wpa_auth;          /* Security of the join: WPA_AUTH_* (AKM) */
+    uint32_t wsec;              /* ... and WSEC_* (ciphers) */
+} cyw_join_cache_t;
+
+/*
+ * Roaming settings; zero fields take the CYW_ROAM_* defaults. The
+ * firmware roams on its own below the trigger (roam offload); the driver
+ * also follows the RSSI events and, below the trigger, reassociates
+ * straight to a stronger BSS of the network joined from the BSS table
+ * (kept fresh by the background scan). The delta and the holdoff keep
+ * the link from bouncing between two BSSes.
+ */
+typedef struct {
+    int8_t trigger;             /* Roam below this RSSI (dBm) */
+    uint8_t delta;              /* Candidates at least this much stronger (dB) */
+    uint16_t scan_period;       /* Firmware roam scans below the trigger (s) */
+    uint32_t holdoff;           /* Least time between two driver roams (ms) */
+    bool fw_only;               /* Leave it to the firmware, no BSS table lookups */
+} cyw_roam_params_t;
+
+typedef struct {
+    int16_t rssi;               /* Last RSSI reported (dBm), 0: unknown */
+    uint32_t low;               /* Times the RSSI fell below the trigger */
+    uint32_t fw;                /* Roams the firmware made on its own */
+    uint32_t host;              /* Reassociations to a BSS table candidate */
+    uint32_t fail;              /* ... that failed or timed out */
+    uint32_t last_ms;           /* ... duration of the last successful one */
+} cyw_roam_stats_t;
+
+/*
+ * Power save. 802.11 power save (WLC_SET_PM) lets the radio doze between
+ * beacons: PM1 fetches every buffered frame with a PS-Poll (least power,
+ * most latency), PM2 stays awake while traffic flows and dozes again
+ * sleep_ret ms after the last frame. Bus sleep clears Keep SDIO On once
+ * the bus has been idle for bus_idle ms, so the chip's SDIO core powers
+ * down too; the next bus access sets KSO again and waits for the core
+ * and its HT clock, at most CYW_PM_WAKE_TIMEOUT_MS. Everything is off by
+ * default, as suits mains-powered units.
+ */
+typedef enum {
+    CYW_PM_OFF = 0,             /* Radio always on */
+    CYW_PM_PM1,                 /* PS-Poll */
+    CYW_PM_PM2,                 /* Fast power save */
+} cyw_pm_mode_t;
+
+/* Power save settings; zero times take the CYW_PM_* defaults */
+typedef struct {
+    cyw_pm_mode_t mode;
+    uint16_t sleep_ret;         /* PM2: awake after the last frame (ms) */
+    bool bus_sleep;             /* Put the bus to sleep (KSO) when idle */
+    uint16_t bus_idle;          /* ... after this long without access (ms) */
+} cyw_pm_params_t;
+
+typedef struct {
+    bool bus_asleep;            /* Bus asleep now (KSO cleared) */
+    uint32_t sleeps;            /* Times the bus was put to sleep */
+    uint32_t wakes;             /* ... and woken for an access */
+    uint32_t wake_fail;         /* Wakes that timed out */
+    uint32_t wake_last_us;      /* Wake latency: last */
+    uint32_t wake_max_us;       /* ... worst */
+    uint32_t wake_total_us;     /* ... sum over wakes */
+} cyw_pm_stats_t;
+
 /*============================================================================
  * SDPCM Header
  *============================================================================*/
@@ -116,10 +380,150 @@ typedef struct __attribute__((packed)) {
 
 #define BCDC_HEADER_SIZE    sizeof(bcdc_header_t)
 
+/* Data frames: BDC header in front of the Ethernet frame */
+typedef struct __attribute__((packed)) {
+    uint8_t flags;          /* Protocol version, checksum flags */
+    uint8_t priority;       /* 802.1d priority */
+    uint8_t flags2;         /* Interface index */
+    uint8_t data_offset;    /* Extra header words before the frame */
+} bdc_header_t;
+
+#define BDC_HEADER_SIZE     sizeof(bdc_header_t)
+
+/* Shortest frame accepted for TX: destination, source, type */
+#define CYW_ETH_HDR_LEN     14
+
+/* Event frames: Broadcom header behind the Ethernet header (big endian) */
+typedef struct __attribute__((packed)) {
+    uint16_t subtype;       /* BCMILCP_SUBTYPE_VENDOR_LONG */
+    uint16_t length;
+    uint8_t  version;
+    uint8_t  oui[3];        /* BRCM_OUI */
+    uint16_t usr_subtype;   /* BCMILCP_BCM_SUBTYPE_EVENT */
+} bcmeth_header_t;
+
+/* ... then the event message (big endian), then its data */
+typedef struct __attribute__((packed)) {
+    uint16_t version;
+    uint16_t flags;
+    uint32_t event_type;
+    uint32_t status;
+    uint32_t reason;
+    uint32_t auth_type;
+    uint32_t datalen;
+    uint8_t  addr[6];
+    char     ifname[16];
+    uint8_t  ifidx;
+    uint8_t  bsscfgidx;
+} wl_event_msg_t;
+
+#define CYW_EVENT_HDR_LEN   (CYW_ETH_HDR_LEN + sizeof(bcmeth_header_t) + sizeof(wl_event_msg_t))
+
+/* escan iovar request; channel_list holds the channels given */
+typedef struct __attribute__((packed)) {
+    uint32_t version;       /* ESCAN_REQ_VERSION */
+    uint16_t action;        /* WL_SCAN_ACTION_* */
+    uint16_t sync_id;       /* Echoed in the results */
+    uint32_t ssid_len;
+    uint8_t  ssid[32];
+    uint8_t  bssid[6];
+    int8_t   bss_type;
+    uint8_t  scan_type;     /* WL_SCANFLAGS_* */
+    int32_t  nprobes;       /* -1: firmware default, likewise the times */
+    int32_t  active_time;
+    int32_t  passive_time;
+    int32_t  home_time;
+    uint32_t channel_num;   /* Channels in the low half, SSIDs in the high */
+    uint16_t channel_list[CYW_SCAN_MAX_CHANNELS];
+} wl_escan_params_t;
+
+/* WLC_E_ESCAN_RESULT data (little endian): header, then bss_count records */
+typedef struct __attribute__((packed)) {
+    uint32_t buflen;
+    uint32_t version;
+    uint16_t sync_id;
+    uint16_t bss_count;
+} wl_escan_result_t;
+
+/* BSS record (wl_bss_info_t version 109), its IEs at ie_offset */
+typedef struct __attribute__((packed)) {
+    uint32_t version;
+    uint32_t length;        /* Whole record, IEs included */
+    uint8_t  bssid[6];
+    uint16_t beacon_period;
+    uint16_t capability;
+    uint8_t  ssid_len;
+    uint8_t  ssid[32];
+    uint8_t  pad0;
+    uint32_t rate_count;
+    uint8_t  rates[16];
+    uint16_t chanspec;
+    uint16_t atim_window;
+    uint8_t  dtim_period;
+    uint8_t  pad1;
+    int16_t  rssi;
+    int8_t   phy_noise;
+    uint8_t  n_cap;
+    uint16_t pad2;
+    uint32_t nbss_cap;
+    uint8_t  ctl_ch;
+    uint8_t  pad3[3];
+    uint32_t reserved32;
+    uint8_t  flags;
+    uint8_t  reserved[3];
+    uint8_t  basic_mcs[16];
+    uint16_t ie_offset;
+    uint16_t pad4;
+    uint32_t ie_length;
+    int16_t  snr;
+} wl_bss_info_t;
+
+/* join iovar request (wl_extjoin_params_t): the join scan pinned to one BSS */
+typedef struct __attribute__((packed)) {
+    uint32_t ssid_len;
+    uint8_t  ssid[32];
+    /* Join scan */
+    int8_t   scan_type;     /* -1: firmware default, likewise the times */
+    uint8_t  pad0[3];
+    int32_t  nprobes;
+    int32_t  active_time;
+    int32_t  passive_time;
+    int32_t  home_time;
+    /* Association */
+    uint8_t  bssid[6];
+    uint16_t bssid_cnt;
+    int32_t  chanspec_num;
+    uint16_t chanspec_list[1];
+    uint16_t pad1;
+} wl_extjoin_params_t;
+
+/* WLC_REASSOC request (wl_reassoc_params_t): one BSS on one channel */
+typedef struct __attribute__((packed)) {
+    uint8_t  bssid[6];
+    uint16_t bssid_cnt;
+    int32_t  chanspec_num;
+    uint16_t chanspec_list[1];
+    uint16_t pad;
+} wl_reassoc_params_t;
+
+/* rssi_event iovar (wl_rssi_event_t): WLC_E_RSSI when a level is crossed */
+typedef struct __attribute__((packed)) {
+    uint32_t rate_limit_msec;   /* Least time between two events */
+    uint8_t  num_rssi_levels;
+    int8_t   rssi_levels[WL_RSSI_EVENT_MAX_LEVELS];    /* Ascending */
+    uint8_t  pad[3];
+} wl_rssi_event_t;
+
 /*============================================================================
  * SDIO Host Operations (Platform Specific)
  *============================================================================*/
 
+/* Gather segment for cmd53_write_sg */
+typedef struct {
+    const uint8_t *data;
+    uint32_t len;
+} sdio_sg_t;
+
 typedef struct {
     int (*init)(void);
     void (*deinit)(void);
@@ -129,14 +533,76 @@ typedef struct {
                       uint32_t len, bool incr_addr);
     int (*cmd53_write)(uint8_t func, uint32_t addr, const uint8_t *data,
                        uint32_t len, bool incr_addr);
+    /* Segments as one transfer (optional, data TX without copying) */
+    int (*cmd53_write_sg)(uint8_t func, uint32_t addr, const sdio_sg_t *sg,
+                          uint32_t count, bool incr_addr);
     int (*set_block_size)(uint8_t func, uint16_t block_size);
     int (*enable_func)(uint8_t func, bool enable);
     int (*enable_irq)(bool enable);
     bool (*irq_pending)(void);
     void (*delay_us)(uint32_t us);
     void (*delay_ms)(uint32_t ms);
+    /* Largest CMD53 transfer for a function in bytes (optional, no limit);
+     * longer transfers are split */
+    uint32_t (*max_xfer)(uint8_t func);
 } sdio_host_ops_t;
 
+/*============================================================================
+ * Data Path
+ *
+ * Received data frames are read straight into buffers owned by the network
+ * stack: once the SDPCM header shows a data frame, alloc() supplies room
+ * for the rest of it, and recv() hands the buffer over with the Ethernet
+ * frame at [off, off + len). recv() and free() take ownership; the driver
+ * never touches the buffer again. Callbacks run in the thread that polls
+ * the bus, with the bus lock held: they must not call back into the driver.
+ *============================================================================*/
+
+typedef struct {
+    /* Storage for len bytes, or NULL to drop the frame; *handle names it */
+    uint8_t *(*alloc)(void *ctx, uint32_t len, void **handle);
+
+    /* Received frame */
+    void (*recv)(void *ctx, void *handle, uint32_t off, uint32_t len,
+                 uint8_t prio, uint8_t ifidx);
+
+    /* Buffer that did not end up holding a frame */
+    void (*free)(void *ctx, void *handle);
+
+    void *ctx;
+} cyw_rx_ops_t;
+
+/*============================================================================
+ * Firmware Events
+ *
+ * Link changes, scan results, ... arrive as event frames on SDPCM channel
+ * 1. Handlers register for the WLC_E_* types they want; the union of all
+ * registrations is programmed into the firmware (event_msgs iovar), so
+ * other events never cross the bus. Each type has a bitmap of its
+ * handlers, so an event costs one table lookup. Handlers run like the
+ * data path callbacks: in the polling thread, with the bus lock held, and
+ * must not call back into the driver.
+ *============================================================================*/
+
+/* Event types handled: one bit each in the event_msgs mask */
+#define CYW_EVENT_MAX       (WL_EVENTING_MASK_LEN * 8)
+
+/* Event message, host byte order */
+typedef struct {
+    uint32_t type;              /* WLC_E_* */
+    uint32_t status;            /* WLC_E_STATUS_* */
+    uint32_t reason;
+    uint32_t auth_type;
+    uint16_t flags;             /* WLC_EVENT_MSG_* */
+    uint8_t addr[6];            /* Peer address */
+    uint8_t ifidx;
+    uint8_t bsscfgidx;
+} cyw_event_t;
+
+/* Event handler; the event data is borrowed for the call */
+typedef void (*cyw_event_cb_t)(void *ctx, const cyw_event_t *ev,
+                               const uint8_t *data, uint32_t len);
+
 /*============================================================================
  * Public API
  *============================================================================*/
@@ -151,18 +617,281 @@ cyw_err_t cyw_load_firmware(const uint8_t *fw_data, uint32_t fw_size,
 cyw_err_t cyw_up(void);
 cyw_err_t cyw_down(void);
 
+/**
+ * Send IOCTL command and wait for the response
+ *
+ * Requests from several threads are in flight together, each matched to
+ * its response by BCDC reqid in whichever thread reads it; frames read
+ * meanwhile take their normal paths. The bus lock is only held to send
+ * and receive. Buffers of up to CYW_IOCTL_MAX_LEN (iovar name included)
+ * go through the driver's IOCTL arena, so callers need little stack.
+ *
+ * @return CYW_OK on success, CYW_ERROR if the firmware refused it,
+ *         CYW_ERR_TIMEOUT, CYW_ERR_BUSY with all request slots taken, or
+ *         CYW_ERR_NOMEM beyond CYW_IOCTL_MAX_LEN
+ */
 cyw_err_t cyw_ioctl(uint32_t cmd, void *data, uint32_t len, bool set);
 cyw_err_t cyw_iovar(const char *name, void *data, uint32_t len, bool set);
 
+/*
+ * One setting of an IOCTL batch (cyw_ioctl_batch()): an IOCTL, or an
+ * iovar if name is set. GET results are written back to data.
+ */
+typedef struct {
+    uint32_t cmd;
+    const char *name;
+    void *data;
+    uint32_t len;
+    bool set;
+    cyw_err_t status;           /* Result; CYW_ERR_NOT_READY if never sent */
+} cyw_ioctl_op_t;
+
+#define CYW_IOCTL_SET(cmd, data, len)   { (cmd), NULL, (data), (len), true, CYW_OK }
+#define CYW_IOCTL_GET(cmd, data, len)   { (cmd), NULL, (data), (len), false, CYW_OK }
+#define CYW_IOVAR_SET(name, data, len)  { WLC_SET_VAR, (name), (data), (len), true, CYW_OK }
+#define CYW_IOVAR_GET(name, data, len)  { WLC_GET_VAR, (name), (data), (len), false, CYW_OK }
+
+/**
+ * Run a profile of IOCTLs and iovars, pipelined
+ *
+ * Up to CYW_IOCTL_PIPELINE requests of the calling thread are in flight
+ * at once, instead of one round trip per setting. After the first
+ * failure nothing more is sent; requests already in flight are still
+ * collected. Every op gets its status.
+ *
+ * @param ops Settings, in firmware order
+ * @param count Number of settings
+ * @return CYW_OK if all succeeded, else the status of the first failure
+ */
+cyw_err_t cyw_ioctl_batch(cyw_ioctl_op_t *ops, uint32_t count);
+
+/**
+ * Start a scan
+ *
+ * Returns once the firmware has taken the request. Results then arrive
+ * in the thread polling the bus: on_result for each BSS as it is heard,
+ * on_done at the end.
+ *
+ * @param params Channels, timing and callbacks (copied)
+ * @return CYW_OK, CYW_ERR_BUSY while a scan runs, CYW_ERR_INVALID for
+ *         too many channels, or the IOCTL error
+ */
+cyw_err_t cyw_scan_start(const cyw_scan_params_t *params);
+
+/**
+ * Abort the running scan; on_done gets CYW_ERR_BUSY before this returns
+ * @return CYW_OK, or the IOCTL error
+ */
+cyw_err_t cyw_scan_abort(void);
+
+/**
+ * Check whether a scan is running
+ * @return true between cyw_scan_start() and on_done
+ */
+bool cyw_scan_busy(void);
+
+/**
+ * Copy the BSS table, latest scan first, strongest first
+ * @param results Buffer for the entries
+ * @param max_results Buffer size in entries
+ * @return Number of entries copied
+ */
+int cyw_scan_results(cyw_scan_result_t *results, int max_results);
+
+/**
+ * Scan all channels and wait for the end (up to CYW_SCAN_TIMEOUT_MS),
+ * polling the bus meanwhile
+ * @param results Buffer for scan results, strongest first
+ * @param max_results Maximum number of results
+ * @return Number of networks found, or error
+ */
 int cyw_scan(cyw_scan_result_t *results, int max_results);
+
+/**
+ * Start (or restart) background scanning, driven by cyw_bgscan_poll()
+ * @param params Settings (NULL: all defaults), copied
+ * @return CYW_OK, CYW_ERR_INVALID for a bad channel list, or the IOCTL
+ *         error reading the valid channels
+ */
+cyw_err_t cyw_bgscan_start(const cyw_bgscan_params_t *params);
+
+/**
+ * Stop background scanning, aborting the slice running
+ */
+void cyw_bgscan_stop(void);
+
+/**
+ * Start the next background scan slice when due; call it from the bus
+ * polling thread. A foreground scan or a join takes precedence.
+ * @param tx_idle No frame waiting to be sent (otherwise the next slice
+ *                waits and the one running is aborted)
+ */
+void cyw_bgscan_poll(bool tx_idle);
+
+/**
+ * Connect to network
+ *
+ * The security profile goes out as one IOCTL batch, then the join;
+ * returns as soon as the firmware reports the outcome, at most
+ * CYW_CONNECT_TIMEOUT_MS later, polling the bus meanwhile. When the join
+ * cache holds this network, a directed join to its BSSID and channel goes
+ * first, without the full-band scan; the full join follows only if it
+ * fails.
+ *
+ * @param ssid SSID string
+ * @param passphrase WPA2 passphrase (NULL or "" for an open network)
+ * @return CYW_OK once associated, CYW_ERROR if the join failed,
+ *         CYW_ERR_TIMEOUT if the firmware gave no answer in time
+ */
 cyw_err_t cyw_connect(const char *ssid, const char *passphrase);
 cyw_err_t cyw_disconnect(void);
+
+/**
+ * Check if connected: the link state cached from firmware events, no
+ * bus access
+ */
 bool cyw_is_connected(void);
+
+/**
+ * Set the link change callback
+ * @param cb Callback (NULL for none)
+ * @param ctx Passed to the callback
+ */
+void cyw_set_link_callback(cyw_link_cb_t cb, void *ctx);
+
+/**
+ * Get the join cache (updated on every successful join)
+ * @param cache Pointer to store the entry
+ * @return CYW_OK, or CYW_ERROR if empty
+ */
+cyw_err_t cyw_get_join_cache(cyw_join_cache_t *cache);
+
+/**
+ * Set the join cache, e.g. restored after a power cycle
+ * @param cache Entry (NULL to clear)
+ */
+void cyw_set_join_cache(const cyw_join_cache_t *cache);
+
+/**
+ * Start (or restart) roaming, driven by cyw_roam_poll(): programs the
+ * firmware's roam trigger, delta and scan period, and RSSI events at the
+ * trigger; candidates from the BSS table need the join cache
+ * @param params Settings (NULL: all defaults), copied
+ * @return CYW_OK, CYW_ERR_NOT_READY before cyw_up(), or the IOCTL error
+ */
+cyw_err_t cyw_roam_start(const cyw_roam_params_t *params);
+
+/**
+ * Stop roaming, the firmware's included (roam_off)
+ * @return CYW_OK, or the IOCTL error
+ */
+cyw_err_t cyw_roam_stop(void);
+
+/**
+ * Refresh the RSSI after a new link and, below the trigger, reassociate
+ * to the best BSS table candidate; call it from the bus polling thread.
+ * A join takes precedence.
+ */
+void cyw_roam_poll(void);
+
+/**
+ * Get roaming statistics
+ * @param stats Pointer to store the counters
+ */
+void cyw_roam_get_stats(cyw_roam_stats_t *stats);
+
+/**
+ * Set power save
+ *
+ * The 802.11 mode goes to the firmware at once. With bus sleep, any bus
+ * access wakes the bus first, and cyw_rx_poll() reads the bus only when
+ * the host reports the interrupt pending.
+ *
+ * @param params Settings (NULL: all off), copied
+ * @return CYW_OK, CYW_ERR_NOT_READY before cyw_up() or bus sleep without
+ *         host irq_pending, CYW_ERR_INVALID for an unknown mode, or the
+ *         IOCTL error
+ */
+cyw_err_t cyw_set_power_save(const cyw_pm_params_t *params);
+
+/**
+ * Put the bus to sleep once it has been idle long enough; call it from
+ * the bus polling thread
+ * @param tx_idle Nothing is queued for transmission
+ */
+void cyw_pm_poll(bool tx_idle);
+
+/**
+ * Get power save statistics (bus sleeps, wake latencies)
+ * @param stats Pointer to store the counters
+ */
+void cyw_pm_get_stats(cyw_pm_stats_t *stats);
+
 int cyw_get_rssi(void);
 
 void cyw_poll(void);
 cyw_state_t cyw_get_state(void);
 
+/**
+ * Register an event handler
+ *
+ * Subscribes cb/ctx to the given types, on top of those it already has.
+ * The firmware's event mask follows the union of all subscriptions: it
+ * is updated at once while the interface is up, otherwise at cyw_up().
+ *
+ * @param events WLC_E_* types, each below CYW_EVENT_MAX
+ * @param count Number of types
+ * @param cb Handler
+ * @param ctx Passed to cb
+ * @return CYW_OK, CYW_ERR_INVALID for a bad type, CYW_ERR_NOMEM with
+ *         CYW_EVENT_HANDLERS handlers registered, or the IOCTL error
+ */
+cyw_err_t cyw_event_register(const uint16_t *events, uint32_t count,
+                             cyw_event_cb_t cb, void *ctx);
+
+/**
+ * Unregister an event handler from all its types
+ * @return CYW_OK, CYW_ERR_INVALID if cb/ctx is not registered, or the
+ *         IOCTL error
+ */
+cyw_err_t cyw_event_unregister(cyw_event_cb_t cb, void *ctx);
+
+/**
+ * Read and dispatch received frames
+ * @param budget Most frames to handle
+ * @return Frames handled (less than budget once the chip has no more)
+ */
+int cyw_rx_poll(int budget);
+
+/**
+ * Send an Ethernet frame gathered from segments
+ *
+ * Segments are sent in place when the host has cmd53_write_sg, otherwise
+ * copied into the TX buffer. They may be reused once this returns.
+ *
+ * @param ifidx Firmware interface index
+ * @param prio 802.1d priority
+ * @param sg Frame segments
+ * @param count Number of segments
+ * @return CYW_OK on success, CYW_ERR_BUSY without credit or while the
+ *         priority is flow controlled (retry after cyw_rx_poll())
+ */
+cyw_err_t cyw_tx_frame_sg(uint8_t ifidx, uint8_t prio,
+                          const sdio_sg_t *sg, uint32_t count);
+
+/**
+ * Set the RX buffer provider for data frames
+ * @param ops Provider (NULL: data frames are dropped)
+ */
+void cyw_set_rx_ops(const cyw_rx_ops_t *ops);
+
+/**
+ * Read the station MAC address from the firmware
+ * @param mac Buffer for 6 bytes
+ * @return CYW_OK on success
+ */
+cyw_err_t cyw_get_mac(uint8_t *mac);
+
 /*============================================================================
  * Low-level SDIO Access
  *============================================================================*/
@@ -0,0 +1,21 @@
+/**
+ * SDIO Host Operations of the Supported Boards
+ * sdio_rp2350.c (RP2350 bit-bang), sdio_litex.c (LiteX SDIO controller)
+ */
+
+#ifndef SDIO_HOST_H
+#define SDIO_HOST_H
+
+#include "cyw55500_sdio.h"
+
+/**
+ * Get the RP2350 SDIO operations structure
+ */
+const sdio_host_ops_t *rp2350_get_sdio_ops(void);
+
+/**
+ * Get the LiteX SDIO operations structure
+ */
+const sdio_host_ops_t *litex_get_sdio_ops(void);
+
+#endif /* SDIO_HOST_H */
@@ -0,0 +1,384 @@
+/**
+ * SDIO HAL for the LiteX SoC (Tang Primer 20K)
+ * Host operations on top of the Wishbone SDIO controller (litex/sdio_hal.h)
+ *
+ * The controller moves one data block per command: every CMD53 is sent in
+ * byte mode, at most 512 bytes and no more than the function's block size;
+ * the driver splits longer transfers at max_xfer.
+ * There is no host-wake line, and reading Int Pending through the CCCR is
+ * not verified yet: irq_pending stays unset and the driver reads the bus.
+ */
+
+#include <zephyr/kernel.h>
+#include <zephyr/devicetree.h>
+#include <zephyr/logging/log.h>
+#include <string.h>
+#include "sdio_hal.h"
+#include "cyw55500_sdio.h"
+#include "sdio_host.h"
+
+LOG_MODULE_REGISTER(sdio_litex, CONFIG_LOG_DEFAULT_LEVEL);
+
+/*============================================================================
+ * Configuration
+ *============================================================================*/
+
+#define SDIO_NODE           DT_NODELABEL(sdio0)
+
+/* Controller clock and SDIO clock after enumeration (board overlay) */
+#define LITEX_MAIN_CLK_HZ   DT_PROP_OR(SDIO_NODE, clock_frequency, 48000000)
+#define LITEX_SDIO_CLK_HZ   DT_PROP_OR(SDIO_NODE, max_frequency, 25000000)
+#define LITEX_INIT_CLK_HZ   400000
+
+/* One data block per command */
+#define LITEX_SDIO_MAX_XFER 512
+
+/*============================================================================
+ * SDIO State
+ *============================================================================*/
+
+static uint16_t rca;
+static uint16_t func_block_size[8];
+
+/* The controller buffer is word-wide: transfers are staged here */
+static uint32_t xfer_buf[LITEX_SDIO_MAX_XFER / 4];
+
+/*============================================================================
+ * Commands
+ *============================================================================*/
+
+static int send_command(uint8_t cmd, uint32_t arg, uint32_t *response)
+{
+    sdio_response_t resp;
+
+    if (sdio_send_cmd(cmd, arg, &resp) != SDIO_OK) {
+        return -1;
+    }
+    if (response) {
+        *response = resp.arg[0];
+    }
+    return 0;
+}
+
+/* R5 flags: COM_CRC_ERROR, ILLEGAL_COMMAND, ERROR, FUNCTION_NUMBER, OUT_OF_RANGE */
+static int check_r5(uint32_t response, const char *what)
+{
+    uint8_t flags = (response >> 8) & 0xFF;
+
+    if (flags & 0xCB) {
+        LOG_ERR("%s error: flags=0x%02x", what, flags);
+        return -1;
+    }
+    return 0;
+}
+
+/*============================================================================
+ * CMD52 - Single byte read/write
+ *============================================================================*/
+
+static int sdio_cmd52_read(uint8_t func, uint32_t addr, uint8_t *val)
+{
+    uint32_t arg = ((func & 0x7) << 28) | ((addr & 0x1FFFF) << 9);
+    uint32_t response;
+
+    if (send_command(SD_CMD52_IO_RW_DIRECT, arg, &response) < 0 ||
+        check_r5(response, "CMD52 read") < 0) {
+        return -1;
+    }
+
+    *val = response & 0xFF;
+    return 0;
+}
+
+static int sdio_cmd52_write(uint8_t func, uint32_t addr, uint8_t val)
+{
+    uint32_t arg = (1u << 31) | ((func & 0x7) << 28) |
+                   ((addr & 0x1FFFF) << 9) | val;
+    uint32_t response;
+
+    if (send_command(SD_CMD52_IO_RW_DIRECT, arg, &response) < 0) {
+        return -1;
+    }
+    return check_r5(response, "CMD52 write");
+}
+
+/*============================================================================
+ * CMD53 - Multi-byte read/write
+ *============================================================================*/
+
+static uint32_t sdio_max_xfer(uint8_t func)
+{
+    uint16_t bs = func_block_size[func & 0x7];
+
+    return (bs != 0 && bs < LITEX_SDIO_MAX_XFER) ? bs : LITEX_SDIO_MAX_XFER;
+}
+
+/* Byte-mode argument; lengths beyond one block are refused, not truncated */
+static int cmd53_arg(bool write, uint8_t func, uint32_t addr, uint32_t len,
+                     bool incr_addr, uint32_t *arg)
+{
+    if (len == 0 || len > sdio_max_xfer(func)) {
+        LOG_ERR("CMD53 length %u exceeds one block", len);
+        return -1;
+    }
+
+    *arg = (write ? (1u << 31) : 0) |
+           ((func & 0x7) << 28) |
+           (incr_addr ? (1 << 26) : 0) |
+           ((addr & 0x1FFFF) << 9) |
+           (len & 0x1FF);                  /* 0 means 512 */
+    return 0;
+}
+
+static int sdio_cmd53_read(uint8_t func, uint32_t addr, uint8_t *data,
+                           uint32_t len, bool incr_addr)
+{
+    sdio_response_t resp;
+    uint32_t arg;
+
+    if (cmd53_arg(false, func, addr, len, incr_addr, &arg) < 0) {
+        return -1;
+    }
+
+    if (sdio_send_cmd_with_data_read(SD_CMD53_IO_RW_EXTENDED, arg, xfer_buf,
+                                     len, &resp) != SDIO_OK ||
+        check_r5(resp.arg[0], "CMD53 read") < 0) {
+        return -1;
+    }
+
+    memcpy(data, xfer_buf, len);
+    return 0;
+}
+
+static int sdio_cmd53_write_sg(uint8_t func, uint32_t addr, const sdio_sg_t *sg,
+                               uint32_t nsg, bool incr_addr)
+{
+    uint8_t *p = (uint8_t *)xfer_buf;
+    sdio_response_t resp;
+    uint32_t len = 0;
+    uint32_t arg;
+
+    for (uint32_t i = 0; i < nsg; i++) {
+        len += sg[i].len;
+    }
+    if (cmd53_arg(true, func, addr, len, incr_addr, &arg) < 0) {
+        return -1;
+    }
+
+    /* Segments back to back, the last word padded with zeros */
+    xfer_buf[(len - 1) / 4] = 0;
+    for (uint32_t i = 0; i < nsg; i++) {
+        memcpy(p, sg[i].data, sg[i].len);
+        p += sg[i].len;
+    }
+
+    if (sdio_send_cmd_with_data_write(SD_CMD53_IO_RW_EXTENDED, arg, xfer_buf,
+                                      len, &resp) != SDIO_OK) {
+        return -1;
+    }
+    return check_r5(resp.arg[0], "CMD53 write");
+}
+
+static int sdio_cmd53_write(uint8_t func, uint32_t addr, const uint8_t *data,
+                            uint32_t len, bool incr_addr)
+{
+    sdio_sg_t sg = { .data = data, .len = len };
+
+    return sdio_cmd53_write_sg(func, addr, &sg, 1, incr_addr);
+}
+
+/*============================================================================
+ * Function Management
+ *============================================================================*/
+
+static int sdio_set_block_size(uint8_t func, uint16_t block_size)
+{
+    uint32_t addr = 0x10 + (func * 0x100);     /* FBR block size */
+    int ret;
+
+    if (func > 7) {
+        return -1;
+    }
+
+    ret = sdio_cmd52_write(0, addr, block_size & 0xFF);
+    if (ret < 0) return ret;
+
+    ret = sdio_cmd52_write(0, addr + 1, (block_size >> 8) & 0xFF);
+    if (ret < 0) return ret;
+
+    func_block_size[func] = block_size;
+    return 0;
+}
+
+static int sdio_enable_func(uint8_t func, bool enable)
+{
+    uint8_t val;
+    int ret;
+
+    ret = sdio_cmd52_read(0, 0x02, &val);      /* CCCR I/O Enable */
+    if (ret < 0) return ret;
+
+    if (enable) {
+        val |= (1 << func);
+    } else {
+        val &= ~(1 << func);
+    }
+
+    ret = sdio_cmd52_write(0, 0x02, val);
+    if (ret < 0 || !enable) {
+        return ret;
+    }
+
+    /* Wait for function ready */
+    for (int i = 0; i < 100; i++) {
+        ret = sdio_cmd52_read(0, 0x03, &val);
+        if (ret < 0) return ret;
+
+        if (val & (1 << func)) {
+            return 0;
+        }
+        k_msleep(10);
+    }
+
+    LOG_ERR("Function %d enable timeout", func);
+    return -1;
+}
+
+/*============================================================================
+ * Interrupts (CCCR, no host-wake line)
+ *============================================================================*/
+
+static int sdio_enable_irq(bool enable)
+{
+    uint8_t val;
+    int ret;
+
+    ret = sdio_cmd52_read(0, 0x04, &val);
+    if (ret < 0) return ret;
+
+    if (enable) {
+        val |= 0x03;  /* Master + Func1 */
+    } else {
+        val &= ~0x03;
+    }
+
+    return sdio_cmd52_write(0, 0x04, val);
+}
+
+/*============================================================================
+ * Delay functions
+ *============================================================================*/
+
+static void sdio_delay_us(uint32_t us)
+{
+    k_busy_wait(us);
+}
+
+static void sdio_delay_ms(uint32_t ms)
+{
+    k_msleep(ms);
+}
+
+/*============================================================================
+ * Card Initialization
+ *============================================================================*/
+
+static int sdio_card_init(void)
+{
+    uint32_t response;
+    uint32_t ocr;
+
+    /* CMD0 - Go Idle (no response) */
+    (void)send_command(SD_CMD0_GO_IDLE_STATE, 0, NULL);
+    k_msleep(10);
+
+    /* CMD5 - query, then repeat with the voltage window until ready */
+    if (send_command(SD_CMD5_IO_SEND_OP_COND, 0, &response) < 0) {
+        LOG_ERR("CMD5 failed - no SDIO card?");
+        return -1;
+    }
+
+    ocr = response & 0x00FFFFFF;
+    for (int i = 0; i < 100; i++) {
+        if (send_command(SD_CMD5_IO_SEND_OP_COND, ocr, &response) < 0) {
+            return -1;
+        }
+        if (response & 0x80000000) {
+            break;
+        }
+        k_msleep(10);
+    }
+    if (!(response & 0x80000000)) {
+        LOG_ERR("SDIO card not ready");
+        return -1;
+    }
+
+    /* CMD3 - Relative Address, CMD7 - Select */
+    if (send_command(SD_CMD3_SEND_RELATIVE_ADDR, 0, &response) < 0) {
+        LOG_ERR("CMD3 failed");
+        return -1;
+    }
+    rca = (response >> 16) & 0xFFFF;
+
+    if (send_command(SD_CMD7_SELECT_CARD, (uint32_t)rca << 16, &response) < 0) {
+        LOG_ERR("CMD7 failed");
+        return -1;
+    }
+
+    LOG_INF("Card selected, RCA 0x%04x", rca);
+    return 0;
+}
+
+/*============================================================================
+ * HAL Init/Deinit
+ *============================================================================*/
+
+static int sdio_litex_init(void)
+{
+    uint8_t bus_if;
+
+    memset(func_block_size, 0, sizeof(func_block_size));
+
+    sdio_init(LITEX_MAIN_CLK_HZ, LITEX_INIT_CLK_HZ);
+    if (sdio_card_init() < 0) {
+        return -1;
+    }
+
+    /* 4-bit bus, then full speed */
+    if (sdio_cmd52_read(0, 0x07, &bus_if) == 0) {
+        sdio_cmd52_write(0, 0x07, (bus_if & ~0x03) | 0x02);
+    }
+    sdio_set_clock_freq(LITEX_SDIO_CLK_HZ);
+
+    return 0;
+}
+
+static void sdio_litex_deinit(void)
+{
+    rca = 0;
+}
+
+/*============================================================================
+ * Public Interface
+ *============================================================================*/
+
+static const sdio_host_ops_t litex_sdio_ops = {
+    .init = sdio_litex_init,
+    .deinit = sdio_litex_deinit,
+    .cmd52_read = sdio_cmd52_read,
+    .cmd52_write = sdio_cmd52_write,
+    .cmd53_read = sdio_cmd53_read,
+    .cmd53_write = sdio_cmd53_write,
+    .cmd53_write_sg = sdio_cmd53_write_sg,
+    .set_block_size = sdio_set_block_size,
+    .enable_func = sdio_enable_func,
+    .enable_irq = sdio_enable_irq,
+    .delay_us = sdio_delay_us,
+    .delay_ms = sdio_delay_ms,
+    .max_xfer = sdio_max_xfer,
+};
+
+const sdio_host_ops_t *litex_get_sdio_ops(void)
+{
+    return &litex_sdio_ops;
+}
@@ -18,6 +18,7 @@
 #include <zephyr/drivers/gpio.h>
 #include <zephyr/logging/log.h>
 #include "cyw55500_sdio.h"
+#include "sdio_host.h"
 
 LOG_MODULE_REGISTER(sdio_rp2350, CONFIG_LOG_DEFAULT_LEVEL);
 
@@ -381,10 +382,16 @@ static int sdio_cmd53_read(uint8_t func, uint32_t addr, uint8_t *data,
     return 0;
 }
 
-static int sdio_cmd53_write(uint8_t func, uint32_t addr, const uint8_t *data,
-                            uint32_t len, bool incr_addr)
+static int sdio_cmd53_write_sg(uint8_t func, uint32_t addr, const sdio_sg_t *sg,
+                               uint32_t nsg, bool incr_addr)
 {
     bool block_mode = false;
+    uint32_t len = 0;
+
+    for (uint32_t i = 0; i < nsg; i++) {
+        len += sg[i].len;
+    }
+
     uint32_t count = len;
 
     if (func_block_size[func] > 0 && len >= func_block_size[func]) {
@@ -417,9 +424,11 @@ static int sdio_cmd53_write(uint8_t func, uint32_t addr, const uint8_t *data,
     gpio_pin_set(gpio_dev, PIN_D0, 0);
     clock_cycle();
 
-    /* Send data */
-    for (uint32_t i = 0; i < len; i++) {
-        send_data_byte(data[i]);
+    /* Send data, segment after segment in one data block */
+    for (uint32_t i = 0; i < nsg; i++) {
+        for (uint32_t j = 0; j < sg[i].len; j++) {
+            send_data_byte(sg[i].data[j]);
+        }
     }
 
     /* Send dummy CRC16 */
@@ -440,6 +449,14 @@ static int sdio_cmd53_write(uint8_t func, uint32_t addr, const uint8_t *data,
     return 0;
 }
 
+static int sdio_cmd53_write(uint8_t func, uint32_t addr, const uint8_t *data,
+                            uint32_t len, bool incr_addr)
+{
+    sdio_sg_t sg = { .data = data, .len = len };
+
+    return sdio_cmd53_write_sg(func, addr, &sg, 1, incr_addr);
+}
+
 /*============================================================================
  * Set Block Size
  *============================================================================*/
@@ -701,6 +718,7 @@ static const sdio_host_ops_t rp2350_sdio_ops = {
     .cmd52_write = sdio_cmd52_write,
     .cmd53_read = sdio_cmd53_read,
     .cmd53_write = sdio_cmd53_write,
+    .cmd53_write_sg = sdio_cmd53_write_sg,
     .set_block_size = sdio_set_block_size,
     .enable_func = sdio_enable_func,
     .enable_irq = sdio_enable_irq,
@@ -0,0 +1,42 @@
+/**
+ * lwIP Architecture - Bare-metal RISC-V (LiteX)
+ * Compiler and platform definitions for the lwIP port (cyw55500_lwip.c)
+ */
+
+#ifndef LWIP_ARCH_CC_H
+#define LWIP_ARCH_CC_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BYTE_ORDER                  LITTLE_ENDIAN
+
+/* Freestanding: no ctype.h, inttypes.h or errno.h */
+#define LWIP_NO_CTYPE_H             1
+#define LWIP_NO_INTTYPES_H          1
+#define LWIP_PROVIDE_ERRNO          1
+
+#define X8_F                        "02x"
+#define U16_F                       "u"
+#define S16_F                       "d"
+#define X16_F                       "x"
+#define U32_F                       "lu"
+#define S32_F                       "ld"
+#define X32_F                       "lx"
+#define SZT_F                       "u"
+
+/*
+ * Received IP headers are only 16-bit aligned (14-byte Ethernet header
+ * behind a word-aligned bus header): access protocol fields bytewise.
+ */
+#define PACK_STRUCT_STRUCT          __attribute__((packed))
+
+/* No console for lwIP: diagnostics are dropped, failed assertions halt */
+#define LWIP_PLATFORM_DIAG(x)       do { } while (0)
+#define LWIP_PLATFORM_ASSERT(x)     do { while (1) { } } while (0)
+
+/* Pseudo-random numbers (cyw55500_lwip.c) */
+uint32_t cyw_lwip_rand(void);
+#define LWIP_RAND()                 cyw_lwip_rand()
+
+#endif /* LWIP_ARCH_CC_H */
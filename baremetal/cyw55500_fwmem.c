@@ -0,0 +1,161 @@
+/**
+ * CYW55500 WiFi - Firmware Image Memory
+ * Ownership of the .firmware region: image store, then reclaimed RAM
+ */
+
+#include "baremetal.h"
+#include "cyw55500_fwmem.h"
+#include "cyw55500_priv.h"
+
+/* Region bounds from linker.ld */
+extern uint8_t _firmware_start[];
+extern uint8_t _firmware_end[];
+
+/*============================================================================
+ * Private Data
+ *============================================================================*/
+
+static struct {
+    cyw_fwmem_state_t state;
+
+    /* Resident images (valid while state == CYW_FWMEM_IMAGE) */
+    const uint8_t *fw;
+    uint32_t fw_len;
+    const uint8_t *nvram;
+    uint32_t nvram_len;
+
+    /* Warm re-download source */
+    cyw_fwmem_refetch_t refetch;
+    void *refetch_ctx;
+
+    /* Bump allocator over the released region */
+    uintptr_t next;
+} g_fwmem;
+
+/*============================================================================
+ * Helpers
+ *============================================================================*/
+
+static bool in_region(const uint8_t *p, uint32_t len)
+{
+    uintptr_t start = (uintptr_t)_firmware_start;
+    uintptr_t end = (uintptr_t)_firmware_end;
+
+    return (uintptr_t)p >= start && (uintptr_t)p <= end &&
+           len <= end - (uintptr_t)p;
+}
+
+/*============================================================================
+ * Public API
+ *============================================================================*/
+
+cyw_err_t cyw_fwmem_init(const uint8_t *fw, uint32_t fw_len,
+                         const uint8_t *nvram, uint32_t nvram_len)
+{
+    if (fw == NULL || !in_region(fw, fw_len) ||
+        (nvram != NULL && !in_region(nvram, nvram_len))) {
+        return CYW_ERR_INVALID;
+    }
+
+    memset(&g_fwmem, 0, sizeof(g_fwmem));
+    g_fwmem.state = CYW_FWMEM_IMAGE;
+    g_fwmem.fw = fw;
+    g_fwmem.fw_len = fw_len;
+    g_fwmem.nvram = nvram;
+    g_fwmem.nvram_len = nvram != NULL ? nvram_len : 0;
+
+    return CYW_OK;
+}
+
+void cyw_fwmem_set_refetch(cyw_fwmem_refetch_t fn, void *ctx)
+{
+    g_fwmem.refetch = fn;
+    g_fwmem.refetch_ctx = ctx;
+}
+
+cyw_err_t cyw_fwmem_load(void)
+{
+    cyw_fw_reader_t fw, nvram;
+    cyw_err_t err;
+
+    if (g_fwmem.state == CYW_FWMEM_IMAGE && g_fwmem.fw != NULL) {
+        return cyw_load_firmware(g_fwmem.fw, g_fwmem.fw_len,
+                                 g_fwmem.nvram, g_fwmem.nvram_len);
+    }
+
+    if (g_fwmem.refetch == NULL) {
+        ERR("Firmware image released and no refetch source");
+        return CYW_ERR_NOT_READY;
+    }
+
+    memset(&fw, 0, sizeof(fw));
+    memset(&nvram, 0, sizeof(nvram));
+
+    err = g_fwmem.refetch(g_fwmem.refetch_ctx, &fw, &nvram);
+    if (err != CYW_OK) return err;
+
+    DBG("Refetching firmware");
+    return cyw_load_firmware_stream(&fw,
+            (nvram.read || nvram.read_start) ? &nvram : NULL);
+}
+
+cyw_err_t cyw_fwmem_release(void)
+{
+    cyw_state_t state = cyw_get_state();
+
+    if (g_fwmem.state == CYW_FWMEM_RELEASED) {
+        return CYW_OK;
+    }
+
+    /* The chip must be running the downloaded image */
+    if (state != CYW_STATE_FW_READY && state != CYW_STATE_UP) {
+        return CYW_ERR_BUSY;
+    }
+
+    g_fwmem.state = CYW_FWMEM_RELEASED;
+    g_fwmem.fw = NULL;
+    g_fwmem.nvram = NULL;
+    g_fwmem.next = (uintptr_t)_firmware_start;
+
+    DBG("Reclaimed %u bytes of firmware image memory", cyw_fwmem_avail());
+
+    return CYW_OK;
+}
+
+void *cyw_fwmem_alloc(uint32_t size, uint32_t align)
+{
+    uintptr_t p;
+
+    if (g_fwmem.state != CYW_FWMEM_RELEASED) {
+        return NULL;
+    }
+
+    if (align == 0) {
+        align = 4;
+    }
+    if (align & (align - 1)) {
+        return NULL;
+    }
+
+    p = ALIGN(g_fwmem.next, (uintptr_t)align);
+    if (p > (uintptr_t)_firmware_end || size > (uintptr_t)_firmware_end - p) {
+        return NULL;
+    }
+
+    g_fwmem.next = p + size;
+    return (void *)p;
+}
+
+uint32_t cyw_fwmem_avail(void)
+{
+    if (g_fwmem.state != CYW_FWMEM_RELEASED) {
+        return 0;
+    }
+
+    return (uintptr_t)_firmware_end - g_fwmem.next;
+}
+
+cyw_fwmem_state_t cyw_fwmem_state(void)
+{
+    return g_fwmem.state;
+}
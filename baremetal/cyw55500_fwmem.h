@@ -0,0 +1,95 @@
+/**
+ * CYW55500 WiFi - Firmware Image Memory
+ * Ownership of the .firmware region: image store, then reclaimed RAM
+ */
+
+#ifndef CYW55500_FWMEM_H
+#define CYW55500_FWMEM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cyw55500_sdio.h"
+
+/*============================================================================
+ * Region Ownership
+ *============================================================================*/
+
+/*
+ * The embedded images live in the .firmware section (main_ram, see
+ * linker.ld). The region has exactly one owner at a time:
+ *
+ *   CYW_FWMEM_IMAGE     holds the firmware/NVRAM images (after boot)
+ *   CYW_FWMEM_RELEASED  images dropped after a successful download; the
+ *                       memory is handed out by cyw_fwmem_alloc()
+ *
+ * There is no way back: once released, a warm re-download must come from
+ * the refetch hook (SPI flash, a compressed copy in ROM, ...).
+ */
+typedef enum {
+    CYW_FWMEM_IMAGE = 0,
+    CYW_FWMEM_RELEASED,
+} cyw_fwmem_state_t;
+
+/**
+ * Refetch hook: open fresh readers for a warm re-download
+ * @param ctx User context
+ * @param fw Firmware reader to fill in
+ * @param nvram NVRAM reader to fill in (leave read/read_start NULL to skip)
+ * @return CYW_OK on success
+ */
+typedef cyw_err_t (*cyw_fwmem_refetch_t)(void *ctx, cyw_fw_reader_t *fw,
+                                         cyw_fw_reader_t *nvram);
+
+/**
+ * Register the images held in the .firmware region
+ * @param fw Firmware image (inside the region)
+ * @param fw_len Firmware image size
+ * @param nvram NVRAM image (inside the region, may be NULL)
+ * @param nvram_len NVRAM image size
+ * @return CYW_OK, CYW_ERR_INVALID if an image lies outside the region
+ */
+cyw_err_t cyw_fwmem_init(const uint8_t *fw, uint32_t fw_len,
+                         const uint8_t *nvram, uint32_t nvram_len);
+
+/**
+ * Set the source used for downloads after the region is released
+ * @param fn Refetch hook (NULL to clear)
+ * @param ctx Passed to fn
+ */
+void cyw_fwmem_set_refetch(cyw_fwmem_refetch_t fn, void *ctx);
+
+/**
+ * Download firmware from the resident images, or via the refetch hook
+ * once the region has been released
+ * @return CYW_OK on success, CYW_ERR_NOT_READY if no source is left
+ */
+cyw_err_t cyw_fwmem_load(void);
+
+/**
+ * Drop the images and hand the region over to cyw_fwmem_alloc()
+ *
+ * Only allowed after a successful download (driver in FW_READY or UP).
+ *
+ * @return CYW_OK on success, CYW_ERR_BUSY if the firmware is not running
+ */
+cyw_err_t cyw_fwmem_release(void);
+
+/**
+ * Carve memory out of the released region (no free)
+ * @param size Bytes
+ * @param align Alignment, power of two (0 = 4)
+ * @return Pointer, or NULL if not released / exhausted
+ */
+void *cyw_fwmem_alloc(uint32_t size, uint32_t align);
+
+/**
+ * Bytes still available to cyw_fwmem_alloc()
+ */
+uint32_t cyw_fwmem_avail(void);
+
+/**
+ * Current owner of the region
+ */
+cyw_fwmem_state_t cyw_fwmem_state(void);
+
+#endif /* CYW55500_FWMEM_H */
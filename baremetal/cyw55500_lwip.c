@@ -0,0 +1,342 @@
+/**
+ * CYW55500 WiFi - lwIP Network Interface
+ * NO_SYS netif on top of the driver data path, without copying frames
+ */
+
+#include "baremetal.h"
+#include "lwip/init.h"
+#include "lwip/pbuf.h"
+#include "lwip/stats.h"
+#include "lwip/sys.h"
+#include "lwip/timeouts.h"
+#include "lwip/etharp.h"
+#include "netif/ethernet.h"
+#include "cyw55500_lwip.h"
+
+/* Bus headers and their alignment pad go in front of every TX frame */
+_Static_assert(PBUF_LINK_ENCAPSULATION_HLEN >= CYW_PKT_DATA_HEADROOM + 3,
+               "PBUF_LINK_ENCAPSULATION_HLEN too small for the bus headers");
+
+/*============================================================================
+ * Private Data
+ *============================================================================*/
+
+/* Received frame lent to lwIP: a custom pbuf holding a driver packet */
+typedef struct cyw_rx_pbuf {
+    struct pbuf_custom pc;          /* Must be first */
+    cyw_pkt_t *pkt;
+    struct cyw_rx_pbuf *next;       /* Free list */
+} cyw_rx_pbuf_t;
+
+static struct {
+    uint32_t (*time_us)(void);
+    uint32_t last_us;
+    uint32_t ms;
+    uint32_t rem_us;
+    uint32_t rand;
+
+    cyw_rx_pbuf_t rx_pbufs[CYW_LWIP_RX_PBUFS];
+    cyw_rx_pbuf_t *rx_free;
+
+    cyw_lwip_stats_t stats;
+} g_lwip;
+
+/*============================================================================
+ * System Hooks (NO_SYS)
+ *============================================================================*/
+
+/*
+ * Millisecond clock from the 32-bit microsecond counter, carried across
+ * its wrap; lwIP reads it at least once per poll.
+ */
+u32_t sys_now(void)
+{
+    uint32_t now, us;
+
+    if (g_lwip.time_us == NULL) {
+        return 0;
+    }
+
+    now = g_lwip.time_us();
+    us = now - g_lwip.last_us + g_lwip.rem_us;
+    g_lwip.last_us = now;
+    g_lwip.ms += us / 1000;
+    g_lwip.rem_us = us % 1000;
+
+    return g_lwip.ms;
+}
+
+/* xorshift32 for DHCP transaction IDs, TCP ports and sequence numbers */
+uint32_t cyw_lwip_rand(void)
+{
+    uint32_t x = g_lwip.rand;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    g_lwip.rand = x;
+    return x;
+}
+
+/*============================================================================
+ * Receive
+ *============================================================================*/
+
+static void rx_pbuf_free(struct pbuf *p)
+{
+    cyw_rx_pbuf_t *rp = (cyw_rx_pbuf_t *)p;
+
+    cyw_pkt_free(rp->pkt);
+    rp->pkt = NULL;
+    rp->next = g_lwip.rx_free;
+    g_lwip.rx_free = rp;
+}
+
+/*
+ * Lend the frame to lwIP as a custom pbuf over the driver buffer. Frames
+ * are copied instead when wrappers run out or lwIP already holds all
+ * but CYW_LWIP_RX_RESERVE RX buffers, so the bus never starves.
+ */
+static struct pbuf *rx_wrap(cyw_pkt_t *pkt)
+{
+    cyw_rx_pbuf_t *rp = g_lwip.rx_free;
+    struct pbuf *p;
+
+    if (rp != NULL && cyw_pkt_rx_avail() >= CYW_LWIP_RX_RESERVE) {
+        rp->pc.custom_free_function = rx_pbuf_free;
+        p = pbuf_alloced_custom(PBUF_RAW, pkt->len, PBUF_REF, &rp->pc,
+                                cyw_pkt_data(pkt), pkt->len);
+        if (p != NULL) {
+            g_lwip.rx_free = rp->next;
+            rp->pkt = cyw_pkt_ref(pkt);
+            return p;
+        }
+    }
+
+    p = pbuf_alloc(PBUF_RAW, pkt->len, PBUF_POOL);
+    if (p != NULL) {
+        pbuf_take(p, cyw_pkt_data(pkt), pkt->len);
+        g_lwip.stats.rx_copied++;
+    }
+    return p;
+}
+
+/*
+ * Driver receive callback (from cyw_poll())
+ */
+static void rx_frame(void *ctx, cyw_pkt_t *pkt)
+{
+    struct netif *netif = ctx;
+    struct pbuf *p = rx_wrap(pkt);
+
+    if (p == NULL) {
+        g_lwip.stats.rx_drop++;
+        LINK_STATS_INC(link.memerr);
+        LINK_STATS_INC(link.drop);
+        return;
+    }
+
+    g_lwip.stats.rx_frames++;
+    LINK_STATS_INC(link.recv);
+
+    if (netif->input(p, netif) != ERR_OK) {
+        pbuf_free(p);
+    }
+}
+
+/*============================================================================
+ * Link
+ *============================================================================*/
+
+/*
+ * Driver link callback (from cyw_poll()): lwIP sees the firmware link
+ * state, so DHCP renews and ARP restarts after a reassociation
+ */
+static void link_changed(void *ctx, bool up, uint32_t reason)
+{
+    struct netif *netif = ctx;
+
+    (void)reason;
+
+    if (up) {
+        netif_set_link_up(netif);
+    } else {
+        netif_set_link_down(netif);
+    }
+}
+
+/*============================================================================
+ * Transmit
+ *============================================================================*/
+
+static void tx_release(void *ctx)
+{
+    pbuf_free((struct pbuf *)ctx);
+}
+
+/*
+ * 802.1d priority from the IP precedence bits, so the frame lands in the
+ * matching WMM queue
+ */
+static uint8_t tx_prio(const struct pbuf *p)
+{
+    const uint8_t *eth = p->payload;
+
+    if (p->len < SIZEOF_ETH_HDR + 2) {
+        return 0;
+    }
+    if (eth[12] == 0x08 && eth[13] == 0x00) {
+        return eth[15] >> 5;                    /* IPv4 TOS */
+    }
+    if (eth[12] == 0x86 && eth[13] == 0xDD) {
+        return (eth[14] >> 1) & 7;              /* IPv6 traffic class */
+    }
+    return 0;
+}
+
+/*
+ * Describe the chain in place: the first pbuf with the bus headers in its
+ * headroom, the others as gathered segments. The chain is referenced
+ * until the driver is done with it. NULL if the first pbuf has no
+ * headroom (PBUF_REF/ROM) or descriptors run out.
+ */
+static cyw_pkt_t *tx_wrap(struct pbuf *p)
+{
+    uint32_t head = CYW_PKT_DATA_HEADROOM + ((uintptr_t)p->payload & 3);
+    cyw_pkt_t *pkt;
+
+    if (pbuf_clen(p) > CYW_TX_MAX_FRAGS || pbuf_add_header(p, head) != 0) {
+        return NULL;
+    }
+    pbuf_remove_header(p, head);
+
+    pkt = cyw_pkt_wrap((uint8_t *)p->payload - head, head, p->len, tx_release, p);
+    if (pkt == NULL) {
+        return NULL;
+    }
+    pbuf_ref(p);
+
+    for (struct pbuf *q = p->next; q != NULL; q = q->next) {
+        cyw_pkt_t *seg;
+
+        if (q->len == 0) {
+            continue;
+        }
+        seg = cyw_pkt_wrap(q->payload, 0, q->len, NULL, NULL);
+        if (seg == NULL) {
+            cyw_pkt_free(pkt);
+            return NULL;
+        }
+        cyw_pkt_append(pkt, seg);
+    }
+
+    return pkt;
+}
+
+static err_t tx_linkoutput(struct netif *netif, struct pbuf *p)
+{
+    cyw_pkt_t *pkt;
+    cyw_err_t err;
+
+    (void)netif;
+
+    pkt = tx_wrap(p);
+    if (pkt == NULL) {
+        pkt = cyw_pkt_alloc(CYW_PKT_DATA_HEADROOM, p->tot_len);
+        if (pkt == NULL) {
+            g_lwip.stats.tx_drop++;
+            LINK_STATS_INC(link.memerr);
+            LINK_STATS_INC(link.drop);
+            return ERR_MEM;
+        }
+        pbuf_copy_partial(p, cyw_pkt_data(pkt), p->tot_len, 0);
+        g_lwip.stats.tx_copied++;
+    }
+
+    pkt->prio = tx_prio(p);
+    pkt->ifidx = 0;
+
+    err = cyw_tx_ethernet(pkt);
+    if (err != CYW_OK) {
+        g_lwip.stats.tx_drop++;
+        LINK_STATS_INC(link.drop);
+        return (err == CYW_ERR_NOMEM) ? ERR_MEM : ERR_IF;
+    }
+
+    g_lwip.stats.tx_frames++;
+    LINK_STATS_INC(link.xmit);
+    return ERR_OK;
+}
+
+/*============================================================================
+ * Public API
+ *============================================================================*/
+
+void cyw_lwip_init(uint32_t (*time_us)(void))
+{
+    memset(&g_lwip, 0, sizeof(g_lwip));
+
+    g_lwip.time_us = time_us;
+    if (time_us != NULL) {
+        g_lwip.last_us = time_us();
+    }
+    g_lwip.rand = 0x2545F491u ^ g_lwip.last_us;
+
+    for (uint32_t i = 0; i < CYW_LWIP_RX_PBUFS; i++) {
+        g_lwip.rx_pbufs[i].next = g_lwip.rx_free;
+        g_lwip.rx_free = &g_lwip.rx_pbufs[i];
+    }
+
+    lwip_init();
+}
+
+err_t cyw_lwip_netif_init(struct netif *netif)
+{
+    if (cyw_iovar("cur_etheraddr", netif->hwaddr, ETH_HWADDR_LEN, false) != CYW_OK) {
+        return ERR_IF;
+    }
+    netif->hwaddr_len = ETH_HWADDR_LEN;
+
+    /* No two boards share a MAC: make it part of the random seed */
+    for (uint32_t i = 0; i < ETH_HWADDR_LEN; i++) {
+        g_lwip.rand = (g_lwip.rand << 5) ^ (g_lwip.rand >> 27) ^ netif->hwaddr[i];
+    }
+    if (g_lwip.rand == 0) {
+        g_lwip.rand = 1;
+    }
+
+    netif->name[0] = 'w';
+    netif->name[1] = 'l';
+    netif->mtu = 1500;
+    netif->flags = NETIF_FLAG_BROADCAST | NETIF_FLAG_ETHARP |
+                   NETIF_FLAG_ETHERNET | NETIF_FLAG_IGMP;
+    netif->output = etharp_output;
+    netif->linkoutput = tx_linkoutput;
+
+    cyw_set_rx_callback(rx_frame, netif);
+    cyw_set_link_callback(link_changed, netif);
+    if (cyw_is_connected()) {
+        netif_set_link_up(netif);
+    }
+    return ERR_OK;
+}
+
+void cyw_lwip_poll(void)
+{
+    /* Keep reading while frames come in, within the budget */
+    for (uint32_t i = 0; i < CYW_LWIP_RX_BUDGET; i++) {
+        uint32_t before = g_lwip.stats.rx_frames + g_lwip.stats.rx_drop;
+
+        cyw_poll();
+        if (g_lwip.stats.rx_frames + g_lwip.stats.rx_drop == before) {
+            break;
+        }
+    }
+
+    sys_check_timeouts();
+}
+
+void cyw_lwip_get_stats(cyw_lwip_stats_t *stats)
+{
+    *stats = g_lwip.stats;
+}
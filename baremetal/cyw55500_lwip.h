@@ -0,0 +1,102 @@
+/**
+ * CYW55500 WiFi - lwIP Network Interface
+ * NO_SYS netif on top of the driver data path, without copying frames
+ */
+
+#ifndef CYW55500_LWIP_H
+#define CYW55500_LWIP_H
+
+#include <stdint.h>
+#include "lwip/netif.h"
+#include "cyw55500_sdio.h"
+
+/*============================================================================
+ * Configuration
+ *============================================================================*/
+
+/* Received frames lwIP may hold without copying (one pbuf wrapper each) */
+#ifndef CYW_LWIP_RX_PBUFS
+#define CYW_LWIP_RX_PBUFS           (CYW_PKT_RX_COUNT + CYW_PKT_CLONE_COUNT)
+#endif
+
+/*
+ * RX buffers kept free for the bus: once lwIP holds more (TCP receive and
+ * out-of-order queues), frames are copied into PBUF_POOL instead and the
+ * driver buffer is released at once.
+ */
+#ifndef CYW_LWIP_RX_RESERVE
+#define CYW_LWIP_RX_RESERVE         1
+#endif
+
+/* Most driver polls per cyw_lwip_poll() while frames keep arriving */
+#ifndef CYW_LWIP_RX_BUDGET
+#define CYW_LWIP_RX_BUDGET          8
+#endif
+
+/*============================================================================
+ * Statistics
+ *============================================================================*/
+
+typedef struct {
+    uint32_t rx_frames;         /* Frames passed to lwIP */
+    uint32_t rx_copied;         /* ... copied for lack of wrappers/buffers */
+    uint32_t rx_drop;           /* No pbuf */
+    uint32_t tx_frames;         /* Frames queued on the bus */
+    uint32_t tx_copied;         /* ... copied for lack of headroom/descriptors */
+    uint32_t tx_drop;           /* Refused by the driver */
+} cyw_lwip_stats_t;
+
+/*============================================================================
+ * Public API
+ *
+ * Bring-up, after cyw_up():
+ *
+ *   cyw_lwip_init(ops->get_time_us);
+ *   netif_add(&netif, IP4_ADDR_ANY4, IP4_ADDR_ANY4, IP4_ADDR_ANY4, NULL,
+ *             cyw_lwip_netif_init, netif_input);
+ *   netif_set_default(&netif);
+ *   netif_set_up(&netif);
+ *
+ *   dhcp_start(&netif);
+ *
+ * The link goes up and down with the firmware link events (association,
+ * deauthentication), so DHCP may be started right away; a roam keeps it
+ * up. Then call cyw_lwip_poll() from the main loop, never from an
+ * interrupt: it runs the receive path and the lwIP timers.
+ *
+ * TX frames are sent from lwIP's pbufs in place: the bus headers go into
+ * PBUF_LINK_ENCAPSULATION_HLEN, further pbufs of a chain are gathered, and
+ * the chain is referenced until it has left the bus (TCP does not touch
+ * segments still held by the driver). RX frames are handed to lwIP as
+ * custom pbufs pointing into the driver's RX buffers.
+ *============================================================================*/
+
+/**
+ * Initialize lwIP and the port
+ * @param time_us Free-running microsecond counter (e.g. host get_time_us)
+ */
+void cyw_lwip_init(uint32_t (*time_us)(void));
+
+/**
+ * Network interface init, for netif_add()
+ *
+ * Reads the MAC address from the firmware and attaches the receive path
+ * and the link state.
+ *
+ * @param netif Interface being added
+ * @return ERR_OK, or ERR_IF if the firmware does not answer
+ */
+err_t cyw_lwip_netif_init(struct netif *netif);
+
+/**
+ * Receive pending frames, send queued ones, run lwIP timers
+ */
+void cyw_lwip_poll(void);
+
+/**
+ * Get port statistics
+ * @param stats Pointer to store the counters
+ */
+void cyw_lwip_get_stats(cyw_lwip_stats_t *stats);
+
+#endif /* CYW55500_LWIP_H */
@@ -0,0 +1,215 @@
+/**
+ * CYW55500 WiFi - Compressed Image Support
+ * Block-framed LZ4 decoder, no heap, one block of scratch
+ */
+
+#include "baremetal.h"
+#include "cyw55500_lz4.h"
+
+/*============================================================================
+ * Helpers
+ *============================================================================*/
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*============================================================================
+ * Raw LZ4 Block
+ *============================================================================*/
+
+int cyw_lz4_decompress_block(const uint8_t *src, uint32_t src_len,
+                             uint8_t *dst, uint32_t dst_cap)
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + src_len;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + dst_cap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        uint32_t len;
+
+        /* Literals */
+        len = token >> 4;
+        if (len == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        if ((uint32_t)(iend - ip) < len || (uint32_t)(oend - op) < len) {
+            return -1;
+        }
+        memcpy(op, ip, len);
+        ip += len;
+        op += len;
+
+        /* Last sequence has no match part */
+        if (ip >= iend) {
+            break;
+        }
+
+        /* Match */
+        if (iend - ip < 2) return -1;
+        uint32_t offset = ip[0] | (ip[1] << 8);
+        ip += 2;
+        if (offset == 0 || offset > (uint32_t)(op - dst)) {
+            return -1;
+        }
+
+        len = (token & 0x0F) + 4;
+        if ((token & 0x0F) == 15) {
+            uint8_t b;
+            do {
+                if (ip >= iend) return -1;
+                b = *ip++;
+                len += b;
+            } while (b == 255);
+        }
+        if ((uint32_t)(oend - op) < len) {
+            return -1;
+        }
+
+        /* Byte copy: source and destination may overlap */
+        const uint8_t *match = op - offset;
+        while (len--) {
+            *op++ = *match++;
+        }
+    }
+
+    return (int)(op - dst);
+}
+
+/*============================================================================
+ * CYZ1 Container
+ *============================================================================*/
+
+bool cyw_lz4_is_frame(const uint8_t *data, uint32_t len)
+{
+    return data != NULL && len >= CYW_LZ4_HDR_SIZE &&
+           get_le32(data) == CYW_LZ4_MAGIC;
+}
+
+cyw_err_t cyw_lz4_stream_init(cyw_lz4_stream_t *s, const uint8_t *src, uint32_t len)
+{
+    if (s == NULL || !cyw_lz4_is_frame(src, len)) {
+        return CYW_ERR_INVALID;
+    }
+
+    s->src = src;
+    s->src_len = len;
+    s->pos = CYW_LZ4_HDR_SIZE;
+    s->raw_size = get_le32(src + 4);
+    s->block_size = get_le32(src + 8);
+    s->produced = 0;
+
+    if (s->block_size == 0 || (s->block_size & 3)) {
+        return CYW_ERR_INVALID;
+    }
+
+    return CYW_OK;
+}
+
+cyw_err_t cyw_lz4_stream_next(cyw_lz4_stream_t *s, uint8_t *scratch,
+                              uint32_t scratch_len, const uint8_t **out,
+                              uint32_t *out_len)
+{
+    uint32_t expect, hdr, plen;
+
+    *out_len = 0;
+    *out = NULL;
+
+    if (s->produced >= s->raw_size) {
+        return CYW_OK;
+    }
+
+    expect = s->raw_size - s->produced;
+    if (expect > s->block_size) {
+        expect = s->block_size;
+    }
+
+    if (s->src_len - s->pos < 4) {
+        return CYW_ERR_INVALID;
+    }
+    hdr = get_le32(s->src + s->pos);
+    s->pos += 4;
+
+    plen = hdr & CYW_LZ4_BLOCK_LEN_MASK;
+    if (s->src_len - s->pos < plen) {
+        return CYW_ERR_INVALID;
+    }
+
+    if (hdr & CYW_LZ4_BLOCK_STORED) {
+        if (plen != expect) {
+            return CYW_ERR_INVALID;
+        }
+        *out = s->src + s->pos;
+    } else {
+        if (scratch_len < expect) {
+            return CYW_ERR_NOMEM;
+        }
+        int n = cyw_lz4_decompress_block(s->src + s->pos, plen, scratch, expect);
+        if (n < 0 || (uint32_t)n != expect) {
+            return CYW_ERR_INVALID;
+        }
+        *out = scratch;
+    }
+
+    s->pos += ALIGN(plen, 4);
+    if (s->pos > s->src_len) {
+        s->pos = s->src_len;
+    }
+    s->produced += expect;
+    *out_len = expect;
+
+    return CYW_OK;
+}
+
+/*============================================================================
+ * Stream Reader Adapter
+ *============================================================================*/
+
+static int lz4_reader_read(void *ctx, uint8_t *buf, uint32_t len)
+{
+    cyw_lz4_stream_t *s = ctx;
+    const uint8_t *block;
+    uint32_t n;
+
+    if (cyw_lz4_stream_next(s, buf, len, &block, &n) != CYW_OK) {
+        return -1;
+    }
+
+    /* Stored blocks come back in place */
+    if (n > 0 && block != buf) {
+        memcpy(buf, block, n);
+    }
+
+    return (int)n;
+}
+
+cyw_err_t cyw_lz4_reader_init(cyw_lz4_stream_t *s, const uint8_t *src,
+                              uint32_t len, cyw_fw_reader_t *rd)
+{
+    cyw_err_t err;
+
+    if (rd == NULL) {
+        return CYW_ERR_INVALID;
+    }
+
+    err = cyw_lz4_stream_init(s, src, len);
+    if (err != CYW_OK) return err;
+
+    if (s->block_size > CYW_FW_CHUNK_SIZE) {
+        return CYW_ERR_NOMEM;
+    }
+
+    memset(rd, 0, sizeof(*rd));
+    rd->read = lz4_reader_read;
+    rd->ctx = s;
+
+    return CYW_OK;
+}
@@ -0,0 +1,91 @@
+/**
+ * CYW55500 WiFi - Compressed Image Support
+ * Block-framed LZ4 container produced by tools/lz4pack.py
+ */
+
+#ifndef CYW55500_LZ4_H
+#define CYW55500_LZ4_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cyw55500_sdio.h"
+
+/*============================================================================
+ * Container Format
+ *============================================================================*/
+
+#define CYW_LZ4_MAGIC               0x315A5943  /* "CYZ1" */
+#define CYW_LZ4_HDR_SIZE            16
+#define CYW_LZ4_BLOCK_STORED        0x80000000
+#define CYW_LZ4_BLOCK_LEN_MASK      0x7FFFFFFF
+
+/*============================================================================
+ * Stream Decoder
+ *============================================================================*/
+
+typedef struct {
+    const uint8_t *src;
+    uint32_t src_len;
+    uint32_t pos;           /* Read position in src */
+    uint32_t raw_size;      /* Decompressed image size */
+    uint32_t block_size;    /* Decompressed bytes per block */
+    uint32_t produced;      /* Decompressed bytes returned so far */
+} cyw_lz4_stream_t;
+
+/**
+ * Check whether a buffer holds a CYZ1 container
+ * @param data Image data
+ * @param len Image size
+ * @return true if the header magic matches
+ */
+bool cyw_lz4_is_frame(const uint8_t *data, uint32_t len);
+
+/**
+ * Open a CYZ1 container for block-by-block decoding
+ * @param s Stream state
+ * @param src Container data (4-byte aligned)
+ * @param len Container size
+ * @return CYW_OK on success, CYW_ERR_INVALID on a malformed header
+ */
+cyw_err_t cyw_lz4_stream_init(cyw_lz4_stream_t *s, const uint8_t *src, uint32_t len);
+
+/**
+ * Decode the next block
+ *
+ * Stored blocks are returned in place (pointing into the container),
+ * compressed blocks are decoded into the scratch buffer.
+ *
+ * @param s Stream state
+ * @param scratch Scratch buffer, at least s->block_size bytes
+ * @param scratch_len Scratch buffer size
+ * @param out Returns pointer to the decoded block
+ * @param out_len Returns decoded block size (0 at end of stream)
+ * @return CYW_OK on success
+ */
+cyw_err_t cyw_lz4_stream_next(cyw_lz4_stream_t *s, uint8_t *scratch,
+                              uint32_t scratch_len, const uint8_t **out,
+                              uint32_t *out_len);
+
+/**
+ * Wrap a CYZ1 container as a cyw_load_firmware_stream() reader
+ *
+ * Blocks are decoded directly into the loader's chunk buffers, so
+ * s->block_size must not exceed CYW_FW_CHUNK_SIZE.
+ *
+ * @param s Stream state (must outlive the download)
+ * @param src Container data, e.g. memory-mapped flash
+ * @param len Container size
+ * @param rd Reader to fill in
+ * @return CYW_OK on success
+ */
+cyw_err_t cyw_lz4_reader_init(cyw_lz4_stream_t *s, const uint8_t *src,
+                              uint32_t len, cyw_fw_reader_t *rd);
+
+/**
+ * Decompress one raw LZ4 block
+ * @return Decompressed size, or -1 on corrupt input / output overflow
+ */
+int cyw_lz4_decompress_block(const uint8_t *src, uint32_t src_len,
+                             uint8_t *dst, uint32_t dst_cap);
+
+#endif /* CYW55500_LZ4_H */
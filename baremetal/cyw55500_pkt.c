@@ -0,0 +1,189 @@
+/**
+ * CYW55500 WiFi - Packet Buffers
+ * Fixed-size buffer pools with header room for in-place framing
+ */
+
+#include "baremetal.h"
+#include "cyw55500_pkt.h"
+#include "cyw55500_regs.h"
+
+/* Descriptor and buffer share one slot: [cyw_pkt_t | pad | buffer] */
+#define PKT_DESC_SIZE       ALIGN(sizeof(cyw_pkt_t), 8)
+
+/*============================================================================
+ * Pool API
+ *============================================================================*/
+
+void cyw_pkt_pool_init(cyw_pkt_pool_t *pool, uint16_t buf_size)
+{
+    memset(pool, 0, sizeof(*pool));
+    pool->buf_size = ALIGN(buf_size, 4);
+}
+
+uint32_t cyw_pkt_pool_add(cyw_pkt_pool_t *pool, void *mem, uint32_t len)
+{
+    uintptr_t p = ALIGN((uintptr_t)mem, 8);
+    uintptr_t end = (uintptr_t)mem + len;
+    uint32_t slot = CYW_PKT_SLOT_SIZE(pool->buf_size);
+    uint32_t added = 0;
+
+    if (mem == NULL) {
+        return 0;
+    }
+
+    while (p <= end && end - p >= slot) {
+        cyw_pkt_t *pkt = (cyw_pkt_t *)p;
+
+        memset(pkt, 0, sizeof(*pkt));
+        pkt->pool = pool;
+        pkt->buf = pool->buf_size ? (uint8_t *)p + PKT_DESC_SIZE : NULL;
+        pkt->cap = pool->buf_size;
+        pkt->next = pool->free;
+        pool->free = pkt;
+
+        p += slot;
+        added++;
+    }
+
+    pool->count += added;
+    pool->nfree += added;
+    pool->min_free = pool->nfree;
+
+    return added;
+}
+
+cyw_pkt_t *cyw_pkt_pool_get(cyw_pkt_pool_t *pool, uint32_t headroom, uint32_t len)
+{
+    cyw_pkt_t *pkt = pool->free;
+
+    if (pkt == NULL || headroom + len > pool->buf_size) {
+        pool->alloc_fail++;
+        return NULL;
+    }
+
+    pool->free = pkt->next;
+    pool->nfree--;
+    if (pool->nfree < pool->min_free) {
+        pool->min_free = pool->nfree;
+    }
+
+    pkt->next = NULL;
+    pkt->parent = NULL;
+    pkt->frag = NULL;
+    pkt->release = NULL;
+    pkt->head = headroom;
+    pkt->len = len;
+    pkt->channel = 0;
+    pkt->prio = 0;
+    pkt->ifidx = 0;
+    pkt->refcnt = 1;
+
+    return pkt;
+}
+
+cyw_pkt_t *cyw_pkt_clone(cyw_pkt_pool_t *pool, cyw_pkt_t *parent,
+                         uint32_t off, uint32_t len)
+{
+    cyw_pkt_t *pkt = pool->free;
+
+    if (pkt == NULL || off > parent->cap || len > parent->cap - off) {
+        pool->alloc_fail++;
+        return NULL;
+    }
+
+    pool->free = pkt->next;
+    pool->nfree--;
+    if (pool->nfree < pool->min_free) {
+        pool->min_free = pool->nfree;
+    }
+
+    pkt->next = NULL;
+    pkt->parent = cyw_pkt_ref(parent);
+    pkt->frag = NULL;
+    pkt->release = NULL;
+    pkt->buf = parent->buf + off;
+    pkt->cap = len;
+    pkt->head = 0;
+    pkt->len = len;
+    pkt->channel = parent->channel;
+    pkt->prio = parent->prio;
+    pkt->ifidx = parent->ifidx;
+    pkt->refcnt = 1;
+
+    return pkt;
+}
+
+cyw_pkt_t *cyw_pkt_pool_wrap(cyw_pkt_pool_t *pool, void *data, uint32_t headroom,
+                             uint32_t len, cyw_pkt_release_t release, void *ctx)
+{
+    cyw_pkt_t *pkt = pool->free;
+
+    if (pkt == NULL || headroom + len > 0xFFFF) {
+        pool->alloc_fail++;
+        return NULL;
+    }
+
+    pool->free = pkt->next;
+    pool->nfree--;
+    if (pool->nfree < pool->min_free) {
+        pool->min_free = pool->nfree;
+    }
+
+    pkt->next = NULL;
+    pkt->parent = NULL;
+    pkt->frag = NULL;
+    pkt->release = release;
+    pkt->release_ctx = ctx;
+    pkt->buf = data;
+    pkt->cap = headroom + len;
+    pkt->head = headroom;
+    pkt->len = len;
+    pkt->channel = 0;
+    pkt->prio = 0;
+    pkt->ifidx = 0;
+    pkt->refcnt = 1;
+
+    return pkt;
+}
+
+cyw_pkt_t *cyw_pkt_ref(cyw_pkt_t *pkt)
+{
+    pkt->refcnt++;
+    return pkt;
+}
+
+void cyw_pkt_free(cyw_pkt_t *pkt)
+{
+    while (pkt != NULL && --pkt->refcnt == 0) {
+        cyw_pkt_pool_t *pool = pkt->pool;
+        cyw_pkt_t *parent = pkt->parent;
+        cyw_pkt_t *frag = pkt->frag;
+
+        /* Wrapped storage goes back to its owner */
+        if (pkt->release) {
+            pkt->release(pkt->release_ctx);
+            pkt->release = NULL;
+        }
+
+        pkt->parent = NULL;
+        pkt->frag = NULL;
+        pkt->next = pool->free;
+        pool->free = pkt;
+        pool->nfree++;
+
+        /* Clone gone: release the buffer it pointed into */
+        if (parent) {
+            cyw_pkt_free(parent);
+        }
+
+        pkt = frag;
+    }
+}
+
+void cyw_pkt_append(cyw_pkt_t *pkt, cyw_pkt_t *seg)
+{
+    while (pkt->frag != NULL) {
+        pkt = pkt->frag;
+    }
+    pkt->frag = seg;
+}
@@ -0,0 +1,313 @@
+/**
+ * CYW55500 WiFi - Packet Buffers
+ * Fixed-size buffer pools with header room for in-place framing
+ */
+
+#ifndef CYW55500_PKT_H
+#define CYW55500_PKT_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*============================================================================
+ * Configuration
+ *============================================================================*/
+
+/* Bytes per buffer, headroom included */
+#ifndef CYW_PKT_BUF_SIZE
+#define CYW_PKT_BUF_SIZE            2048
+#endif
+
+/* Statically allocated TX buffers (more via cyw_pkt_pool_add()) */
+#ifndef CYW_PKT_TX_COUNT
+#define CYW_PKT_TX_COUNT            4
+#endif
+
+/* Statically allocated RX buffers: frames in flight at once */
+#ifndef CYW_PKT_RX_COUNT
+#define CYW_PKT_RX_COUNT            4
+#endif
+
+/* Descriptor-only packets for views into another buffer (RX glom) */
+#ifndef CYW_PKT_CLONE_COUNT
+#define CYW_PKT_CLONE_COUNT         16
+#endif
+
+/* Descriptor-only packets wrapping external TX storage (cyw_pkt_wrap()) */
+#ifndef CYW_PKT_WRAP_COUNT
+#define CYW_PKT_WRAP_COUNT          16
+#endif
+
+/*============================================================================
+ * Packet Buffer
+ *
+ * Payload lives at buf[head .. head + len). Space in front of it is
+ * headroom for protocol headers, pushed with cyw_pkt_push_hdr() so a
+ * frame is built in place and sent without copying.
+ *
+ * Received frames are handed out the same way: head/len describe the
+ * payload inside the bus buffer. Packets are reference counted; whoever
+ * needs a packet beyond a callback takes a reference with cyw_pkt_ref()
+ * and drops it with cyw_pkt_free().
+ *
+ * A clone is a descriptor without storage of its own: it describes a slice
+ * of its parent's buffer and holds a reference on the parent until freed.
+ * A wrapped packet describes storage owned by someone else (e.g. an IP
+ * stack buffer), which is handed back through its release hook.
+ *
+ * A TX frame may be gathered from several packets chained through frag:
+ * the first carries the headroom, the rest only payload. The chain is
+ * freed with its first packet.
+ *============================================================================*/
+
+struct cyw_pkt_pool;
+
+/* Called once the last reference to a wrapped packet is gone */
+typedef void (*cyw_pkt_release_t)(void *ctx);
+
+typedef struct cyw_pkt {
+    struct cyw_pkt *next;           /* Queue link (owner's use) */
+    struct cyw_pkt_pool *pool;      /* Pool to return to */
+    struct cyw_pkt *parent;         /* Buffer owner (clones only) */
+    struct cyw_pkt *frag;           /* Next segment of the frame (TX gather) */
+    cyw_pkt_release_t release;      /* Storage owner (wrapped packets only) */
+    void *release_ctx;
+    uint8_t *buf;                   /* Storage (4-byte aligned) */
+    uint16_t cap;                   /* Storage size */
+    uint16_t head;                  /* Offset of first valid byte */
+    uint16_t len;                   /* Valid bytes */
+    uint8_t channel;                /* SDPCM channel */
+    uint8_t prio;                   /* 802.1d priority */
+    uint8_t ifidx;                  /* Firmware interface (data frames) */
+    uint8_t refcnt;
+} cyw_pkt_t;
+
+/* Memory needed per buffer (descriptor + storage), for sizing pool blocks */
+#define CYW_PKT_SLOT_SIZE(buf_size) \
+    (((sizeof(cyw_pkt_t) + 7) & ~7u) + (((buf_size) + 7) & ~7u))
+
+/* FIFO of packets linked through next */
+typedef struct {
+    cyw_pkt_t *head;
+    cyw_pkt_t *tail;
+    uint16_t count;
+} cyw_pkt_queue_t;
+
+typedef struct cyw_pkt_pool {
+    cyw_pkt_t *free;                /* Free list */
+    uint16_t buf_size;
+    uint16_t count;                 /* Buffers owned by the pool */
+    uint16_t nfree;
+    uint16_t min_free;              /* Low-water mark */
+    uint32_t alloc_fail;
+} cyw_pkt_pool_t;
+
+/*============================================================================
+ * Pool API
+ *============================================================================*/
+
+/**
+ * Initialize an empty pool
+ * @param pool Pool
+ * @param buf_size Bytes per buffer (0 for a clone descriptor pool)
+ */
+void cyw_pkt_pool_init(cyw_pkt_pool_t *pool, uint16_t buf_size);
+
+/**
+ * Add buffers carved from a memory block (e.g. cyw_fwmem_alloc())
+ * @param pool Pool
+ * @param mem Memory block, owned by the pool from now on
+ * @param len Block size
+ * @return Number of buffers added
+ */
+uint32_t cyw_pkt_pool_add(cyw_pkt_pool_t *pool, void *mem, uint32_t len);
+
+/**
+ * Take a buffer from a pool
+ * @param pool Pool
+ * @param headroom Bytes reserved in front of the payload
+ * @param len Payload length
+ * @return Packet, or NULL if the pool is empty or the request too large
+ */
+cyw_pkt_t *cyw_pkt_pool_get(cyw_pkt_pool_t *pool, uint32_t headroom, uint32_t len);
+
+/**
+ * Describe a slice of another packet's buffer without copying
+ * @param pool Clone descriptor pool (buf_size 0)
+ * @param parent Packet owning the storage; gains a reference
+ * @param off Offset of the slice in parent->buf
+ * @param len Slice length
+ * @return Clone, or NULL if no descriptor is free or the slice is out of range
+ */
+cyw_pkt_t *cyw_pkt_clone(cyw_pkt_pool_t *pool, cyw_pkt_t *parent,
+                         uint32_t off, uint32_t len);
+
+/**
+ * Describe storage owned by someone else without copying
+ * @param pool Descriptor pool (buf_size 0)
+ * @param data Start of the storage, headroom included
+ * @param headroom Bytes in front of the payload free for headers
+ * @param len Payload length
+ * @param release Called with ctx once the last reference is dropped (may be NULL)
+ * @param ctx Passed to release
+ * @return Packet, or NULL if no descriptor is free
+ */
+cyw_pkt_t *cyw_pkt_pool_wrap(cyw_pkt_pool_t *pool, void *data, uint32_t headroom,
+                             uint32_t len, cyw_pkt_release_t release, void *ctx);
+
+/**
+ * Take an additional reference
+ * @return pkt
+ */
+cyw_pkt_t *cyw_pkt_ref(cyw_pkt_t *pkt);
+
+/**
+ * Drop a reference; the last one returns the packet (and its frag chain)
+ * to its pool
+ */
+void cyw_pkt_free(cyw_pkt_t *pkt);
+
+/**
+ * Chain a segment behind the last one of a frame; the frame takes over
+ * the caller's reference to seg
+ */
+void cyw_pkt_append(cyw_pkt_t *pkt, cyw_pkt_t *seg);
+
+/*============================================================================
+ * Buffer Manipulation
+ *============================================================================*/
+
+static inline uint8_t *cyw_pkt_data(const cyw_pkt_t *pkt)
+{
+    return pkt->buf + pkt->head;
+}
+
+static inline uint32_t cyw_pkt_headroom(const cyw_pkt_t *pkt)
+{
+    return pkt->head;
+}
+
+static inline uint32_t cyw_pkt_tailroom(const cyw_pkt_t *pkt)
+{
+    return pkt->cap - pkt->head - pkt->len;
+}
+
+/* Frame length over the whole frag chain */
+static inline uint32_t cyw_pkt_frame_len(const cyw_pkt_t *pkt)
+{
+    uint32_t len = 0;
+
+    for (; pkt != NULL; pkt = pkt->frag) {
+        len += pkt->len;
+    }
+    return len;
+}
+
+/* Packets in the frag chain, this one included */
+static inline uint32_t cyw_pkt_segs(const cyw_pkt_t *pkt)
+{
+    uint32_t n = 0;
+
+    for (; pkt != NULL; pkt = pkt->frag) {
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Prepend a header in the headroom
+ * @return Pointer to the n header bytes, or NULL if headroom is short
+ */
+static inline void *cyw_pkt_push_hdr(cyw_pkt_t *pkt, uint32_t n)
+{
+    if (n > pkt->head) {
+        return NULL;
+    }
+    pkt->head -= n;
+    pkt->len += n;
+    return pkt->buf + pkt->head;
+}
+
+/**
+ * Strip a header from the front
+ * @return Pointer to the stripped bytes, or NULL if the packet is shorter
+ */
+static inline void *cyw_pkt_pull_hdr(cyw_pkt_t *pkt, uint32_t n)
+{
+    uint8_t *p = pkt->buf + pkt->head;
+
+    if (n > pkt->len) {
+        return NULL;
+    }
+    pkt->head += n;
+    pkt->len -= n;
+    return p;
+}
+
+/*============================================================================
+ * Packet Queue
+ *============================================================================*/
+
+static inline void cyw_pkt_queue_push(cyw_pkt_queue_t *q, cyw_pkt_t *pkt)
+{
+    pkt->next = NULL;
+    if (q->tail) {
+        q->tail->next = pkt;
+    } else {
+        q->head = pkt;
+    }
+    q->tail = pkt;
+    q->count++;
+}
+
+static inline void cyw_pkt_queue_push_front(cyw_pkt_queue_t *q, cyw_pkt_t *pkt)
+{
+    pkt->next = q->head;
+    q->head = pkt;
+    if (q->tail == NULL) {
+        q->tail = pkt;
+    }
+    q->count++;
+}
+
+/**
+ * Unlink a packet from anywhere in the queue
+ * @return true if it was queued
+ */
+static inline bool cyw_pkt_queue_remove(cyw_pkt_queue_t *q, cyw_pkt_t *pkt)
+{
+    cyw_pkt_t **pp = &q->head, *prev = NULL;
+
+    while (*pp != NULL && *pp != pkt) {
+        prev = *pp;
+        pp = &(*pp)->next;
+    }
+    if (*pp == NULL) {
+        return false;
+    }
+
+    *pp = pkt->next;
+    if (q->tail == pkt) {
+        q->tail = prev;
+    }
+    pkt->next = NULL;
+    q->count--;
+    return true;
+}
+
+static inline cyw_pkt_t *cyw_pkt_queue_pop(cyw_pkt_queue_t *q)
+{
+    cyw_pkt_t *pkt = q->head;
+
+    if (pkt) {
+        q->head = pkt->next;
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+        pkt->next = NULL;
+        q->count--;
+    }
+    return pkt;
+}
+
+#endif /* CYW55500_PKT_H */
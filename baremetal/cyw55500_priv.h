@@ -0,0 +1,26 @@
+/**
+ * CYW55500 WiFi - Driver Internals
+ * Shared between the driver modules, not part of the public API
+ */
+
+#ifndef CYW55500_PRIV_H
+#define CYW55500_PRIV_H
+
+/*============================================================================
+ * Debug Macros (implement as needed)
+ *============================================================================*/
+
+#ifndef CYW_DEBUG
+#define CYW_DEBUG 1
+#endif
+
+#if CYW_DEBUG
+extern int printf(const char *fmt, ...);
+#define DBG(fmt, ...)   printf("[CYW] " fmt "\n", ##__VA_ARGS__)
+#define ERR(fmt, ...)   printf("[CYW ERR] " fmt "\n", ##__VA_ARGS__)
+#else
+#define DBG(fmt, ...)
+#define ERR(fmt, ...)
+#endif
+
+#endif /* CYW55500_PRIV_H */
@@ -5,6 +5,9 @@
 
 #include "baremetal.h"
 #include "cyw55500_sdio.h"
+#include "cyw55500_priv.h"
+#include "cyw55500_lz4.h"
+#include "cyw55500_trx.h"
 
 /*============================================================================
  * Private Data
@@ -12,21 +15,32 @@
 
 static cyw_dev_t g_cyw_dev;
 
-/*============================================================================
- * Debug Macros (implement as needed)
- *============================================================================*/
+/* Static TX/RX buffers; large, so kept in main_ram (see linker.ld) */
+static uint8_t g_tx_pool_mem[CYW_PKT_TX_COUNT * CYW_PKT_SLOT_SIZE(CYW_PKT_BUF_SIZE)]
+    __attribute__((section(".pktbuf"), aligned(8)));
+static uint8_t g_rx_pool_mem[CYW_PKT_RX_COUNT * CYW_PKT_SLOT_SIZE(CYW_PKT_BUF_SIZE)]
+    __attribute__((section(".pktbuf"), aligned(8)));
+static uint8_t g_rx_clone_mem[CYW_PKT_CLONE_COUNT * CYW_PKT_SLOT_SIZE(0)]
+    __attribute__((section(".pktbuf"), aligned(8)));
+static uint8_t g_tx_wrap_mem[CYW_PKT_WRAP_COUNT * CYW_PKT_SLOT_SIZE(0)]
+    __attribute__((section(".pktbuf"), aligned(8)));
 
-#ifndef CYW_DEBUG
-#define CYW_DEBUG 1
-#endif
+/* Users of the large-IOCTL arena (dev->ioctl_arena) */
+#define ARENA_TX                    0x01    /* Request being sent from it */
+#define ARENA_REQ                   0x02    /* Its request awaits the response */
+#define ARENA_RX                    0x04    /* Received frame held in it */
 
-#if CYW_DEBUG
-extern int printf(const char *fmt, ...);
-#define DBG(fmt, ...)   printf("[CYW] " fmt "\n", ##__VA_ARGS__)
-#define ERR(fmt, ...)   printf("[CYW ERR] " fmt "\n", ##__VA_ARGS__)
-#else
-#define DBG(fmt, ...)
-#define ERR(fmt, ...)
+/* Batch op status while its request is in flight: no cyw_err_t value */
+#define IOCTL_OP_INFLIGHT           ((cyw_err_t)1)
+
+#if CYW_IOCTL_MAX_LEN > 0
+/* Large-IOCTL arena: bus headers, the IOCTL buffer and word padding */
+#define IOCTL_ARENA_SIZE            ALIGN(CYW_PKT_HEADROOM + CYW_IOCTL_MAX_LEN + 4, 8)
+
+_Static_assert(IOCTL_ARENA_SIZE <= 0xFFFF, "CYW_IOCTL_MAX_LEN too large for a packet");
+
+static uint8_t g_ioctl_arena[IOCTL_ARENA_SIZE]
+    __attribute__((section(".pktbuf"), aligned(8)));
 #endif
 
 /*============================================================================
@@ -47,15 +61,45 @@ static inline void delay_ms(uint32_t ms)
     }
 }
 
+static inline uint32_t time_us(void)
+{
+    if (g_cyw_dev.ops && g_cyw_dev.ops->get_time_us) {
+        return g_cyw_dev.ops->get_time_us();
+    }
+    return 0;
+}
+
+/* Network byte order fields (event messages) */
+static inline uint16_t be16(uint16_t v)
+{
+    return __builtin_bswap16(v);
+}
+
+static inline uint32_t be32(uint32_t v)
+{
+    return __builtin_bswap32(v);
+}
+
 /*============================================================================
  * SDIO Low-level Access
  *============================================================================*/
 
+static cyw_err_t pm_wake(void);
+
+/* Every access marks the bus busy, and wakes it first if asleep */
+static inline cyw_err_t bus_wake(void)
+{
+    g_cyw_dev.bus_used = true;
+    return g_cyw_dev.bus_asleep ? pm_wake() : CYW_OK;
+}
+
 cyw_err_t cyw_sdio_read8(uint8_t func, uint32_t addr, uint8_t *val)
 {
     if (!g_cyw_dev.ops || !g_cyw_dev.ops->cmd52_read) {
         return CYW_ERR_INVALID;
     }
+    cyw_err_t err = bus_wake();
+    if (err != CYW_OK) return err;
     int ret = g_cyw_dev.ops->cmd52_read(func, addr, val);
     return (ret == 0) ? CYW_OK : CYW_ERR_IO;
 }
@@ -65,18 +109,45 @@ cyw_err_t cyw_sdio_write8(uint8_t func, uint32_t addr, uint8_t val)
     if (!g_cyw_dev.ops || !g_cyw_dev.ops->cmd52_write) {
         return CYW_ERR_INVALID;
     }
+    cyw_err_t err = bus_wake();
+    if (err != CYW_OK) return err;
     int ret = g_cyw_dev.ops->cmd52_write(func, addr, val);
     return (ret == 0) ? CYW_OK : CYW_ERR_IO;
 }
 
+/* Largest CMD53 the host can do for a function, 0 = no limit */
+static inline uint32_t xfer_max(uint8_t func)
+{
+    return g_cyw_dev.ops->max_xfer ? g_cyw_dev.ops->max_xfer(func) : 0;
+}
+
+/*
+ * Byte transfers are split into host-sized CMD53s. F1 addresses advance
+ * with the data; F2 is a FIFO and keeps its address.
+ */
 static cyw_err_t sdio_read_bytes(uint8_t func, uint32_t addr,
                                   uint8_t *data, uint32_t len, bool incr)
 {
     if (!g_cyw_dev.ops || !g_cyw_dev.ops->cmd53_read) {
         return CYW_ERR_INVALID;
     }
-    int ret = g_cyw_dev.ops->cmd53_read(func, addr, data, len, incr);
-    return (ret == 0) ? CYW_OK : CYW_ERR_IO;
+    cyw_err_t err = bus_wake();
+    if (err != CYW_OK) return err;
+
+    uint32_t max = xfer_max(func);
+    do {
+        uint32_t n = (max != 0) ? MIN(len, max) : len;
+
+        if (g_cyw_dev.ops->cmd53_read(func, addr, data, n, incr) != 0) {
+            return CYW_ERR_IO;
+        }
+        data += n;
+        len -= n;
+        if (incr && func != SDIO_FUNC_2) {
+            addr += n;
+        }
+    } while (len > 0);
+    return CYW_OK;
 }
 
 static cyw_err_t sdio_write_bytes(uint8_t func, uint32_t addr,
@@ -85,8 +156,69 @@ static cyw_err_t sdio_write_bytes(uint8_t func, uint32_t addr,
     if (!g_cyw_dev.ops || !g_cyw_dev.ops->cmd53_write) {
         return CYW_ERR_INVALID;
     }
-    int ret = g_cyw_dev.ops->cmd53_write(func, addr, data, len, incr);
-    return (ret == 0) ? CYW_OK : CYW_ERR_IO;
+    cyw_err_t err = bus_wake();
+    if (err != CYW_OK) return err;
+
+    uint32_t max = xfer_max(func);
+    do {
+        uint32_t n = (max != 0) ? MIN(len, max) : len;
+
+        if (g_cyw_dev.ops->cmd53_write(func, addr, data, n, incr) != 0) {
+            return CYW_ERR_IO;
+        }
+        data += n;
+        len -= n;
+        if (incr && func != SDIO_FUNC_2) {
+            addr += n;
+        }
+    } while (len > 0);
+    return CYW_OK;
+}
+
+/* Gathered write, split like sdio_write_bytes() */
+static cyw_err_t sdio_write_sg(uint8_t func, uint32_t addr,
+                               const sdio_sg_t *sg, uint32_t count, bool incr)
+{
+    if (!g_cyw_dev.ops || !g_cyw_dev.ops->cmd53_write_sg) {
+        return CYW_ERR_INVALID;
+    }
+    cyw_err_t err = bus_wake();
+    if (err != CYW_OK) return err;
+
+    uint32_t max = xfer_max(func);
+    if (max == 0) {
+        int ret = g_cyw_dev.ops->cmd53_write_sg(func, addr, sg, count, incr);
+        return (ret == 0) ? CYW_OK : CYW_ERR_IO;
+    }
+
+    sdio_sg_t part[CYW_TX_MAX_SEGS];
+    uint32_t i = 0, off = 0;
+
+    while (i < count) {
+        uint32_t n = 0, len = 0;
+
+        while (i < count && len < max && n < ARRAY_SIZE(part)) {
+            uint32_t take = MIN(sg[i].len - off, max - len);
+
+            part[n].data = sg[i].data + off;
+            part[n].len = take;
+            n++;
+            len += take;
+            off += take;
+            if (off == sg[i].len) {
+                i++;
+                off = 0;
+            }
+        }
+
+        if (g_cyw_dev.ops->cmd53_write_sg(func, addr, part, n, incr) != 0) {
+            return CYW_ERR_IO;
+        }
+        if (incr && func != SDIO_FUNC_2) {
+            addr += len;
+        }
+    }
+    return CYW_OK;
 }
 
 /*============================================================================
@@ -358,649 +490,3903 @@ static cyw_err_t reset_core(uint32_t core_base, uint32_t prereset, uint32_t rese
  * Firmware Download
  *============================================================================*/
 
-cyw_err_t cyw_load_firmware(const uint8_t *fw_data, uint32_t fw_size,
-                            const uint8_t *nvram_data, uint32_t nvram_size)
-{
-    cyw_dev_t *dev = &g_cyw_dev;
-    cyw_err_t err;
+/*
+ * Image sink: places file bytes in chip RAM. A plain image lands linearly
+ * at base. A TRX image is split into segments on the fly: container
+ * overhead is dropped, the CRC is accumulated and checked in sink_finish()
+ * before the ARM is released. The TRX header must arrive in the first chunk.
+ */
+typedef struct {
+    uint32_t file_off;
+    uint32_t len;
     uint32_t addr;
+} fw_seg_t;
+
+typedef struct {
+    uint32_t base;          /* Plain image: RAM address of file offset 0 */
+    uint32_t off;           /* File bytes consumed */
+    uint32_t tail;          /* Last 4 bytes written (NVRAM token check) */
+    bool allow_trx;
+    bool trx;
+    bool crc_checked;       /* CRC already verified up front */
+    uint32_t crc;
+    cyw_trx_info_t info;
+    fw_seg_t seg[2];
+    int nseg;
+} fw_sink_t;
+
+static void sink_init(fw_sink_t *sink, uint32_t base, bool allow_trx)
+{
+    memset(sink, 0, sizeof(*sink));
+    sink->base = base;
+    sink->allow_trx = allow_trx;
+    sink->crc = 0xFFFFFFFF;
+}
 
-    if (dev->state < CYW_STATE_INIT) {
-        return CYW_ERR_NOT_READY;
+static uint32_t trx_secure_hdr_len(void)
+{
+    return g_cyw_dev.chip.chip_rev == 0 ? CYW55500_TRXHDR_SIZE
+                                        : CYW55500_A1_TRXHDR_SIZE;
+}
+
+/*
+ * The signed header block is verified by the bootloader in place, right
+ * below the TCAM boundary; the RAM image starts on the boundary itself.
+ */
+static void trx_layout(fw_sink_t *sink)
+{
+    const cyw_trx_info_t *trx = &sink->info;
+    uint32_t body_addr = sink->base;
+
+    sink->nseg = 0;
+
+    if (trx->hdr_needed) {
+        body_addr += g_cyw_dev.chip.chip_rev == 0 ? CYW55500_TCAM_SIZE
+                                                  : CYW55500_A1_TCAM_SIZE;
+        sink->seg[sink->nseg].file_off = 0;
+        sink->seg[sink->nseg].len = trx->hdr_len;
+        sink->seg[sink->nseg].addr = body_addr - trx->hdr_len;
+        sink->nseg++;
     }
 
-    dev->state = CYW_STATE_FW_LOADING;
-    DBG("Loading firmware (%u bytes)...", fw_size);
+    sink->seg[sink->nseg].file_off = trx->body_off;
+    sink->seg[sink->nseg].len = trx->body_len;
+    sink->seg[sink->nseg].addr = body_addr;
+    sink->nseg++;
+}
 
-    /* Halt ARM core */
-    err = cyw_sdio_write32(dev->core_arm.base + ARMCR4_BANKIDX, 0);
-    if (err != CYW_OK) goto error;
+/* Parse and CRC-check a memory-resident TRX image. No bus traffic. */
+static cyw_err_t sink_check_trx(fw_sink_t *sink, const uint8_t *data, uint32_t size)
+{
+    cyw_err_t err;
 
-    /* Download firmware to RAM */
-    addr = dev->chip.ram_base;
-    err = cyw_backplane_write(addr, fw_data, fw_size);
+    err = cyw_trx_parse(data, size, size, trx_secure_hdr_len(), &sink->info);
     if (err != CYW_OK) {
-        ERR("Firmware download failed");
-        goto error;
+        ERR("Bad TRX header");
+        return err;
     }
 
-    DBG("Firmware downloaded");
+    err = cyw_trx_verify(&sink->info, data);
+    if (err != CYW_OK) {
+        ERR("TRX CRC mismatch");
+        return err;
+    }
 
-    /* Download NVRAM */
-    if (nvram_data && nvram_size > 0) {
-        /* NVRAM goes at end of RAM */
-        /* Calculate proper NVRAM location based on RAM size */
-        addr = NVRAM_DL_ADDR;
-        err = cyw_backplane_write(addr, nvram_data, nvram_size);
-        if (err != CYW_OK) {
-            ERR("NVRAM download failed");
-            goto error;
-        }
+    sink->trx = true;
+    sink->crc_checked = true;
+    trx_layout(sink);
 
-        /* Write NVRAM size at end */
-        uint32_t nvram_sz_words = nvram_size / 4;
-        nvram_sz_words = (~nvram_sz_words << 16) | nvram_sz_words;
-        addr += nvram_size;
-        err = cyw_sdio_write32(addr, nvram_sz_words);
-        if (err != CYW_OK) goto error;
+    DBG("TRX v%u: %u byte image, %u byte header%s, %u byte trailer",
+        sink->info.version, sink->info.body_len, sink->info.hdr_len,
+        sink->info.hdr_needed ? "" : " (skipped)", sink->info.trailer_len);
 
-        DBG("NVRAM downloaded (%u bytes)", nvram_size);
-    }
+    return CYW_OK;
+}
 
-    /* Release ARM core */
-    err = reset_core(dev->core_arm.base, 0, 0);
-    if (err != CYW_OK) goto error;
+static cyw_err_t sink_write(fw_sink_t *sink, const uint8_t *data, uint32_t len)
+{
+    uint32_t start = sink->off;
+    uint32_t end = start + len;
+    cyw_err_t err;
 
-    /* Wait for firmware ready */
-    int timeout = 200;
-    while (timeout-- > 0) {
-        uint8_t val;
-        err = cyw_sdio_read8(SDIO_FUNC_1, SBSDIO_FUNC1_CHIPCLKCSR, &val);
-        if (err == CYW_OK && (val & SBSDIO_HT_AVAIL)) {
-            break;
+    if (start == 0 && sink->allow_trx && !sink->trx &&
+        cyw_trx_is_image(data, len)) {
+        err = cyw_trx_parse(data, len, 0, trx_secure_hdr_len(), &sink->info);
+        if (err != CYW_OK) {
+            ERR("Bad TRX header");
+            return err;
         }
-        delay_ms(10);
+        sink->trx = true;
+        trx_layout(sink);
     }
 
-    if (timeout <= 0) {
-        ERR("Firmware start timeout");
-        err = CYW_ERR_TIMEOUT;
-        goto error;
+    sink->off = end;
+
+    for (uint32_t i = len > 4 ? len - 4 : 0; i < len; i++) {
+        sink->tail = (sink->tail >> 8) | ((uint32_t)data[i] << 24);
     }
 
-    /* Check for firmware ready in mailbox */
-    uint32_t mbox;
-    timeout = 100;
-    while (timeout-- > 0) {
-        err = cyw_sdio_read32(SDIO_CORE_TOHOSTMAILBOXDATA, &mbox);
-        if (err != CYW_OK) goto error;
+    if (!sink->trx) {
+        return cyw_backplane_write(sink->base + start, data, len);
+    }
 
-        if (mbox & HMB_DATA_FWREADY) {
-            DBG("Firmware ready!");
-            dev->state = CYW_STATE_FW_READY;
-            return CYW_OK;
+    /* CRC over [TRX_CRC_START, len) of the container */
+    if (!sink->crc_checked) {
+        uint32_t lo = MAX(start, TRX_CRC_START);
+        uint32_t hi = MIN(end, sink->info.len);
+        if (lo < hi) {
+            sink->crc = cyw_crc32(sink->crc, data + (lo - start), hi - lo);
         }
-        delay_ms(10);
     }
 
-    ERR("Firmware not ready");
-    err = CYW_ERR_FW;
+    for (int i = 0; i < sink->nseg; i++) {
+        const fw_seg_t *seg = &sink->seg[i];
+        uint32_t lo = MAX(start, seg->file_off);
+        uint32_t hi = MIN(end, seg->file_off + seg->len);
 
-error:
-    dev->state = CYW_STATE_ERROR;
-    return err;
-}
+        if (lo < hi) {
+            err = cyw_backplane_write(seg->addr + (lo - seg->file_off),
+                                      data + (lo - start), hi - lo);
+            if (err != CYW_OK) return err;
+        }
+    }
 
-/*============================================================================
- * SDPCM Frame Handling
- *============================================================================*/
+    return CYW_OK;
+}
 
-static cyw_err_t send_sdpcm_frame(uint8_t channel, const uint8_t *data, uint32_t len)
+static cyw_err_t sink_finish(fw_sink_t *sink)
 {
-    cyw_dev_t *dev = &g_cyw_dev;
-    sdpcm_header_t *hdr = (sdpcm_header_t *)dev->tx_buf;
-    uint32_t total_len;
-
-    /* Build SDPCM header */
-    total_len = SDPCM_HEADER_SIZE + len;
-    memset(hdr, 0, SDPCM_HEADER_SIZE);
-
-    hdr->len = total_len;
-    hdr->len_check = ~total_len;
-    hdr->seq = dev->tx_seq++;
-    hdr->channel = channel;
-    hdr->data_offset = SDPCM_HEADER_SIZE;
+    if (!sink->trx || sink->crc_checked) {
+        return CYW_OK;
+    }
 
-    /* Copy payload */
-    if (len > 0 && data != NULL) {
-        memcpy(dev->tx_buf + SDPCM_HEADER_SIZE, data, len);
+    if (sink->off < sink->info.len) {
+        ERR("TRX image truncated (%u of %u bytes)", sink->off, sink->info.len);
+        return CYW_ERR_FW;
     }
 
-    /* Align to 4 bytes */
-    total_len = ALIGN(total_len, 4);
+    if (sink->crc != sink->info.crc32) {
+        ERR("TRX CRC mismatch");
+        return CYW_ERR_FW;
+    }
 
-    /* Send via Function 2 */
-    return sdio_write_bytes(SDIO_FUNC_2, 0, dev->tx_buf, total_len, true);
+    return CYW_OK;
 }
 
-static cyw_err_t recv_sdpcm_frame(uint8_t *channel, uint8_t *data, uint32_t *len)
+/*
+ * Feed an image to a sink. CYZ1 containers are decoded one block at a
+ * time into the TX buffer (idle during download); stored blocks are written
+ * straight from the container. Returns the decoded image size.
+ */
+static cyw_err_t download_image(fw_sink_t *sink, const uint8_t *data,
+                                uint32_t size, uint32_t *raw_size)
 {
     cyw_dev_t *dev = &g_cyw_dev;
-    sdpcm_header_t *hdr;
+    cyw_lz4_stream_t zs;
     cyw_err_t err;
-    uint16_t frame_len;
-    uint8_t frame_hdr[4];
 
-    /* Read frame length first */
-    err = sdio_read_bytes(SDIO_FUNC_2, 0, frame_hdr, 4, true);
-    if (err != CYW_OK) return err;
-
-    frame_len = frame_hdr[0] | (frame_hdr[1] << 8);
-    if (frame_len == 0 || frame_len > RX_BUF_SIZE) {
-        return CYW_ERR_INVALID;
+    if (!cyw_lz4_is_frame(data, size)) {
+        *raw_size = size;
+        return sink_write(sink, data, size);
     }
 
-    /* Read full frame */
-    err = sdio_read_bytes(SDIO_FUNC_2, 0, dev->rx_buf, frame_len, true);
+    err = cyw_lz4_stream_init(&zs, data, size);
     if (err != CYW_OK) return err;
 
-    hdr = (sdpcm_header_t *)dev->rx_buf;
+    DBG("Decompressing image (%u -> %u bytes)", size, zs.raw_size);
 
-    /* Validate header */
-    if ((hdr->len ^ hdr->len_check) != 0xFFFF) {
-        ERR("SDPCM header checksum error");
-        return CYW_ERR_INVALID;
-    }
+    for (;;) {
+        const uint8_t *block;
+        uint32_t len;
 
-    /* Update flow control */
-    dev->flow_ctrl = hdr->flow_control;
-    dev->tx_max = hdr->max_seq;
-    dev->rx_seq = hdr->seq;
+        err = cyw_lz4_stream_next(&zs, dev->tx_buf, sizeof(dev->tx_buf),
+                                  &block, &len);
+        if (err != CYW_OK) {
+            ERR("Corrupt compressed image at offset %u", zs.produced);
+            return err;
+        }
+        if (len == 0) {
+            break;
+        }
 
-    /* Extract payload */
-    *channel = hdr->channel;
-    *len = hdr->len - hdr->data_offset;
-    if (*len > 0) {
-        memcpy(data, dev->rx_buf + hdr->data_offset, *len);
+        err = sink_write(sink, block, len);
+        if (err != CYW_OK) return err;
     }
 
+    *raw_size = zs.raw_size;
     return CYW_OK;
 }
 
-/*============================================================================
- * BCDC Commands
- *============================================================================*/
+static inline uint32_t nvram_token(uint32_t words)
+{
+    return (~words << 16) | (words & 0xFFFF);
+}
 
-cyw_err_t cyw_ioctl(uint32_t cmd, void *data, uint32_t len, bool set)
+/*
+ * Blobs from tools/nvram_pack.py already end in the length token and are
+ * written verbatim; plain text gets it appended on the next word boundary.
+ */
+static cyw_err_t write_nvram_size(const fw_sink_t *sink, uint32_t addr,
+                                  uint32_t nvram_size)
 {
-    cyw_dev_t *dev = &g_cyw_dev;
-    cyw_err_t err;
-    bcdc_header_t *bcdc_tx, *bcdc_rx;
-    uint8_t buf[512];
-    uint32_t total_len;
+    uint32_t padded = ALIGN(nvram_size, 4);
 
-    if (dev->state < CYW_STATE_FW_READY) {
-        return CYW_ERR_NOT_READY;
+    if (nvram_size >= 8 && nvram_size == padded &&
+        sink->tail == nvram_token((nvram_size - 4) / 4)) {
+        return CYW_OK;
     }
 
-    /* Build BCDC header */
-    bcdc_tx = (bcdc_header_t *)buf;
-    bcdc_tx->cmd = cmd;
-    bcdc_tx->len = len;
-    bcdc_tx->flags = (BCDC_PROTO_VER << BCDC_FLAG_VER_SHIFT) |
-                     (set ? 0x02 : 0) |
-                     (dev->reqid++ << 16);
-    bcdc_tx->status = 0;
-
-    /* Copy data for SET */
-    if (set && len > 0 && data != NULL) {
-        memcpy(buf + BCDC_HEADER_SIZE, data, len);
-    }
+    return cyw_sdio_write32(addr + padded, nvram_token(padded / 4));
+}
 
-    total_len = BCDC_HEADER_SIZE + len;
+/*
+ * Release the ARM core and wait for the firmware to report ready.
+ * Common tail of every download path.
+ */
+static cyw_err_t start_firmware(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_err_t err;
 
-    /* Send via control channel */
-    err = send_sdpcm_frame(SDPCM_CONTROL_CHANNEL, buf, total_len);
+    /* Release ARM core */
+    err = reset_core(dev->core_arm.base, 0, 0);
     if (err != CYW_OK) return err;
 
-    /* Wait for response */
-    int timeout = 100;
+    /* Wait for firmware ready */
+    int timeout = 200;
     while (timeout-- > 0) {
-        uint8_t channel;
-        uint32_t rx_len = sizeof(buf);
-
-        err = recv_sdpcm_frame(&channel, buf, &rx_len);
-        if (err == CYW_OK && channel == SDPCM_CONTROL_CHANNEL) {
-            bcdc_rx = (bcdc_header_t *)buf;
-
-            /* Check for matching response */
-            if ((bcdc_rx->flags >> 16) == (uint32_t)(dev->reqid - 1)) {
-                if (bcdc_rx->status != 0) {
-                    ERR("IOCTL error: %d", bcdc_rx->status);
-                    return CYW_ERROR;
-                }
-
-                /* Copy data for GET */
-                if (!set && len > 0 && data != NULL) {
-                    memcpy(data, buf + BCDC_HEADER_SIZE,
-                           (bcdc_rx->len < len) ? bcdc_rx->len : len);
-                }
-                return CYW_OK;
-            }
+        uint8_t val;
+        err = cyw_sdio_read8(SDIO_FUNC_1, SBSDIO_FUNC1_CHIPCLKCSR, &val);
+        if (err == CYW_OK && (val & SBSDIO_HT_AVAIL)) {
+            break;
         }
-        delay_ms(1);
-    }
-
-    return CYW_ERR_TIMEOUT;
-}
-
-cyw_err_t cyw_iovar(const char *name, void *data, uint32_t len, bool set)
-{
-    uint8_t buf[256];
-    uint32_t name_len = strlen(name) + 1;
-    uint32_t total_len = name_len + len;
-
-    if (total_len > sizeof(buf)) {
-        return CYW_ERR_NOMEM;
+        delay_ms(10);
     }
 
-    /* Format: name + \0 + data */
-    memcpy(buf, name, name_len);
-    if (len > 0 && data != NULL) {
-        memcpy(buf + name_len, data, len);
+    if (timeout <= 0) {
+        ERR("Firmware start timeout");
+        return CYW_ERR_TIMEOUT;
     }
 
-    cyw_err_t err = cyw_ioctl(set ? WLC_SET_VAR : WLC_GET_VAR,
-                              buf, total_len, set);
+    /* Check for firmware ready in mailbox */
+    uint32_t mbox;
+    timeout = 100;
+    while (timeout-- > 0) {
+        err = cyw_sdio_read32(SDIO_CORE_TOHOSTMAILBOXDATA, &mbox);
+        if (err != CYW_OK) return err;
 
-    if (err == CYW_OK && !set && data != NULL && len > 0) {
-        memcpy(data, buf + name_len, len);
+        if (mbox & HMB_DATA_FWREADY) {
+            DBG("Firmware ready!");
+            /* Room for a few frames until the first header grants credit */
+            dev->tx_seq = 0;
+            dev->tx_max = 4;
+            dev->state = CYW_STATE_FW_READY;
+            return CYW_OK;
+        }
+        delay_ms(10);
     }
 
-    return err;
+    ERR("Firmware not ready");
+    return CYW_ERR_FW;
 }
 
-/*============================================================================
- * Initialization
- *============================================================================*/
-
-static cyw_err_t sdio_init_card(void)
+cyw_err_t cyw_load_firmware(const uint8_t *fw_data, uint32_t fw_size,
+                            const uint8_t *nvram_data, uint32_t nvram_size)
 {
+    cyw_dev_t *dev = &g_cyw_dev;
     cyw_err_t err;
-    uint8_t val;
+    uint32_t addr;
+    uint32_t raw_size;
+    fw_sink_t sink;
 
-    /* Enable function 1 */
-    if (g_cyw_dev.ops->enable_func) {
-        g_cyw_dev.ops->enable_func(SDIO_FUNC_1, true);
+    if (dev->state < CYW_STATE_INIT) {
+        return CYW_ERR_NOT_READY;
     }
 
-    /* Wait for function 1 ready */
-    int timeout = 100;
-    while (timeout-- > 0) {
-        err = cyw_sdio_read8(SDIO_FUNC_0, CCCR_IO_READY, &val);
-        if (err == CYW_OK && (val & SDIO_FUNC_READY_1)) {
-            break;
-        }
-        delay_ms(1);
-    }
-    if (timeout <= 0) {
-        ERR("Function 1 not ready");
-        return CYW_ERR_TIMEOUT;
-    }
-
-    /* Set block sizes */
-    if (g_cyw_dev.ops->set_block_size) {
-        g_cyw_dev.ops->set_block_size(SDIO_FUNC_1, SDIO_F1_BLOCK_SIZE);
-        g_cyw_dev.ops->set_block_size(SDIO_FUNC_2, SDIO_F2_BLOCK_SIZE);
+    /* Reject a corrupt TRX image before touching the bus */
+    sink_init(&sink, dev->chip.ram_base, true);
+    if (cyw_trx_is_image(fw_data, fw_size)) {
+        err = sink_check_trx(&sink, fw_data, fw_size);
+        if (err != CYW_OK) return err;
     }
 
-    /* Request ALP clock */
-    err = request_alp_clock();
-    if (err != CYW_OK) return err;
+    dev->state = CYW_STATE_FW_LOADING;
+    DBG("Loading firmware (%u bytes)...", fw_size);
 
-    /* Detect chip */
-    err = detect_chip();
-    if (err != CYW_OK) return err;
+    /* Halt ARM core */
+    err = cyw_sdio_write32(dev->core_arm.base + ARMCR4_BANKIDX, 0);
+    if (err != CYW_OK) goto error;
 
-    /* Enable function 2 */
-    if (g_cyw_dev.ops->enable_func) {
-        g_cyw_dev.ops->enable_func(SDIO_FUNC_2, true);
+    /* Download firmware to RAM */
+    err = download_image(&sink, fw_data, fw_size, &raw_size);
+    if (err == CYW_OK) {
+        err = sink_finish(&sink);
+    }
+    if (err != CYW_OK) {
+        ERR("Firmware download failed");
+        goto error;
     }
 
-    /* Wait for function 2 ready */
-    timeout = 100;
-    while (timeout-- > 0) {
-        err = cyw_sdio_read8(SDIO_FUNC_0, CCCR_IO_READY, &val);
-        if (err == CYW_OK && (val & SDIO_FUNC_READY_2)) {
-            break;
+    DBG("Firmware downloaded");
+
+    /* Download NVRAM */
+    if (nvram_data && nvram_size > 0) {
+        /* NVRAM goes at end of RAM */
+        /* Calculate proper NVRAM location based on RAM size */
+        addr = NVRAM_DL_ADDR;
+        sink_init(&sink, addr, false);
+        err = download_image(&sink, nvram_data, nvram_size, &raw_size);
+        if (err != CYW_OK) {
+            ERR("NVRAM download failed");
+            goto error;
         }
-        delay_ms(1);
+
+        /* Write NVRAM size at end */
+        err = write_nvram_size(&sink, addr, raw_size);
+        if (err != CYW_OK) goto error;
+
+        DBG("NVRAM downloaded (%u bytes)", raw_size);
     }
-    if (timeout <= 0) {
-        ERR("Function 2 not ready");
-        return CYW_ERR_TIMEOUT;
+
+    err = start_firmware();
+    if (err == CYW_OK) {
+        return CYW_OK;
     }
 
-    /* Set F2 watermark */
-    err = cyw_sdio_write8(SDIO_FUNC_1, SBSDIO_WATERMARK, CYW55500_F2_WATERMARK);
-    if (err != CYW_OK) return err;
+error:
+    dev->state = CYW_STATE_ERROR;
+    return err;
+}
 
-    /* Enable interrupts */
-    err = cyw_sdio_write8(SDIO_FUNC_0, CCCR_INT_ENABLE,
-                          CCCR_IEN_FUNC0 | CCCR_IEN_FUNC1 | CCCR_IEN_FUNC2);
-    if (err != CYW_OK) return err;
+/*============================================================================
+ * Streaming Firmware Download
+ *============================================================================*/
 
-    DBG("SDIO card initialized");
-    return CYW_OK;
+static bool reader_valid(const cyw_fw_reader_t *rd)
+{
+    if (rd == NULL) {
+        return false;
+    }
+    if (rd->read_start) {
+        return rd->read_wait != NULL;
+    }
+    return rd->read != NULL;
 }
 
-cyw_err_t cyw_init(const sdio_host_ops_t *ops)
+/*
+ * Pump a reader into a sink. Two chunk buffers (TX/RX, idle during
+ * download) alternate: while one is written over the bus, an asynchronous
+ * reader is already filling the other.
+ */
+static cyw_err_t download_stream(fw_sink_t *sink, const cyw_fw_reader_t *rd,
+                                 uint32_t *total)
 {
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint8_t *buf[2] = { dev->tx_buf, dev->rx_buf };
+    int cur = 0;
+    int n;
     cyw_err_t err;
 
-    if (ops == NULL) {
-        return CYW_ERR_INVALID;
+    *total = 0;
+
+    /* Prime the first buffer */
+    if (rd->read_start) {
+        n = rd->read_start(rd->ctx, buf[cur], CYW_FW_CHUNK_SIZE);
+        if (n >= 0) {
+            n = rd->read_wait(rd->ctx);
+        }
+    } else {
+        n = rd->read(rd->ctx, buf[cur], CYW_FW_CHUNK_SIZE);
     }
 
-    memset(&g_cyw_dev, 0, sizeof(g_cyw_dev));
-    g_cyw_dev.ops = ops;
-    g_cyw_dev.state = CYW_STATE_OFF;
+    while (n > 0) {
+        if ((uint32_t)n > CYW_FW_CHUNK_SIZE) {
+            return CYW_ERR_INVALID;
+        }
 
-    /* Initialize SDIO host */
-    if (ops->init) {
-        int ret = ops->init();
-        if (ret != 0) {
-            ERR("SDIO host init failed");
+        /* Kick off the next fetch before occupying the bus */
+        if (rd->read_start &&
+            rd->read_start(rd->ctx, buf[cur ^ 1], CYW_FW_CHUNK_SIZE) < 0) {
+            ERR("Image read failed at offset %u", *total);
             return CYW_ERR_IO;
         }
-    }
 
-    /* Initialize card */
-    err = sdio_init_card();
-    if (err != CYW_OK) {
-        ERR("Card init failed");
-        return err;
+        err = sink_write(sink, buf[cur], n);
+        if (err != CYW_OK) {
+            /* Don't leave the reader filling a buffer behind our back */
+            if (rd->read_start) {
+                rd->read_wait(rd->ctx);
+            }
+            return err;
+        }
+
+        *total += n;
+        cur ^= 1;
+
+        if (rd->read_start) {
+            n = rd->read_wait(rd->ctx);
+        } else {
+            n = rd->read(rd->ctx, buf[cur], CYW_FW_CHUNK_SIZE);
+        }
     }
 
-    g_cyw_dev.state = CYW_STATE_INIT;
-    DBG("CYW55500 driver initialized");
+    if (n < 0) {
+        ERR("Image read failed at offset %u", *total);
+        return CYW_ERR_IO;
+    }
 
     return CYW_OK;
 }
 
-void cyw_deinit(void)
+cyw_err_t cyw_load_firmware_stream(const cyw_fw_reader_t *fw,
+                                   const cyw_fw_reader_t *nvram)
 {
     cyw_dev_t *dev = &g_cyw_dev;
+    cyw_err_t err;
+    uint32_t addr;
+    uint32_t size;
+    fw_sink_t sink;
 
-    if (dev->state != CYW_STATE_OFF) {
-        /* Disable interrupts */
-        cyw_sdio_write8(SDIO_FUNC_0, CCCR_INT_ENABLE, 0);
+    if (!reader_valid(fw) || (nvram && !reader_valid(nvram))) {
+        return CYW_ERR_INVALID;
+    }
 
-        /* Disable functions */
-        if (dev->ops->enable_func) {
-            dev->ops->enable_func(SDIO_FUNC_2, false);
-            dev->ops->enable_func(SDIO_FUNC_1, false);
+    if (dev->state < CYW_STATE_INIT) {
+        return CYW_ERR_NOT_READY;
+    }
+
+    dev->state = CYW_STATE_FW_LOADING;
+    DBG("Streaming firmware...");
+
+    /* Halt ARM core */
+    err = cyw_sdio_write32(dev->core_arm.base + ARMCR4_BANKIDX, 0);
+    if (err != CYW_OK) goto error;
+
+    /* TRX CRC is accumulated on the fly and checked before ARM release */
+    sink_init(&sink, dev->chip.ram_base, true);
+    err = download_stream(&sink, fw, &size);
+    if (err == CYW_OK) {
+        err = sink_finish(&sink);
+    }
+    if (err != CYW_OK || size == 0) {
+        ERR("Firmware download failed");
+        if (err == CYW_OK) err = CYW_ERR_FW;
+        goto error;
+    }
+
+    DBG("Firmware downloaded (%u bytes)", size);
+
+    if (nvram) {
+        addr = NVRAM_DL_ADDR;
+        sink_init(&sink, addr, false);
+        err = download_stream(&sink, nvram, &size);
+        if (err != CYW_OK) {
+            ERR("NVRAM download failed");
+            goto error;
         }
 
-        /* Deinit host */
-        if (dev->ops->deinit) {
-            dev->ops->deinit();
+        if (size > 0) {
+            err = write_nvram_size(&sink, addr, size);
+            if (err != CYW_OK) goto error;
         }
 
-        dev->state = CYW_STATE_OFF;
+        DBG("NVRAM downloaded (%u bytes)", size);
     }
+
+    err = start_firmware();
+    if (err == CYW_OK) {
+        return CYW_OK;
+    }
+
+error:
+    dev->state = CYW_STATE_ERROR;
+    return err;
 }
 
 /*============================================================================
- * WiFi Operations
+ * Packet Buffers
  *============================================================================*/
 
-cyw_err_t cyw_up(void)
+cyw_pkt_t *cyw_pkt_alloc(uint32_t headroom, uint32_t len)
 {
-    cyw_dev_t *dev = &g_cyw_dev;
-
-    if (dev->state < CYW_STATE_FW_READY) {
-        return CYW_ERR_NOT_READY;
-    }
+    return cyw_pkt_pool_get(&g_cyw_dev.tx_pool, headroom, len);
+}
 
-    cyw_err_t err = cyw_ioctl(WLC_UP, NULL, 0, true);
-    if (err == CYW_OK) {
-        dev->state = CYW_STATE_UP;
-    }
-    return err;
+cyw_pkt_t *cyw_pkt_wrap(void *data, uint32_t headroom, uint32_t len,
+                        cyw_pkt_release_t release, void *ctx)
+{
+    return cyw_pkt_pool_wrap(&g_cyw_dev.tx_wrap_pool, data, headroom, len,
+                             release, ctx);
 }
 
-cyw_err_t cyw_down(void)
+uint32_t cyw_pkt_rx_avail(void)
 {
-    cyw_dev_t *dev = &g_cyw_dev;
+    return g_cyw_dev.rx_pool.nfree;
+}
 
-    if (dev->state < CYW_STATE_FW_READY) {
-        return CYW_ERR_NOT_READY;
-    }
+uint32_t cyw_pkt_tx_pool_add(void *mem, uint32_t len)
+{
+    return cyw_pkt_pool_add(&g_cyw_dev.tx_pool, mem, len);
+}
 
-    cyw_err_t err = cyw_ioctl(WLC_DOWN, NULL, 0, true);
-    if (err == CYW_OK) {
-        dev->state = CYW_STATE_FW_READY;
-    }
-    return err;
+uint32_t cyw_pkt_rx_pool_add(void *mem, uint32_t len)
+{
+    return cyw_pkt_pool_add(&g_cyw_dev.rx_pool, mem, len);
 }
 
-cyw_err_t cyw_get_chip_info(cyw_chip_info_t *info)
+/*============================================================================
+ * IOCTL Arena
+ *
+ * IOCTL buffers larger than a pool buffer, up to CYW_IOCTL_MAX_LEN, are
+ * sent from one static arena, and the response (as large as the request)
+ * is read back into it. A large request keeps the arena from being sent
+ * until its response is in or it is given up.
+ *============================================================================*/
+
+#if CYW_IOCTL_MAX_LEN > 0
+static void arena_release(void *ctx)
 {
-    if (info == NULL) {
-        return CYW_ERR_INVALID;
-    }
-    memcpy(info, &g_cyw_dev.chip, sizeof(cyw_chip_info_t));
-    return CYW_OK;
+    g_cyw_dev.ioctl_arena &= ~(uint8_t)(uintptr_t)ctx;
 }
+#endif
 
-cyw_state_t cyw_get_state(void)
+static inline bool arena_owns(const cyw_pkt_t *pkt)
 {
-    return g_cyw_dev.state;
+#if CYW_IOCTL_MAX_LEN > 0
+    return pkt->buf == g_ioctl_arena;
+#else
+    (void)pkt;
+    return false;
+#endif
 }
 
-void cyw_poll(void)
+/*
+ * TX packet in the arena, with tailroom for the word padding
+ * @return NULL if the arena is taken or len is beyond CYW_IOCTL_MAX_LEN
+ */
+static cyw_pkt_t *arena_tx(uint32_t len)
 {
-    cyw_dev_t *dev = &g_cyw_dev;
+#if CYW_IOCTL_MAX_LEN > 0
+    cyw_pkt_t *pkt;
 
-    if (dev->state < CYW_STATE_FW_READY) {
-        return;
+    if (len > CYW_IOCTL_MAX_LEN || g_cyw_dev.ioctl_arena != 0) {
+        return NULL;
     }
 
-    /* Check for pending data */
-    if (dev->ops->irq_pending && dev->ops->irq_pending()) {
-        uint8_t channel;
-        uint32_t len = sizeof(dev->rx_buf);
-
-        if (recv_sdpcm_frame(&channel, dev->rx_buf, &len) == CYW_OK) {
-            switch (channel) {
-                case SDPCM_EVENT_CHANNEL:
-                    /* Handle events */
-                    DBG("Event received, len=%u", len);
-                    break;
-                case SDPCM_DATA_CHANNEL:
-                    /* Handle data */
-                    DBG("Data received, len=%u", len);
-                    break;
-                default:
-                    break;
-            }
+    pkt = cyw_pkt_wrap(g_ioctl_arena, CYW_PKT_HEADROOM,
+                       IOCTL_ARENA_SIZE - CYW_PKT_HEADROOM,
+                       arena_release, (void *)ARENA_TX);
+    if (pkt != NULL) {
+        pkt->len = len;
+        g_cyw_dev.ioctl_arena = ARENA_TX;
+    }
+    return pkt;
+#else
+    (void)len;
+    return NULL;
+#endif
+}
+
+/*
+ * Move a frame too large for its RX buffer into the arena: the rd_len
+ * bytes read so far are copied over and the pool buffer is released.
+ * Only once no request is being sent from the arena.
+ * @return Arena packet, or NULL if the frame cannot be taken
+ */
+static cyw_pkt_t *arena_rx(cyw_pkt_t *pkt, uint32_t rd_len, uint32_t frame_len)
+{
+    cyw_pkt_t *big = NULL;
+
+#if CYW_IOCTL_MAX_LEN > 0
+    if (frame_len <= IOCTL_ARENA_SIZE &&
+        (g_cyw_dev.ioctl_arena & (ARENA_TX | ARENA_RX)) == 0) {
+        big = cyw_pkt_wrap(g_ioctl_arena, 0, IOCTL_ARENA_SIZE,
+                           arena_release, (void *)ARENA_RX);
+        if (big != NULL) {
+            memcpy(g_ioctl_arena, pkt->buf, rd_len);
+            g_cyw_dev.ioctl_arena |= ARENA_RX;
         }
     }
+#else
+    (void)rd_len;
+    (void)frame_len;
+#endif
+
+    cyw_pkt_free(pkt);
+    return big;
 }
 
 /*============================================================================
- * TODO: WiFi Connection Functions (Not Implemented Yet)
+ * SDPCM Frame Handling
  *============================================================================*/
 
-/*
- * TODO 1: cyw_scan() - Сканирование WiFi сетей
- *
- * int cyw_scan(void *results, int max_results)
- * {
- *     // 1. Установить параметры сканирования
- *     struct wl_escan_params {
- *         uint32_t version;
- *         uint16_t action;      // WL_SCAN_ACTION_START = 1
- *         uint16_t sync_id;
- *         struct wl_scan_params {
- *             wlc_ssid_t ssid;
- *             uint8_t bssid[6];
- *             int8_t bss_type;  // -1 = any
- *             uint8_t scan_type; // 0 = active
- *             int32_t nprobes;
- *             int32_t active_time;
- *             int32_t passive_time;
- *             int32_t home_time;
- *             int32_t channel_num;
- *             uint16_t channel_list[1];
- *         } params;
- *     } scan_params = {0};
- *
- *     scan_params.version = 1;
- *     scan_params.action = 1;
- *     scan_params.params.bss_type = -1;
- *     scan_params.params.nprobes = -1;
- *     scan_params.params.active_time = -1;
- *     scan_params.params.passive_time = -1;
- *     scan_params.params.home_time = -1;
- *
- *     // 2. Запустить сканирование
- *     cyw_iovar("escan", &scan_params, sizeof(scan_params), true);
- *
- *     // 3. Ждать событий ESCAN_RESULT на SDPCM_EVENT_CHANNEL
- *     //    Парсить WLC_E_ESCANRESULT события
- *
- *     // 4. Вернуть количество найденных сетей
- *     return count;
- * }
- */
+/* Word and block padding beyond the last segment's tailroom */
+static const uint8_t g_zero_pad[SDIO_F2_BLOCK_SIZE + 4] __attribute__((aligned(4)));
 
 /*
- * TODO 2: cyw_connect() - Подключение к WiFi сети
- *
- * cyw_err_t cyw_connect(const char *ssid, const char *passphrase)
- * {
- *     // 1. Установить режим инфраструктуры
- *     uint32_t infra = 1;
- *     cyw_ioctl(WLC_SET_INFRA, &infra, 4, true);
- *
- *     // 2. Установить режим аутентификации
- *     uint32_t auth = 0;  // Open System
- *     cyw_ioctl(WLC_SET_AUTH, &auth, 4, true);
- *
- *     // 3. Установить WPA auth
- *     uint32_t wpa_auth = 0x80;  // WPA2-PSK
- *     cyw_iovar("wpa_auth", &wpa_auth, 4, true);
- *
- *     // 4. Установить PMK (пароль -> PSK)
- *     struct {
- *         uint16_t key_len;
- *         uint16_t flags;
- *         uint8_t key[64];
- *     } pmk;
- *     pmk.key_len = strlen(passphrase);
- *     pmk.flags = 0;
- *     memcpy(pmk.key, passphrase, pmk.key_len);
- *     cyw_ioctl(WLC_SET_WSEC_PMK, &pmk, sizeof(pmk), true);
- *
- *     // 5. Установить WSEC (шифрование)
- *     uint32_t wsec = 6;  // AES + TKIP
- *     cyw_ioctl(WLC_SET_WSEC, &wsec, 4, true);
- *
- *     // 6. Установить SSID (это запускает подключение)
- *     struct {
- *         uint32_t ssid_len;
- *         char ssid[32];
- *     } wlc_ssid;
- *     wlc_ssid.ssid_len = strlen(ssid);
- *     memcpy(wlc_ssid.ssid, ssid, wlc_ssid.ssid_len);
- *     cyw_ioctl(WLC_SET_SSID, &wlc_ssid, sizeof(wlc_ssid), true);
- *
- *     // 7. Ждать события WLC_E_LINK или WLC_E_SET_SSID
- *     //    с status = WLC_E_STATUS_SUCCESS
- *
- *     return CYW_OK;
- * }
+ * Frames the firmware still accepts: tx_seq must stay behind tx_max.
  */
+static inline uint32_t tx_credits(void)
+{
+    uint8_t window = g_cyw_dev.tx_max - g_cyw_dev.tx_seq;
 
-/*
- * TODO 3: cyw_disconnect() - Отключение от сети
- *
- * cyw_err_t cyw_disconnect(void)
- * {
- *     cyw_ioctl(WLC_DISASSOC, NULL, 0, true);
- *     return CYW_OK;
- * }
- */
+    return (window & 0x80) ? 0 : window;
+}
 
 /*
- * TODO 4: cyw_is_connected() - Проверка подключения
- *
- * bool cyw_is_connected(void)
- * {
- *     uint8_t bssid[6];
- *     cyw_ioctl(WLC_GET_BSSID, bssid, 6, false);
- *     // Если bssid != 00:00:00:00:00:00, то подключены
- *     return (bssid[0] | bssid[1] | bssid[2] |
- *             bssid[3] | bssid[4] | bssid[5]) != 0;
- * }
+ * The flow-control byte holds off data by 802.1d priority; control frames
+ * are never held.
  */
+static inline bool tx_fc_blocked(const cyw_pkt_t *pkt)
+{
+    return pkt->channel == SDPCM_DATA_CHANNEL &&
+           (g_cyw_dev.flow_ctrl & (1u << (pkt->prio & 7)));
+}
 
-/*
- * TODO 5: cyw_get_rssi() - Получить уровень сигнала
- *
- * int cyw_get_rssi(void)
- * {
- *     int32_t rssi = 0;
- *     cyw_ioctl(WLC_GET_RSSI, &rssi, 4, false);
- *     return rssi;
- * }
- */
+static inline uint32_t tx_hdr_len(void)
+{
+    return g_cyw_dev.txglom ? SDPCM_GLOM_HEADER_SIZE : SDPCM_HEADER_SIZE;
+}
 
 /*
- * TODO 6: Event Handler - Обработка событий WiFi
- *
- * В cyw_poll() добавить парсинг событий:
- *
- * typedef struct {
- *     uint16_t version;
- *     uint16_t flags;
- *     uint32_t event_type;    // WLC_E_*
- *     uint32_t status;
- *     uint32_t reason;
- *     uint32_t auth_type;
- *     uint32_t datalen;
- *     uint8_t addr[6];
- *     char ifname[16];
- *     uint8_t ifidx;
- *     uint8_t bsscfgidx;
- * } wl_event_msg_t;
- *
- * События:
- *   WLC_E_LINK        = 16  - Link up/down
- *   WLC_E_AUTH        = 3   - Authentication
- *   WLC_E_ASSOC       = 0   - Association
- *   WLC_E_SET_SSID    = 46  - SSID set result
- *   WLC_E_ESCANRESULT = 69  - Scan result
+ * Pad bytes between an SDPCM header of hlen bytes and the payload, so the
+ * header starts on a word: bus transfers are done in 32-bit words.
  */
+static inline uint32_t tx_head_pad(const cyw_pkt_t *pkt, uint32_t hlen)
+{
+    return ((uintptr_t)cyw_pkt_data(pkt) - hlen) & 3;
+}
 
 /*
- * TODO 7: IOCTL номера (добавить в cyw55500_regs.h)
- *
- * #define WLC_GET_MAGIC         0
- * #define WLC_GET_VERSION       1
- * #define WLC_UP                2
- * #define WLC_DOWN              3
- * #define WLC_SET_INFRA         20
- * #define WLC_SET_AUTH          22
- * #define WLC_SET_SSID          26
- * #define WLC_SET_WSEC          134
- * #define WLC_SET_WSEC_PMK      268
- * #define WLC_GET_RSSI          127
- * #define WLC_GET_BSSID         23
- * #define WLC_DISASSOC          52
- * #define WLC_SCAN              50
- * #define WLC_GET_VAR           262
- * #define WLC_SET_VAR           263
+ * Push the SDPCM header for pkt->channel into the packet's headroom. Once
+ * the firmware takes superframes every frame carries the hardware
+ * extension; a frame sent alone is marked as the last of its superframe.
+ * A misaligned payload is preceded by pad bytes that the firmware skips
+ * through data_offset.
  */
+static cyw_err_t tx_push_hdr(cyw_pkt_t *pkt)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint32_t hlen = tx_hdr_len();
+    uint32_t doff = hlen + tx_head_pad(pkt, hlen);
+    uint32_t len;
+    uint8_t *p;
+
+    p = cyw_pkt_push_hdr(pkt, doff);
+    if (p == NULL) {
+        return CYW_ERR_NOMEM;
+    }
+
+    len = cyw_pkt_frame_len(pkt);
+    memset(p, 0, hlen);
+    if (dev->txglom) {
+        sdpcm_glom_header_t *hdr = (sdpcm_glom_header_t *)p;
+
+        hdr->len = len;
+        hdr->len_check = ~len;
+        hdr->hwext_len = (len - 4) | SDPCM_HWEXT_LAST;
+        hdr->seq = dev->tx_seq++;
+        hdr->channel = pkt->channel;
+        hdr->data_offset = doff;
+    } else {
+        sdpcm_header_t *hdr = (sdpcm_header_t *)p;
+
+        hdr->len = len;
+        hdr->len_check = ~len;
+        hdr->seq = dev->tx_seq++;
+        hdr->channel = pkt->channel;
+        hdr->data_offset = doff;
+    }
+
+    return CYW_OK;
+}
+
+/*
+ * Gather list for a framed packet: its segments, then pad bytes from the
+ * last segment's tailroom as far as it goes and from g_zero_pad beyond
+ * that. Returns the number of entries used.
+ */
+static uint32_t tx_gather(const cyw_pkt_t *pkt, uint32_t pad, sdio_sg_t *sg)
+{
+    const cyw_pkt_t *last = pkt;
+    uint32_t n = 0, in_buf;
+
+    for (; pkt != NULL; pkt = pkt->frag) {
+        if (pkt->len > 0) {
+            sg[n].data = cyw_pkt_data(pkt);
+            sg[n].len = pkt->len;
+            last = pkt;
+            n++;
+        }
+    }
+
+    in_buf = MIN(pad, cyw_pkt_tailroom(last));
+    sg[n - 1].len += in_buf;
+    if (pad > in_buf) {
+        sg[n].data = g_zero_pad;
+        sg[n].len = pad - in_buf;
+        n++;
+    }
+
+    return n;
+}
+
+/*
+ * Send one frame, padded to 4 bytes: straight from its buffer when it is
+ * contiguous with room for the padding, gathered otherwise.
+ */
+static cyw_err_t tx_send_one(cyw_pkt_t *pkt)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    sdio_sg_t sg[CYW_TX_MAX_FRAGS + 1];
+    uint32_t len, pad, n;
+    cyw_err_t err;
+
+    err = tx_push_hdr(pkt);
+    if (err != CYW_OK) return err;
+
+    len = cyw_pkt_frame_len(pkt);
+    pad = ALIGN(len, 4) - len;
+    if (pkt->frag == NULL && pad <= cyw_pkt_tailroom(pkt)) {
+        return sdio_write_bytes(SDIO_FUNC_2, 0, cyw_pkt_data(pkt), len + pad, true);
+    }
+
+    if (dev->ops->cmd53_write_sg == NULL) {
+        return CYW_ERR_INVALID;
+    }
+
+    n = tx_gather(pkt, pad, sg);
+    return sdio_write_sg(SDIO_FUNC_2, 0, sg, n, true);
+}
+
+/*
+ * A frame can join a superframe if the glom header fits in its headroom;
+ * word padding comes from g_zero_pad where the tailroom is short.
+ */
+static bool tx_glom_fits(const cyw_pkt_t *pkt)
+{
+    return cyw_pkt_headroom(pkt) >=
+           SDPCM_GLOM_HEADER_SIZE + tx_head_pad(pkt, SDPCM_GLOM_HEADER_SIZE);
+}
+
+/* Gather entries a frame may need: its segments and one for padding */
+static inline uint32_t tx_seg_count(const cyw_pkt_t *pkt)
+{
+    return cyw_pkt_segs(pkt) + 1;
+}
+
+/*
+ * Send frames back to back in one gathered CMD53. Each subframe is padded
+ * to a word; the last one also pads the superframe to whole F2 blocks so
+ * it goes out in block mode.
+ */
+static cyw_err_t tx_send_glom(cyw_pkt_t **pkts, uint32_t n)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    sdio_sg_t sg[CYW_TX_MAX_SEGS];
+    uint32_t nsg = 0, total = 0;
+    cyw_err_t err;
+
+    for (uint32_t i = 0; i < n; i++) {
+        cyw_pkt_t *pkt = pkts[i];
+        sdpcm_glom_header_t *hdr;
+        uint32_t len, pad, extra = 0;
+
+        err = tx_push_hdr(pkt);
+        if (err != CYW_OK) return err;
+
+        len = cyw_pkt_frame_len(pkt);
+        pad = ALIGN(len, 4) - len;
+        if (i == n - 1) {
+            uint32_t end = total + len + pad;
+            if (end > SDIO_F2_BLOCK_SIZE) {
+                extra = ALIGN(end, SDIO_F2_BLOCK_SIZE) - end;
+            }
+        }
+
+        hdr = (sdpcm_glom_header_t *)cyw_pkt_data(pkt);
+        hdr->len = len + pad + extra;
+        hdr->len_check = ~hdr->len;
+        hdr->hwext_len = (uint32_t)(hdr->len - 4) |
+                         ((i == n - 1) ? SDPCM_HWEXT_LAST : 0);
+        hdr->hwext_pad = (pad + extra) << 16;
+
+        nsg += tx_gather(pkt, pad + extra, &sg[nsg]);
+        total += hdr->len;
+    }
+
+    err = sdio_write_sg(SDIO_FUNC_2, 0, sg, nsg, true);
+    if (err != CYW_OK) {
+        return err;
+    }
+
+    dev->tx_glom++;
+    dev->tx_glom_frames += n;
+    return CYW_OK;
+}
+
+/* 802.1d priority to WMM access category */
+static const uint8_t g_prio2txq[8] = {
+    CYW_TXQ_BE, CYW_TXQ_BK, CYW_TXQ_BK, CYW_TXQ_BE,
+    CYW_TXQ_VI, CYW_TXQ_VI, CYW_TXQ_VO, CYW_TXQ_VO,
+};
+
+/* Deficit round robin quantum per access category, in bytes */
+static const uint32_t g_txq_quantum[CYW_TXQ_COUNT] = {
+    [CYW_TXQ_VO] = CYW_WMM_WEIGHT_VO * CYW_PKT_BUF_SIZE,
+    [CYW_TXQ_VI] = CYW_WMM_WEIGHT_VI * CYW_PKT_BUF_SIZE,
+    [CYW_TXQ_BE] = CYW_WMM_WEIGHT_BE * CYW_PKT_BUF_SIZE,
+    [CYW_TXQ_BK] = CYW_WMM_WEIGHT_BK * CYW_PKT_BUF_SIZE,
+};
+
+static inline uint32_t tx_queue_of(const cyw_pkt_t *pkt)
+{
+    return (pkt->channel == SDPCM_DATA_CHANNEL) ? g_prio2txq[pkt->prio & 7]
+                                                : CYW_TXQ_CTRL;
+}
+
+/*
+ * Queue a frame for the bus; the queue owns the packet from here on.
+ * Data frames get their BDC header here, carrying the packet's priority.
+ */
+static cyw_err_t tx_enqueue(uint8_t channel, cyw_pkt_t *pkt)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    pkt->channel = channel;
+
+    if (channel == SDPCM_DATA_CHANNEL) {
+        bdc_header_t *bdc = cyw_pkt_push_hdr(pkt, BDC_HEADER_SIZE);
+        if (bdc == NULL) {
+            cyw_pkt_free(pkt);
+            return CYW_ERR_NOMEM;
+        }
+        bdc->flags = BCDC_PROTO_VER << BCDC_FLAG_VER_SHIFT;
+        bdc->priority = pkt->prio & 7;
+        bdc->flags2 = pkt->ifidx & BCDC_FLAG2_IF_MASK;
+        bdc->data_offset = 0;
+    }
+
+    if (dev->tx_q_count == 0) {
+        dev->tx_q_since = time_us();
+    }
+    cyw_pkt_queue_push(&dev->txq[tx_queue_of(pkt)], pkt);
+    dev->tx_q_count++;
+    dev->tx_q_bytes += cyw_pkt_frame_len(pkt);
+    if (dev->tx_q_count > dev->tx_q_peak) {
+        dev->tx_q_peak = dev->tx_q_count;
+    }
+
+    return CYW_OK;
+}
+
+/*
+ * Next frame for the bus: control traffic strictly first, then the access
+ * categories by deficit round robin, so each gets bandwidth in proportion
+ * to its weight. A quantum covers at least one full buffer, so every
+ * visit to a ready queue yields a frame. Flow-controlled queues are
+ * skipped without banking credit.
+ */
+static cyw_pkt_t *tx_dequeue(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_pkt_t *pkt;
+
+    pkt = cyw_pkt_queue_pop(&dev->txq[CYW_TXQ_CTRL]);
+    if (pkt == NULL) {
+        for (uint32_t i = 0; i <= CYW_TXQ_COUNT; i++) {
+            uint32_t q = dev->txq_rr;
+
+            pkt = dev->txq[q].head;
+            if (pkt != NULL && !tx_fc_blocked(pkt) &&
+                dev->txq_deficit[q] >= cyw_pkt_frame_len(pkt)) {
+                dev->txq_deficit[q] -= cyw_pkt_frame_len(pkt);
+                cyw_pkt_queue_pop(&dev->txq[q]);
+                break;
+            }
+            pkt = NULL;
+
+            /* Done with this one: idle queues do not save up */
+            if (dev->txq[q].head == NULL || tx_fc_blocked(dev->txq[q].head)) {
+                dev->txq_deficit[q] = 0;
+            }
+            dev->txq_rr = (q >= CYW_TXQ_COUNT - 1) ? CYW_TXQ_VO : q + 1;
+            dev->txq_deficit[dev->txq_rr] += g_txq_quantum[dev->txq_rr];
+        }
+    }
+
+    if (pkt != NULL) {
+        dev->tx_q_count--;
+        dev->tx_q_bytes -= cyw_pkt_frame_len(pkt);
+    }
+    return pkt;
+}
+
+/*
+ * Put back a frame taken by tx_dequeue() that did not make the batch.
+ */
+static void tx_requeue(cyw_pkt_t *pkt)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint32_t q = tx_queue_of(pkt);
+    uint32_t len = cyw_pkt_frame_len(pkt);
+
+    if (q != CYW_TXQ_CTRL) {
+        dev->txq_deficit[q] += len;
+    }
+    cyw_pkt_queue_push_front(&dev->txq[q], pkt);
+    dev->tx_q_count++;
+    dev->tx_q_bytes += len;
+}
+
+/* Superframe byte budget: CYW_TXGLOM_MAX_BYTES, or less if the host says so */
+static uint32_t tx_glom_max_bytes(void)
+{
+    uint32_t max = xfer_max(SDIO_FUNC_2);
+
+    return (max != 0 && max < CYW_TXGLOM_MAX_BYTES) ? max : CYW_TXGLOM_MAX_BYTES;
+}
+
+/*
+ * Queued frames go out once the superframe budget is full or the oldest
+ * has waited CYW_TXGLOM_HOLD_US. Without a clock there is nothing to wait
+ * for and the queue is sent on every call.
+ */
+static bool tx_glom_due(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    if (!dev->txglom || dev->ops->get_time_us == NULL) {
+        return true;
+    }
+    if (dev->tx_q_count >= CYW_TXGLOM_MAX_FRAMES ||
+        dev->tx_q_bytes >= tx_glom_max_bytes()) {
+        return true;
+    }
+    return (uint32_t)(time_us() - dev->tx_q_since) >= CYW_TXGLOM_HOLD_US;
+}
+
+/*
+ * Send the TX queue: as superframes within the frame/byte budget when
+ * the firmware takes them, otherwise one frame per CMD53. Frames only
+ * leave inside the credit window and while their priority is not flow
+ * controlled; the rest stay queued until an RX header opens the window.
+ */
+static cyw_err_t tx_flush(bool force)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_pkt_t *batch[CYW_TXGLOM_MAX_FRAMES];
+    uint32_t glom_max = tx_glom_max_bytes();
+    cyw_err_t ret = CYW_OK;
+
+    while (dev->tx_q_count > 0 && (force || tx_glom_due())) {
+        uint32_t n = 0, bytes = 0, segs = 0;
+        uint32_t credits = tx_credits();
+        cyw_err_t err;
+
+        if (credits == 0) {
+            dev->tx_credit_stall++;
+            break;
+        }
+
+        do {
+            cyw_pkt_t *pkt = tx_dequeue();
+            uint32_t frame;
+
+            if (pkt == NULL) {
+                break;
+            }
+
+            frame = ALIGN(cyw_pkt_frame_len(pkt) + SDPCM_GLOM_HEADER_SIZE + 3, 4);
+            if (n > 0 && (n == credits || !tx_glom_fits(pkt) ||
+                          segs + tx_seg_count(pkt) > CYW_TX_MAX_SEGS ||
+                          ALIGN(bytes + frame, SDIO_F2_BLOCK_SIZE) > glom_max)) {
+                tx_requeue(pkt);
+                break;
+            }
+
+            batch[n++] = pkt;
+            bytes += frame;
+            segs += tx_seg_count(pkt);
+
+            /* A frame that cannot be glommed goes alone */
+            if (!tx_glom_fits(pkt)) {
+                break;
+            }
+        } while (dev->txglom && dev->ops->cmd53_write_sg &&
+                 dev->tx_q_count > 0 && n < CYW_TXGLOM_MAX_FRAMES);
+
+        /* Everything left is flow controlled */
+        if (n == 0) {
+            dev->tx_fc_stall++;
+            break;
+        }
+
+        err = (n == 1) ? tx_send_one(batch[0]) : tx_send_glom(batch, n);
+        if (err != CYW_OK) {
+            ERR("TX failed: %d", err);
+            ret = err;
+        }
+
+        while (n > 0) {
+            cyw_pkt_free(batch[--n]);
+        }
+
+        dev->tx_q_since = time_us();
+    }
+
+    return ret;
+}
+
+/*
+ * Drop the rest of the current F2 frame after a bad header, so the next
+ * read starts on a frame boundary again.
+ */
+static void rx_abort(void)
+{
+    uint8_t hi, lo;
+
+    cyw_sdio_write8(SDIO_FUNC_0, CCCR_IO_ABORT, SDIO_FUNC_2);
+    cyw_sdio_write8(SDIO_FUNC_1, SBSDIO_FUNC1_FRAMECTRL, SFC_RF_TERM);
+
+    for (int retry = 0; retry < 10; retry++) {
+        if (cyw_sdio_read8(SDIO_FUNC_1, SBSDIO_FUNC1_RFRAMEBCHI, &hi) != CYW_OK ||
+            cyw_sdio_read8(SDIO_FUNC_1, SBSDIO_FUNC1_RFRAMEBCLO, &lo) != CYW_OK) {
+            break;
+        }
+        if (hi == 0 && lo == 0) {
+            break;
+        }
+    }
+}
+
+/*
+ * Every RX header carries the firmware's TX credit window (highest
+ * sequence number it accepts) and its flow-control bitmap. A window more
+ * than 0x40 ahead is bogus; fall back to a couple of frames.
+ */
+static void rx_update_credit(const sdpcm_header_t *hdr)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint8_t max_seq = hdr->max_seq;
+
+    if ((uint8_t)(max_seq - dev->tx_seq) > 0x40) {
+        ERR("Bad TX credit: seq %u max %u", dev->tx_seq, max_seq);
+        max_seq = dev->tx_seq + 2;
+    }
+
+    dev->tx_max = max_seq;
+    dev->flow_ctrl = hdr->flow_control;
+    dev->rx_seq = hdr->seq;
+}
+
+/*
+ * Round an RX read to what the bus transfers efficiently: whole F2 blocks
+ * once past one block, 32-bit words below that.
+ */
+static uint32_t rx_read_len(uint32_t len, uint32_t cap)
+{
+    if (len > SDIO_F2_BLOCK_SIZE) {
+        len = ALIGN(len, SDIO_F2_BLOCK_SIZE);
+    } else {
+        len = ALIGN(len, 4);
+    }
+    return (len > cap) ? (cap & ~3u) : len;
+}
+
+/*
+ * Read one SDPCM frame straight into an RX pool buffer. On success the
+ * packet's head/len describe the payload and channel is set; the caller
+ * owns the packet. CYW_ERR_NOMEM means no buffer is free: the frame stays
+ * in the chip until one is.
+ *
+ * Every header announces the size of the following frame (next_len), so
+ * a stream of frames costs one CMD53 each. Without a prediction, or when
+ * it falls short, the rest of the frame is fetched with a second read.
+ */
+static cyw_err_t rx_frame(cyw_pkt_t **out)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    sdpcm_header_t *hdr;
+    cyw_pkt_t *pkt;
+    cyw_err_t err;
+    uint16_t frame_len;
+    uint32_t rd_len;
+
+    *out = NULL;
+
+    pkt = cyw_pkt_pool_get(&dev->rx_pool, 0, 0);
+    if (pkt == NULL) {
+        return CYW_ERR_NOMEM;
+    }
+    hdr = (sdpcm_header_t *)pkt->buf;
+
+    /* Predicted length in one go, otherwise the length word first */
+    rd_len = dev->rx_next_len ? rx_read_len(dev->rx_next_len, pkt->cap) : 4;
+    dev->rx_next_len = 0;
+
+    err = sdio_read_bytes(SDIO_FUNC_2, 0, pkt->buf, rd_len, true);
+    if (err != CYW_OK) goto fail;
+
+    frame_len = hdr->len;
+    if (frame_len == 0 && hdr->len_check == 0) {
+        err = CYW_ERR_NOT_READY;        /* No frame pending */
+        goto fail;
+    }
+    if ((hdr->len ^ hdr->len_check) != 0xFFFF || frame_len < SDPCM_HEADER_SIZE) {
+        ERR("SDPCM header checksum error");
+        rx_abort();
+        err = CYW_ERR_INVALID;
+        goto fail;
+    }
+    if (frame_len > pkt->cap) {
+        /* Response to a large IOCTL */
+        pkt = arena_rx(pkt, rd_len, frame_len);
+        if (pkt == NULL) {
+            ERR("RX frame too large: %u", frame_len);
+            rx_abort();
+            return CYW_ERR_INVALID;
+        }
+        hdr = (sdpcm_header_t *)pkt->buf;
+    }
+
+    if (frame_len > rd_len) {
+        /* Rest of the frame lands right behind what was read */
+        if (rd_len > 4) {
+            dev->rx_mispredict++;
+        }
+        err = sdio_read_bytes(SDIO_FUNC_2, 0, pkt->buf + rd_len,
+                              frame_len - rd_len, true);
+        if (err != CYW_OK) goto fail;
+    } else {
+        dev->rx_single++;
+    }
+
+    rx_update_credit(hdr);
+    dev->rx_next_len = hdr->next_len << 4;
+
+    if (hdr->data_offset < SDPCM_HEADER_SIZE || hdr->data_offset > frame_len) {
+        err = CYW_ERR_INVALID;
+        goto fail;
+    }
+
+    /* Hand out the payload in place */
+    pkt->channel = hdr->channel & 0x0F;
+    pkt->head = hdr->data_offset;
+    pkt->len = frame_len - hdr->data_offset;
+
+    *out = pkt;
+    return CYW_OK;
+
+fail:
+    cyw_pkt_free(pkt);
+    return err;
+}
+
+/*
+ * Glom descriptor: the payload lists the lengths of the subframes packed
+ * into the superframe that follows. A descriptor that cannot be honoured
+ * is forgotten; the superframe then arrives as an orphan and is dropped.
+ */
+static cyw_err_t rx_glom_desc(const cyw_pkt_t *pkt)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    const uint8_t *p = cyw_pkt_data(pkt);
+    uint32_t count = pkt->len / 2;
+    uint32_t total = 0;
+
+    dev->rx_glom_count = 0;
+
+    if (count == 0 || count > CYW_RXGLOM_MAX_FRAMES) {
+        goto bad;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint16_t sublen = p[2 * i] | (p[2 * i + 1] << 8);
+
+        /* Subframes must start word aligned for in-place parsing */
+        if (sublen < SDPCM_HEADER_SIZE || (sublen & 3)) {
+            goto bad;
+        }
+        dev->rx_glom_len[i] = sublen;
+        total += sublen;
+    }
+
+    /* The whole superframe has to fit one RX buffer */
+    if (total > dev->rx_pool.buf_size) {
+        goto bad;
+    }
+
+    dev->rx_glom_count = count;
+    return CYW_OK;
+
+bad:
+    ERR("Bad glom descriptor (%u frames, %u bytes)", count, total);
+    dev->rx_glom_drop++;
+    return CYW_ERR_INVALID;
+}
+
+/*
+ * Read the superframe announced by the last descriptor with one CMD53 and
+ * split it into clones of the RX buffer, queued on rx_glom_q. The buffer
+ * returns to the pool once the last subframe is freed.
+ */
+static cyw_err_t rx_superframe(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    sdpcm_header_t *hdr;
+    cyw_pkt_t *super, *sub;
+    uint32_t total = 0, off = 0;
+    cyw_err_t err;
+
+    for (uint32_t i = 0; i < dev->rx_glom_count; i++) {
+        total += dev->rx_glom_len[i];
+    }
+
+    super = cyw_pkt_pool_get(&dev->rx_pool, 0, 0);
+    if (super == NULL) {
+        return CYW_ERR_NOMEM;           /* Superframe waits in the chip */
+    }
+
+    dev->rx_next_len = 0;
+    err = sdio_read_bytes(SDIO_FUNC_2, 0, super->buf, total, true);
+    if (err != CYW_OK) goto out;
+
+    /* First header covers the superframe and announces the frame after it */
+    hdr = (sdpcm_header_t *)super->buf;
+    if ((hdr->len ^ hdr->len_check) != 0xFFFF) {
+        ERR("Superframe header checksum error");
+        err = CYW_ERR_INVALID;
+        goto out;
+    }
+    dev->rx_next_len = hdr->next_len << 4;
+
+    for (uint32_t i = 0; i < dev->rx_glom_count; i++) {
+        uint16_t sublen = dev->rx_glom_len[i];
+        uint16_t flen;
+
+        hdr = (sdpcm_header_t *)(super->buf + off);
+        flen = MIN(hdr->len, sublen);
+        if ((hdr->len ^ hdr->len_check) != 0xFFFF ||
+            hdr->data_offset < SDPCM_HEADER_SIZE || hdr->data_offset > flen) {
+            ERR("Subframe %u header error", i);
+            err = CYW_ERR_INVALID;
+            break;
+        }
+
+        rx_update_credit(hdr);
+
+        sub = cyw_pkt_clone(&dev->rx_clone_pool, super, off + hdr->data_offset,
+                            flen - hdr->data_offset);
+        if (sub != NULL) {
+            sub->channel = hdr->channel & 0x0F;
+            cyw_pkt_queue_push(&dev->rx_glom_q, sub);
+        } else {
+            dev->rx_dropped++;
+        }
+
+        off += sublen;
+    }
+
+out:
+    if (err == CYW_OK) {
+        dev->rx_glom++;
+    } else {
+        dev->rx_glom_drop++;
+    }
+    dev->rx_glom_count = 0;
+    cyw_pkt_free(super);
+    return err;
+}
+
+/*
+ * Next received frame: a subframe left from the last superframe, or a
+ * fresh one from the bus. Superframes are unpacked transparently, so the
+ * caller always sees single frames.
+ */
+static cyw_err_t recv_sdpcm_pkt(cyw_pkt_t **out)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_pkt_t *pkt;
+    cyw_err_t err;
+
+    *out = cyw_pkt_queue_pop(&dev->rx_glom_q);
+    if (*out != NULL) {
+        return CYW_OK;
+    }
+
+    if (dev->rx_glom_count) {
+        err = rx_superframe();
+    } else {
+        err = rx_frame(&pkt);
+        if (err != CYW_OK) return err;
+
+        if (pkt->channel != SDPCM_GLOM_CHANNEL) {
+            *out = pkt;
+            return CYW_OK;
+        }
+
+        if (((sdpcm_header_t *)pkt->buf)->channel & SDPCM_GLOMDESC_FLAG) {
+            err = rx_glom_desc(pkt);
+            cyw_pkt_free(pkt);
+            if (err == CYW_OK) {
+                err = rx_superframe();
+            }
+        } else {
+            ERR("Superframe without descriptor");
+            dev->rx_glom_drop++;
+            cyw_pkt_free(pkt);
+            err = CYW_ERR_INVALID;
+        }
+    }
+    if (err != CYW_OK) return err;
+
+    *out = cyw_pkt_queue_pop(&dev->rx_glom_q);
+    return (*out != NULL) ? CYW_OK : CYW_ERR_NOT_READY;
+}
+
+/*
+ * Strip the BDC header (and the firmware's extra words behind it) off a
+ * data or event frame, taking priority and interface index into the packet.
+ */
+static cyw_err_t rx_pull_bdc(cyw_pkt_t *pkt)
+{
+    const bdc_header_t *bdc = cyw_pkt_pull_hdr(pkt, BDC_HEADER_SIZE);
+
+    if (bdc == NULL ||
+        ((bdc->flags & BCDC_FLAG_VER_MASK) >> BCDC_FLAG_VER_SHIFT) != BCDC_PROTO_VER ||
+        cyw_pkt_pull_hdr(pkt, (uint32_t)bdc->data_offset * 4) == NULL) {
+        return CYW_ERR_INVALID;
+    }
+
+    pkt->prio = bdc->priority & 7;
+    pkt->ifidx = bdc->flags2 & BCDC_FLAG2_IF_MASK;
+    return CYW_OK;
+}
+
+/*
+ * Frames held by rx_data(), BDC already stripped, in arrival order
+ */
+static void rx_data_pend(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_pkt_t *pkt;
+
+    while (!dev->rx_cb_busy && (pkt = cyw_pkt_queue_pop(&dev->rx_pend)) != NULL) {
+        if (dev->rx_cb != NULL) {
+            dev->rx_data++;
+            dev->rx_cb_busy = true;
+            dev->rx_cb(dev->rx_cb_ctx, pkt);
+            dev->rx_cb_busy = false;
+        } else {
+            dev->rx_data_drop++;
+        }
+        cyw_pkt_free(pkt);
+    }
+}
+
+/*
+ * Ethernet frame to the receive callback, which must not be re-entered
+ * (it may be waiting for an IOCTL): hold the frame for cyw_poll() then,
+ * but never with the last free RX buffer.
+ */
+static void rx_data(cyw_pkt_t *pkt)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    if (rx_pull_bdc(pkt) != CYW_OK || pkt->len < CYW_ETH_HDR_LEN ||
+        dev->rx_cb == NULL) {
+        dev->rx_data_drop++;
+        return;
+    }
+
+    if (dev->rx_cb_busy) {
+        if (dev->rx_pool.nfree > 0) {
+            cyw_pkt_queue_push(&dev->rx_pend, cyw_pkt_ref(pkt));
+        } else {
+            dev->rx_dropped++;
+        }
+        return;
+    }
+
+    rx_data_pend();
+
+    dev->rx_data++;
+    dev->rx_cb_busy = true;
+    dev->rx_cb(dev->rx_cb_ctx, pkt);
+    dev->rx_cb_busy = false;
+}
+
+/*
+ * Event frame to the handlers subscribed to its type
+ */
+static void rx_event(cyw_pkt_t *pkt)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    const uint8_t *eth;
+    const bcmeth_header_t *bh;
+    const wl_event_msg_t *msg;
+    cyw_event_t ev;
+    uint32_t datalen;
+    uint8_t subs;
+
+    if (rx_pull_bdc(pkt) != CYW_OK || pkt->len < CYW_EVENT_HDR_LEN) {
+        goto drop;
+    }
+
+    eth = cyw_pkt_data(pkt);
+    bh = (const bcmeth_header_t *)(eth + CYW_ETH_HDR_LEN);
+    msg = (const wl_event_msg_t *)(bh + 1);
+    if (eth[12] != (ETHER_TYPE_BRCM >> 8) || eth[13] != (ETHER_TYPE_BRCM & 0xFF) ||
+        be16(bh->subtype) != BCMILCP_SUBTYPE_VENDOR_LONG ||
+        memcmp(bh->oui, BRCM_OUI, sizeof(bh->oui)) != 0 ||
+        be16(bh->usr_subtype) != BCMILCP_BCM_SUBTYPE_EVENT) {
+        goto drop;
+    }
+
+    ev.type = be32(msg->event_type);
+    datalen = be32(msg->datalen);
+    if (ev.type >= CYW_EVENT_MAX || dev->ev_subs[ev.type] == 0 ||
+        datalen > pkt->len - CYW_EVENT_HDR_LEN) {
+        goto drop;
+    }
+
+    ev.status = be32(msg->status);
+    ev.reason = be32(msg->reason);
+    ev.auth_type = be32(msg->auth_type);
+    ev.flags = be16(msg->flags);
+    memcpy(ev.addr, msg->addr, sizeof(ev.addr));
+    ev.ifidx = msg->ifidx;
+    ev.bsscfgidx = msg->bsscfgidx;
+
+    dev->rx_event++;
+
+    /* Handlers may unregister themselves or others meanwhile */
+    for (subs = dev->ev_subs[ev.type]; subs != 0; subs &= subs - 1) {
+        uint32_t i = __builtin_ctz(subs);
+
+        if (dev->ev_subs[ev.type] & (1u << i)) {
+            dev->ev_handler[i].cb(dev->ev_handler[i].ctx, &ev,
+                                  eth + CYW_EVENT_HDR_LEN, datalen);
+        }
+    }
+    return;
+
+drop:
+    dev->rx_event_drop++;
+}
+
+static void rx_ctrl(cyw_pkt_t *pkt);
+
+/*
+ * Hand a received frame to its consumer. Consumers borrow the packet for
+ * the duration of the call and take a reference to keep it.
+ */
+static void rx_dispatch(cyw_pkt_t *pkt)
+{
+    switch (pkt->channel) {
+        case SDPCM_CONTROL_CHANNEL:
+            rx_ctrl(pkt);
+            break;
+        case SDPCM_EVENT_CHANNEL:
+            rx_event(pkt);
+            break;
+        case SDPCM_DATA_CHANNEL:
+            rx_data(pkt);
+            break;
+        default:
+            break;
+    }
+
+    cyw_pkt_free(pkt);
+}
+
+/*
+ * Receive and dispatch one frame, sending queued ones first
+ * @return true if a frame was received
+ */
+static bool rx_pump(void)
+{
+    cyw_pkt_t *pkt;
+
+    if (g_cyw_dev.tx_q_count > 0) {
+        tx_flush(true);
+    }
+    if (recv_sdpcm_pkt(&pkt) != CYW_OK) {
+        return false;
+    }
+    rx_dispatch(pkt);
+    return true;
+}
+
+/*
+ * Acknowledge the SDIO core interrupt (write 1 to clear) before reading:
+ * frames arriving meanwhile raise it again. Those already queued are read
+ * while rx_irq_more holds.
+ */
+static void rx_irq_ack(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    const uint32_t reg = SDIO_CORE_BASE_ADDR + SDIO_CORE_INTSTATUS;
+    uint32_t intstatus;
+
+    if (cyw_sdio_read32(reg, &intstatus) != CYW_OK) {
+        return;
+    }
+    if (intstatus != 0) {
+        cyw_sdio_write32(reg, intstatus);
+    }
+    if (intstatus & I_HMB_FRAME_IND) {
+        dev->rx_irq_more = true;
+    }
+}
+
+/*============================================================================
+ * BCDC Commands
+ *============================================================================*/
+
+static cyw_ioctl_req_t *ioctl_find(uint16_t reqid)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    for (uint32_t i = 0; i < CYW_IOCTL_MAX_PENDING; i++) {
+        if (dev->ioctl[i].busy && dev->ioctl[i].reqid == reqid) {
+            return &dev->ioctl[i];
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Free the slot, then report: the callback may issue the next request
+ */
+static void ioctl_complete(cyw_ioctl_req_t *req, cyw_err_t err,
+                           const uint8_t *resp, uint32_t len)
+{
+    cyw_ioctl_cb_t cb = req->cb;
+    void *ctx = req->ctx;
+
+    req->busy = false;
+    g_cyw_dev.ioctl_pending--;
+    if (req->arena) {
+        g_cyw_dev.ioctl_arena &= ~ARENA_REQ;
+    }
+
+    if (cb != NULL) {
+        cb(ctx, err, resp, len);
+    }
+}
+
+/*
+ * Give up on a request: if it is still waiting for credit, it must not
+ * go out late.
+ */
+static void ioctl_cancel(cyw_ioctl_req_t *req, cyw_err_t err)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_pkt_queue_t *q = &dev->txq[CYW_TXQ_CTRL];
+
+    for (cyw_pkt_t *pkt = q->head; pkt != NULL; pkt = pkt->next) {
+        const bcdc_header_t *bcdc = (const bcdc_header_t *)cyw_pkt_data(pkt);
+
+        if ((uint16_t)(bcdc->flags >> 16) == req->reqid) {
+            cyw_pkt_queue_remove(q, pkt);
+            dev->tx_q_count--;
+            dev->tx_q_bytes -= cyw_pkt_frame_len(pkt);
+            cyw_pkt_free(pkt);
+            break;
+        }
+    }
+
+    ioctl_complete(req, err, NULL, 0);
+}
+
+/*
+ * Time out requests past their deadline
+ */
+static void ioctl_expire(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint32_t now;
+
+    if (dev->ioctl_pending == 0 || dev->ops->get_time_us == NULL) {
+        return;
+    }
+
+    now = time_us();
+    for (uint32_t i = 0; i < CYW_IOCTL_MAX_PENDING; i++) {
+        cyw_ioctl_req_t *req = &dev->ioctl[i];
+
+        if (req->busy && (int32_t)(now - req->deadline) >= 0) {
+            ERR("IOCTL %u timed out", req->reqid);
+            dev->ioctl_timeout++;
+            ioctl_cancel(req, CYW_ERR_TIMEOUT);
+        }
+    }
+}
+
+/*
+ * IOCTL response to the request with its reqid
+ */
+static void rx_ctrl(cyw_pkt_t *pkt)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    const bcdc_header_t *bcdc = (const bcdc_header_t *)cyw_pkt_data(pkt);
+    cyw_ioctl_req_t *req;
+    uint32_t n;
+
+    if (pkt->len < BCDC_HEADER_SIZE) {
+        return;
+    }
+
+    req = ioctl_find((uint16_t)(bcdc->flags >> 16));
+    if (req == NULL) {
+        /* Timed out or cancelled already */
+        DBG("IOCTL response %u unclaimed", (unsigned)(bcdc->flags >> 16));
+        dev->ioctl_orphan++;
+        return;
+    }
+
+    if (bcdc->status != 0) {
+        ERR("IOCTL error: %d", bcdc->status);
+        ioctl_complete(req, CYW_ERROR, NULL, 0);
+        return;
+    }
+
+    n = pkt->len - BCDC_HEADER_SIZE;
+    if (n > bcdc->len) n = bcdc->len;
+    ioctl_complete(req, CYW_OK, cyw_pkt_data(pkt) + BCDC_HEADER_SIZE, n);
+}
+
+cyw_err_t cyw_ioctl_async(uint32_t cmd, cyw_pkt_t *pkt, bool set,
+                          uint32_t timeout_ms, cyw_ioctl_cb_t cb, void *ctx)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_ioctl_req_t *req = NULL;
+    bcdc_header_t *bcdc;
+    cyw_err_t err;
+    uint32_t len;
+
+    if (pkt == NULL) {
+        return CYW_ERR_INVALID;
+    }
+
+    if (dev->state < CYW_STATE_FW_READY) {
+        cyw_pkt_free(pkt);
+        return CYW_ERR_NOT_READY;
+    }
+
+    for (uint32_t i = 0; i < CYW_IOCTL_MAX_PENDING; i++) {
+        if (!dev->ioctl[i].busy) {
+            req = &dev->ioctl[i];
+            break;
+        }
+    }
+    if (req == NULL) {
+        cyw_pkt_free(pkt);
+        return CYW_ERR_BUSY;
+    }
+
+    /* Build BCDC header in front of the payload */
+    len = pkt->len;
+    bcdc = cyw_pkt_push_hdr(pkt, BCDC_HEADER_SIZE);
+    if (bcdc == NULL) {
+        cyw_pkt_free(pkt);
+        return CYW_ERR_NOMEM;
+    }
+
+    req->reqid = dev->reqid++;
+    bcdc->cmd = cmd;
+    bcdc->len = len;
+    bcdc->flags = (BCDC_PROTO_VER << BCDC_FLAG_VER_SHIFT) |
+                  (set ? 0x02 : 0) |
+                  ((uint32_t)req->reqid << 16);
+    bcdc->status = 0;
+
+    if (timeout_ms == 0) {
+        timeout_ms = CYW_IOCTL_TIMEOUT_MS;
+    }
+    req->cb = cb;
+    req->ctx = ctx;
+    req->deadline = time_us() + timeout_ms * 1000;
+    req->busy = true;
+    dev->ioctl_pending++;
+
+    /* A large request keeps the arena for its response */
+    req->arena = arena_owns(pkt);
+    if (req->arena) {
+        dev->ioctl_arena |= ARENA_REQ;
+    }
+
+    /* Send via control channel, with whatever is queued */
+    err = tx_enqueue(SDPCM_CONTROL_CHANNEL, pkt);
+    if (err == CYW_OK) {
+        err = tx_flush(true);
+    }
+    if (err != CYW_OK) {
+        req->cb = NULL;
+        ioctl_cancel(req, err);
+    }
+    return err;
+}
+
+/* Synchronous request: completion lands here */
+typedef struct {
+    void *resp;
+    uint32_t resp_len;
+    cyw_err_t err;
+    bool done;
+} ioctl_wait_t;
+
+static void ioctl_wake(void *ctx, cyw_err_t err, const uint8_t *resp, uint32_t len)
+{
+    ioctl_wait_t *w = ctx;
+
+    if (err == CYW_OK && w->resp != NULL) {
+        memcpy(w->resp, resp, (len < w->resp_len) ? len : w->resp_len);
+    }
+    w->err = err;
+    w->done = true;
+}
+
+/*
+ * One step of a synchronous wait: receive a frame and expire requests,
+ * idling CYW_IOCTL_POLL_US when nothing came in. Expiry runs every step,
+ * so a lost response times out under steady traffic too; the idle count
+ * stands in for the deadline on hosts without a clock.
+ * @return false once idle for longer than an IOCTL timeout
+ */
+static bool ioctl_wait_step(uint32_t *idle)
+{
+    uint8_t pending = g_cyw_dev.ioctl_pending;
+    bool rx = rx_pump();
+
+    ioctl_expire();
+    if (rx || g_cyw_dev.ioctl_pending != pending) {
+        return true;
+    }
+    if (++*idle > CYW_IOCTL_TIMEOUT_MS * 1000 / CYW_IOCTL_POLL_US) {
+        return false;
+    }
+    delay_us(CYW_IOCTL_POLL_US);
+    return true;
+}
+
+/*
+ * Time out a request the clock never expired
+ */
+static void ioctl_give_up(cyw_ioctl_req_t *req)
+{
+    ERR("IOCTL %u timed out", req->reqid);
+    g_cyw_dev.ioctl_timeout++;
+    ioctl_cancel(req, CYW_ERR_TIMEOUT);
+}
+
+cyw_err_t cyw_ioctl_pkt(uint32_t cmd, cyw_pkt_t *pkt, bool set,
+                        void *resp, uint32_t resp_len)
+{
+    ioctl_wait_t w = { resp, resp_len, CYW_ERR_TIMEOUT, false };
+    uint16_t reqid = g_cyw_dev.reqid;
+    uint32_t idle = 0;
+    cyw_err_t err;
+
+    err = cyw_ioctl_async(cmd, pkt, set, CYW_IOCTL_TIMEOUT_MS, ioctl_wake, &w);
+    if (err != CYW_OK) return err;
+
+    /* Receive until the response is in */
+    while (!w.done) {
+        if (!ioctl_wait_step(&idle)) {
+            ioctl_give_up(ioctl_find(reqid));
+        }
+    }
+
+    return w.err;
+}
+
+/*
+ * IOCTL request written straight into a TX buffer, or into the arena when
+ * too large for one: the IOCTL buffer, or an iovar name + \0 + value. GET
+ * requests carry their input too (zeroed without data).
+ * @return CYW_OK, CYW_ERR_BUSY if the arena is taken, else CYW_ERR_NOMEM
+ */
+static cyw_err_t ioctl_build(const char *name, const void *data, uint32_t len,
+                             cyw_pkt_t **out)
+{
+    uint32_t name_len = (name != NULL) ? strlen(name) + 1 : 0;
+    cyw_pkt_t *pkt;
+    uint8_t *p;
+
+    if (CYW_PKT_HEADROOM + name_len + len <= CYW_PKT_BUF_SIZE) {
+        pkt = cyw_pkt_alloc(CYW_PKT_HEADROOM, name_len + len);
+    } else if (g_cyw_dev.ioctl_arena != 0 && name_len + len <= CYW_IOCTL_MAX_LEN) {
+        return CYW_ERR_BUSY;
+    } else {
+        pkt = arena_tx(name_len + len);
+    }
+    if (pkt == NULL) {
+        return CYW_ERR_NOMEM;
+    }
+
+    p = cyw_pkt_data(pkt);
+    if (name_len > 0) {
+        memcpy(p, name, name_len);
+    }
+    if (len > 0) {
+        if (data != NULL) {
+            memcpy(p + name_len, data, len);
+        } else {
+            memset(p + name_len, 0, len);
+        }
+    }
+    *out = pkt;
+    return CYW_OK;
+}
+
+cyw_err_t cyw_ioctl(uint32_t cmd, void *data, uint32_t len, bool set)
+{
+    cyw_pkt_t *pkt;
+    cyw_err_t err;
+
+    if (g_cyw_dev.state < CYW_STATE_FW_READY) {
+        return CYW_ERR_NOT_READY;
+    }
+
+    err = ioctl_build(NULL, data, len, &pkt);
+    if (err != CYW_OK) return err;
+
+    return cyw_ioctl_pkt(cmd, pkt, set, set ? NULL : data, len);
+}
+
+cyw_err_t cyw_iovar(const char *name, void *data, uint32_t len, bool set)
+{
+    cyw_pkt_t *pkt;
+    cyw_err_t err;
+
+    if (g_cyw_dev.state < CYW_STATE_FW_READY) {
+        return CYW_ERR_NOT_READY;
+    }
+
+    err = ioctl_build(name, data, len, &pkt);
+    if (err != CYW_OK) return err;
+
+    /* GET_VAR returns the value at the start of the buffer */
+    return cyw_ioctl_pkt(set ? WLC_SET_VAR : WLC_GET_VAR, pkt, set,
+                         set ? NULL : data, len);
+}
+
+/*
+ * Batch op completion: status, and the value for a GET
+ */
+static void ioctl_op_done(void *ctx, cyw_err_t err, const uint8_t *resp, uint32_t len)
+{
+    cyw_ioctl_op_t *op = ctx;
+
+    if (err == CYW_OK && !op->set && op->data != NULL) {
+        memcpy(op->data, resp, (len < op->len) ? len : op->len);
+    }
+    op->status = err;
+}
+
+cyw_err_t cyw_ioctl_batch(cyw_ioctl_op_t *ops, uint32_t count)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_err_t err = CYW_OK;
+    uint32_t next = 0, idle = 0;
+
+    if (ops == NULL) {
+        return CYW_ERR_INVALID;
+    }
+    if (dev->state < CYW_STATE_FW_READY) {
+        return CYW_ERR_NOT_READY;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        ops[i].status = CYW_ERR_NOT_READY;
+    }
+
+    /*
+     * In flight: IOCTL_OP_INFLIGHT until the callback stores the result.
+     * CYW_ERR_BUSY stays an error (arena taken with nothing in flight).
+     */
+    for (;;) {
+        uint32_t inflight = 0;
+
+        for (uint32_t i = 0; i < next; i++) {
+            if (ops[i].status == IOCTL_OP_INFLIGHT) {
+                inflight++;
+            } else if (ops[i].status != CYW_OK && err == CYW_OK) {
+                err = ops[i].status;
+            }
+        }
+
+        /* Keep the pipe full while the firmware has credit for more */
+        while (err == CYW_OK && next < count && inflight < CYW_IOCTL_PIPELINE &&
+               dev->ioctl_pending < CYW_IOCTL_MAX_PENDING &&
+               (inflight == 0 || tx_credits() > 0)) {
+            cyw_ioctl_op_t *op = &ops[next];
+            cyw_pkt_t *pkt;
+            cyw_err_t e = ioctl_build(op->name, op->data, op->len, &pkt);
+
+            if (e == CYW_ERR_BUSY && inflight > 0) {
+                /* Large op behind another: goes once the arena is back */
+                break;
+            }
+            next++;
+
+            if (e == CYW_OK) {
+                op->status = IOCTL_OP_INFLIGHT;
+                e = cyw_ioctl_async(op->cmd, pkt, op->set, CYW_IOCTL_TIMEOUT_MS,
+                                    ioctl_op_done, op);
+            }
+            if (e != CYW_OK) {
+                op->status = e;
+                err = e;
+                break;
+            }
+            inflight++;
+        }
+
+        if (inflight == 0 && (err != CYW_OK || next == count)) {
+            break;
+        }
+
+        if (!ioctl_wait_step(&idle)) {
+            for (uint32_t i = 0; i < CYW_IOCTL_MAX_PENDING; i++) {
+                cyw_ioctl_req_t *req = &dev->ioctl[i];
+
+                if (req->busy && req->cb == ioctl_op_done &&
+                    (cyw_ioctl_op_t *)req->ctx >= ops &&
+                    (cyw_ioctl_op_t *)req->ctx < ops + count) {
+                    ioctl_give_up(req);
+                }
+            }
+        }
+    }
+
+    return err;
+}
+
+/*============================================================================
+ * Initialization
+ *============================================================================*/
+
+static cyw_err_t sdio_init_card(void)
+{
+    cyw_err_t err;
+    uint8_t val;
+
+    /* Enable function 1 */
+    if (g_cyw_dev.ops->enable_func) {
+        g_cyw_dev.ops->enable_func(SDIO_FUNC_1, true);
+    }
+
+    /* Wait for function 1 ready */
+    int timeout = 100;
+    while (timeout-- > 0) {
+        err = cyw_sdio_read8(SDIO_FUNC_0, CCCR_IO_READY, &val);
+        if (err == CYW_OK && (val & SDIO_FUNC_READY_1)) {
+            break;
+        }
+        delay_ms(1);
+    }
+    if (timeout <= 0) {
+        ERR("Function 1 not ready");
+        return CYW_ERR_TIMEOUT;
+    }
+
+    /* Set block sizes */
+    if (g_cyw_dev.ops->set_block_size) {
+        g_cyw_dev.ops->set_block_size(SDIO_FUNC_1, SDIO_F1_BLOCK_SIZE);
+        g_cyw_dev.ops->set_block_size(SDIO_FUNC_2, SDIO_F2_BLOCK_SIZE);
+    }
+
+    /* Request ALP clock */
+    err = request_alp_clock();
+    if (err != CYW_OK) return err;
+
+    /* Detect chip */
+    err = detect_chip();
+    if (err != CYW_OK) return err;
+
+    /* Enable function 2 */
+    if (g_cyw_dev.ops->enable_func) {
+        g_cyw_dev.ops->enable_func(SDIO_FUNC_2, true);
+    }
+
+    /* Wait for function 2 ready */
+    timeout = 100;
+    while (timeout-- > 0) {
+        err = cyw_sdio_read8(SDIO_FUNC_0, CCCR_IO_READY, &val);
+        if (err == CYW_OK && (val & SDIO_FUNC_READY_2)) {
+            break;
+        }
+        delay_ms(1);
+    }
+    if (timeout <= 0) {
+        ERR("Function 2 not ready");
+        return CYW_ERR_TIMEOUT;
+    }
+
+    /* Set F2 watermark */
+    err = cyw_sdio_write8(SDIO_FUNC_1, SBSDIO_WATERMARK, CYW55500_F2_WATERMARK);
+    if (err != CYW_OK) return err;
+
+    /* Enable interrupts */
+    err = cyw_sdio_write8(SDIO_FUNC_0, CCCR_INT_ENABLE,
+                          CCCR_IEN_FUNC0 | CCCR_IEN_FUNC1 | CCCR_IEN_FUNC2);
+    if (err != CYW_OK) return err;
+
+    DBG("SDIO card initialized");
+    return CYW_OK;
+}
+
+static void scan_init(void);
+static void link_init(void);
+
+cyw_err_t cyw_init(const sdio_host_ops_t *ops)
+{
+    cyw_err_t err;
+
+    if (ops == NULL) {
+        return CYW_ERR_INVALID;
+    }
+
+    memset(&g_cyw_dev, 0, sizeof(g_cyw_dev));
+    g_cyw_dev.ops = ops;
+    g_cyw_dev.state = CYW_STATE_OFF;
+
+    cyw_pkt_pool_init(&g_cyw_dev.tx_pool, CYW_PKT_BUF_SIZE);
+    cyw_pkt_pool_add(&g_cyw_dev.tx_pool, g_tx_pool_mem, sizeof(g_tx_pool_mem));
+    cyw_pkt_pool_init(&g_cyw_dev.rx_pool, CYW_PKT_BUF_SIZE);
+    cyw_pkt_pool_add(&g_cyw_dev.rx_pool, g_rx_pool_mem, sizeof(g_rx_pool_mem));
+    cyw_pkt_pool_init(&g_cyw_dev.rx_clone_pool, 0);
+    cyw_pkt_pool_add(&g_cyw_dev.rx_clone_pool, g_rx_clone_mem, sizeof(g_rx_clone_mem));
+    cyw_pkt_pool_init(&g_cyw_dev.tx_wrap_pool, 0);
+    cyw_pkt_pool_add(&g_cyw_dev.tx_wrap_pool, g_tx_wrap_mem, sizeof(g_tx_wrap_mem));
+
+    scan_init();
+    link_init();
+
+    /* Initialize SDIO host */
+    if (ops->init) {
+        int ret = ops->init();
+        if (ret != 0) {
+            ERR("SDIO host init failed");
+            return CYW_ERR_IO;
+        }
+    }
+
+    /* Initialize card */
+    err = sdio_init_card();
+    if (err != CYW_OK) {
+        ERR("Card init failed");
+        return err;
+    }
+
+    g_cyw_dev.state = CYW_STATE_INIT;
+    DBG("CYW55500 driver initialized");
+
+    return CYW_OK;
+}
+
+void cyw_deinit(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    if (dev->state != CYW_STATE_OFF) {
+        /* Nothing answers outstanding IOCTLs any more */
+        for (uint32_t i = 0; i < CYW_IOCTL_MAX_PENDING; i++) {
+            if (dev->ioctl[i].busy) {
+                ioctl_complete(&dev->ioctl[i], CYW_ERR_NOT_READY, NULL, 0);
+            }
+        }
+
+        /* Disable interrupts */
+        cyw_sdio_write8(SDIO_FUNC_0, CCCR_INT_ENABLE, 0);
+
+        /* Disable functions */
+        if (dev->ops->enable_func) {
+            dev->ops->enable_func(SDIO_FUNC_2, false);
+            dev->ops->enable_func(SDIO_FUNC_1, false);
+        }
+
+        /* Deinit host */
+        if (dev->ops->deinit) {
+            dev->ops->deinit();
+        }
+
+        dev->state = CYW_STATE_OFF;
+    }
+}
+
+/*============================================================================
+ * Firmware Events
+ *============================================================================*/
+
+/*
+ * Program the union of all subscriptions into the firmware, unless it
+ * has it already
+ */
+static cyw_err_t event_mask_program(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint8_t mask[WL_EVENTING_MASK_LEN];
+    cyw_err_t err;
+
+    memset(mask, 0, sizeof(mask));
+    for (uint32_t e = 0; e < CYW_EVENT_MAX; e++) {
+        if (dev->ev_subs[e] != 0) {
+            mask[e >> 3] |= 1u << (e & 7);
+        }
+    }
+
+    if (dev->ev_mask_valid && memcmp(mask, dev->ev_mask, sizeof(mask)) == 0) {
+        return CYW_OK;
+    }
+
+    err = cyw_iovar("event_msgs", mask, sizeof(mask), true);
+    if (err == CYW_OK) {
+        memcpy(dev->ev_mask, mask, sizeof(mask));
+        dev->ev_mask_valid = true;
+    }
+    return err;
+}
+
+/* Subscriptions changed: before the interface is up, cyw_up() programs them */
+static cyw_err_t event_mask_sync(void)
+{
+    if (g_cyw_dev.state < CYW_STATE_UP) {
+        return CYW_OK;
+    }
+    return event_mask_program();
+}
+
+static int event_find(cyw_event_cb_t cb, void *ctx)
+{
+    for (int i = 0; i < CYW_EVENT_HANDLERS; i++) {
+        if (g_cyw_dev.ev_handler[i].cb == cb && g_cyw_dev.ev_handler[i].ctx == ctx) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+cyw_err_t cyw_event_register(const uint16_t *events, uint32_t count,
+                             cyw_event_cb_t cb, void *ctx)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    int slot;
+
+    if (cb == NULL || (events == NULL && count > 0)) {
+        return CYW_ERR_INVALID;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        if (events[i] >= CYW_EVENT_MAX) {
+            return CYW_ERR_INVALID;
+        }
+    }
+
+    slot = event_find(cb, ctx);
+    if (slot < 0) {
+        slot = event_find(NULL, NULL);
+        if (slot < 0) {
+            return CYW_ERR_NOMEM;
+        }
+        dev->ev_handler[slot].cb = cb;
+        dev->ev_handler[slot].ctx = ctx;
+    }
+
+    for (uint32_t i = 0; i < count; i++) {
+        dev->ev_subs[events[i]] |= 1u << slot;
+    }
+
+    return event_mask_sync();
+}
+
+cyw_err_t cyw_event_unregister(cyw_event_cb_t cb, void *ctx)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    int slot = (cb != NULL) ? event_find(cb, ctx) : -1;
+
+    if (slot < 0) {
+        return CYW_ERR_INVALID;
+    }
+
+    for (uint32_t e = 0; e < CYW_EVENT_MAX; e++) {
+        dev->ev_subs[e] &= ~(1u << slot);
+    }
+    dev->ev_handler[slot].cb = NULL;
+    dev->ev_handler[slot].ctx = NULL;
+
+    return event_mask_sync();
+}
+
+/*============================================================================
+ * Link State
+ *============================================================================*/
+
+static void link_set(bool up, const uint8_t *bssid, uint32_t reason)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    if (up) {
+        memcpy(dev->link_bssid, bssid, sizeof(dev->link_bssid));
+    }
+    if (dev->link_up == up) {
+        return;
+    }
+
+    dev->link_up = up;
+    if (!up) {
+        memset(dev->link_bssid, 0, sizeof(dev->link_bssid));
+    }
+    DBG("Link %s (%u)", up ? "up" : "down", (unsigned int)reason);
+
+    if (dev->link_cb != NULL) {
+        dev->link_cb(dev->link_cb_ctx, up, reason);
+    }
+}
+
+static void link_event(void *ctx, const cyw_event_t *ev, const uint8_t *data, uint32_t len)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    (void)ctx;
+    (void)data;
+    (void)len;
+
+    switch (ev->type) {
+        case WLC_E_LINK:
+            link_set((ev->flags & WLC_EVENT_MSG_LINK) != 0, ev->addr, ev->reason);
+            break;
+
+        case WLC_E_SET_SSID:
+            /* Join result: a failure ends the wait in cyw_connect() */
+            if (ev->status == WLC_E_STATUS_ABORT || ev->status == WLC_E_STATUS_NEWASSOC) {
+                break;                      /* Superseded by a newer join */
+            }
+            if (ev->status == WLC_E_STATUS_SUCCESS) {
+                dev->join_status = CYW_OK;
+            } else {
+                dev->join_status = (ev->status == WLC_E_STATUS_TIMEOUT) ? CYW_ERR_TIMEOUT
+                                                                        : CYW_ERROR;
+                link_set(false, NULL, 0);   /* A status, not an 802.11 reason */
+            }
+            break;
+
+        default:
+            /* Deauthenticated or disassociated, by us or the AP (not an old one) */
+            if (memcmp(ev->addr, dev->link_bssid, sizeof(dev->link_bssid)) == 0) {
+                link_set(false, NULL, ev->reason);
+            }
+            break;
+    }
+}
+
+static void link_init(void)
+{
+    static const uint16_t events[] = {
+        WLC_E_LINK, WLC_E_SET_SSID, WLC_E_DEAUTH, WLC_E_DEAUTH_IND,
+        WLC_E_DISASSOC, WLC_E_DISASSOC_IND,
+    };
+
+    cyw_event_register(events, ARRAY_SIZE(events), link_event, NULL);
+}
+
+void cyw_set_link_callback(cyw_link_cb_t cb, void *ctx)
+{
+    g_cyw_dev.link_cb_ctx = ctx;
+    g_cyw_dev.link_cb = cb;
+}
+
+/*============================================================================
+ * Join
+ *============================================================================*/
+
+/*
+ * Wait for the join result and the link. The bus is read directly, as in
+ * an IOCTL wait, so hosts that cannot report interrupts see the events
+ * too. The deadline is on the host clock, or idle milliseconds without one.
+ */
+static cyw_err_t join_wait(uint32_t timeout_ms)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint32_t start = time_us();
+    uint32_t idle = 0;
+
+    for (;;) {
+        bool busy = rx_pump();
+
+        cyw_poll();
+        if (dev->join_status == CYW_OK && dev->link_up) {
+            return CYW_OK;
+        }
+        if (dev->join_status != CYW_OK && dev->join_status != CYW_ERR_BUSY) {
+            return dev->join_status;
+        }
+        if (dev->ops->get_time_us ? time_us() - start >= timeout_ms * 1000u
+                                  : idle >= timeout_ms) {
+            break;
+        }
+        if (!busy) {
+            delay_ms(1);
+            idle++;
+        }
+    }
+
+    dev->join_status = CYW_ERR_TIMEOUT;
+    return CYW_ERR_TIMEOUT;
+}
+
+/*
+ * Directed join: the join scan covers only the cached channel and the
+ * association only the cached BSSID
+ */
+static cyw_err_t join_fast(const cyw_join_cache_t *jc)
+{
+    wl_extjoin_params_t join;
+    cyw_err_t err;
+
+    memset(&join, 0, sizeof(join));
+    join.ssid_len = jc->ssid_len;
+    memcpy(join.ssid, jc->ssid, jc->ssid_len);
+    join.scan_type = -1;
+    join.nprobes = -1;
+    join.active_time = -1;
+    join.passive_time = -1;
+    join.home_time = -1;
+    memcpy(join.bssid, jc->bssid, sizeof(join.bssid));
+    join.chanspec_num = 1;
+    join.chanspec_list[0] = jc->chanspec;
+
+    g_cyw_dev.join_status = CYW_ERR_BUSY;
+    err = cyw_iovar("join", &join, sizeof(join), true);
+    if (err != CYW_OK) {
+        return err;
+    }
+
+    return join_wait(CYW_FAST_JOIN_TIMEOUT_MS);
+}
+
+/* Remember the BSS just joined; emptied if its channel cannot be read */
+static void join_cache_update(const char *ssid, uint32_t ssid_len,
+                              uint32_t wpa_auth, uint32_t wsec)
+{
+    cyw_join_cache_t *jc = &g_cyw_dev.join_cache;
+    uint32_t chanspec = 0;
+
+    memset(jc, 0, sizeof(*jc));
+    if (cyw_iovar("chanspec", &chanspec, sizeof(chanspec), false) != CYW_OK) {
+        return;
+    }
+
+    memcpy(jc->ssid, ssid, ssid_len);
+    jc->ssid_len = ssid_len;
+    memcpy(jc->bssid, g_cyw_dev.link_bssid, sizeof(jc->bssid));
+    jc->chanspec = chanspec;
+    jc->wpa_auth = wpa_auth;
+    jc->wsec = wsec;
+}
+
+cyw_err_t cyw_get_join_cache(cyw_join_cache_t *cache)
+{
+    if (cache == NULL) {
+        return CYW_ERR_INVALID;
+    }
+    *cache = g_cyw_dev.join_cache;
+    return (cache->ssid_len != 0) ? CYW_OK : CYW_ERROR;
+}
+
+void cyw_set_join_cache(const cyw_join_cache_t *cache)
+{
+    cyw_join_cache_t *jc = &g_cyw_dev.join_cache;
+
+    if (cache == NULL || cache->ssid_len > sizeof(jc->ssid)) {
+        memset(jc, 0, sizeof(*jc));
+        return;
+    }
+    *jc = *cache;
+}
+
+/*============================================================================
+ * WiFi Operations
+ *============================================================================*/
+
+cyw_err_t cyw_up(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    if (dev->state < CYW_STATE_FW_READY) {
+        return CYW_ERR_NOT_READY;
+    }
+
+    /*
+     * Let frames and flow-control changes raise the host's SDIO interrupt;
+     * anything queued before that is read without one
+     */
+    if (dev->ops->irq_pending) {
+        if (cyw_sdio_write32(SDIO_CORE_BASE_ADDR + SDIO_CORE_HOSTINTMASK,
+                             SDIO_HOSTINTMASK) != CYW_OK) {
+            ERR("HOSTINTMASK write failed");
+        }
+        dev->rx_irq_more = true;
+    }
+
+    /* Glom iovars are named from the firmware's side */
+#if CYW_RXGLOM
+    /* Firmware superframes must fit one RX buffer */
+    uint32_t txglom = CYW_RXGLOM_MAX_FRAMES;
+    if (cyw_iovar("bus:txglom", &txglom, sizeof(txglom), true) != CYW_OK) {
+        DBG("bus:txglom not supported");
+    }
+#endif
+#if CYW_TXGLOM
+    /* Host superframes need a gathering host and a firmware that takes them */
+    if (dev->ops->cmd53_write_sg && !dev->txglom) {
+        uint32_t rxglom = 1;
+        if (cyw_iovar("bus:rxglom", &rxglom, sizeof(rxglom), true) == CYW_OK) {
+            dev->txglom = true;
+        }
+    }
+#endif
+
+    /* A freshly started firmware reports everything: narrow it down first */
+    dev->ev_mask_valid = false;
+    if (event_mask_program() != CYW_OK) {
+        ERR("event_msgs failed");
+    }
+
+    cyw_err_t err = cyw_ioctl(WLC_UP, NULL, 0, true);
+    if (err == CYW_OK) {
+        dev->state = CYW_STATE_UP;
+    }
+    return err;
+}
+
+cyw_err_t cyw_down(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    if (dev->state < CYW_STATE_FW_READY) {
+        return CYW_ERR_NOT_READY;
+    }
+
+    cyw_err_t err = cyw_ioctl(WLC_DOWN, NULL, 0, true);
+    if (err == CYW_OK) {
+        dev->state = CYW_STATE_FW_READY;
+        link_set(false, NULL, 0);
+    }
+    return err;
+}
+
+cyw_err_t cyw_connect(const char *ssid, const char *passphrase)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    const cyw_join_cache_t *jc = &dev->join_cache;
+    uint32_t infra = 1;
+    uint32_t auth = 0;                  /* Open System */
+    uint32_t wpa_auth = WPA_AUTH_DISABLED;
+    uint32_t wsec = WSEC_NONE;
+    cyw_err_t err;
+
+    struct __attribute__((packed)) {
+        uint16_t key_len;
+        uint16_t flags;
+        uint8_t key[64];
+    } pmk;
+
+    struct __attribute__((packed)) {
+        uint32_t ssid_len;
+        char ssid[32];
+    } wlc_ssid;
+
+    if (dev->state < CYW_STATE_UP) {
+        return CYW_ERR_NOT_READY;
+    }
+    if (ssid == NULL) {
+        return CYW_ERR_INVALID;
+    }
+
+    memset(&pmk, 0, sizeof(pmk));
+    if (passphrase != NULL && passphrase[0] != '\0') {
+        pmk.key_len = strlen(passphrase);
+        if (pmk.key_len < 8 || pmk.key_len > 63) {
+            return CYW_ERR_INVALID;
+        }
+        pmk.flags = WSEC_PASSPHRASE;
+        memcpy(pmk.key, passphrase, pmk.key_len);
+        wpa_auth = WPA2_AUTH_PSK;
+        wsec = WSEC_AES_ENABLED;
+    }
+
+    /* Security profile in one round of the pipe; the PMK only with a key */
+    cyw_ioctl_op_t profile[] = {
+        CYW_IOCTL_SET(WLC_SET_INFRA, &infra, sizeof(infra)),
+        CYW_IOCTL_SET(WLC_SET_AUTH, &auth, sizeof(auth)),
+        CYW_IOVAR_SET("wpa_auth", &wpa_auth, sizeof(wpa_auth)),
+        CYW_IOCTL_SET(WLC_SET_WSEC, &wsec, sizeof(wsec)),
+        CYW_IOCTL_SET(WLC_SET_WSEC_PMK, &pmk, sizeof(pmk)),
+    };
+
+    err = cyw_ioctl_batch(profile, (pmk.key_len > 0) ? ARRAY_SIZE(profile)
+                                                     : ARRAY_SIZE(profile) - 1);
+    if (err != CYW_OK) return err;
+
+    /* The join goes last, only once the whole profile is in */
+    memset(&wlc_ssid, 0, sizeof(wlc_ssid));
+    wlc_ssid.ssid_len = strlen(ssid);
+    if (wlc_ssid.ssid_len > sizeof(wlc_ssid.ssid)) {
+        wlc_ssid.ssid_len = sizeof(wlc_ssid.ssid);
+    }
+    memcpy(wlc_ssid.ssid, ssid, wlc_ssid.ssid_len);
+
+    DBG("Connecting to %s...", ssid);
+
+    /* Same network and security as last time: straight to the cached BSS */
+    if (jc->ssid_len == wlc_ssid.ssid_len &&
+        memcmp(jc->ssid, wlc_ssid.ssid, wlc_ssid.ssid_len) == 0 &&
+        jc->wpa_auth == wpa_auth && jc->wsec == wsec) {
+        err = join_fast(jc);
+        if (err == CYW_OK) {
+            dev->join_stat_fast++;
+            DBG("Connected (cached BSS)");
+            return CYW_OK;
+        }
+        dev->join_stat_fast_fail++;
+        DBG("Directed join failed (%d), scanning", err);
+    }
+
+    dev->join_status = CYW_ERR_BUSY;
+    err = cyw_ioctl(WLC_SET_SSID, &wlc_ssid, sizeof(wlc_ssid), true);
+    if (err != CYW_OK) return err;
+
+    err = join_wait(CYW_CONNECT_TIMEOUT_MS);
+    if (err != CYW_OK) {
+        ERR("Join failed: %d", err);
+        return err;
+    }
+
+    dev->join_stat_full++;
+    join_cache_update(wlc_ssid.ssid, wlc_ssid.ssid_len, wpa_auth, wsec);
+    DBG("Connected");
+    return CYW_OK;
+}
+
+cyw_err_t cyw_disconnect(void)
+{
+    return cyw_ioctl(WLC_DISASSOC, NULL, 0, true);
+}
+
+bool cyw_is_connected(void)
+{
+    return g_cyw_dev.link_up;
+}
+
+int cyw_get_rssi(void)
+{
+    int32_t rssi = 0;
+
+    if (cyw_ioctl(WLC_GET_RSSI, &rssi, sizeof(rssi), false) != CYW_OK) {
+        return 0;
+    }
+    return rssi;
+}
+
+cyw_err_t cyw_get_chip_info(cyw_chip_info_t *info)
+{
+    if (info == NULL) {
+        return CYW_ERR_INVALID;
+    }
+    memcpy(info, &g_cyw_dev.chip, sizeof(cyw_chip_info_t));
+    return CYW_OK;
+}
+
+cyw_err_t cyw_get_stats(cyw_stats_t *stats)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    if (stats == NULL) {
+        return CYW_ERR_INVALID;
+    }
+
+    stats->tx_queued = dev->tx_q_count;
+    for (uint32_t q = 0; q < CYW_TXQ_COUNT; q++) {
+        stats->tx_queued_q[q] = dev->txq[q].count;
+    }
+    stats->tx_queued_peak = dev->tx_q_peak;
+    stats->tx_credits = tx_credits();
+    stats->tx_credit_stall = dev->tx_credit_stall;
+    stats->tx_fc_stall = dev->tx_fc_stall;
+    stats->tx_glom = dev->tx_glom;
+    stats->tx_glom_frames = dev->tx_glom_frames;
+    stats->tx_linearized = dev->tx_linearized;
+    stats->flow_ctrl = dev->flow_ctrl;
+    stats->rx_single = dev->rx_single;
+    stats->rx_mispredict = dev->rx_mispredict;
+    stats->rx_glom = dev->rx_glom;
+    stats->rx_glom_drop = dev->rx_glom_drop;
+    stats->rx_dropped = dev->rx_dropped;
+    stats->ioctl_pending = dev->ioctl_pending;
+    stats->ioctl_timeout = dev->ioctl_timeout;
+    stats->ioctl_orphan = dev->ioctl_orphan;
+    stats->rx_event = dev->rx_event;
+    stats->rx_event_drop = dev->rx_event_drop;
+    stats->scan_bss = dev->scan_stat_bss;
+    stats->scan_dup = dev->scan_stat_dup;
+    stats->scan_drop = dev->scan_stat_drop;
+    stats->bgscan_slices = dev->bgscan_stat_slices;
+    stats->bgscan_sweeps = dev->bgscan_stat_sweeps;
+    stats->bgscan_defer = dev->bgscan_stat_defer;
+    stats->join_fast = dev->join_stat_fast;
+    stats->join_fast_fail = dev->join_stat_fast_fail;
+    stats->join_full = dev->join_stat_full;
+    stats->rssi = dev->roam_rssi;
+    stats->roam_low = dev->roam_stat_low;
+    stats->roam_fw = dev->roam_stat_fw;
+    stats->roam_host = dev->roam_stat_host;
+    stats->roam_fail = dev->roam_stat_fail;
+    stats->roam_last_ms = dev->roam_stat_last_ms;
+    stats->bus_asleep = dev->bus_asleep;
+    stats->bus_sleeps = dev->pm_stat_sleeps;
+    stats->bus_wakes = dev->pm_stat_wakes;
+    stats->bus_wake_fail = dev->pm_stat_wake_fail;
+    stats->wake_last_us = dev->pm_stat_wake_last;
+    stats->wake_max_us = dev->pm_stat_wake_max;
+    stats->wake_total_us = dev->pm_stat_wake_total;
+    stats->tx_data = dev->tx_data;
+    stats->rx_data = dev->rx_data;
+    stats->rx_data_drop = dev->rx_data_drop;
+
+    return CYW_OK;
+}
+
+cyw_state_t cyw_get_state(void)
+{
+    return g_cyw_dev.state;
+}
+
+static void bgscan_run(void);
+static void roam_run(void);
+static void pm_run(void);
+
+void cyw_poll(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    if (dev->state < CYW_STATE_FW_READY) {
+        return;
+    }
+
+    /* Frames held while the receive callback was busy first */
+    rx_data_pend();
+    cyw_pkt_t *pkt;
+
+    /* Check for pending data; a host without an interrupt reads the bus */
+    if (dev->ops->irq_pending == NULL) {
+        if (recv_sdpcm_pkt(&pkt) == CYW_OK) {
+            rx_dispatch(pkt);
+        }
+    } else {
+        if (dev->ops->irq_pending()) {
+            rx_irq_ack();
+        }
+        /* One frame per call, the rest on the following ones */
+        if (dev->rx_irq_more) {
+            cyw_err_t err = recv_sdpcm_pkt(&pkt);
+            if (err == CYW_OK) {
+                rx_dispatch(pkt);
+            } else if (err != CYW_ERR_NOMEM) {
+                dev->rx_irq_more = false;
+            }
+        }
+    }
+
+    /* Rest of a superframe, already off the bus */
+    while ((pkt = cyw_pkt_queue_pop(&dev->rx_glom_q)) != NULL) {
+        rx_dispatch(pkt);
+    }
+
+    ioctl_expire();
+    tx_flush(false);
+    bgscan_run();
+    roam_run();
+    pm_run();
+}
+
+/*
+ * A frame the bus cannot take as it is: headroom short of the headers
+ * (and the pad that aligns them), too many segments, or segments and
+ * padding without cmd53_write_sg to gather them.
+ */
+static bool tx_must_copy(const cyw_pkt_t *pkt)
+{
+    uintptr_t data = (uintptr_t)cyw_pkt_data(pkt);
+
+    if (cyw_pkt_segs(pkt) > CYW_TX_MAX_FRAGS ||
+        cyw_pkt_headroom(pkt) < CYW_PKT_DATA_HEADROOM + (data & 3)) {
+        return true;
+    }
+    return g_cyw_dev.ops->cmd53_write_sg == NULL &&
+           (pkt->frag != NULL ||
+            cyw_pkt_tailroom(pkt) < ((0 - (data + pkt->len)) & 3));
+}
+
+/*
+ * Copy a frame into one TX buffer; the original is released either way.
+ */
+static cyw_pkt_t *tx_linearize(cyw_pkt_t *pkt)
+{
+    cyw_pkt_t *copy = cyw_pkt_alloc(CYW_PKT_DATA_HEADROOM, cyw_pkt_frame_len(pkt));
+
+    if (copy != NULL) {
+        uint8_t *p = cyw_pkt_data(copy);
+
+        for (const cyw_pkt_t *seg = pkt; seg != NULL; seg = seg->frag) {
+            memcpy(p, cyw_pkt_data(seg), seg->len);
+            p += seg->len;
+        }
+        copy->prio = pkt->prio;
+        copy->ifidx = pkt->ifidx;
+        g_cyw_dev.tx_linearized++;
+    }
+
+    cyw_pkt_free(pkt);
+    return copy;
+}
+
+cyw_err_t cyw_tx_ethernet(cyw_pkt_t *pkt)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_err_t err;
+
+    if (pkt == NULL) {
+        return CYW_ERR_INVALID;
+    }
+
+    if (dev->state < CYW_STATE_FW_READY) {
+        cyw_pkt_free(pkt);
+        return CYW_ERR_NOT_READY;
+    }
+
+    if (pkt->len < CYW_ETH_HDR_LEN || cyw_pkt_frame_len(pkt) > CYW_PKT_BUF_SIZE) {
+        cyw_pkt_free(pkt);
+        return CYW_ERR_INVALID;
+    }
+
+    if (tx_must_copy(pkt)) {
+        pkt = tx_linearize(pkt);
+        if (pkt == NULL) {
+            return CYW_ERR_NOMEM;
+        }
+    }
+
+    err = tx_enqueue(SDPCM_DATA_CHANNEL, pkt);
+    if (err != CYW_OK) return err;
+    dev->tx_data++;
+
+    /* Goes now if there is credit and no reason to wait for company */
+    tx_flush(false);
+    return CYW_OK;
+}
+
+void cyw_set_rx_callback(cyw_rx_cb_t cb, void *ctx)
+{
+    g_cyw_dev.rx_cb_ctx = ctx;
+    g_cyw_dev.rx_cb = cb;
+}
+
+cyw_err_t cyw_tx_flush(void)
+{
+    if (g_cyw_dev.state < CYW_STATE_FW_READY) {
+        return CYW_ERR_NOT_READY;
+    }
+
+    return tx_flush(true);
+}
+
+/*============================================================================
+ * Scan
+ *============================================================================*/
+
+#define SCAN_SLOT_FREE      0xFF
+
+/* BSSID hash: FNV-1a */
+static uint32_t scan_hash(const uint8_t *bssid)
+{
+    uint32_t h = 2166136261u;
+
+    for (int i = 0; i < 6; i++) {
+        h = (h ^ bssid[i]) * 16777619u;
+    }
+    return h & (CYW_SCAN_HASH_SIZE - 1);
+}
+
+/* Hash slot holding the BSSID, or the free slot it would go to */
+static uint32_t scan_lookup(const uint8_t *bssid)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint32_t h = scan_hash(bssid);
+
+    while (dev->scan_hash[h] != SCAN_SLOT_FREE &&
+           memcmp(dev->scan_bss[dev->scan_hash[h]].bssid, bssid, 6) != 0) {
+        h = (h + 1) & (CYW_SCAN_HASH_SIZE - 1);
+    }
+    return h;
+}
+
+/* Free a hash slot, moving later entries of its probe run back into it */
+static void scan_unhash(uint32_t h)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint32_t j = h;
+
+    dev->scan_hash[h] = SCAN_SLOT_FREE;
+    for (;;) {
+        uint32_t home;
+
+        j = (j + 1) & (CYW_SCAN_HASH_SIZE - 1);
+        if (dev->scan_hash[j] == SCAN_SLOT_FREE) {
+            return;
+        }
+        home = scan_hash(dev->scan_bss[dev->scan_hash[j]].bssid);
+        if ((j > h) ? (home <= h || home > j) : (home <= h && home > j)) {
+            dev->scan_hash[h] = dev->scan_hash[j];
+            dev->scan_hash[j] = SCAN_SLOT_FREE;
+            h = j;
+        }
+    }
+}
+
+/* Heap order: heard in an earlier scan, or weaker in the same one */
+static bool scan_weaker(const cyw_scan_result_t *a, const cyw_scan_result_t *b)
+{
+    if (a->scan != b->scan) {
+        return a->scan < b->scan;
+    }
+    return a->rssi < b->rssi;
+}
+
+static void scan_heap_set(uint32_t pos, uint8_t idx)
+{
+    g_cyw_dev.scan_heap[pos] = idx;
+    g_cyw_dev.scan_pos[idx] = pos;
+}
+
+static void scan_sift_up(uint32_t pos)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint8_t idx = dev->scan_heap[pos];
+
+    while (pos > 0) {
+        uint32_t parent = (pos - 1) / 2;
+
+        if (!scan_weaker(&dev->scan_bss[idx], &dev->scan_bss[dev->scan_heap[parent]])) {
+            break;
+        }
+        scan_heap_set(pos, dev->scan_heap[parent]);
+        pos = parent;
+    }
+    scan_heap_set(pos, idx);
+}
+
+static void scan_sift_down(uint32_t pos)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint8_t idx = dev->scan_heap[pos];
+
+    for (;;) {
+        uint32_t child = 2 * pos + 1;
+
+        if (child >= dev->scan_count) {
+            break;
+        }
+        if (child + 1 < dev->scan_count &&
+            scan_weaker(&dev->scan_bss[dev->scan_heap[child + 1]],
+                        &dev->scan_bss[dev->scan_heap[child]])) {
+            child++;
+        }
+        if (!scan_weaker(&dev->scan_bss[dev->scan_heap[child]], &dev->scan_bss[idx])) {
+            break;
+        }
+        scan_heap_set(pos, dev->scan_heap[child]);
+        pos = child;
+    }
+    scan_heap_set(pos, idx);
+}
+
+/*
+ * Merge a BSS record into the table. New BSSes take a free entry or
+ * replace the weakest one, if weaker themselves. Returns the entry to
+ * report (first heard in this scan), or NULL.
+ */
+static const cyw_scan_result_t *scan_add(const cyw_scan_result_t *r)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_scan_result_t *b;
+    uint32_t h = scan_lookup(r->bssid);
+    uint8_t idx = dev->scan_hash[h];
+
+    if (idx != SCAN_SLOT_FREE) {
+        /* Seen before: keep the strongest sighting of this scan */
+        b = &dev->scan_bss[idx];
+        if (b->scan == r->scan) {
+            dev->scan_stat_dup++;
+            if (r->rssi > b->rssi) {
+                b->rssi = r->rssi;
+                scan_sift_down(dev->scan_pos[idx]);
+            }
+            if (b->ssid_len == 0 && r->ssid_len > 0) {
+                memcpy(b->ssid, r->ssid, sizeof(b->ssid));
+                b->ssid_len = r->ssid_len;
+            }
+            return NULL;
+        }
+
+        /* From an earlier scan: hidden networks keep the SSID learned then */
+        if (r->ssid_len == 0 && b->ssid_len > 0) {
+            cyw_scan_result_t tmp = *r;
+
+            memcpy(tmp.ssid, b->ssid, sizeof(tmp.ssid));
+            tmp.ssid_len = b->ssid_len;
+            *b = tmp;
+        } else {
+            *b = *r;
+        }
+        scan_sift_down(dev->scan_pos[idx]);
+        return b;
+    }
+
+    if (dev->scan_count < CYW_SCAN_MAX_BSS) {
+        idx = dev->scan_count++;
+        dev->scan_bss[idx] = *r;
+        dev->scan_hash[h] = idx;
+        scan_heap_set(dev->scan_count - 1, idx);
+        scan_sift_up(dev->scan_count - 1);
+        return &dev->scan_bss[idx];
+    }
+
+    /* Table full: the weakest entry goes, unless this one is weaker */
+    idx = dev->scan_heap[0];
+    if (!scan_weaker(&dev->scan_bss[idx], r)) {
+        dev->scan_stat_drop++;
+        return NULL;
+    }
+    scan_unhash(scan_lookup(dev->scan_bss[idx].bssid));
+    dev->scan_bss[idx] = *r;
+    dev->scan_hash[scan_lookup(r->bssid)] = idx;
+    scan_sift_down(0);
+    return &dev->scan_bss[idx];
+}
+
+/* RSN element body: WPA2-PSK, unless SAE is the only key management */
+static uint8_t scan_rsn(const uint8_t *rsn, uint32_t len)
+{
+    uint32_t off = 2 + 4;               /* Version, group cipher */
+    uint32_t n;
+    bool psk = false;
+    bool sae = false;
+
+    if (len < off + 2) {
+        return CYW_SEC_WPA2_PSK;
+    }
+    n = rsn[off] | (rsn[off + 1] << 8);
+    off += 2 + 4 * n;                   /* Pairwise ciphers */
+    if (len < off + 2) {
+        return CYW_SEC_WPA2_PSK;
+    }
+    n = rsn[off] | (rsn[off + 1] << 8);
+    off += 2;
+
+    for (; n > 0 && off + 4 <= len; n--, off += 4) {
+        if (memcmp(&rsn[off], RSN_OUI, 3) == 0) {
+            psk |= rsn[off + 3] == RSN_AKM_PSK || rsn[off + 3] == RSN_AKM_SHA256_PSK;
+            sae |= rsn[off + 3] == RSN_AKM_SAE;
+        }
+    }
+
+    return (sae && !psk) ? CYW_SEC_WPA3_SAE : CYW_SEC_WPA2_PSK;
+}
+
+/* Security from the privacy bit and the RSN/WPA elements */
+static uint8_t scan_security(uint16_t capability, const uint8_t *ie, uint32_t len)
+{
+    uint8_t sec = (capability & DOT11_CAP_PRIVACY) ? CYW_SEC_WEP : CYW_SEC_OPEN;
+
+    while (len >= 2 && ie[1] + 2u <= len) {
+        if (ie[0] == DOT11_MNG_RSN_ID) {
+            return scan_rsn(ie + 2, ie[1]);
+        }
+        if (ie[0] == DOT11_MNG_VS_ID && ie[1] >= 4 &&
+            memcmp(ie + 2, WPA_OUI, 3) == 0 && ie[5] == WPA_OUI_TYPE) {
+            sec = CYW_SEC_WPA_PSK;
+        }
+        len -= ie[1] + 2u;
+        ie += ie[1] + 2u;
+    }
+    return sec;
+}
+
+/* BSS record to a table entry; false if malformed */
+static bool scan_parse(const wl_bss_info_t *bi, uint32_t len, cyw_scan_result_t *r)
+{
+    if (len < sizeof(*bi) || bi->ie_offset > len || bi->ie_length > len - bi->ie_offset) {
+        return false;
+    }
+
+    memset(r, 0, sizeof(*r));
+    memcpy(r->bssid, bi->bssid, sizeof(r->bssid));
+    r->ssid_len = MIN(bi->ssid_len, sizeof(bi->ssid));
+    memcpy(r->ssid, bi->ssid, r->ssid_len);
+    r->rssi = bi->rssi;
+    r->chanspec = bi->chanspec;
+    r->channel = (bi->ctl_ch != 0) ? bi->ctl_ch : (bi->chanspec & WL_CHANSPEC_CHAN_MASK);
+    r->capability = bi->capability;
+    r->security = scan_security(bi->capability, (const uint8_t *)bi + bi->ie_offset,
+                                bi->ie_length);
+    r->scan = g_cyw_dev.scan_gen;
+    return true;
+}
+
+static void scan_finish(cyw_err_t status)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_scan_done_cb_t done = dev->scan_req.on_done;
+    void *ctx = dev->scan_req.ctx;
+
+    /* Free for the next scan before telling, so on_done may start it */
+    dev->scan_busy = false;
+    memset(&dev->scan_req, 0, sizeof(dev->scan_req));
+
+    DBG("Scan done (%d), %u BSSes", status, (unsigned int)dev->scan_count);
+    if (done != NULL) {
+        done(ctx, status);
+    }
+}
+
+/*
+ * WLC_E_ESCAN_RESULT: partial results carry BSS records, anything else
+ * ends the scan
+ */
+static void scan_event(void *ctx, const cyw_event_t *ev, const uint8_t *data, uint32_t len)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    const wl_escan_result_t *res = (const wl_escan_result_t *)data;
+    uint32_t off = sizeof(*res);
+
+    (void)ctx;
+
+    if (!dev->scan_busy || (len >= sizeof(*res) && res->sync_id != dev->scan_sync_id)) {
+        return;
+    }
+
+    if (ev->status != WLC_E_STATUS_PARTIAL) {
+        scan_finish((ev->status == WLC_E_STATUS_SUCCESS) ? CYW_OK :
+                    (ev->status == WLC_E_STATUS_ABORT ||
+                     ev->status == WLC_E_STATUS_NEWSCAN) ? CYW_ERR_BUSY : CYW_ERROR);
+        return;
+    }
+
+    for (uint32_t i = 0; len >= sizeof(*res) && i < res->bss_count; i++) {
+        const wl_bss_info_t *bi = (const wl_bss_info_t *)(data + off);
+        const cyw_scan_result_t *b;
+        cyw_scan_result_t r;
+
+        if (len - off < sizeof(*bi) || bi->length > len - off ||
+            !scan_parse(bi, bi->length, &r)) {
+            break;
+        }
+        off += bi->length;
+        dev->scan_stat_bss++;
+
+        b = scan_add(&r);
+        if (b != NULL && dev->scan_req.on_result != NULL) {
+            dev->scan_req.on_result(dev->scan_req.ctx, b);
+        }
+        if (!dev->scan_busy || dev->scan_sync_id != res->sync_id) {
+            break;                      /* Aborted from on_result */
+        }
+    }
+}
+
+static void scan_init(void)
+{
+    static const uint16_t events[] = { WLC_E_ESCAN_RESULT };
+
+    memset(g_cyw_dev.scan_hash, SCAN_SLOT_FREE, sizeof(g_cyw_dev.scan_hash));
+    cyw_event_register(events, ARRAY_SIZE(events), scan_event, NULL);
+}
+
+/* Channel number to a 20 MHz chanspec */
+static uint16_t scan_chanspec(uint16_t channel)
+{
+    return channel | WL_CHANSPEC_BW_20 |
+           ((channel <= 14) ? WL_CHANSPEC_BAND_2G : WL_CHANSPEC_BAND_5G);
+}
+
+/*
+ * Start an escan. new_gen: false for a background slice continuing a
+ * sweep, which ranks together with the slices before it.
+ */
+static cyw_err_t scan_start(const cyw_scan_params_t *params, bool new_gen)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    wl_escan_params_t esc;
+    cyw_err_t err;
+
+    if (dev->state < CYW_STATE_UP) {
+        return CYW_ERR_NOT_READY;
+    }
+    if (params == NULL || params->channel_count > CYW_SCAN_MAX_CHANNELS ||
+        (params->channels == NULL && params->channel_count > 0)) {
+        return CYW_ERR_INVALID;
+    }
+    if (dev->scan_busy && dev->bgscan_slice && new_gen) {
+        cyw_scan_abort();                   /* The caller comes first */
+    }
+    if (dev->scan_busy) {
+        return CYW_ERR_BUSY;
+    }
+
+    memset(&esc, 0, sizeof(esc));
+    esc.version = ESCAN_REQ_VERSION;
+    esc.action = WL_SCAN_ACTION_START;
+    esc.sync_id = ++dev->scan_sync_id;
+    if (params->ssid != NULL) {
+        esc.ssid_len = MIN(strlen(params->ssid), sizeof(esc.ssid));
+        memcpy(esc.ssid, params->ssid, esc.ssid_len);
+    }
+    memset(esc.bssid, 0xFF, sizeof(esc.bssid));
+    esc.bss_type = DOT11_BSSTYPE_ANY;
+    esc.scan_type = params->passive ? WL_SCANFLAGS_PASSIVE : 0;
+    esc.nprobes = params->nprobes ? params->nprobes : -1;
+    esc.active_time = params->active_time ? params->active_time : -1;
+    esc.passive_time = params->passive_time ? params->passive_time : -1;
+    esc.home_time = params->home_time ? params->home_time : -1;
+    esc.channel_num = params->channel_count;
+    for (uint32_t i = 0; i < params->channel_count; i++) {
+        esc.channel_list[i] = scan_chanspec(params->channels[i]);
+    }
+
+    /* Results may come in while the request is still being answered */
+    dev->scan_req = *params;
+    dev->scan_busy = true;
+    if (new_gen) {
+        dev->scan_gen++;
+    }
+
+    err = cyw_iovar("escan", &esc, offsetof(wl_escan_params_t, channel_list) +
+                    params->channel_count * sizeof(esc.channel_list[0]), true);
+    if (err != CYW_OK) {
+        ERR("escan failed: %d", err);
+        dev->scan_busy = false;
+        memset(&dev->scan_req, 0, sizeof(dev->scan_req));
+        return err;
+    }
+
+    DBG("Scan %u started, %u channels", (unsigned int)dev->scan_gen,
+        (unsigned int)params->channel_count);
+    return CYW_OK;
+}
+
+cyw_err_t cyw_scan_start(const cyw_scan_params_t *params)
+{
+    return scan_start(params, true);
+}
+
+cyw_err_t cyw_scan_abort(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    wl_escan_params_t esc;
+    cyw_err_t err;
+
+    if (!dev->scan_busy) {
+        return CYW_OK;
+    }
+
+    memset(&esc, 0, sizeof(esc));
+    esc.version = ESCAN_REQ_VERSION;
+    esc.action = WL_SCAN_ACTION_ABORT;
+    esc.sync_id = dev->scan_sync_id;
+
+    err = cyw_iovar("escan", &esc, offsetof(wl_escan_params_t, channel_list), true);
+
+    /* Whatever the firmware still reports is ignored */
+    if (dev->scan_busy) {
+        scan_finish(CYW_ERR_BUSY);
+    }
+    return err;
+}
+
+bool cyw_scan_busy(void)
+{
+    return g_cyw_dev.scan_busy;
+}
+
+int cyw_scan_results(cyw_scan_result_t *results, int max_results)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint8_t order[CYW_SCAN_MAX_BSS];
+    uint32_t n = dev->scan_count;
+
+    if (results == NULL || max_results <= 0) {
+        return 0;
+    }
+
+    /* Insertion sort, best first: the table is small */
+    for (uint32_t i = 0; i < n; i++) {
+        uint32_t j = i;
+
+        while (j > 0 && scan_weaker(&dev->scan_bss[order[j - 1]], &dev->scan_bss[i])) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    n = MIN(n, (uint32_t)max_results);
+    for (uint32_t i = 0; i < n; i++) {
+        results[i] = dev->scan_bss[order[i]];
+    }
+    return n;
+}
+
+static void scan_wait_done(void *ctx, cyw_err_t status)
+{
+    *(cyw_err_t *)ctx = status;
+}
+
+int cyw_scan(cyw_scan_result_t *results, int max_results)
+{
+    cyw_scan_params_t params;
+    cyw_err_t status = CYW_ERR_BUSY;
+    cyw_err_t err;
+    uint32_t elapsed;
+    int n;
+
+    memset(&params, 0, sizeof(params));
+    params.on_done = scan_wait_done;
+    params.ctx = &status;
+
+    err = cyw_scan_start(&params);
+    if (err != CYW_OK) {
+        return err;
+    }
+
+    for (elapsed = 0; g_cyw_dev.scan_busy && elapsed < CYW_SCAN_TIMEOUT_MS; elapsed += 10) {
+        cyw_poll();
+        delay_ms(10);
+    }
+    if (g_cyw_dev.scan_busy) {
+        ERR("Scan timeout");
+        cyw_scan_abort();
+        status = CYW_ERR_TIMEOUT;
+    }
+    if (status != CYW_OK) {
+        return status;
+    }
+
+    /* Only what this scan heard: it sorts first */
+    n = cyw_scan_results(results, max_results);
+    while (n > 0 && results[n - 1].scan != g_cyw_dev.scan_gen) {
+        n--;
+    }
+    return n;
+}
+
+/*============================================================================
+ * Background Scan
+ *============================================================================*/
+
+static void bgscan_done(void *ctx, cyw_err_t status)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint32_t n = (uint32_t)(uintptr_t)ctx;
+    uint32_t pause = dev->bgscan.slice_interval;
+
+    dev->bgscan_slice = false;
+
+    /* Aborted or failed: the same slice again after the pause */
+    if (status == CYW_OK) {
+        dev->bgscan_stat_slices++;
+        dev->bgscan_pos += n;
+        if (dev->bgscan_pos >= dev->bgscan.channel_count) {
+            dev->bgscan_pos = 0;
+            dev->bgscan_stat_sweeps++;
+            pause = dev->bgscan.sweep_interval;
+        }
+    }
+
+    dev->bgscan_next = time_us() + pause * 1000;
+}
+
+/*
+ * Start the next slice when due: not while a scan or a join runs, and not
+ * while TX frames wait (they would sit out the off-channel time). Frames
+ * queued during a slice abort it; bgscan_done() retries it later.
+ */
+static void bgscan_run(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    const cyw_bgscan_params_t *bg = &dev->bgscan;
+    cyw_scan_params_t params;
+    uint32_t n;
+
+    if (dev->bgscan_slice && dev->scan_busy && dev->tx_q_count > 0) {
+        dev->bgscan_stat_defer++;
+        cyw_scan_abort();
+        return;
+    }
+
+    if (!dev->bgscan_on || dev->state < CYW_STATE_UP || dev->scan_busy ||
+        dev->join_status == CYW_ERR_BUSY ||
+        (int32_t)(time_us() - dev->bgscan_next) < 0) {
+        return;
+    }
+
+    if (dev->tx_q_count > 0) {
+        if (!dev->bgscan_deferred) {
+            dev->bgscan_deferred = true;
+            dev->bgscan_stat_defer++;
+        }
+        return;
+    }
+    dev->bgscan_deferred = false;
+
+    n = MIN(bg->slice, bg->channel_count - dev->bgscan_pos);
+
+    memset(&params, 0, sizeof(params));
+    params.channels = &dev->bgscan_ch[dev->bgscan_pos];
+    params.channel_count = n;
+    params.passive = bg->passive;
+    params.active_time = bg->active_time;
+    params.passive_time = bg->passive_time;
+    params.home_time = bg->home_time;
+    params.on_done = bgscan_done;
+    params.ctx = (void *)(uintptr_t)n;
+
+    /* Set first: the slice may end while the request is being answered */
+    dev->bgscan_slice = true;
+    if (scan_start(&params, dev->bgscan_pos == 0) != CYW_OK) {
+        dev->bgscan_slice = false;
+        dev->bgscan_next = time_us() + bg->slice_interval * 1000;
+    }
+}
+
+/* Channels the firmware allows in this country */
+static cyw_err_t bgscan_valid_channels(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint32_t list[1 + CYW_SCAN_MAX_CHANNELS];
+    cyw_err_t err;
+
+    memset(list, 0, sizeof(list));
+    list[0] = CYW_SCAN_MAX_CHANNELS;
+    err = cyw_ioctl(WLC_GET_VALID_CHANNELS, list, sizeof(list), false);
+    if (err != CYW_OK) {
+        return err;
+    }
+
+    dev->bgscan.channel_count = MIN(list[0], CYW_SCAN_MAX_CHANNELS);
+    for (uint32_t i = 0; i < dev->bgscan.channel_count; i++) {
+        dev->bgscan_ch[i] = list[1 + i];
+    }
+    return (dev->bgscan.channel_count > 0) ? CYW_OK : CYW_ERR_FW;
+}
+
+cyw_err_t cyw_bgscan_start(const cyw_bgscan_params_t *params)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_bgscan_params_t *bg = &dev->bgscan;
+    cyw_err_t err;
+
+    if (dev->ops == NULL || dev->ops->get_time_us == NULL) {
+        return CYW_ERR_NOT_READY;
+    }
+    if (params != NULL && (params->channel_count > CYW_SCAN_MAX_CHANNELS ||
+                           (params->channels == NULL && params->channel_count > 0))) {
+        return CYW_ERR_INVALID;
+    }
+
+    cyw_bgscan_stop();
+
+    if (params != NULL) {
+        *bg = *params;
+    } else {
+        memset(bg, 0, sizeof(*bg));
+    }
+    bg->slice = bg->slice ? bg->slice : CYW_BGSCAN_SLICE;
+    bg->home_time = bg->home_time ? bg->home_time : CYW_BGSCAN_HOME_TIME_MS;
+    bg->slice_interval = bg->slice_interval ? bg->slice_interval : CYW_BGSCAN_SLICE_INTERVAL_MS;
+    bg->sweep_interval = bg->sweep_interval ? bg->sweep_interval : CYW_BGSCAN_SWEEP_INTERVAL_MS;
+
+    if (bg->channels != NULL) {
+        memcpy(dev->bgscan_ch, bg->channels, bg->channel_count * sizeof(dev->bgscan_ch[0]));
+    } else {
+        err = bgscan_valid_channels();
+        if (err != CYW_OK) {
+            return err;
+        }
+    }
+    bg->channels = dev->bgscan_ch;
+
+    dev->bgscan_pos = 0;
+    dev->bgscan_next = time_us();
+    dev->bgscan_deferred = false;
+    dev->bgscan_on = true;
+
+    DBG("Background scan: %u channels, %u per slice",
+        (unsigned int)bg->channel_count, (unsigned int)bg->slice);
+    return CYW_OK;
+}
+
+void cyw_bgscan_stop(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    dev->bgscan_on = false;
+    if (dev->bgscan_slice) {
+        cyw_scan_abort();
+    }
+}
+
+/*============================================================================
+ * Roaming
+ *============================================================================*/
+
+/* New RSSI in dBm, clamped to what an int8 trigger compares with */
+static void roam_rssi_set(int32_t rssi)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    int8_t trigger = dev->roam.trigger;
+
+    rssi = MAX(MIN(rssi, 0), INT8_MIN);
+    if (rssi < trigger && (dev->roam_rssi == 0 || dev->roam_rssi >= trigger)) {
+        dev->roam_stat_low++;
+    }
+    dev->roam_rssi = rssi;
+}
+
+static void roam_fail(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    if (dev->roam_busy) {
+        dev->roam_busy = false;
+        dev->roam_stat_fail++;
+    }
+}
+
+/* Roam over, successful: the firmware's own or the reassociation asked for */
+static void roam_done(const uint8_t *bssid)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    bool directed = dev->roam_busy;
+
+    if (directed) {
+        dev->roam_busy = false;
+        dev->roam_stat_last_ms = (time_us() - dev->roam_start) / 1000;
+    } else if (memcmp(bssid, dev->roam_bssid, sizeof(dev->roam_bssid)) != 0) {
+        dev->roam_stat_fw++;
+    } else {
+        return;                             /* Same roam, reported twice */
+    }
+
+    DBG("Roamed (%s)", directed ? "directed" : "firmware");
+    memcpy(dev->roam_bssid, bssid, sizeof(dev->roam_bssid));
+    if (dev->link_up) {
+        memcpy(dev->link_bssid, bssid, sizeof(dev->link_bssid));
+    }
+    dev->roam_rssi = 0;
+    dev->roam_resync = true;
+}
+
+static void roam_event(void *ctx, const cyw_event_t *ev, const uint8_t *data, uint32_t len)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint32_t rssi;
+
+    (void)ctx;
+
+    switch (ev->type) {
+        case WLC_E_RSSI:
+            /* int32 in network byte order, like the event header */
+            if (len >= sizeof(rssi)) {
+                memcpy(&rssi, data, sizeof(rssi));
+                roam_rssi_set((int32_t)be32(rssi));
+            }
+            break;
+
+        case WLC_E_LINK:
+            /* New link: its RSSI is unknown until read */
+            dev->roam_rssi = 0;
+            if (ev->flags & WLC_EVENT_MSG_LINK) {
+                dev->roam_resync = true;
+            } else {
+                roam_fail();
+                memset(dev->roam_bssid, 0, sizeof(dev->roam_bssid));
+            }
+            break;
+
+        default:
+            /* WLC_E_ROAM, WLC_E_REASSOC */
+            if (ev->status == WLC_E_STATUS_SUCCESS) {
+                roam_done(ev->addr);
+            } else {
+                roam_fail();
+            }
+            break;
+    }
+}
+
+/* New BSS: its RSSI, and the join cache moved over to it */
+static void roam_resync(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_join_cache_t *jc = &dev->join_cache;
+    uint32_t chanspec = 0;
+    int rssi;
+
+    dev->roam_resync = false;
+
+    rssi = cyw_get_rssi();
+    if (rssi != 0 && dev->roam_rssi == 0) {
+        roam_rssi_set(rssi);
+    }
+
+    if (jc->ssid_len != 0 && memcmp(jc->bssid, dev->link_bssid, sizeof(jc->bssid)) != 0 &&
+        cyw_iovar("chanspec", &chanspec, sizeof(chanspec), false) == CYW_OK) {
+        memcpy(jc->bssid, dev->link_bssid, sizeof(jc->bssid));
+        jc->chanspec = chanspec;
+    }
+}
+
+/*
+ * Strongest BSS of the network joined, heard in the latest scan or sweep,
+ * at least delta above the current RSSI; NULL if none
+ */
+static const cyw_scan_result_t *roam_candidate(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    const cyw_join_cache_t *jc = &dev->join_cache;
+    uint8_t sec = (jc->wpa_auth == WPA_AUTH_DISABLED) ? CYW_SEC_OPEN : CYW_SEC_WPA2_PSK;
+    int32_t floor = dev->roam_rssi + dev->roam.delta;
+    const cyw_scan_result_t *best = NULL;
+
+    if (jc->ssid_len == 0) {
+        return NULL;
+    }
+
+    for (uint32_t i = 0; i < dev->scan_count; i++) {
+        const cyw_scan_result_t *b = &dev->scan_bss[i];
+
+        if (b->scan + 1 < dev->scan_gen || b->rssi < floor || b->security != sec ||
+            b->ssid_len != jc->ssid_len || memcmp(b->ssid, jc->ssid, jc->ssid_len) != 0 ||
+            memcmp(b->bssid, dev->link_bssid, sizeof(b->bssid)) == 0) {
+            continue;
+        }
+        if (best == NULL || b->rssi > best->rssi) {
+            best = b;
+        }
+    }
+    return best;
+}
+
+/*
+ * Below the trigger, once the holdoff is over, look up the BSS table
+ * whenever it has news and reassociate to the best candidate
+ */
+static void roam_run(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    const cyw_roam_params_t *rp = &dev->roam;
+    const cyw_scan_result_t *best;
+    wl_reassoc_params_t reassoc;
+    uint32_t now;
+
+    if (!dev->roam_on || dev->state < CYW_STATE_UP || dev->join_status == CYW_ERR_BUSY) {
+        return;
+    }
+    if (!dev->link_up) {
+        roam_fail();
+        return;
+    }
+
+    if (dev->roam_resync) {
+        roam_resync();
+    }
+
+    now = time_us();
+    if (dev->roam_busy) {
+        /* A reassociation takes no longer than a directed join */
+        if (now - dev->roam_start > CYW_FAST_JOIN_TIMEOUT_MS * 1000) {
+            roam_fail();
+        }
+        return;
+    }
+
+    if (rp->fw_only || dev->ops->get_time_us == NULL ||
+        dev->roam_rssi == 0 || dev->roam_rssi >= rp->trigger ||
+        now - dev->roam_start < rp->holdoff * 1000 ||
+        dev->roam_seen == dev->scan_stat_bss) {
+        return;
+    }
+    dev->roam_seen = dev->scan_stat_bss;
+
+    best = roam_candidate();
+    if (best == NULL) {
+        return;
+    }
+
+    memset(&reassoc, 0, sizeof(reassoc));
+    memcpy(reassoc.bssid, best->bssid, sizeof(reassoc.bssid));
+    reassoc.chanspec_num = 1;
+    reassoc.chanspec_list[0] = best->chanspec;
+
+    DBG("Roaming: %d dBm, candidate %d dBm on channel %u",
+        dev->roam_rssi, best->rssi, (unsigned int)best->channel);
+
+    /* Busy first: the answer may come while the request is being sent */
+    dev->roam_busy = true;
+    dev->roam_start = now;
+    dev->roam_stat_host++;
+    if (cyw_ioctl(WLC_REASSOC, &reassoc, sizeof(reassoc), true) != CYW_OK) {
+        roam_fail();
+    }
+}
+
+cyw_err_t cyw_roam_start(const cyw_roam_params_t *params)
+{
+    static const uint16_t events[] = {
+        WLC_E_LINK, WLC_E_ROAM, WLC_E_REASSOC, WLC_E_RSSI,
+    };
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_roam_params_t *rp = &dev->roam;
+    uint32_t roam_off = 0;
+    int32_t trigger[2];
+    int32_t delta[2];
+    uint32_t period;
+    wl_rssi_event_t rssi_ev;
+    cyw_err_t err;
+
+    if (dev->state < CYW_STATE_UP) {
+        return CYW_ERR_NOT_READY;
+    }
+
+    if (params != NULL) {
+        *rp = *params;
+    } else {
+        memset(rp, 0, sizeof(*rp));
+    }
+    rp->trigger = rp->trigger ? rp->trigger : CYW_ROAM_TRIGGER;
+    rp->delta = rp->delta ? rp->delta : CYW_ROAM_DELTA;
+    rp->scan_period = rp->scan_period ? rp->scan_period : CYW_ROAM_SCAN_PERIOD;
+    rp->holdoff = rp->holdoff ? rp->holdoff : CYW_ROAM_HOLDOFF_MS;
+
+    trigger[0] = rp->trigger;
+    trigger[1] = WLC_BAND_ALL;
+    delta[0] = rp->delta;
+    delta[1] = WLC_BAND_ALL;
+    period = rp->scan_period;
+
+    /* An event at the trigger, and one more delta below it */
+    memset(&rssi_ev, 0, sizeof(rssi_ev));
+    rssi_ev.rate_limit_msec = 1000;
+    rssi_ev.num_rssi_levels = 2;
+    rssi_ev.rssi_levels[0] = MAX(rp->trigger - rp->delta, -127);
+    rssi_ev.rssi_levels[1] = rp->trigger;
+
+    cyw_ioctl_op_t ops[] = {
+        CYW_IOCTL_SET(WLC_SET_ROAM_TRIGGER, trigger, sizeof(trigger)),
+        CYW_IOCTL_SET(WLC_SET_ROAM_DELTA, delta, sizeof(delta)),
+        CYW_IOCTL_SET(WLC_SET_ROAM_SCAN_PERIOD, &period, sizeof(period)),
+        CYW_IOVAR_SET("rssi_event", &rssi_ev, sizeof(rssi_ev)),
+    };
+
+    /* Some firmware only takes roam_off while down; roaming is on by default */
+    if (cyw_iovar("roam_off", &roam_off, sizeof(roam_off), true) != CYW_OK) {
+        DBG("roam_off not supported");
+    }
+
+    err = cyw_ioctl_batch(ops, ARRAY_SIZE(ops));
+    if (err != CYW_OK) {
+        return err;
+    }
+
+    err = cyw_event_register(events, ARRAY_SIZE(events), roam_event, NULL);
+    if (err != CYW_OK) {
+        return err;
+    }
+
+    dev->roam_rssi = 0;
+    dev->roam_resync = dev->link_up;
+    dev->roam_busy = false;
+    dev->roam_seen = dev->scan_stat_bss - 1;
+    dev->roam_start = time_us() - rp->holdoff * 1000;
+    dev->roam_on = true;
+
+    DBG("Roaming: below %d dBm, %u dB better", rp->trigger, (unsigned int)rp->delta);
+    return CYW_OK;
+}
+
+cyw_err_t cyw_roam_stop(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint32_t roam_off = 1;
+    wl_rssi_event_t rssi_ev;
+
+    dev->roam_on = false;
+    dev->roam_busy = false;
+    cyw_event_unregister(roam_event, NULL);
+
+    if (dev->state < CYW_STATE_UP) {
+        return CYW_OK;
+    }
+
+    memset(&rssi_ev, 0, sizeof(rssi_ev));
+    cyw_ioctl_op_t ops[] = {
+        CYW_IOVAR_SET("rssi_event", &rssi_ev, sizeof(rssi_ev)),
+        CYW_IOVAR_SET("roam_off", &roam_off, sizeof(roam_off)),
+    };
+
+    return cyw_ioctl_batch(ops, ARRAY_SIZE(ops));
+}
+
+/*============================================================================
+ * Power Save
+ *============================================================================*/
+
+/* Poll a F1 register until the bits are set, within *budget_us */
+static bool pm_wait(uint32_t addr, uint8_t bits, uint8_t set, uint32_t *budget_us)
+{
+    uint8_t val;
+
+    for (;;) {
+        if (set != 0) {
+            cyw_sdio_write8(SDIO_FUNC_1, addr, set);    /* Unanswered until the core is up */
+        }
+        if (cyw_sdio_read8(SDIO_FUNC_1, addr, &val) == CYW_OK && (val & bits) == bits) {
+            return true;
+        }
+        if (*budget_us < 100) {
+            return false;
+        }
+        delay_us(100);
+        *budget_us -= 100;
+    }
+}
+
+/*
+ * Set KSO until the SDIO core reports itself on, then take the HT clock
+ * back; bounded by CYW_PM_WAKE_TIMEOUT_MS
+ */
+static cyw_err_t pm_wake(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint32_t budget = CYW_PM_WAKE_TIMEOUT_MS * 1000;
+    uint32_t start = time_us();
+    uint32_t lat;
+
+    /* From here on accesses go straight to the bus */
+    dev->bus_asleep = false;
+
+    if (!pm_wait(SBSDIO_FUNC1_SLEEPCSR, SBSDIO_SLEEPCSR_KSO | SBSDIO_SLEEPCSR_DEVON,
+                 SBSDIO_SLEEPCSR_KSO, &budget) ||
+        cyw_sdio_write8(SDIO_FUNC_1, SBSDIO_FUNC1_CHIPCLKCSR, SBSDIO_HT_AVAIL_REQ) != CYW_OK ||
+        !pm_wait(SBSDIO_FUNC1_CHIPCLKCSR, SBSDIO_HT_AVAIL, 0, &budget)) {
+        dev->bus_asleep = true;
+        dev->pm_stat_wake_fail++;
+        ERR("Bus wake timeout");
+        return CYW_ERR_TIMEOUT;
+    }
+
+    lat = time_us() - start;
+    dev->pm_stat_wakes++;
+    dev->pm_stat_wake_last = lat;
+    dev->pm_stat_wake_max = MAX(dev->pm_stat_wake_max, lat);
+    dev->pm_stat_wake_total += lat;
+    return CYW_OK;
+}
+
+/* Drop the clock request, then KSO: the SDIO core may power down */
+static void pm_sleep(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+
+    if (cyw_sdio_write8(SDIO_FUNC_1, SBSDIO_FUNC1_CHIPCLKCSR, 0) != CYW_OK) {
+        return;
+    }
+    if (cyw_sdio_write8(SDIO_FUNC_1, SBSDIO_FUNC1_SLEEPCSR, 0) != CYW_OK) {
+        cyw_sdio_write8(SDIO_FUNC_1, SBSDIO_FUNC1_CHIPCLKCSR, SBSDIO_HT_AVAIL_REQ);
+        return;
+    }
+
+    dev->bus_asleep = true;
+    dev->sbwad_valid = false;               /* Window set again after the wake */
+    dev->pm_stat_sleeps++;
+}
+
+/*
+ * Put the bus to sleep once it has been idle for bus_idle: nothing queued
+ * for TX, no IOCTL awaited, no interrupt pending
+ */
+static void pm_run(void)
+{
+    cyw_dev_t *dev = &g_cyw_dev;
+    uint32_t now;
+
+    if (!dev->pm.bus_sleep || dev->bus_asleep || dev->state < CYW_STATE_UP) {
+        return;
+    }
+
+    now = time_us();
+    if (dev->bus_used || dev->tx_q_count > 0 || dev->ioctl_pending > 0) {
+        dev->bus_used = false;
+        dev->bus_idle_since = now;
+        return;
+    }
+    if (now - dev->bus_idle_since < dev->pm.bus_idle * 1000u ||
+        dev->ops->irq_pending()) {
+        return;
+    }
+
+    pm_sleep();
+}
+
+cyw_err_t cyw_set_power_save(const cyw_pm_params_t *params)
+{
+    static const uint32_t pm_modes[] = { PM_OFF, PM_MAX, PM_FAST };
+    cyw_dev_t *dev = &g_cyw_dev;
+    cyw_pm_params_t pm;
+    uint32_t mode;
+    uint32_t sleep_ret;
+    uint8_t wake;
+    cyw_err_t err;
+
+    if (params != NULL) {
+        pm = *params;
+    } else {
+        memset(&pm, 0, sizeof(pm));
+    }
+    if (dev->state < CYW_STATE_UP ||
+        (pm.bus_sleep && (dev->ops->get_time_us == NULL || dev->ops->irq_pending == NULL))) {
+        return CYW_ERR_NOT_READY;
+    }
+    if ((uint32_t)pm.mode >= ARRAY_SIZE(pm_modes)) {
+        return CYW_ERR_INVALID;
+    }
+    pm.sleep_ret = pm.sleep_ret ? pm.sleep_ret : CYW_PM2_SLEEP_RET_MS;
+    pm.bus_idle = pm.bus_idle ? pm.bus_idle : CYW_PM_BUS_IDLE_MS;
+
+    mode = pm_modes[pm.mode];
+    sleep_ret = pm.sleep_ret;
+
+    /* The return-to-sleep time only means something in PM2 */
+    cyw_ioctl_op_t ops[] = {
+        CYW_IOCTL_SET(WLC_SET_PM, &mode, sizeof(mode)),
+        CYW_IOVAR_SET("pm2_sleep_ret", &sleep_ret, sizeof(sleep_ret)),
+    };
+
+    err = cyw_ioctl_batch(ops, (pm.mode == CYW_PM_PM2) ? ARRAY_SIZE(ops)
+                                                       : ARRAY_SIZE(ops) - 1);
+    if (err != CYW_OK) {
+        return err;
+    }
+
+    /* A KSO wake answers only once the HT clock is up */
+    if (pm.bus_sleep) {
+        err = cyw_sdio_read8(SDIO_FUNC_1, SBSDIO_FUNC1_WAKEUPCTRL, &wake);
+        if (err == CYW_OK) {
+            err = cyw_sdio_write8(SDIO_FUNC_1, SBSDIO_FUNC1_WAKEUPCTRL,
+                                  wake | SBSDIO_WCTRL_HTWAIT);
+        }
+        if (err != CYW_OK) {
+            return err;
+        }
+    }
+
+    dev->pm = pm;
+    dev->bus_used = true;
+
+    DBG("Power save: PM%u, bus sleep %s", (unsigned int)mode, pm.bus_sleep ? "on" : "off");
+    return CYW_OK;
+}
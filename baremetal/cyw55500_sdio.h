@@ -9,6 +9,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "cyw55500_regs.h"
+#include "cyw55500_pkt.h"
 
 /*============================================================================
  * Configuration
@@ -24,6 +25,181 @@
 #define TX_BUF_SIZE                 2048
 #define RX_BUF_SIZE                 2048
 
+/* Streaming download chunk (double-buffered in TX/RX buffers) */
+#define CYW_FW_CHUNK_SIZE           2048
+
+/* Let the firmware aggregate RX frames into superframes (bus:txglom) */
+#ifndef CYW_RXGLOM
+#define CYW_RXGLOM                  1
+#endif
+
+/* Most subframes accepted in one superframe */
+#ifndef CYW_RXGLOM_MAX_FRAMES
+#define CYW_RXGLOM_MAX_FRAMES       16
+#endif
+
+/* Send queued frames as superframes (needs host cmd53_write_sg) */
+#ifndef CYW_TXGLOM
+#define CYW_TXGLOM                  1
+#endif
+
+/* Superframe budget: frames, bytes */
+#ifndef CYW_TXGLOM_MAX_FRAMES
+#define CYW_TXGLOM_MAX_FRAMES       8
+#endif
+#ifndef CYW_TXGLOM_MAX_BYTES
+#define CYW_TXGLOM_MAX_BYTES        4096
+#endif
+
+/* Longest a queued frame waits for company (needs host get_time_us) */
+#ifndef CYW_TXGLOM_HOLD_US
+#define CYW_TXGLOM_HOLD_US          500
+#endif
+
+/* Segments one TX frame may be gathered from; longer chains are copied */
+#ifndef CYW_TX_MAX_FRAGS
+#define CYW_TX_MAX_FRAGS            8
+#endif
+
+/* Gather list of one F2 write: frames, their segments, padding */
+#define CYW_TX_MAX_SEGS             (CYW_TXGLOM_MAX_FRAMES + CYW_TX_MAX_FRAGS + 1)
+
+/* IOCTLs in flight at once (outstanding request table) */
+#ifndef CYW_IOCTL_MAX_PENDING
+#define CYW_IOCTL_MAX_PENDING       4
+#endif
+
+/* IOCTL response timeout (async timeouts need host get_time_us) */
+#ifndef CYW_IOCTL_TIMEOUT_MS
+#define CYW_IOCTL_TIMEOUT_MS        100
+#endif
+
+/* Idle step of a synchronous IOCTL waiting for its response */
+#ifndef CYW_IOCTL_POLL_US
+#define CYW_IOCTL_POLL_US           20
+#endif
+
+/* Requests of one batch in flight at once (1: one round trip each) */
+#ifndef CYW_IOCTL_PIPELINE
+#define CYW_IOCTL_PIPELINE          CYW_IOCTL_MAX_PENDING
+#endif
+
+/*
+ * Largest IOCTL buffer (the firmware's WLC_IOCTL_MAXLEN). Requests too
+ * large for a TX pool buffer are sent from, and answered into, one static
+ * arena of this size; 0 leaves them out.
+ */
+#ifndef CYW_IOCTL_MAX_LEN
+#define CYW_IOCTL_MAX_LEN           8192
+#endif
+
+/* Event handlers registered at once (one bit each in the per-type table) */
+#ifndef CYW_EVENT_HANDLERS
+#define CYW_EVENT_HANDLERS          8
+#endif
+#if CYW_EVENT_HANDLERS > 8
+#error "CYW_EVENT_HANDLERS exceeds 8"
+#endif
+
+/*
+ * Scan engine: strongest BSSes kept (the BSS table, newest scan first),
+ * and BSSID hash slots (power of two, at least twice the table)
+ */
+#ifndef CYW_SCAN_MAX_BSS
+#define CYW_SCAN_MAX_BSS            32
+#endif
+#ifndef CYW_SCAN_HASH_SIZE
+#define CYW_SCAN_HASH_SIZE          64
+#endif
+#if CYW_SCAN_MAX_BSS > 254 || CYW_SCAN_HASH_SIZE < 2 * CYW_SCAN_MAX_BSS || \
+    (CYW_SCAN_HASH_SIZE & (CYW_SCAN_HASH_SIZE - 1)) != 0
+#error "Bad CYW_SCAN_MAX_BSS/CYW_SCAN_HASH_SIZE"
+#endif
+
+/* Most channels in one scan request */
+#ifndef CYW_SCAN_MAX_CHANNELS
+#define CYW_SCAN_MAX_CHANNELS       64
+#endif
+
+/* Longest cyw_scan() waits for the scan to end */
+#ifndef CYW_SCAN_TIMEOUT_MS
+#define CYW_SCAN_TIMEOUT_MS         10000
+#endif
+
+/*
+ * Background scan defaults: channels per slice, time back on the home
+ * channel between them (ms), pause after a slice and after a sweep over
+ * all channels (ms)
+ */
+#ifndef CYW_BGSCAN_SLICE
+#define CYW_BGSCAN_SLICE            3
+#endif
+#ifndef CYW_BGSCAN_HOME_TIME_MS
+#define CYW_BGSCAN_HOME_TIME_MS     100
+#endif
+#ifndef CYW_BGSCAN_SLICE_INTERVAL_MS
+#define CYW_BGSCAN_SLICE_INTERVAL_MS 500
+#endif
+#ifndef CYW_BGSCAN_SWEEP_INTERVAL_MS
+#define CYW_BGSCAN_SWEEP_INTERVAL_MS 30000
+#endif
+
+/* Longest cyw_connect() waits for the link */
+#ifndef CYW_CONNECT_TIMEOUT_MS
+#define CYW_CONNECT_TIMEOUT_MS      10000
+#endif
+
+/* Longest a directed join to the cached BSS may take before the full join */
+#ifndef CYW_FAST_JOIN_TIMEOUT_MS
+#define CYW_FAST_JOIN_TIMEOUT_MS    3000
+#endif
+
+/*
+ * Roaming defaults: RSSI that starts a roam (dBm), how much stronger a
+ * candidate must be (dB), firmware roam scan period below the trigger
+ * (s), least time between two roams started by the driver (ms)
+ */
+#ifndef CYW_ROAM_TRIGGER
+#define CYW_ROAM_TRIGGER            (-75)
+#endif
+#ifndef CYW_ROAM_DELTA
+#define CYW_ROAM_DELTA              10
+#endif
+#ifndef CYW_ROAM_SCAN_PERIOD
+#define CYW_ROAM_SCAN_PERIOD        10
+#endif
+#ifndef CYW_ROAM_HOLDOFF_MS
+#define CYW_ROAM_HOLDOFF_MS         5000
+#endif
+
+/*
+ * Power save defaults: PM2 time awake after the last frame (ms), bus idle
+ * time before host sleep (ms); longest a bus wake may take (ms)
+ */
+#ifndef CYW_PM2_SLEEP_RET_MS
+#define CYW_PM2_SLEEP_RET_MS        200
+#endif
+#ifndef CYW_PM_BUS_IDLE_MS
+#define CYW_PM_BUS_IDLE_MS          50
+#endif
+#ifndef CYW_PM_WAKE_TIMEOUT_MS
+#define CYW_PM_WAKE_TIMEOUT_MS      10
+#endif
+
+/* WMM scheduling weights: bytes per round = weight * CYW_PKT_BUF_SIZE */
+#ifndef CYW_WMM_WEIGHT_VO
+#define CYW_WMM_WEIGHT_VO           8
+#endif
+#ifndef CYW_WMM_WEIGHT_VI
+#define CYW_WMM_WEIGHT_VI           4
+#endif
+#ifndef CYW_WMM_WEIGHT_BE
+#define CYW_WMM_WEIGHT_BE           2
+#endif
+#ifndef CYW_WMM_WEIGHT_BK
+#define CYW_WMM_WEIGHT_BK           1
+#endif
+
 /*============================================================================
  * Error Codes
  *============================================================================*/
@@ -68,6 +244,89 @@ typedef struct {
     uint32_t pmu_rev;
 } cyw_chip_info_t;
 
+/*============================================================================
+ * TX Queues
+ *============================================================================*/
+
+/* Control traffic first, then WMM access categories by priority */
+typedef enum {
+    CYW_TXQ_CTRL = 0,
+    CYW_TXQ_VO,
+    CYW_TXQ_VI,
+    CYW_TXQ_BE,
+    CYW_TXQ_BK,
+    CYW_TXQ_COUNT,
+} cyw_txq_t;
+
+/*============================================================================
+ * Statistics
+ *============================================================================*/
+
+typedef struct {
+    /* TX queue */
+    uint32_t tx_queued;         /* Frames waiting now */
+    uint16_t tx_queued_q[CYW_TXQ_COUNT];    /* ... per queue */
+    uint32_t tx_queued_peak;    /* Most frames ever waiting */
+    uint32_t tx_credits;        /* Frames the firmware accepts now */
+    uint32_t tx_credit_stall;   /* Flushes held by an empty credit window */
+    uint32_t tx_fc_stall;       /* Flushes held by firmware flow control */
+    uint32_t tx_glom;           /* Superframes sent */
+    uint32_t tx_glom_frames;    /* Frames sent inside superframes */
+    uint32_t tx_linearized;     /* Gathered frames copied into one buffer */
+    uint8_t flow_ctrl;          /* Flow-controlled priorities (bitmap) */
+
+    /* RX */
+    uint32_t rx_single;         /* Frames read with one CMD53 */
+    uint32_t rx_mispredict;     /* next_len predictions that fell short */
+    uint32_t rx_glom;           /* Superframes received */
+    uint32_t rx_glom_drop;      /* Superframes discarded */
+    uint32_t rx_dropped;        /* Frames dropped for lack of buffers */
+
+    /* Events */
+    uint32_t rx_event;          /* Events passed to handlers */
+    uint32_t rx_event_drop;     /* Malformed, or nobody subscribed */
+
+    /* Scan */
+    uint32_t scan_bss;          /* BSS records received */
+    uint32_t scan_dup;          /* ... merged into an entry of the same scan */
+    uint32_t scan_drop;         /* ... weaker than all CYW_SCAN_MAX_BSS kept */
+    uint32_t bgscan_slices;     /* Background scan slices completed */
+    uint32_t bgscan_sweeps;     /* ... sweeps over all channels */
+    uint32_t bgscan_defer;      /* Slices held back or cut short by TX frames */
+
+    /* Join */
+    uint32_t join_fast;         /* Directed joins to the cached BSS */
+    uint32_t join_fast_fail;    /* ... that fell back to a full join */
+    uint32_t join_full;         /* Joins with a full-band scan */
+
+    /* Roaming */
+    int16_t rssi;               /* Last RSSI reported (dBm), 0: unknown */
+    uint32_t roam_low;          /* Times the RSSI fell below the trigger */
+    uint32_t roam_fw;           /* Roams the firmware made on its own */
+    uint32_t roam_host;         /* Reassociations to a BSS table candidate */
+    uint32_t roam_fail;         /* ... that failed or timed out */
+    uint32_t roam_last_ms;      /* ... duration of the last successful one */
+
+    /* Power save */
+    bool bus_asleep;            /* Bus asleep now (KSO cleared) */
+    uint32_t bus_sleeps;        /* Times the bus was put to sleep */
+    uint32_t bus_wakes;         /* ... and woken for an access */
+    uint32_t bus_wake_fail;     /* Wakes that timed out */
+    uint32_t wake_last_us;      /* Wake latency: last */
+    uint32_t wake_max_us;       /* ... worst */
+    uint32_t wake_total_us;     /* ... sum over bus_wakes */
+
+    /* IOCTL */
+    uint32_t ioctl_pending;     /* Requests waiting for a response now */
+    uint32_t ioctl_timeout;     /* Requests that got no response in time */
+    uint32_t ioctl_orphan;      /* Responses nobody was waiting for */
+
+    /* Data path */
+    uint32_t tx_data;           /* Ethernet frames queued */
+    uint32_t rx_data;           /* Ethernet frames delivered */
+    uint32_t rx_data_drop;      /* Bad BDC header or no receiver */
+} cyw_stats_t;
+
 /*============================================================================
  * Core Information
  *============================================================================*/
@@ -97,6 +356,24 @@ typedef struct __attribute__((packed)) {
 
 #define SDPCM_HEADER_SIZE   sizeof(sdpcm_header_t)
 
+/* TX header once glomming is on: hardware extension between tag and header */
+typedef struct __attribute__((packed)) {
+    uint16_t len;
+    uint16_t len_check;     /* ~len */
+    uint32_t hwext_len;     /* len - 4, bit 24 = last subframe */
+    uint32_t hwext_pad;     /* Tail padding << 16 */
+    uint8_t  seq;
+    uint8_t  channel;
+    uint8_t  next_len;
+    uint8_t  data_offset;
+    uint8_t  flow_control;
+    uint8_t  max_seq;
+    uint8_t  reserved[2];
+} sdpcm_glom_header_t;
+
+#define SDPCM_GLOM_HEADER_SIZE  sizeof(sdpcm_glom_header_t)
+#define SDPCM_HWEXT_LAST        (1u << 24)
+
 /*============================================================================
  * BCDC Header
  *============================================================================*/
@@ -110,12 +387,166 @@ typedef struct __attribute__((packed)) {
 
 #define BCDC_HEADER_SIZE    sizeof(bcdc_header_t)
 
+/* Data frames: BDC header in front of the Ethernet frame */
+typedef struct __attribute__((packed)) {
+    uint8_t flags;          /* Protocol version, checksum flags */
+    uint8_t priority;       /* 802.1d priority */
+    uint8_t flags2;         /* Interface index */
+    uint8_t data_offset;    /* Extra header words before the frame */
+} bdc_header_t;
+
+#define BDC_HEADER_SIZE     sizeof(bdc_header_t)
+
+/* Shortest frame cyw_tx_ethernet() accepts: destination, source, type */
+#define CYW_ETH_HDR_LEN     14
+
+/* Event frames: Broadcom header behind the Ethernet header (big endian) */
+typedef struct __attribute__((packed)) {
+    uint16_t subtype;       /* BCMILCP_SUBTYPE_VENDOR_LONG */
+    uint16_t length;
+    uint8_t  version;
+    uint8_t  oui[3];        /* BRCM_OUI */
+    uint16_t usr_subtype;   /* BCMILCP_BCM_SUBTYPE_EVENT */
+} bcmeth_header_t;
+
+/* ... then the event message (big endian), then its data */
+typedef struct __attribute__((packed)) {
+    uint16_t version;
+    uint16_t flags;
+    uint32_t event_type;
+    uint32_t status;
+    uint32_t reason;
+    uint32_t auth_type;
+    uint32_t datalen;
+    uint8_t  addr[6];
+    char     ifname[16];
+    uint8_t  ifidx;
+    uint8_t  bsscfgidx;
+} wl_event_msg_t;
+
+#define CYW_EVENT_HDR_LEN   (CYW_ETH_HDR_LEN + sizeof(bcmeth_header_t) + sizeof(wl_event_msg_t))
+
+/* escan iovar request; channel_list holds the channels given */
+typedef struct __attribute__((packed)) {
+    uint32_t version;       /* ESCAN_REQ_VERSION */
+    uint16_t action;        /* WL_SCAN_ACTION_* */
+    uint16_t sync_id;       /* Echoed in the results */
+    uint32_t ssid_len;
+    uint8_t  ssid[32];
+    uint8_t  bssid[6];
+    int8_t   bss_type;
+    uint8_t  scan_type;     /* WL_SCANFLAGS_* */
+    int32_t  nprobes;       /* -1: firmware default, likewise the times */
+    int32_t  active_time;
+    int32_t  passive_time;
+    int32_t  home_time;
+    uint32_t channel_num;   /* Channels in the low half, SSIDs in the high */
+    uint16_t channel_list[CYW_SCAN_MAX_CHANNELS];
+} wl_escan_params_t;
+
+/* WLC_E_ESCAN_RESULT data (little endian): header, then bss_count records */
+typedef struct __attribute__((packed)) {
+    uint32_t buflen;
+    uint32_t version;
+    uint16_t sync_id;
+    uint16_t bss_count;
+} wl_escan_result_t;
+
+/* BSS record (wl_bss_info_t version 109), its IEs at ie_offset */
+typedef struct __attribute__((packed)) {
+    uint32_t version;
+    uint32_t length;        /* Whole record, IEs included */
+    uint8_t  bssid[6];
+    uint16_t beacon_period;
+    uint16_t capability;
+    uint8_t  ssid_len;
+    uint8_t  ssid[32];
+    uint8_t  pad0;
+    uint32_t rate_count;
+    uint8_t  rates[16];
+    uint16_t chanspec;
+    uint16_t atim_window;
+    uint8_t  dtim_period;
+    uint8_t  pad1;
+    int16_t  rssi;
+    int8_t   phy_noise;
+    uint8_t  n_cap;
+    uint16_t pad2;
+    uint32_t nbss_cap;
+    uint8_t  ctl_ch;
+    uint8_t  pad3[3];
+    uint32_t reserved32;
+    uint8_t  flags;
+    uint8_t  reserved[3];
+    uint8_t  basic_mcs[16];
+    uint16_t ie_offset;
+    uint16_t pad4;
+    uint32_t ie_length;
+    int16_t  snr;
+} wl_bss_info_t;
+
+/* join iovar request (wl_extjoin_params_t): the join scan pinned to one BSS */
+typedef struct __attribute__((packed)) {
+    uint32_t ssid_len;
+    uint8_t  ssid[32];
+    /* Join scan */
+    int8_t   scan_type;     /* -1: firmware default, likewise the times */
+    uint8_t  pad0[3];
+    int32_t  nprobes;
+    int32_t  active_time;
+    int32_t  passive_time;
+    int32_t  home_time;
+    /* Association */
+    uint8_t  bssid[6];
+    uint16_t bssid_cnt;
+    int32_t  chanspec_num;
+    uint16_t chanspec_list[1];
+    uint16_t pad1;
+} wl_extjoin_params_t;
+
+/* WLC_REASSOC request (wl_reassoc_params_t): one BSS on one channel */
+typedef struct __attribute__((packed)) {
+    uint8_t  bssid[6];
+    uint16_t bssid_cnt;
+    int32_t  chanspec_num;
+    uint16_t chanspec_list[1];
+    uint16_t pad;
+} wl_reassoc_params_t;
+
+/* rssi_event iovar (wl_rssi_event_t): WLC_E_RSSI when a level is crossed */
+typedef struct __attribute__((packed)) {
+    uint32_t rate_limit_msec;   /* Least time between two events */
+    uint8_t  num_rssi_levels;
+    int8_t   rssi_levels[WL_RSSI_EVENT_MAX_LEVELS];    /* Ascending */
+    uint8_t  pad[3];
+} wl_rssi_event_t;
+
+/* Headroom for a control frame: SDPCM (+ glom extension) + BCDC, built in place */
+#if CYW_TXGLOM
+#define CYW_PKT_HEADROOM    (SDPCM_GLOM_HEADER_SIZE + BCDC_HEADER_SIZE)
+#else
+#define CYW_PKT_HEADROOM    (SDPCM_HEADER_SIZE + BCDC_HEADER_SIZE)
+#endif
+
+/* Headroom for a data frame: SDPCM (+ glom extension) + BDC */
+#if CYW_TXGLOM
+#define CYW_PKT_DATA_HEADROOM   (SDPCM_GLOM_HEADER_SIZE + BDC_HEADER_SIZE)
+#else
+#define CYW_PKT_DATA_HEADROOM   (SDPCM_HEADER_SIZE + BDC_HEADER_SIZE)
+#endif
+
 /*============================================================================
  * SDIO Host Operations (Platform Specific)
  *
  * These functions must be implemented by the platform layer
  *============================================================================*/
 
+/* Gather segment for cmd53_write_sg */
+typedef struct {
+    const uint8_t *data;
+    uint32_t len;
+} sdio_sg_t;
+
 typedef struct {
     /* Initialize SDIO host controller */
     int (*init)(void);
@@ -137,6 +568,10 @@ typedef struct {
     int (*cmd53_write)(uint8_t func, uint32_t addr, const uint8_t *data,
                        uint32_t len, bool incr_addr);
 
+    /* CMD53: Write segments as one transfer (optional, enables TX glom) */
+    int (*cmd53_write_sg)(uint8_t func, uint32_t addr, const sdio_sg_t *sg,
+                          uint32_t count, bool incr_addr);
+
     /* Set block size for function */
     int (*set_block_size)(uint8_t func, uint16_t block_size);
 
@@ -146,7 +581,8 @@ typedef struct {
     /* Enable/disable interrupts */
     int (*enable_irq)(bool enable);
 
-    /* Check interrupt pending */
+    /* Check interrupt pending (optional: without it cyw_poll() reads the
+     * bus every call and bus sleep is unavailable) */
     bool (*irq_pending)(void);
 
     /* Delay microseconds */
@@ -154,8 +590,299 @@ typedef struct {
 
     /* Delay milliseconds */
     void (*delay_ms)(uint32_t ms);
+
+    /* Free-running microsecond counter (optional) */
+    uint32_t (*get_time_us)(void);
+
+    /* Largest CMD53 transfer for a function in bytes (optional, no limit);
+     * longer transfers are split, superframes are kept within it */
+    uint32_t (*max_xfer)(uint8_t func);
 } sdio_host_ops_t;
 
+/*============================================================================
+ * Firmware Image Reader
+ *
+ * Chunk source for cyw_load_firmware_stream(): SPI flash, filesystem,
+ * decompressor, ... Provide either read() or the read_start()/read_wait()
+ * pair. The asynchronous pair lets the next chunk be fetched (e.g. by DMA)
+ * while the previous one is being written over SDIO.
+ *============================================================================*/
+
+typedef struct {
+    /* Read up to len bytes into buf: returns bytes read, 0 at end, <0 error */
+    int (*read)(void *ctx, uint8_t *buf, uint32_t len);
+
+    /* Start filling buf (up to len bytes): returns 0 or <0 on error */
+    int (*read_start)(void *ctx, uint8_t *buf, uint32_t len);
+
+    /* Complete the started read: returns bytes read, 0 at end, <0 error */
+    int (*read_wait)(void *ctx);
+
+    /* Reader private data */
+    void *ctx;
+} cyw_fw_reader_t;
+
+/*============================================================================
+ * Data Path
+ *
+ * Ethernet frames travel on SDPCM channel 2 behind a BDC header, which
+ * carries the 802.1d priority (pkt->prio) and the firmware interface index
+ * (pkt->ifidx). The driver adds and strips it; callers see bare frames.
+ *
+ * Buffer ownership, no copies on either side:
+ * - TX: build the frame in place in a packet from
+ *   cyw_pkt_alloc(CYW_PKT_DATA_HEADROOM, len) and pass it to
+ *   cyw_tx_ethernet(), which consumes it in all cases. Do not touch the
+ *   packet afterwards; it returns to the pool once it has been sent.
+ *   Frames living in someone else's buffers (e.g. an IP stack's chain)
+ *   are described with cyw_pkt_wrap() and chained with cyw_pkt_append();
+ *   the segments are gathered onto the bus and each owner is called back
+ *   once the frame is gone.
+ * - RX: the callback borrows the packet for the duration of the call, with
+ *   cyw_pkt_data() at the Ethernet header. To keep it (e.g. to queue it for
+ *   an IP stack) take a reference with cyw_pkt_ref() and drop it with
+ *   cyw_pkt_free() when done. The frame may be a view into a superframe,
+ *   so a held packet also holds the RX buffer behind it: release promptly.
+ *============================================================================*/
+
+/* Receive callback: called from cyw_poll() for every data frame */
+typedef void (*cyw_rx_cb_t)(void *ctx, cyw_pkt_t *pkt);
+
+/*============================================================================
+ * IOCTL Requests
+ *
+ * Every IOCTL is a slot in a table of outstanding requests, keyed by its
+ * BCDC reqid. The response is routed to its slot by the receive path
+ * wherever it is running (cyw_poll() or another request's wait); event
+ * and data frames that arrive meanwhile take their normal paths.
+ *============================================================================*/
+
+/*
+ * IOCTL completion: err is CYW_OK, CYW_ERROR (firmware refused it) or
+ * CYW_ERR_TIMEOUT. The response payload is borrowed for the call.
+ */
+typedef void (*cyw_ioctl_cb_t)(void *ctx, cyw_err_t err,
+                               const uint8_t *resp, uint32_t len);
+
+typedef struct {
+    cyw_ioctl_cb_t cb;
+    void *ctx;
+    uint32_t deadline;          /* get_time_us() */
+    uint16_t reqid;
+    bool busy;
+    bool arena;                 /* Holds the large-IOCTL arena */
+} cyw_ioctl_req_t;
+
+/*
+ * One setting of an IOCTL batch (cyw_ioctl_batch()): an IOCTL, or an
+ * iovar if name is set. GET results are written back to data.
+ */
+typedef struct {
+    uint32_t cmd;
+    const char *name;
+    void *data;
+    uint32_t len;
+    bool set;
+    cyw_err_t status;           /* Result; CYW_ERR_NOT_READY if never sent */
+} cyw_ioctl_op_t;
+
+#define CYW_IOCTL_SET(cmd, data, len)   { (cmd), NULL, (data), (len), true, CYW_OK }
+#define CYW_IOCTL_GET(cmd, data, len)   { (cmd), NULL, (data), (len), false, CYW_OK }
+#define CYW_IOVAR_SET(name, data, len)  { WLC_SET_VAR, (name), (data), (len), true, CYW_OK }
+#define CYW_IOVAR_GET(name, data, len)  { WLC_GET_VAR, (name), (data), (len), false, CYW_OK }
+
+/*============================================================================
+ * Firmware Events
+ *
+ * Link changes, scan results, ... arrive as event frames on SDPCM channel
+ * 1. Handlers register for the WLC_E_* types they want; the union of all
+ * registrations is programmed into the firmware (event_msgs iovar), so
+ * other events never cross the bus. Each type has a bitmap of its
+ * handlers: an event costs one table lookup, not a walk of all handlers.
+ *============================================================================*/
+
+/* Event types handled: one bit each in the event_msgs mask */
+#define CYW_EVENT_MAX       (WL_EVENTING_MASK_LEN * 8)
+
+/* Event message, host byte order */
+typedef struct {
+    uint32_t type;              /* WLC_E_* */
+    uint32_t status;            /* WLC_E_STATUS_* */
+    uint32_t reason;
+    uint32_t auth_type;
+    uint16_t flags;             /* WLC_EVENT_MSG_* */
+    uint8_t addr[6];            /* Peer address */
+    uint8_t ifidx;
+    uint8_t bsscfgidx;
+} cyw_event_t;
+
+/*
+ * Event handler, called from cyw_poll() (or an IOCTL wait). The event
+ * data is borrowed for the call.
+ */
+typedef void (*cyw_event_cb_t)(void *ctx, const cyw_event_t *ev,
+                               const uint8_t *data, uint32_t len);
+
+typedef struct {
+    cyw_event_cb_t cb;          /* NULL: free */
+    void *ctx;
+} cyw_event_handler_t;
+
+/*============================================================================
+ * Scan
+ *
+ * escan results are parsed as they arrive, one WLC_E_ESCAN_RESULT at a
+ * time, into a bounded BSS table: a BSSID hash merges repeated sightings,
+ * and a heap keeps the CYW_SCAN_MAX_BSS strongest of the latest scan
+ * (entries of earlier scans go first when room is needed). Each BSS is
+ * reported to the caller once per scan on arrival, so results show up
+ * long before the scan ends however many BSSes are around.
+ *============================================================================*/
+
+typedef struct {
+    uint8_t bssid[6];
+    uint8_t ssid[33];
+    uint8_t ssid_len;           /* 0: hidden */
+    int16_t rssi;               /* dBm, strongest heard in that scan */
+    uint16_t channel;
+    uint16_t chanspec;          /* Channel, band and bandwidth */
+    uint16_t capability;        /* 802.11 capability field */
+    uint8_t security;           /* CYW_SEC_* */
+    uint32_t scan;              /* Scan that last heard it */
+} cyw_scan_result_t;
+
+#define CYW_SEC_OPEN        0
+#define CYW_SEC_WEP         1
+#define CYW_SEC_WPA_PSK     2
+#define CYW_SEC_WPA2_PSK    3
+#define CYW_SEC_WPA3_SAE    4
+
+/* BSS heard for the first time in this scan (borrowed for the call) */
+typedef void (*cyw_scan_result_cb_t)(void *ctx, const cyw_scan_result_t *bss);
+
+/*
+ * Scan over: CYW_OK, CYW_ERR_BUSY if aborted (cyw_scan_abort(), a join,
+ * a newer scan), CYW_ERROR if the firmware failed it
+ */
+typedef void (*cyw_scan_done_cb_t)(void *ctx, cyw_err_t status);
+
+/* Scan request; zero fields take the firmware defaults */
+typedef struct {
+    const uint16_t *channels;   /* 2.4/5 GHz channel numbers; NULL: all */
+    uint32_t channel_count;
+    const char *ssid;           /* Directed probes; NULL: broadcast */
+    bool passive;               /* Listen only, no probe requests */
+    uint8_t nprobes;            /* Probe requests per channel */
+    uint16_t active_time;       /* Dwell per channel (ms), active scan */
+    uint16_t passive_time;      /* ... passive scan */
+    uint16_t home_time;         /* Back on the home channel between channels (ms) */
+    cyw_scan_result_cb_t on_result;
+    cyw_scan_done_cb_t on_done;
+    void *ctx;
+} cyw_scan_params_t;
+
+/*============================================================================
+ * Background Scan
+ *
+ * A scheduler run from cyw_poll() sweeps the channels a few at a time:
+ * each slice is a short escan going back to the home channel between its
+ * channels, and slices only start while no TX frame waits (frames queued
+ * meanwhile abort the slice), so traffic never queues up behind
+ * off-channel time. Results land in the BSS table
+ * (one sweep ranks as one scan), keeping roaming and reconnect candidates
+ * fresh; a foreground scan or a join takes precedence.
+ *============================================================================*/
+
+/* Background scan settings; zero fields take the CYW_BGSCAN_* defaults */
+typedef struct {
+    const uint16_t *channels;   /* Channel numbers; NULL: all valid here */
+    uint32_t channel_count;
+    uint8_t slice;              /* Channels per slice */
+    bool passive;               /* Listen only, no probe requests */
+    uint16_t active_time;       /* Dwell per channel (ms); 0: firmware default */
+    uint16_t passive_time;      /* ... passive scan */
+    uint16_t home_time;         /* On the home channel between channels (ms) */
+    uint32_t slice_interval;    /* Pause after a slice (ms) */
+    uint32_t sweep_interval;    /* Pause after a sweep (ms), below 35 min */
+} cyw_bgscan_params_t;
+
+/*============================================================================
+ * Link State
+ *
+ * The driver follows the link from firmware events (WLC_E_LINK, the join
+ * result, deauthentication and disassociation) instead of asking the
+ * firmware: cyw_is_connected() reads the cached state, and a callback
+ * hears about every change as soon as the event is polled.
+ *============================================================================*/
+
+/*
+ * Link up or down, called from cyw_poll(). reason: 802.11 reason code
+ * when the link went down, or the WLC_E_STATUS_* of a failed join.
+ */
+typedef void (*cyw_link_cb_t)(void *ctx, bool up, uint32_t reason);
+
+/*
+ * Last BSS joined, kept for a directed join that skips the full-band
+ * scan. Plain data: it may be saved across power cycles and given back
+ * with cyw_set_join_cache().
+ */
+typedef struct {
+    uint8_t ssid[32];
+    uint8_t ssid_len;           /* 0: empty */
+    uint8_t bssid[6];
+    uint16_t chanspec;
+    uint32_t wpa_auth;          /* Security of the join: WPA_AUTH_* (AKM) */
+    uint32_t wsec;              /* ... and WSEC_* (ciphers) */
+} cyw_join_cache_t;
+
+/*============================================================================
+ * Roaming
+ *
+ * The firmware roams on its own once the RSSI drops below the trigger,
+ * to a BSS at least delta stronger (roam offload). The driver follows the
+ * RSSI through WLC_E_RSSI as well and, below the trigger, looks in the
+ * BSS table (kept fresh by the background scan) for a stronger BSS of
+ * the network joined: it reassociates there directly, on its channel,
+ * without waiting for the firmware's roam scan. The delta and a holdoff
+ * between roams keep the link from bouncing between two BSSes.
+ *============================================================================*/
+
+/* Roaming settings; zero fields take the CYW_ROAM_* defaults */
+typedef struct {
+    int8_t trigger;             /* Roam below this RSSI (dBm) */
+    uint8_t delta;              /* Candidates at least this much stronger (dB) */
+    uint16_t scan_period;       /* Firmware roam scans below the trigger (s) */
+    uint32_t holdoff;           /* Least time between two driver roams (ms) */
+    bool fw_only;               /* Leave it to the firmware, no BSS table lookups */
+} cyw_roam_params_t;
+
+/*============================================================================
+ * Power Save
+ *
+ * Two independent trade-offs. 802.11 power save (WLC_SET_PM) lets the
+ * radio doze between beacons: PM1 fetches every buffered frame with a
+ * PS-Poll (least power, most latency), PM2 stays awake while traffic
+ * flows and dozes again sleep_ret ms after the last frame. Bus sleep
+ * clears Keep SDIO On once the bus has been idle for bus_idle ms, so the
+ * chip's SDIO core powers down too; the next bus access sets KSO again
+ * and waits for the core and its HT clock, at most CYW_PM_WAKE_TIMEOUT_MS.
+ * Everything is off by default, as suits mains-powered units.
+ *============================================================================*/
+
+typedef enum {
+    CYW_PM_OFF = 0,             /* Radio always on */
+    CYW_PM_PM1,                 /* PS-Poll */
+    CYW_PM_PM2,                 /* Fast power save */
+} cyw_pm_mode_t;
+
+/* Power save settings; zero times take the CYW_PM_* defaults */
+typedef struct {
+    cyw_pm_mode_t mode;
+    uint16_t sleep_ret;         /* PM2: awake after the last frame (ms) */
+    bool bus_sleep;             /* Put the bus to sleep (KSO) when idle */
+    uint16_t bus_idle;          /* ... after this long without access (ms) */
+} cyw_pm_params_t;
+
 /*============================================================================
  * Driver Context
  *============================================================================*/
@@ -183,8 +910,131 @@ typedef struct {
     uint8_t tx_max;
     uint8_t flow_ctrl;
 
-    /* BCDC state */
+    /* Length of the next RX frame announced by the previous one (0 = unknown) */
+    uint16_t rx_next_len;
+    uint32_t rx_single;         /* Frames read with one CMD53 */
+    uint32_t rx_mispredict;     /* Predictions that needed a second read */
+    bool rx_irq_more;           /* Interrupt acknowledged, frames left to read */
+
+    /* RX glom: descriptor of the superframe due next, split subframes */
+    uint16_t rx_glom_len[CYW_RXGLOM_MAX_FRAMES];
+    uint8_t rx_glom_count;
+    cyw_pkt_queue_t rx_glom_q;
+    uint32_t rx_glom;           /* Superframes received */
+    uint32_t rx_glom_drop;      /* Superframes discarded */
+
+    /* TX: frames waiting for credit / to be glommed */
+    bool txglom;                /* Firmware accepts superframes */
+    cyw_pkt_queue_t txq[CYW_TXQ_COUNT];
+    uint32_t txq_deficit[CYW_TXQ_COUNT];    /* WMM deficit round robin */
+    uint8_t txq_rr;             /* AC being served */
+    uint16_t tx_q_count;        /* Frames in all queues */
+    uint32_t tx_q_bytes;
+    uint32_t tx_q_since;        /* get_time_us() when the queue got its first frame */
+    uint32_t tx_glom;           /* Superframes sent */
+    uint32_t tx_glom_frames;    /* Frames sent inside superframes */
+    uint32_t tx_linearized;
+    uint16_t tx_q_peak;
+    uint32_t tx_credit_stall;
+    uint32_t tx_fc_stall;
+
+    /* BCDC state: outstanding IOCTLs */
     uint16_t reqid;
+    cyw_ioctl_req_t ioctl[CYW_IOCTL_MAX_PENDING];
+    uint8_t ioctl_pending;
+    uint8_t ioctl_arena;        /* Users of the large-IOCTL arena */
+    uint32_t ioctl_timeout;
+    uint32_t ioctl_orphan;
+
+    /* Packet buffers */
+    cyw_pkt_pool_t tx_pool;
+    cyw_pkt_pool_t rx_pool;
+    cyw_pkt_pool_t rx_clone_pool;   /* Subframe views into superframes */
+    cyw_pkt_pool_t tx_wrap_pool;    /* TX segments in caller storage */
+
+    /* Frames received while the receive callback was busy */
+    cyw_pkt_queue_t rx_pend;
+    uint32_t rx_dropped;
+
+    /* Events: handlers, and per type a bitmap of the handlers subscribed */
+    cyw_event_handler_t ev_handler[CYW_EVENT_HANDLERS];
+    uint8_t ev_subs[CYW_EVENT_MAX];
+    uint8_t ev_mask[WL_EVENTING_MASK_LEN];  /* As last programmed */
+    bool ev_mask_valid;
+    uint32_t rx_event;
+    uint32_t rx_event_drop;
+
+    /* Scan: BSS table, its BSSID hash and its heap, weakest on top */
+    cyw_scan_result_t scan_bss[CYW_SCAN_MAX_BSS];
+    uint8_t scan_hash[CYW_SCAN_HASH_SIZE];
+    uint8_t scan_heap[CYW_SCAN_MAX_BSS];
+    uint8_t scan_pos[CYW_SCAN_MAX_BSS];     /* Heap index of each entry */
+    uint32_t scan_count;
+    uint32_t scan_gen;                      /* Scans started */
+    uint16_t scan_sync_id;
+    bool scan_busy;
+    cyw_scan_params_t scan_req;             /* Callbacks of the scan running */
+    uint32_t scan_stat_bss;
+    uint32_t scan_stat_dup;
+    uint32_t scan_stat_drop;
+
+    /* Background scan: channel plan and where the sweep is */
+    bool bgscan_on;
+    bool bgscan_slice;                      /* The scan running is a slice */
+    bool bgscan_deferred;                   /* Held back by TX, counted */
+    cyw_bgscan_params_t bgscan;             /* Settings, defaults filled in */
+    uint16_t bgscan_ch[CYW_SCAN_MAX_CHANNELS];
+    uint32_t bgscan_pos;                    /* First channel of the next slice */
+    uint32_t bgscan_next;                   /* get_time_us() of the next slice */
+    uint32_t bgscan_stat_slices;
+    uint32_t bgscan_stat_sweeps;
+    uint32_t bgscan_stat_defer;
+
+    /* Link, as the firmware reports it */
+    volatile bool link_up;
+    uint8_t link_bssid[6];
+    cyw_err_t join_status;                  /* CYW_ERR_BUSY while joining */
+    cyw_link_cb_t link_cb;
+    void *link_cb_ctx;
+    cyw_join_cache_t join_cache;
+    uint32_t join_stat_fast;
+    uint32_t join_stat_fast_fail;
+    uint32_t join_stat_full;
+
+    /* Roaming */
+    bool roam_on;
+    cyw_roam_params_t roam;                 /* Settings, defaults filled in */
+    int16_t roam_rssi;                      /* Last RSSI (dBm), 0: unknown */
+    bool roam_resync;                       /* New BSS: RSSI and join cache to refresh */
+    bool roam_busy;                         /* Reassociation in flight */
+    uint8_t roam_bssid[6];                  /* Where the last roam went */
+    uint32_t roam_seen;                     /* scan_stat_bss at the last lookup */
+    uint32_t roam_start;                    /* get_time_us() of the last reassociation */
+    uint32_t roam_stat_low;
+    uint32_t roam_stat_fw;
+    uint32_t roam_stat_host;
+    uint32_t roam_stat_fail;
+    uint32_t roam_stat_last_ms;
+
+    /* Power save: bus sleep (KSO) */
+    cyw_pm_params_t pm;                     /* Settings, defaults filled in */
+    bool bus_asleep;                        /* KSO cleared: the next access wakes it */
+    bool bus_used;                          /* Accessed since the last idle check */
+    uint32_t bus_idle_since;                /* get_time_us() of the last access seen */
+    uint32_t pm_stat_sleeps;
+    uint32_t pm_stat_wakes;
+    uint32_t pm_stat_wake_fail;
+    uint32_t pm_stat_wake_last;
+    uint32_t pm_stat_wake_max;
+    uint32_t pm_stat_wake_total;
+
+    /* Data path */
+    cyw_rx_cb_t rx_cb;
+    void *rx_cb_ctx;
+    bool rx_cb_busy;
+    uint32_t tx_data;
+    uint32_t rx_data;
+    uint32_t rx_data_drop;
 
     /* Buffers */
     uint8_t tx_buf[TX_BUF_SIZE] __attribute__((aligned(4)));
@@ -218,17 +1068,46 @@ void cyw_deinit(void);
  */
 cyw_err_t cyw_get_chip_info(cyw_chip_info_t *info);
 
+/**
+ * Get bus statistics
+ * @param stats Pointer to store the counters
+ * @return CYW_OK on success
+ */
+cyw_err_t cyw_get_stats(cyw_stats_t *stats);
+
 /**
  * Load firmware
+ *
+ * Either image may be raw or a CYZ1 container from tools/lz4pack.py;
+ * containers are decompressed block by block while downloading.
+ * A TRX firmware image is length- and CRC-checked before any bus traffic
+ * and only its RAM segments are transferred. NVRAM packed by
+ * tools/nvram_pack.py (ends in the size token) is written verbatim.
+ *
  * @param fw_data Firmware binary data
  * @param fw_size Firmware size
  * @param nvram_data NVRAM data (text)
  * @param nvram_size NVRAM size
- * @return CYW_OK on success
+ * @return CYW_OK on success, CYW_ERR_FW for a corrupt TRX image
  */
 cyw_err_t cyw_load_firmware(const uint8_t *fw_data, uint32_t fw_size,
                             const uint8_t *nvram_data, uint32_t nvram_size);
 
+/**
+ * Load firmware from chunk readers
+ *
+ * Images are pulled CYW_FW_CHUNK_SIZE bytes at a time, so they never have
+ * to be memory-resident. Chunk buffers must hold CYW_FW_CHUNK_SIZE bytes.
+ * A TRX header must arrive in the first chunk; its CRC is checked before
+ * the ARM core is released.
+ *
+ * @param fw Firmware reader
+ * @param nvram NVRAM reader (NULL to skip)
+ * @return CYW_OK on success
+ */
+cyw_err_t cyw_load_firmware_stream(const cyw_fw_reader_t *fw,
+                                   const cyw_fw_reader_t *nvram);
+
 /**
  * Bring up the WiFi interface
  * @return CYW_OK on success
@@ -242,17 +1121,119 @@ cyw_err_t cyw_up(void);
 cyw_err_t cyw_down(void);
 
 /**
- * Send IOCTL command
+ * Send IOCTL command and wait for the response
+ *
+ * Frames received while waiting are dispatched as usual (a data frame
+ * arriving while the receive callback itself is waiting is held for the
+ * next cyw_poll()). Buffers too large for a TX pool buffer, up to
+ * CYW_IOCTL_MAX_LEN, go through the IOCTL arena, one request at a time.
+ *
  * @param cmd IOCTL command number
  * @param data Input/output data buffer
  * @param len Data length
  * @param set true for SET, false for GET
- * @return CYW_OK on success
+ * @return CYW_OK on success, CYW_ERR_BUSY while the arena is taken,
+ *         CYW_ERR_NOMEM beyond CYW_IOCTL_MAX_LEN
  */
 cyw_err_t cyw_ioctl(uint32_t cmd, void *data, uint32_t len, bool set);
 
+/**
+ * Allocate a TX packet
+ *
+ * The payload is written in place at cyw_pkt_data(); headroom bytes in
+ * front of it are left for the driver's headers (use CYW_PKT_HEADROOM).
+ * A payload that is not 4-byte aligned costs up to 3 more bytes of
+ * headroom (the SDPCM header is padded to a word boundary).
+ *
+ * @param headroom Bytes reserved in front of the payload
+ * @param len Payload length
+ * @return Packet, or NULL if no buffer is free
+ */
+cyw_pkt_t *cyw_pkt_alloc(uint32_t headroom, uint32_t len);
+
+/**
+ * Describe TX storage owned by the caller, without copying
+ *
+ * For the first segment of a frame, headroom must cover
+ * CYW_PKT_DATA_HEADROOM plus the payload's misalignment (0-3 bytes);
+ * further segments (cyw_pkt_append()) need none.
+ *
+ * @param data Start of the storage, headroom included
+ * @param headroom Bytes in front of the payload free for headers
+ * @param len Payload length
+ * @param release Called with ctx once the driver is done with the storage
+ * @param ctx Passed to release
+ * @return Packet, or NULL if no descriptor is free
+ */
+cyw_pkt_t *cyw_pkt_wrap(void *data, uint32_t headroom, uint32_t len,
+                        cyw_pkt_release_t release, void *ctx);
+
+/**
+ * Free RX buffers: frames that can still be received before the ones
+ * held by the application are released
+ * @return Buffers in the RX pool
+ */
+uint32_t cyw_pkt_rx_avail(void);
+
+/**
+ * Give the TX pool more buffers (e.g. from cyw_fwmem_alloc())
+ * @param mem Memory block, owned by the driver from now on
+ * @param len Block size
+ * @return Number of buffers added
+ */
+uint32_t cyw_pkt_tx_pool_add(void *mem, uint32_t len);
+
+/**
+ * Give the RX pool more buffers: more frames can be in flight
+ * @param mem Memory block, owned by the driver from now on
+ * @param len Block size
+ * @return Number of buffers added
+ */
+uint32_t cyw_pkt_rx_pool_add(void *mem, uint32_t len);
+
+/**
+ * Send IOCTL command from a packet built in place
+ *
+ * The packet payload is the IOCTL buffer; the BCDC and SDPCM headers are
+ * pushed into its headroom. The packet is consumed in all cases.
+ *
+ * @param cmd IOCTL command number
+ * @param pkt Request (from cyw_pkt_alloc(CYW_PKT_HEADROOM, len))
+ * @param set true for SET, false for GET
+ * @param resp Response buffer (NULL to discard)
+ * @param resp_len Response buffer size
+ * @return CYW_OK on success
+ */
+cyw_err_t cyw_ioctl_pkt(uint32_t cmd, cyw_pkt_t *pkt, bool set,
+                        void *resp, uint32_t resp_len);
+
+/**
+ * Send IOCTL command without waiting
+ *
+ * The request goes on the control queue at once; cb is called from
+ * cyw_poll() (or from another request's wait) with the response, or with
+ * CYW_ERR_TIMEOUT once timeout_ms has passed. The packet is consumed in
+ * all cases; cb is not called if this returns an error.
+ *
+ * @param cmd IOCTL command number
+ * @param pkt Request (from cyw_pkt_alloc(CYW_PKT_HEADROOM, len))
+ * @param set true for SET, false for GET
+ * @param timeout_ms Response timeout (0 for CYW_IOCTL_TIMEOUT_MS)
+ * @param cb Completion callback (NULL to ignore the result)
+ * @param ctx Passed to cb
+ * @return CYW_OK if sent, CYW_ERR_BUSY if CYW_IOCTL_MAX_PENDING requests
+ *         are outstanding
+ */
+cyw_err_t cyw_ioctl_async(uint32_t cmd, cyw_pkt_t *pkt, bool set,
+                          uint32_t timeout_ms, cyw_ioctl_cb_t cb, void *ctx);
+
 /**
  * Get/set variable
+ *
+ * Name and value share the IOCTL buffer, so large values (escan channel
+ * lists, packet filters, counter dumps) take the IOCTL arena as in
+ * cyw_ioctl().
+ *
  * @param name Variable name
  * @param data Input/output data buffer
  * @param len Data length
@@ -262,18 +1243,88 @@ cyw_err_t cyw_ioctl(uint32_t cmd, void *data, uint32_t len, bool set);
 cyw_err_t cyw_iovar(const char *name, void *data, uint32_t len, bool set);
 
 /**
- * Scan for networks
- * @param results Buffer for scan results
+ * Run a profile of IOCTLs and iovars, pipelined
+ *
+ * Up to CYW_IOCTL_PIPELINE requests are in flight at once, sent in order
+ * as the firmware's credit window allows, instead of one round trip per
+ * setting. After the first failure nothing more is sent; requests
+ * already in flight are still collected. Every op gets its status.
+ *
+ * @param ops Settings, in firmware order
+ * @param count Number of settings
+ * @return CYW_OK if all succeeded, else the status of the first failure
+ */
+cyw_err_t cyw_ioctl_batch(cyw_ioctl_op_t *ops, uint32_t count);
+
+/**
+ * Start a scan
+ *
+ * Returns once the firmware has taken the request. Results then arrive
+ * through cyw_poll(): on_result for each BSS as it is heard, on_done at
+ * the end. The callbacks may start the next scan.
+ *
+ * @param params Channels, timing and callbacks (copied)
+ * @return CYW_OK, CYW_ERR_BUSY while a scan runs, CYW_ERR_INVALID for
+ *         too many channels, or the IOCTL error
+ */
+cyw_err_t cyw_scan_start(const cyw_scan_params_t *params);
+
+/**
+ * Abort the running scan; on_done gets CYW_ERR_BUSY before this returns
+ * @return CYW_OK, or the IOCTL error
+ */
+cyw_err_t cyw_scan_abort(void);
+
+/**
+ * Check whether a scan is running
+ * @return true between cyw_scan_start() and on_done
+ */
+bool cyw_scan_busy(void);
+
+/**
+ * Copy the BSS table, latest scan first, strongest first
+ * @param results Buffer for the entries
+ * @param max_results Buffer size in entries
+ * @return Number of entries copied
+ */
+int cyw_scan_results(cyw_scan_result_t *results, int max_results);
+
+/**
+ * Scan all channels and wait for the end (up to CYW_SCAN_TIMEOUT_MS)
+ * @param results Buffer for scan results, strongest first
  * @param max_results Maximum number of results
  * @return Number of networks found, or error
  */
-int cyw_scan(void *results, int max_results);
+int cyw_scan(cyw_scan_result_t *results, int max_results);
+
+/**
+ * Start (or restart) background scanning; the first slice goes out on
+ * the next cyw_poll() after cyw_up()
+ * @param params Settings (NULL: all defaults), copied
+ * @return CYW_OK, CYW_ERR_INVALID for a bad channel list,
+ *         CYW_ERR_NOT_READY without host get_time_us, or the IOCTL error
+ *         reading the valid channels
+ */
+cyw_err_t cyw_bgscan_start(const cyw_bgscan_params_t *params);
+
+/**
+ * Stop background scanning, aborting the slice running
+ */
+void cyw_bgscan_stop(void);
 
 /**
  * Connect to network
+ *
+ * The security profile goes out as one IOCTL batch, then the join;
+ * returns as soon as the firmware reports the outcome, at most
+ * CYW_CONNECT_TIMEOUT_MS later. When the join cache holds this network,
+ * a directed join to its BSSID and channel goes first, without the
+ * full-band scan; the full join follows only if it fails.
+ *
  * @param ssid SSID string
- * @param passphrase Passphrase (NULL for open network)
- * @return CYW_OK on success
+ * @param passphrase WPA2 passphrase (NULL or "" for an open network)
+ * @return CYW_OK once associated, CYW_ERROR if the join failed,
+ *         CYW_ERR_TIMEOUT if the firmware gave no answer in time
  */
 cyw_err_t cyw_connect(const char *ssid, const char *passphrase);
 
@@ -284,11 +1335,60 @@ cyw_err_t cyw_connect(const char *ssid, const char *passphrase);
 cyw_err_t cyw_disconnect(void);
 
 /**
- * Check if connected
+ * Check if connected (cached link state, no bus access)
  * @return true if connected
  */
 bool cyw_is_connected(void);
 
+/**
+ * Set the link change callback
+ * @param cb Callback (NULL for none)
+ * @param ctx Passed to the callback
+ */
+void cyw_set_link_callback(cyw_link_cb_t cb, void *ctx);
+
+/**
+ * Get the join cache (updated on every successful join)
+ * @param cache Pointer to store the entry
+ * @return CYW_OK, or CYW_ERROR if empty
+ */
+cyw_err_t cyw_get_join_cache(cyw_join_cache_t *cache);
+
+/**
+ * Set the join cache, e.g. restored after a power cycle
+ * @param cache Entry (NULL to clear)
+ */
+void cyw_set_join_cache(const cyw_join_cache_t *cache);
+
+/**
+ * Start (or restart) roaming: programs the firmware's roam trigger, delta
+ * and scan period, and RSSI events at the trigger; candidates from the
+ * BSS table need host get_time_us and the join cache
+ * @param params Settings (NULL: all defaults), copied
+ * @return CYW_OK, CYW_ERR_NOT_READY before cyw_up(), or the IOCTL error
+ */
+cyw_err_t cyw_roam_start(const cyw_roam_params_t *params);
+
+/**
+ * Stop roaming, the firmware's included (roam_off)
+ * @return CYW_OK, or the IOCTL error
+ */
+cyw_err_t cyw_roam_stop(void);
+
+/**
+ * Set power save
+ *
+ * The 802.11 mode goes to the firmware at once. With bus sleep, any bus
+ * access (including cyw_poll() finding an interrupt) wakes the bus first;
+ * wake latencies are in cyw_get_stats().
+ *
+ * @param params Settings (NULL: all off), copied
+ * @return CYW_OK, CYW_ERR_NOT_READY before cyw_up() or bus sleep without
+ *         host get_time_us and irq_pending, CYW_ERR_INVALID for an unknown
+ *         mode, or the IOCTL error
+ */
+cyw_err_t cyw_set_power_save(const cyw_pm_params_t *params);
+
 /**
  * Get RSSI
  * @return RSSI value in dBm, or 0 on error
@@ -300,6 +1400,60 @@ int cyw_get_rssi(void);
  */
 void cyw_poll(void);
 
+/**
+ * Register an event handler
+ *
+ * Subscribes cb/ctx to the given types, on top of those it already has.
+ * The firmware's event mask follows the union of all subscriptions: it
+ * is updated at once while the interface is up, otherwise at cyw_up().
+ *
+ * @param events WLC_E_* types, each below CYW_EVENT_MAX
+ * @param count Number of types
+ * @param cb Handler
+ * @param ctx Passed to cb
+ * @return CYW_OK, CYW_ERR_INVALID for a bad type, CYW_ERR_NOMEM with
+ *         CYW_EVENT_HANDLERS handlers registered, or the IOCTL error
+ */
+cyw_err_t cyw_event_register(const uint16_t *events, uint32_t count,
+                             cyw_event_cb_t cb, void *ctx);
+
+/**
+ * Unregister an event handler from all its types (may be called from the
+ * handler itself)
+ * @return CYW_OK, CYW_ERR_INVALID if cb/ctx is not registered, or the
+ *         IOCTL error
+ */
+cyw_err_t cyw_event_unregister(cyw_event_cb_t cb, void *ctx);
+
+/**
+ * Send an Ethernet frame
+ *
+ * The frame is queued by pkt->prio and goes out with the next flush; the
+ * BDC and SDPCM headers are pushed into its headroom. A frame chained
+ * from segments is gathered in one CMD53; without host cmd53_write_sg, or
+ * beyond CYW_TX_MAX_FRAGS segments, it is copied into a TX buffer first.
+ * The packet is consumed in all cases.
+ *
+ * @param pkt Frame (from cyw_pkt_alloc(CYW_PKT_DATA_HEADROOM, len)), with
+ *            prio and ifidx set
+ * @return CYW_OK if queued, CYW_ERR_INVALID for a runt frame, CYW_ERR_NOMEM
+ *         if a chain had to be copied and no TX buffer was free
+ */
+cyw_err_t cyw_tx_ethernet(cyw_pkt_t *pkt);
+
+/**
+ * Set the receive callback for Ethernet frames
+ * @param cb Callback (NULL to drop received frames)
+ * @param ctx Passed to the callback
+ */
+void cyw_set_rx_callback(cyw_rx_cb_t cb, void *ctx);
+
+/**
+ * Send all queued TX frames now, without waiting for the glom deadline
+ * @return CYW_OK on success
+ */
+cyw_err_t cyw_tx_flush(void);
+
 /**
  * Get driver state
  * @return Current state
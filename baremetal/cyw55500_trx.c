@@ -0,0 +1,111 @@
+/**
+ * CYW55500 WiFi - TRX Firmware Container
+ * Header parsing and validation for .trx / .trxse images
+ */
+
+#include "baremetal.h"
+#include "cyw55500_trx.h"
+
+/*============================================================================
+ * CRC32 (reflected, poly 0xEDB88320, nibble table)
+ *============================================================================*/
+
+static const uint32_t crc32_nibble[16] = {
+    0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+    0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+    0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+    0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C,
+};
+
+uint32_t cyw_crc32(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+    while (len--) {
+        crc ^= *data++;
+        crc = (crc >> 4) ^ crc32_nibble[crc & 0x0F];
+        crc = (crc >> 4) ^ crc32_nibble[crc & 0x0F];
+    }
+    return crc;
+}
+
+/*============================================================================
+ * Header Parsing
+ *============================================================================*/
+
+static inline uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool cyw_trx_is_image(const uint8_t *data, uint32_t len)
+{
+    return data != NULL && len >= TRX_HEADER_SIZE &&
+           get_le32(data) == TRX_MAGIC;
+}
+
+cyw_err_t cyw_trx_parse(const uint8_t *data, uint32_t avail, uint32_t file_size,
+                        uint32_t secure_hdr_len, cyw_trx_info_t *info)
+{
+    uint32_t flag_version;
+
+    if (!cyw_trx_is_image(data, avail) || info == NULL) {
+        return CYW_ERR_FW;
+    }
+
+    memset(info, 0, sizeof(*info));
+    info->len = get_le32(data + 4);
+    info->crc32 = get_le32(data + 8);
+    flag_version = get_le32(data + 12);
+    info->version = (flag_version & TRX_VERSION_MASK) >> TRX_VERSION_SHIFT;
+    info->flags = flag_version & TRX_FLAGS_MASK;
+
+    if (info->version == 0) {
+        return CYW_ERR_FW;
+    }
+
+    if (file_size != 0) {
+        if (info->len > file_size) {
+            return CYW_ERR_FW;      /* Truncated */
+        }
+        info->trailer_len = file_size - info->len;
+    }
+
+    if (info->version >= TRX_VERSION_SECURE) {
+        /* Signed image: header block is verified by the chip bootloader */
+        if (secure_hdr_len < TRX_HEADER_SIZE || avail < secure_hdr_len) {
+            return CYW_ERR_FW;
+        }
+        info->hdr_len = secure_hdr_len;
+        info->hdr_needed = true;
+        info->body_off = secure_hdr_len;
+        info->body_len = info->len > secure_hdr_len ? info->len - secure_hdr_len : 0;
+    } else {
+        /* Plain image: first partition is the RAM image */
+        uint32_t start = get_le32(data + 16);
+        uint32_t end = get_le32(data + 20);
+
+        if (end == 0 || end > info->len) {
+            end = info->len;
+        }
+        if (start < TRX_HEADER_SIZE || start > end) {
+            return CYW_ERR_FW;
+        }
+        info->hdr_len = start;
+        info->hdr_needed = false;
+        info->body_off = start;
+        info->body_len = end - start;
+    }
+
+    if (info->body_len == 0) {
+        return CYW_ERR_FW;
+    }
+
+    return CYW_OK;
+}
+
+cyw_err_t cyw_trx_verify(const cyw_trx_info_t *info, const uint8_t *data)
+{
+    uint32_t crc = cyw_crc32(0xFFFFFFFF, data + TRX_CRC_START,
+                             info->len - TRX_CRC_START);
+
+    return (crc == info->crc32) ? CYW_OK : CYW_ERR_FW;
+}
@@ -0,0 +1,97 @@
+/**
+ * CYW55500 WiFi - TRX Firmware Container
+ * Header parsing and validation for .trx / .trxse images
+ */
+
+#ifndef CYW55500_TRX_H
+#define CYW55500_TRX_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cyw55500_sdio.h"
+
+/*============================================================================
+ * TRX Header
+ *============================================================================*/
+
+#define TRX_MAGIC                   0x30524448  /* "HDR0" */
+#define TRX_MAX_OFFSET              3
+
+#define TRX_VERSION_MASK            0xFFFF0000
+#define TRX_VERSION_SHIFT           16
+#define TRX_FLAGS_MASK              0x0000FFFF
+
+/* flag_version flags */
+#define TRX_FLAG_UNCOMP_IMAGE       0x0020      /* Image is not compressed */
+
+/* Versions 1-2: partition offsets; 3+: signed (secure boot) image */
+#define TRX_VERSION_SECURE          3
+
+/* CRC32 covers flag_version .. end of image */
+#define TRX_CRC_START               12
+
+typedef struct __attribute__((packed)) {
+    uint32_t magic;
+    uint32_t len;                       /* Image length incl. header */
+    uint32_t crc32;                     /* hnd CRC32 (no final XOR) */
+    uint32_t flag_version;              /* 15:0 flags, 31:16 version */
+    uint32_t offsets[TRX_MAX_OFFSET];   /* Partition offsets (v1/v2) */
+} trx_header_t;
+
+#define TRX_HEADER_SIZE             sizeof(trx_header_t)
+
+/*============================================================================
+ * Parsed Image Layout
+ *============================================================================*/
+
+typedef struct {
+    uint32_t version;
+    uint32_t flags;
+    uint32_t len;           /* Image length from header */
+    uint32_t crc32;         /* Expected CRC */
+
+    uint32_t hdr_len;       /* Header block size */
+    bool hdr_needed;        /* Header block must reach the chip (signed) */
+
+    uint32_t body_off;      /* RAM image: offset in file */
+    uint32_t body_len;      /* RAM image: length */
+
+    uint32_t trailer_len;   /* Bytes after len (never transferred) */
+} cyw_trx_info_t;
+
+/**
+ * Check for a TRX header
+ * @param data Image data
+ * @param len Bytes available
+ * @return true if data starts with the HDR0 magic
+ */
+bool cyw_trx_is_image(const uint8_t *data, uint32_t len);
+
+/**
+ * Parse and length-check a TRX header
+ *
+ * No bus traffic is involved; the result describes which bytes of the
+ * file make up the RAM image and which are container overhead.
+ *
+ * @param data Start of image (at least secure_hdr_len bytes for v3+)
+ * @param avail Bytes available at data
+ * @param file_size Total file size, or 0 if unknown (streaming)
+ * @param secure_hdr_len Chip-specific header block size for signed images
+ * @param info Parsed layout
+ * @return CYW_OK, or CYW_ERR_FW for a corrupt/unsupported header
+ */
+cyw_err_t cyw_trx_parse(const uint8_t *data, uint32_t avail, uint32_t file_size,
+                        uint32_t secure_hdr_len, cyw_trx_info_t *info);
+
+/**
+ * Verify the CRC of a memory-resident image
+ * @return CYW_OK if the CRC matches
+ */
+cyw_err_t cyw_trx_verify(const cyw_trx_info_t *info, const uint8_t *data);
+
+/**
+ * Update a running hnd CRC32 (start with 0xFFFFFFFF, no final XOR)
+ */
+uint32_t cyw_crc32(uint32_t crc, const uint8_t *data, uint32_t len);
+
+#endif /* CYW55500_TRX_H */
@@ -0,0 +1,81 @@
+/**
+ * lwIP Options - Bare-metal CYW55500 Build
+ * NO_SYS: raw API from the main loop, IPv4 with TCP, UDP, DHCP and DNS
+ */
+
+#ifndef LWIPOPTS_H
+#define LWIPOPTS_H
+
+/*============================================================================
+ * System
+ *============================================================================*/
+
+/* No RTOS: everything runs from cyw_lwip_poll(), nothing from interrupts */
+#define NO_SYS                          1
+#define SYS_LIGHTWEIGHT_PROT            0
+#define LWIP_NETCONN                    0
+#define LWIP_SOCKET                     0
+
+/*============================================================================
+ * Memory
+ *============================================================================*/
+
+#define MEM_ALIGNMENT                   4
+#define MEM_SIZE                        (32 * 1024)
+
+#define MEMP_NUM_PBUF                   32
+#define MEMP_NUM_UDP_PCB                6
+#define MEMP_NUM_TCP_PCB                8
+#define MEMP_NUM_TCP_PCB_LISTEN         4
+#define MEMP_NUM_TCP_SEG                32
+
+/* RX frames are copied here only when driver buffers run short */
+#define PBUF_POOL_SIZE                  16
+
+/*
+ * Room for the driver's bus headers in front of every TX frame, so the
+ * frame goes out in place: SDPCM with glom extension (20) + BDC (4) + up
+ * to 3 alignment bytes (checked against CYW_PKT_DATA_HEADROOM).
+ */
+#define PBUF_LINK_ENCAPSULATION_HLEN    28
+#define ETH_PAD_SIZE                    0
+
+/* Received frames are lent to lwIP as custom pbufs */
+#define LWIP_SUPPORT_CUSTOM_PBUF        1
+
+/*============================================================================
+ * Protocols
+ *============================================================================*/
+
+#define LWIP_ARP                        1
+#define LWIP_ETHERNET                   1
+#define LWIP_IPV4                       1
+#define LWIP_IPV6                       0
+#define LWIP_ICMP                       1
+#define LWIP_IGMP                       1
+#define LWIP_DHCP                       1
+#define LWIP_DNS                        1
+#define LWIP_UDP                        1
+#define LWIP_TCP                        1
+
+#define LWIP_NETIF_STATUS_CALLBACK      1
+#define LWIP_NETIF_LINK_CALLBACK        1
+
+/*============================================================================
+ * TCP
+ *============================================================================*/
+
+#define TCP_MSS                         1460
+#define TCP_WND                         (8 * TCP_MSS)
+#define TCP_SND_BUF                     (8 * TCP_MSS)
+#define TCP_SND_QUEUELEN                (4 * TCP_SND_BUF / TCP_MSS)
+
+/*============================================================================
+ * Statistics and Debug
+ *============================================================================*/
+
+#define LWIP_STATS                      1
+#define LINK_STATS                      1
+#define LWIP_STATS_DISPLAY              0
+
+#endif /* LWIPOPTS_H */
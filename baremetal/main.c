@@ -8,8 +8,15 @@
 #include <stdbool.h>
 #include "baremetal.h"
 #include "cyw55500_sdio.h"
+#include "cyw55500_fwmem.h"
 #include "sdio_litex.h"
 
+#ifdef USE_LWIP
+#include "cyw55500_lwip.h"
+
+static struct netif wifi_netif;
+#endif
+
 /*============================================================================
  * Firmware Data
  *
@@ -65,27 +72,58 @@ static void print_hex(const char *prefix, uint32_t val)
  * WiFi Event Callback (Optional)
  *============================================================================*/
 
-void wifi_event_handler(uint32_t event_type, void *data, uint32_t len)
+/* Only these reach the host; the firmware drops all other events */
+static const uint16_t wifi_events[] = {
+    WLC_E_LINK, WLC_E_SET_SSID, WLC_E_DEAUTH_IND, WLC_E_DISASSOC_IND,
+};
+
+static void wifi_event_handler(void *ctx, const cyw_event_t *ev,
+                               const uint8_t *data, uint32_t len)
 {
+    (void)ctx;
     (void)data;
     (void)len;
 
-    switch (event_type) {
-        case 0: /* Link up */
-            print("WiFi: Link Up\n");
+    switch (ev->type) {
+        case WLC_E_LINK:
+            print((ev->flags & WLC_EVENT_MSG_LINK) ? "WiFi: Link Up\n"
+                                                   : "WiFi: Link Down\n");
             break;
-        case 1: /* Link down */
-            print("WiFi: Link Down\n");
+        case WLC_E_SET_SSID:
+            print_hex("WiFi: Join status: ", ev->status);
             break;
-        case 16: /* Scan complete */
-            print("WiFi: Scan Complete\n");
+        case WLC_E_DEAUTH_IND:
+        case WLC_E_DISASSOC_IND:
+            print_hex("WiFi: Dropped by AP, reason: ", ev->reason);
             break;
         default:
-            print_hex("WiFi Event: ", event_type);
+            print_hex("WiFi Event: ", ev->type);
             break;
     }
 }
 
+/*============================================================================
+ * Scan Callbacks
+ *============================================================================*/
+
+/* Each network as soon as it is heard, from cyw_poll() */
+static void wifi_scan_result(void *ctx, const cyw_scan_result_t *bss)
+{
+    (void)ctx;
+
+    print("  ");
+    print(bss->ssid_len ? (const char *)bss->ssid : "<hidden>");
+    print_hex(" channel ", bss->channel);
+    print_hex("    RSSI ", (uint32_t)bss->rssi);
+}
+
+static void wifi_scan_done(void *ctx, cyw_err_t status)
+{
+    (void)ctx;
+
+    print_hex("Scan complete, status: ", (uint32_t)status);
+}
+
 /*============================================================================
  * Main Application
  *============================================================================*/
@@ -133,8 +171,29 @@ int main(void)
     uint32_t nvram_size = _binary_cyfmac55500_sdio_txt_end -
                           _binary_cyfmac55500_sdio_txt_start;
 
-    err = cyw_load_firmware(_binary_cyfmac55500_sdio_bin_start, fw_size,
-                            _binary_cyfmac55500_sdio_txt_start, nvram_size);
+    err = cyw_fwmem_init(_binary_cyfmac55500_sdio_bin_start, fw_size,
+                         _binary_cyfmac55500_sdio_txt_start, nvram_size);
+    if (err == CYW_OK) {
+        err = cyw_fwmem_load();
+    }
+
+    /*
+     * The images are dead once the chip runs them: hand the .firmware
+     * region over to packet buffers (cyw_fwmem_alloc()). A warm
+     * re-download then needs cyw_fwmem_set_refetch() (flash, ROM copy).
+     */
+    if (err == CYW_OK && cyw_fwmem_release() == CYW_OK) {
+        uint32_t len = (cyw_fwmem_avail() / 2) & ~7u;
+
+        print_hex("Reclaimed bytes: ", cyw_fwmem_avail());
+
+        /* Half to each pool: more frames in flight both ways */
+        print_hex("Extra TX buffers: ",
+                  cyw_pkt_tx_pool_add(cyw_fwmem_alloc(len, 0), len));
+        len = cyw_fwmem_avail();
+        print_hex("Extra RX buffers: ",
+                  cyw_pkt_rx_pool_add(cyw_fwmem_alloc(len, 0), len));
+    }
 #else
     /* For testing - you need to provide actual firmware data */
     print("WARNING: No firmware embedded. Skipping FW load.\n");
@@ -155,6 +214,10 @@ int main(void)
     if (cyw_get_state() >= CYW_STATE_FW_READY) {
         print("Bringing up WiFi interface...\n");
 
+        /* Programmed into the firmware's event mask by cyw_up() */
+        cyw_event_register(wifi_events, ARRAY_SIZE(wifi_events),
+                           wifi_event_handler, NULL);
+
         err = cyw_up();
         if (err != CYW_OK) {
             print("ERROR: WiFi UP failed\n");
@@ -168,10 +231,26 @@ int main(void)
      * Step 5: Example operations
      *------------------------------------------------------------------------*/
     if (cyw_get_state() >= CYW_STATE_UP) {
-        /* Get MAC address */
-        uint8_t mac[6];
-        err = cyw_iovar("cur_etheraddr", mac, 6, false);
-        if (err == CYW_OK) {
+        /* Bring-up profile: one pipelined batch instead of a round trip each */
+        uint8_t mac[6] = {0};
+        char ver[64] = {0};
+        struct {
+            char ccode[4];
+            uint32_t rev;
+        } country = { "KZ", 0 };
+
+        cyw_ioctl_op_t boot[] = {
+            CYW_IOVAR_GET("cur_etheraddr", mac, sizeof(mac)),
+            CYW_IOVAR_GET("ver", ver, sizeof(ver) - 1),
+            CYW_IOVAR_SET("country", &country, sizeof(country)),
+        };
+
+        err = cyw_ioctl_batch(boot, ARRAY_SIZE(boot));
+        if (err != CYW_OK) {
+            print_hex("Bring-up settings failed: ", err);
+        }
+
+        if (boot[0].status == CYW_OK) {
             print("MAC Address: ");
             for (int i = 0; i < 6; i++) {
                 print_hex("", mac[i]);
@@ -180,25 +259,22 @@ int main(void)
             print("\n");
         }
 
-        /* Get firmware version */
-        char ver[64] = {0};
-        err = cyw_iovar("ver", ver, sizeof(ver) - 1, false);
-        if (err == CYW_OK) {
+        if (boot[1].status == CYW_OK) {
             print("Firmware: ");
             print(ver);
             print("\n");
         }
 
-        /* Set country code */
-        struct {
-            char ccode[4];
-            uint32_t rev;
-        } country = { "KZ", 0 };
-        cyw_iovar("country", &country, sizeof(country), true);
+        /* Example: Start scan, results arrive while the main loop polls */
+        cyw_scan_params_t scan = {
+            .on_result = wifi_scan_result,
+            .on_done = wifi_scan_done,
+        };
 
-        /* Example: Start scan */
         print("Starting WiFi scan...\n");
-        /* TODO: Implement scan and result retrieval */
+        if (cyw_scan_start(&scan) != CYW_OK) {
+            print("ERROR: Scan failed\n");
+        }
 
         /* Example: Connect to network */
         /*
@@ -209,18 +285,49 @@ int main(void)
 
             int rssi = cyw_get_rssi();
             print_hex("RSSI: ", rssi);
+
+            cyw_bgscan_start(NULL);     // Keep the BSS table fresh
+            cyw_roam_start(NULL);       // Roam below -75 dBm
+
+            cyw_pm_params_t pm = { .mode = CYW_PM_PM2, .bus_sleep = true };
+            cyw_set_power_save(&pm);    // Battery SKUs only
         }
         */
     }
 
+#ifdef USE_LWIP
     /*------------------------------------------------------------------------
-     * Step 6: Main loop
+     * Step 6: TCP/IP stack
+     *------------------------------------------------------------------------*/
+    if (cyw_get_state() >= CYW_STATE_UP) {
+        cyw_lwip_init(litex_get_sdio_ops()->get_time_us);
+
+        if (netif_add(&wifi_netif, IP4_ADDR_ANY4, IP4_ADDR_ANY4, IP4_ADDR_ANY4,
+                      NULL, cyw_lwip_netif_init, netif_input) != NULL) {
+            netif_set_default(&wifi_netif);
+            netif_set_up(&wifi_netif);
+
+            /* Link follows firmware events; DHCP renews on link up (lwip/dhcp.h): */
+            /*
+            dhcp_start(&wifi_netif);
+            */
+        }
+    }
+#endif
+
+    /*------------------------------------------------------------------------
+     * Step 7: Main loop
      *------------------------------------------------------------------------*/
     print("\nEntering main loop...\n");
 
     while (1) {
+#ifdef USE_LWIP
+        /* Frames, events and lwIP timers */
+        cyw_lwip_poll();
+#else
         /* Poll for events */
         cyw_poll();
+#endif
 
         /* Your application code here */
 
@@ -247,6 +354,8 @@ error:
 
 void sdio_irq_handler(void)
 {
-    /* Called from interrupt context */
+    /* Called from interrupt context; with lwIP everything runs from the main loop */
+#ifndef USE_LWIP
     cyw_poll();
+#endif
 }
@@ -290,13 +290,38 @@ int litex_sdio_cmd52_write(uint8_t func, uint32_t addr, uint8_t val)
  * CMD53 Implementation (IO_RW_EXTENDED)
  *============================================================================*/
 
+uint32_t litex_sdio_max_xfer(uint8_t func)
+{
+    uint16_t bs = sdio_state.block_size[func & 0x7];
+
+    return (bs != 0 && bs < LITEX_SDIO_MAX_XFER) ? bs : LITEX_SDIO_MAX_XFER;
+}
+
+/**
+ * CMD53 count field, byte mode (0 means 512). Lengths the controller
+ * cannot move in one block are refused rather than truncated.
+ */
+static int cmd53_count(uint8_t func, uint32_t len, uint32_t *count)
+{
+    if (len == 0 || len > litex_sdio_max_xfer(func)) {
+        return -1;
+    }
+    *count = len & 0x1FF;
+    return 0;
+}
+
 int litex_sdio_cmd53_read(uint8_t func, uint32_t addr, uint8_t *data,
                           uint32_t len, bool incr_addr)
 {
     uint32_t arg;
+    uint32_t count;
     uint32_t response;
     int ret;
 
+    if (cmd53_count(func, len, &count) != 0) {
+        return -1;
+    }
+
     /* Set data length */
     sdio_write_reg(SDIO_REG_DATA_LENGTH, len);
 
@@ -311,7 +336,7 @@ int litex_sdio_cmd53_read(uint8_t func, uint32_t addr, uint8_t *data,
     arg = ((func & 0x7) << 28) |
           (incr_addr ? (1 << 26) : 0) |
           ((addr & 0x1FFFF) << 9) |
-          (len & 0x1FF);
+          count;
 
     /* Send command and read data */
     ret = send_command_read_data(CMD53_IO_RW_EXTENDED, arg, &response);
@@ -349,9 +374,14 @@ int litex_sdio_cmd53_write(uint8_t func, uint32_t addr, const uint8_t *data,
                            uint32_t len, bool incr_addr)
 {
     uint32_t arg;
+    uint32_t count;
     uint32_t response;
     int ret;
 
+    if (cmd53_count(func, len, &count) != 0) {
+        return -1;
+    }
+
     /* Set data length */
     sdio_write_reg(SDIO_REG_DATA_LENGTH, len);
 
@@ -379,7 +409,7 @@ int litex_sdio_cmd53_write(uint8_t func, uint32_t addr, const uint8_t *data,
           ((func & 0x7) << 28) |
           (incr_addr ? (1 << 26) : 0) |
           ((addr & 0x1FFFF) << 9) |
-          (len & 0x1FF);
+          count;
 
     /* Send command and write data */
     ret = send_command_write_data(CMD53_IO_RW_EXTENDED, arg, &response);
@@ -395,6 +425,81 @@ int litex_sdio_cmd53_write(uint8_t func, uint32_t addr, const uint8_t *data,
     return 0;
 }
 
+int litex_sdio_cmd53_write_sg(uint8_t func, uint32_t addr, const sdio_sg_t *sg,
+                              uint32_t count, bool incr_addr)
+{
+    uint32_t arg;
+    uint32_t count_field;
+    uint32_t response;
+    uint32_t len = 0;
+    uint32_t index = 0;
+    uint32_t word = 0;
+    int ret;
+
+    for (uint32_t i = 0; i < count; i++) {
+        len += sg[i].len;
+    }
+    if (cmd53_count(func, len, &count_field) != 0) {
+        return -1;
+    }
+    len = 0;
+
+    /*
+     * Segments are packed back to back into the data buffer. Segment
+     * boundaries need not fall on words: bytes are collected into the
+     * current word, whole aligned words are stored directly.
+     */
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *p = sg[i].data;
+        uint32_t n = sg[i].len;
+
+        while (n > 0) {
+            if ((len & 3) == 0 && ((uintptr_t)p & 3) == 0 && n >= 4) {
+                const uint32_t *data32 = (const uint32_t *)p;
+                uint32_t words = n / 4;
+
+                for (uint32_t w = 0; w < words; w++) {
+                    sdio_write_data_buffer(index++, data32[w]);
+                }
+                p += words * 4;
+                n -= words * 4;
+                len += words * 4;
+                continue;
+            }
+
+            word |= (uint32_t)*p++ << ((len & 3) * 8);
+            n--;
+            len++;
+            if ((len & 3) == 0) {
+                sdio_write_data_buffer(index++, word);
+                word = 0;
+            }
+        }
+    }
+    if (len & 3) {
+        sdio_write_data_buffer(index, word);
+    }
+
+    sdio_write_reg(SDIO_REG_DATA_LENGTH, len);
+
+    arg = (1 << 31) |                   /* Write flag */
+          ((func & 0x7) << 28) |
+          (incr_addr ? (1 << 26) : 0) |
+          ((addr & 0x1FFFF) << 9) |
+          count_field;
+
+    ret = send_command_write_data(CMD53_IO_RW_EXTENDED, arg, &response);
+    if (ret != 0) {
+        return ret;
+    }
+
+    if (response & 0xCB00) {
+        return -1;
+    }
+
+    return 0;
+}
+
 /*============================================================================
  * Function Management
  *============================================================================*/
@@ -439,17 +544,35 @@ int litex_sdio_enable_func(uint8_t func, bool enable)
     return ret;
 }
 
+/*
+ * No host-wake line and no DAT1 interrupt in the controller: the card's
+ * interrupt is enabled and read back through the CCCR instead.
+ */
 int litex_sdio_enable_irq(bool enable)
 {
-    (void)enable;
-    /* TODO: Implement when interrupt support is added to hardware */
-    return 0;
+    uint8_t val;
+    int ret;
+
+    ret = litex_sdio_cmd52_read(0, 0x04, &val); /* CCCR Int Enable */
+    if (ret != 0) return ret;
+
+    if (enable) {
+        val |= 0x03;    /* Master + Func1 */
+    } else {
+        val &= ~0x03;
+    }
+
+    return litex_sdio_cmd52_write(0, 0x04, val);
 }
 
 bool litex_sdio_irq_pending(void)
 {
-    /* TODO: Implement when interrupt support is added to hardware */
-    return false;
+    uint8_t val;
+
+    if (litex_sdio_cmd52_read(0, 0x05, &val) != 0) { /* CCCR Int Pending */
+        return false;
+    }
+    return (val & 0x02) != 0;   /* Func1 interrupt */
 }
 
 /*============================================================================
@@ -504,12 +627,18 @@ static const sdio_host_ops_t litex_sdio_ops = {
     .cmd52_write = litex_sdio_cmd52_write,
     .cmd53_read = litex_sdio_cmd53_read,
     .cmd53_write = litex_sdio_cmd53_write,
+    .cmd53_write_sg = litex_sdio_cmd53_write_sg,
     .set_block_size = litex_sdio_set_block_size,
     .enable_func = litex_sdio_enable_func,
     .enable_irq = litex_sdio_enable_irq,
-    .irq_pending = litex_sdio_irq_pending,
+    /*
+     * .irq_pending left unset: Int Pending through the CCCR is not verified
+     * on this controller yet, so cyw_poll() reads the bus instead
+     */
     .delay_us = litex_delay_us,
     .delay_ms = litex_delay_ms,
+    .get_time_us = litex_get_time_us,
+    .max_xfer = litex_sdio_max_xfer,
 };
 
 const sdio_host_ops_t *litex_get_sdio_ops(void)
@@ -53,6 +53,13 @@
 /* Data length register */
 #define SDIO_REG_DATA_LENGTH        (SDIO_BASE + 0xe000)  /* Data length in bytes */
 
+/*
+ * One data block per command (one CRC, no multi-block mode), sent in
+ * CMD53 byte mode: at most 512 bytes, and no more than the function's
+ * block size
+ */
+#define LITEX_SDIO_MAX_XFER         512
+
 /* Command status bits */
 #define SDIO_CMD_STATUS_TIMEOUT     (1 << 0)  /* Command timeout */
 #define SDIO_CMD_STATUS_INDEX_MASK  0xFE      /* Response index (bits 7:1) */
@@ -79,13 +86,48 @@
 #define TIMER_BASE              0x82001000  /* Example: Update from csr.h */
 #endif
 
-/* Simple busy-wait delay using CPU cycles */
+/* CPU clock: CONFIG_CLOCK_FREQUENCY from the LiteX build when available */
+#ifndef LITEX_CPU_HZ
+#if defined(__has_include)
+#if __has_include(<generated/soc.h>)
+#include <generated/soc.h>
+#endif
+#endif
+#ifdef CONFIG_CLOCK_FREQUENCY
+#define LITEX_CPU_HZ            CONFIG_CLOCK_FREQUENCY
+#else
+#define LITEX_CPU_HZ            48000000    /* sipeed_tang_primer_20k default */
+#endif
+#endif
+
+#define LITEX_CPU_MHZ           (LITEX_CPU_HZ / 1000000)
+
+/* 64-bit cycle counter (rdcycleh re-read guards the carry on RV32) */
+static inline uint64_t litex_cycles(void)
+{
+#if defined(__riscv_xlen) && __riscv_xlen == 64
+    uint64_t cycles;
+
+    __asm__ volatile ("rdcycle %0" : "=r"(cycles));
+    return cycles;
+#else
+    uint32_t hi, lo, hi2;
+
+    do {
+        __asm__ volatile ("rdcycleh %0" : "=r"(hi));
+        __asm__ volatile ("rdcycle %0" : "=r"(lo));
+        __asm__ volatile ("rdcycleh %0" : "=r"(hi2));
+    } while (hi != hi2);
+    return ((uint64_t)hi << 32) | lo;
+#endif
+}
+
+/* Busy-wait on the cycle counter */
 static inline void litex_delay_us(uint32_t us)
 {
-    /* Assuming ~100MHz CPU, adjust for your clock */
-    volatile uint32_t count = us * 100;
-    while (count--) {
-        __asm__ volatile ("nop");
+    uint64_t end = litex_cycles() + (uint64_t)us * LITEX_CPU_MHZ;
+
+    while (litex_cycles() < end) {
     }
 }
 
@@ -96,6 +138,15 @@ static inline void litex_delay_ms(uint32_t ms)
     }
 }
 
+/*
+ * Microseconds since reset, wrapping modulo 2^32 like the driver expects
+ * (the 64-bit counter does not wrap within the device's lifetime)
+ */
+static inline uint32_t litex_get_time_us(void)
+{
+    return (uint32_t)(litex_cycles() / LITEX_CPU_MHZ);
+}
+
 /*============================================================================
  * SDIO Commands
  *============================================================================*/
@@ -143,6 +194,12 @@ int litex_sdio_cmd53_read(uint8_t func, uint32_t addr, uint8_t *data,
 int litex_sdio_cmd53_write(uint8_t func, uint32_t addr, const uint8_t *data,
                            uint32_t len, bool incr_addr);
 
+/**
+ * Send CMD53 write gathered from segments (any length and alignment)
+ */
+int litex_sdio_cmd53_write_sg(uint8_t func, uint32_t addr, const sdio_sg_t *sg,
+                              uint32_t count, bool incr_addr);
+
 /**
  * Set block size for function
  */
@@ -154,15 +211,20 @@ int litex_sdio_set_block_size(uint8_t func, uint16_t block_size);
 int litex_sdio_enable_func(uint8_t func, bool enable);
 
 /**
- * Enable/disable interrupts
+ * Enable/disable interrupts (CCCR Int Enable)
  */
 int litex_sdio_enable_irq(bool enable);
 
 /**
- * Check if interrupt pending
+ * Check if interrupt pending (CCCR Int Pending, one CMD52)
  */
 bool litex_sdio_irq_pending(void);
 
+/**
+ * Largest CMD53 transfer for a function
+ */
+uint32_t litex_sdio_max_xfer(uint8_t func);
+
 /*============================================================================
  * Platform Operations Structure
  *============================================================================*/
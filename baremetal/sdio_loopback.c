@@ -0,0 +1,506 @@
+/**
+ * SDIO Host Controller - Loopback Platform Implementation
+ *
+ * Host-side device model for running the driver without hardware. Build
+ * it with the driver sources for the host instead of sdio_litex.c.
+ */
+
+#include <time.h>
+#include "baremetal.h"
+#include "sdio_loopback.h"
+
+/* Largest write: one host superframe, or one frame */
+#define LOOPBACK_SG_SIZE    (MAX(CYW_TXGLOM_MAX_BYTES, LOOPBACK_FRAME_SIZE) + \
+                             SDIO_F2_BLOCK_SIZE)
+
+/*============================================================================
+ * Private State
+ *============================================================================*/
+
+static struct {
+    /* F1: backplane window from SBADDR{LOW,MID,HIGH} */
+    uint32_t window;
+
+    /* SDIO core interrupt: raised bits, those routed to the host */
+    uint32_t intstatus;
+    uint32_t hostintmask;
+
+    /* F2 towards the host: frames waiting, the head one partly read */
+    uint8_t rx[LOOPBACK_RX_FRAMES][LOOPBACK_FRAME_SIZE] __attribute__((aligned(4)));
+    uint16_t rx_len[LOOPBACK_RX_FRAMES];
+    uint8_t rx_head;
+    uint8_t rx_count;
+    uint16_t rx_off;
+    uint8_t rx_seq;
+
+    /* F2 from the host */
+    uint8_t tx_expect;          /* Sequence number after the last frame */
+    uint8_t flow_ctrl;
+    uint32_t ioctl_drop;        /* IOCTLs left to go unanswered */
+    bool glom;                  /* Host sends superframes (bus:rxglom) */
+    uint8_t sg_buf[LOOPBACK_SG_SIZE] __attribute__((aligned(4)));
+    uint32_t sg_fill;           /* Bytes of a frame split across CMD53s */
+
+    loopback_stats_t stats;
+} lb;
+
+/*============================================================================
+ * Helpers
+ *============================================================================*/
+
+static inline uint16_t rd16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+static inline uint32_t rd32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static inline void wr32(uint8_t *p, uint32_t v)
+{
+    p[0] = v & 0xFF;
+    p[1] = (v >> 8) & 0xFF;
+    p[2] = (v >> 16) & 0xFF;
+    p[3] = (v >> 24) & 0xFF;
+}
+
+/* Backplane registers the driver polls during bring-up */
+static uint32_t lb_backplane_reg(uint32_t addr)
+{
+    switch (addr) {
+        case SDIO_CORE_CHIPID:
+            return CYW55500_CHIP_ID;
+        case SDIO_CORE_TOHOSTMAILBOXDATA:
+            return HMB_DATA_FWREADY;
+        case SDIO_CORE_BASE_ADDR + SDIO_CORE_INTSTATUS:
+            return lb.intstatus;
+        case SDIO_CORE_BASE_ADDR + SDIO_CORE_HOSTINTMASK:
+            return lb.hostintmask;
+        default:
+            return 0;
+    }
+}
+
+/* Interrupt status is write-1-to-clear */
+static void lb_backplane_write(uint32_t addr, uint32_t val)
+{
+    switch (addr) {
+        case SDIO_CORE_BASE_ADDR + SDIO_CORE_INTSTATUS:
+            lb.intstatus &= ~val;
+            break;
+        case SDIO_CORE_BASE_ADDR + SDIO_CORE_HOSTINTMASK:
+            lb.hostintmask = val;
+            break;
+        default:
+            break;
+    }
+}
+
+/*============================================================================
+ * F2: Firmware Side of SDPCM
+ *============================================================================*/
+
+int loopback_inject(uint8_t channel, const void *payload, uint32_t len)
+{
+    uint32_t slot = (lb.rx_head + lb.rx_count) % LOOPBACK_RX_FRAMES;
+    sdpcm_header_t *hdr = (sdpcm_header_t *)lb.rx[slot];
+
+    if (lb.rx_count == LOOPBACK_RX_FRAMES ||
+        len > LOOPBACK_FRAME_SIZE - SDPCM_HEADER_SIZE) {
+        lb.stats.rx_overflow++;
+        return -1;
+    }
+
+    /* Sequence, credit and next_len are filled in when the host reads it */
+    memset(hdr, 0, SDPCM_HEADER_SIZE);
+    hdr->len = SDPCM_HEADER_SIZE + len;
+    hdr->len_check = ~hdr->len;
+    hdr->channel = channel;
+    hdr->data_offset = SDPCM_HEADER_SIZE;
+    memcpy(lb.rx[slot] + SDPCM_HEADER_SIZE, payload, len);
+
+    lb.rx_len[slot] = hdr->len;
+    lb.rx_count++;
+    lb.intstatus |= I_HMB_FRAME_IND;
+    return 0;
+}
+
+/*
+ * Answer an IOCTL: status 0, buffer echoed, unless it is to be dropped.
+ * Setting bus:rxglom switches the host's following writes to glom headers.
+ */
+static void lb_ioctl(uint8_t *payload, uint32_t len)
+{
+    static const char rxglom[] = "bus:rxglom";
+    bcdc_header_t *bcdc = (bcdc_header_t *)payload;
+
+    if (len < BCDC_HEADER_SIZE) {
+        lb.stats.tx_bad++;
+        return;
+    }
+
+    if (bcdc->cmd == WLC_SET_VAR && len >= BCDC_HEADER_SIZE + sizeof(rxglom) + 4 &&
+        memcmp(payload + BCDC_HEADER_SIZE, rxglom, sizeof(rxglom)) == 0) {
+        lb.glom = rd32(payload + BCDC_HEADER_SIZE + sizeof(rxglom)) != 0;
+    }
+
+    if (lb.ioctl_drop > 0) {
+        lb.ioctl_drop--;
+        return;
+    }
+
+    bcdc->status = 0;
+    loopback_inject(SDPCM_CONTROL_CHANNEL, payload, len);
+}
+
+/*
+ * One write from the host: a single frame, or back-to-back subframes with
+ * hardware extension headers once glom is on.
+ */
+static void lb_write(uint8_t *buf, uint32_t len)
+{
+    uint32_t hlen = lb.glom ? SDPCM_GLOM_HEADER_SIZE : SDPCM_HEADER_SIZE;
+    uint32_t off = 0, frames = 0;
+
+    while (len - off >= hlen) {
+        uint8_t *f = buf + off;
+        sdpcm_header_t sw;
+        uint32_t flen = rd16(f), pad = 0;
+        bool last = true;
+
+        if ((flen ^ rd16(f + 2)) != 0xFFFF || flen < hlen || flen > len - off) {
+            lb.stats.tx_bad++;
+            break;
+        }
+
+        /* Software header follows the hardware extension */
+        memcpy(&sw, f + hlen - SDPCM_HEADER_SIZE, sizeof(sw));
+        if (lb.glom) {
+            last = (rd32(f + 4) & SDPCM_HWEXT_LAST) != 0;
+            pad = rd32(f + 8) >> 16;
+        }
+        if (sw.data_offset < hlen || sw.data_offset + pad > flen) {
+            lb.stats.tx_bad++;
+            break;
+        }
+
+        lb.tx_expect = sw.seq + 1;
+        lb.stats.tx_frames++;
+        frames++;
+
+        switch (sw.channel & 0x0F) {
+            case SDPCM_CONTROL_CHANNEL:
+                lb_ioctl(f + sw.data_offset, flen - pad - sw.data_offset);
+                break;
+            case SDPCM_DATA_CHANNEL:
+                loopback_inject(SDPCM_DATA_CHANNEL, f + sw.data_offset,
+                                flen - pad - sw.data_offset);
+                break;
+            default:
+                break;
+        }
+
+        off += flen;
+        if (last) {
+            break;
+        }
+    }
+
+    if (frames > 1) {
+        lb.stats.tx_superframes++;
+    }
+}
+
+/*
+ * Length of the first complete write in the F2 stream, 0 while it is still
+ * arriving: frames are padded to a word, subframes count up to the last.
+ * A broken length takes everything, lb_write() counts it as bad.
+ */
+static uint32_t lb_write_len(const uint8_t *buf, uint32_t len)
+{
+    uint32_t hlen = lb.glom ? SDPCM_GLOM_HEADER_SIZE : SDPCM_HEADER_SIZE;
+    uint32_t off = 0;
+
+    for (;;) {
+        uint32_t flen;
+
+        if (len - off < hlen) {
+            return 0;
+        }
+        flen = rd16(buf + off);
+        if ((flen ^ rd16(buf + off + 2)) != 0xFFFF || flen < hlen) {
+            return len;
+        }
+        flen = ALIGN(flen, 4);
+        if (flen > len - off) {
+            return 0;
+        }
+        off += flen;
+        if (!lb.glom || (rd32(buf + off - flen + 4) & SDPCM_HWEXT_LAST)) {
+            return off;
+        }
+    }
+}
+
+/* Append host data to the F2 stream and hand over every complete write */
+static int lb_write_stream(const sdio_sg_t *sg, uint32_t count)
+{
+    for (uint32_t i = 0; i < count; i++) {
+        if (sg[i].len > LOOPBACK_SG_SIZE - lb.sg_fill) {
+            lb.sg_fill = 0;
+            lb.stats.tx_bad++;
+            return -1;
+        }
+        memcpy(lb.sg_buf + lb.sg_fill, sg[i].data, sg[i].len);
+        lb.sg_fill += sg[i].len;
+    }
+
+    for (;;) {
+        uint32_t n = lb_write_len(lb.sg_buf, lb.sg_fill);
+
+        if (n == 0) {
+            break;
+        }
+        lb_write(lb.sg_buf, n);
+        lb.sg_fill -= n;
+        memmove(lb.sg_buf, lb.sg_buf + n, lb.sg_fill);
+    }
+    return 0;
+}
+
+/*
+ * Host reads the head frame, possibly in several pieces; reads past its
+ * end return zeros. Header fields that depend on timing are set on the
+ * first read.
+ */
+static void lb_read(uint8_t *data, uint32_t len)
+{
+    uint8_t *f = lb.rx[lb.rx_head];
+    uint32_t flen = lb.rx_len[lb.rx_head];
+    uint32_t n;
+
+    if (lb.rx_count == 0) {
+        memset(data, 0, len);
+        return;
+    }
+
+    if (lb.rx_off == 0) {
+        sdpcm_header_t *hdr = (sdpcm_header_t *)f;
+
+        hdr->seq = lb.rx_seq++;
+        hdr->flow_control = lb.flow_ctrl;
+        hdr->max_seq = lb.tx_expect + LOOPBACK_TX_WINDOW;
+        hdr->next_len = 0;
+        if (lb.rx_count > 1) {
+            uint32_t next = lb.rx_len[(lb.rx_head + 1) % LOOPBACK_RX_FRAMES];
+            hdr->next_len = (next + 15) >> 4;
+        }
+    }
+
+    n = MIN(len, flen - lb.rx_off);
+    memcpy(data, f + lb.rx_off, n);
+    memset(data + n, 0, len - n);
+    lb.rx_off += n;
+
+    if (lb.rx_off >= flen) {
+        lb.rx_head = (lb.rx_head + 1) % LOOPBACK_RX_FRAMES;
+        lb.rx_count--;
+        lb.rx_off = 0;
+        lb.stats.rx_frames++;
+    }
+}
+
+/* Read frame terminate: drop what is left of the head frame */
+static void lb_read_abort(void)
+{
+    if (lb.rx_count > 0 && lb.rx_off > 0) {
+        lb.rx_head = (lb.rx_head + 1) % LOOPBACK_RX_FRAMES;
+        lb.rx_count--;
+        lb.rx_off = 0;
+    }
+}
+
+void loopback_set_flow_ctrl(uint8_t bitmap)
+{
+    lb.flow_ctrl = bitmap;
+}
+
+void loopback_drop_ioctl(uint32_t count)
+{
+    lb.ioctl_drop = count;
+}
+
+void loopback_get_stats(loopback_stats_t *stats)
+{
+    memcpy(stats, &lb.stats, sizeof(*stats));
+}
+
+/*============================================================================
+ * SDIO Host Operations
+ *============================================================================*/
+
+static int loopback_init(void)
+{
+    memset(&lb, 0, sizeof(lb));
+    return 0;
+}
+
+static void loopback_deinit(void)
+{
+}
+
+static int loopback_cmd52_read(uint8_t func, uint32_t addr, uint8_t *val)
+{
+    *val = 0;
+
+    if (func == SDIO_FUNC_0 && addr == CCCR_IO_READY) {
+        *val = SDIO_FUNC_READY_1 | SDIO_FUNC_READY_2;
+    } else if (func == SDIO_FUNC_1 && addr == SBSDIO_FUNC1_CHIPCLKCSR) {
+        *val = SBSDIO_ALP_AVAIL | SBSDIO_HT_AVAIL;
+    }
+    return 0;
+}
+
+static int loopback_cmd52_write(uint8_t func, uint32_t addr, uint8_t val)
+{
+    if (func != SDIO_FUNC_1) {
+        return 0;
+    }
+
+    switch (addr) {
+        case SBSDIO_FUNC1_SBADDRLOW:
+            lb.window = (lb.window & 0xFFFF00FF) | ((uint32_t)val << 8);
+            break;
+        case SBSDIO_FUNC1_SBADDRMID:
+            lb.window = (lb.window & 0xFF00FFFF) | ((uint32_t)val << 16);
+            break;
+        case SBSDIO_FUNC1_SBADDRHIGH:
+            lb.window = (lb.window & 0x00FFFFFF) | ((uint32_t)val << 24);
+            break;
+        case SBSDIO_FUNC1_FRAMECTRL:
+            if (val & SFC_RF_TERM) {
+                lb_read_abort();
+            }
+            break;
+        default:
+            break;
+    }
+    return 0;
+}
+
+static int loopback_cmd53_read(uint8_t func, uint32_t addr, uint8_t *data,
+                               uint32_t len, bool incr_addr)
+{
+    (void)incr_addr;
+
+    if (func == SDIO_FUNC_2) {
+        lb_read(data, len);
+    } else if (func == SDIO_FUNC_1 && len == 4) {
+        wr32(data, lb_backplane_reg(lb.window | (addr & SBSDIO_SB_OFT_ADDR_MASK)));
+    } else {
+        memset(data, 0, len);
+    }
+    return 0;
+}
+
+static int loopback_cmd53_write(uint8_t func, uint32_t addr, const uint8_t *data,
+                                uint32_t len, bool incr_addr)
+{
+    (void)incr_addr;
+
+    /* Other backplane writes (firmware download, core control) go nowhere */
+    if (func == SDIO_FUNC_2) {
+        sdio_sg_t sg = { .data = data, .len = len };
+
+        return lb_write_stream(&sg, 1);
+    }
+    if (func == SDIO_FUNC_1 && len == 4) {
+        lb_backplane_write(lb.window | (addr & SBSDIO_SB_OFT_ADDR_MASK), rd32(data));
+    }
+    return 0;
+}
+
+static int loopback_cmd53_write_sg(uint8_t func, uint32_t addr, const sdio_sg_t *sg,
+                                   uint32_t count, bool incr_addr)
+{
+    (void)addr;
+    (void)incr_addr;
+
+    if (func != SDIO_FUNC_2) {
+        return -1;
+    }
+    return lb_write_stream(sg, count);
+}
+
+static int loopback_set_block_size(uint8_t func, uint16_t block_size)
+{
+    (void)func;
+    (void)block_size;
+    return 0;
+}
+
+static int loopback_enable_func(uint8_t func, bool enable)
+{
+    (void)func;
+    (void)enable;
+    return 0;
+}
+
+static int loopback_enable_irq(bool enable)
+{
+    (void)enable;
+    return 0;
+}
+
+static bool loopback_irq_pending(void)
+{
+    return (lb.intstatus & lb.hostintmask) != 0;
+}
+
+static void loopback_delay_us(uint32_t us)
+{
+    struct timespec ts = { us / 1000000, (long)(us % 1000000) * 1000 };
+
+    nanosleep(&ts, NULL);
+}
+
+static void loopback_delay_ms(uint32_t ms)
+{
+    loopback_delay_us(ms * 1000);
+}
+
+static uint32_t loopback_get_time_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec * 1000000u + ts.tv_nsec / 1000;
+}
+
+/*============================================================================
+ * Operations Structure
+ *============================================================================*/
+
+static const sdio_host_ops_t loopback_sdio_ops = {
+    .init = loopback_init,
+    .deinit = loopback_deinit,
+    .cmd52_read = loopback_cmd52_read,
+    .cmd52_write = loopback_cmd52_write,
+    .cmd53_read = loopback_cmd53_read,
+    .cmd53_write = loopback_cmd53_write,
+    .cmd53_write_sg = loopback_cmd53_write_sg,
+    .set_block_size = loopback_set_block_size,
+    .enable_func = loopback_enable_func,
+    .enable_irq = loopback_enable_irq,
+    .irq_pending = loopback_irq_pending,
+    .delay_us = loopback_delay_us,
+    .delay_ms = loopback_delay_ms,
+    .get_time_us = loopback_get_time_us,
+};
+
+const sdio_host_ops_t *loopback_get_sdio_ops(void)
+{
+    return &loopback_sdio_ops;
+}
@@ -0,0 +1,95 @@
+/**
+ * SDIO Host Controller - Loopback Platform Layer
+ *
+ * Models just enough of a CYW55500 behind an SDIO bus to run the driver
+ * on a host (e.g. Linux) without hardware: card and clock bring-up,
+ * chip ID, firmware-ready mailbox and an SDPCM endpoint on F2.
+ *
+ * Every frame the driver sends is answered: IOCTLs complete with status 0
+ * (GET returns the request buffer unchanged) unless set to be dropped, data frames come back
+ * unchanged on the data channel. Credit is granted in a fixed window and
+ * host superframes are accepted once bus:rxglom is set. F2 is a stream in
+ * both directions: frames may be read and written over several CMD53s.
+ */
+
+#ifndef SDIO_LOOPBACK_H
+#define SDIO_LOOPBACK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include "cyw55500_sdio.h"
+
+/*============================================================================
+ * Configuration
+ *============================================================================*/
+
+/* Frames waiting to be read by the host */
+#ifndef LOOPBACK_RX_FRAMES
+#define LOOPBACK_RX_FRAMES      16
+#endif
+
+/* Largest frame in either direction: beyond an RX pool buffer, so large
+ * IOCTLs and frames going through the IOCTL arena are covered */
+#ifndef LOOPBACK_FRAME_SIZE
+#define LOOPBACK_FRAME_SIZE     (2048 + CYW_IOCTL_MAX_LEN)
+#endif
+
+/* Frames granted beyond the last one received */
+#ifndef LOOPBACK_TX_WINDOW
+#define LOOPBACK_TX_WINDOW      8
+#endif
+
+/*============================================================================
+ * Statistics
+ *============================================================================*/
+
+typedef struct {
+    uint32_t tx_frames;         /* Frames received from the host */
+    uint32_t tx_superframes;    /* ... of which arrived glommed */
+    uint32_t tx_bad;            /* Malformed frames discarded */
+    uint32_t rx_frames;         /* Frames read by the host */
+    uint32_t rx_overflow;       /* Replies lost to a full RX queue */
+} loopback_stats_t;
+
+/*============================================================================
+ * Platform Implementation
+ *============================================================================*/
+
+/**
+ * Queue a frame for the host as if the firmware had sent it
+ * @param channel SDPCM channel
+ * @param payload Frame payload (BCDC/BDC header included)
+ * @param len Payload length
+ * @return 0 on success, -1 if the RX queue is full or the frame too large
+ */
+int loopback_inject(uint8_t channel, const void *payload, uint32_t len);
+
+/**
+ * Set the flow-control bitmap sent with every following frame
+ * @param bitmap Bit n holds off 802.1d priority n
+ */
+void loopback_set_flow_ctrl(uint8_t bitmap);
+
+/**
+ * Leave IOCTLs unanswered, as if the firmware lost the responses
+ * @param count Number of following IOCTLs to drop
+ */
+void loopback_drop_ioctl(uint32_t count);
+
+/**
+ * Get device model statistics
+ * @param stats Pointer to store the counters
+ */
+void loopback_get_stats(loopback_stats_t *stats);
+
+/*============================================================================
+ * Platform Operations Structure
+ *============================================================================*/
+
+/**
+ * Get the loopback SDIO operations structure
+ * Use this to initialize the CYW55500 driver
+ */
+const sdio_host_ops_t *loopback_get_sdio_ops(void);
+
+#endif /* SDIO_LOOPBACK_H */
@@ -0,0 +1,336 @@
+/**
+ * Host test: streaming firmware download
+ *
+ * Runs cyw_load_firmware_stream() against the loopback device model with
+ * file-backed readers, synchronous and asynchronous, and checks what
+ * arrives in the chip's RAM byte for byte, also through a host that moves
+ * few bytes per CMD53.
+ *
+ *   make test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "baremetal.h"
+#include "cyw55500_sdio.h"
+#include "sdio_loopback.h"
+
+#define IMAGE_SIZE          (300 * 1024 + 123)  /* Not a chunk multiple */
+#define RAM_SPAN            0x500000            /* Backplane space mirrored */
+
+static int failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+/*============================================================================
+ * Device RAM: backplane writes mirrored on top of the loopback model
+ *============================================================================*/
+
+static const sdio_host_ops_t *lb_ops;
+static sdio_host_ops_t ops;
+static uint8_t *ram;
+static uint32_t window;
+static uint32_t xfer_seen;              /* Longest backplane CMD53 */
+
+static int ram_cmd52_write(uint8_t func, uint32_t addr, uint8_t val)
+{
+    if (func == SDIO_FUNC_1) {
+        switch (addr) {
+            case SBSDIO_FUNC1_SBADDRLOW:
+                window = (window & 0xFFFF00FF) | ((uint32_t)val << 8);
+                break;
+            case SBSDIO_FUNC1_SBADDRMID:
+                window = (window & 0xFF00FFFF) | ((uint32_t)val << 16);
+                break;
+            case SBSDIO_FUNC1_SBADDRHIGH:
+                window = (window & 0x00FFFFFF) | ((uint32_t)val << 24);
+                break;
+            default:
+                break;
+        }
+    }
+    return lb_ops->cmd52_write(func, addr, val);
+}
+
+static int ram_cmd53_write(uint8_t func, uint32_t addr, const uint8_t *data,
+                           uint32_t len, bool incr_addr)
+{
+    if (func == SDIO_FUNC_1) {
+        uint32_t bp = window | (addr & SBSDIO_SB_OFT_ADDR_MASK);
+
+        if (bp < RAM_SPAN && len <= RAM_SPAN - bp) {
+            memcpy(ram + bp, data, len);
+        }
+        xfer_seen = MAX(xfer_seen, len);
+    }
+    return lb_ops->cmd53_write(func, addr, data, len, incr_addr);
+}
+
+static void device_reset(void)
+{
+    memset(ram, 0xEE, RAM_SPAN);
+    window = 0;
+    xfer_seen = 0;
+    CHECK(cyw_init(&ops) == CYW_OK);
+}
+
+/*============================================================================
+ * File-backed Readers
+ *============================================================================*/
+
+typedef struct {
+    FILE *f;
+    uint8_t *buf;           /* Asynchronous read in flight */
+    uint32_t len;
+    uint32_t chunks;
+    uint32_t max_chunk;
+} file_reader_t;
+
+static int file_read(void *ctx, uint8_t *buf, uint32_t len)
+{
+    file_reader_t *fr = ctx;
+    size_t n = fread(buf, 1, len, fr->f);
+
+    if (n == 0 && ferror(fr->f)) {
+        return -1;
+    }
+    if (n > 0) {
+        fr->chunks++;
+        fr->max_chunk = MAX(fr->max_chunk, (uint32_t)n);
+    }
+    return (int)n;
+}
+
+/* The "DMA" runs when the driver waits for it */
+static int file_read_start(void *ctx, uint8_t *buf, uint32_t len)
+{
+    file_reader_t *fr = ctx;
+
+    if (fr->buf != NULL) {
+        return -1;                      /* One read at a time */
+    }
+    fr->buf = buf;
+    fr->len = len;
+    return 0;
+}
+
+static int file_read_wait(void *ctx)
+{
+    file_reader_t *fr = ctx;
+    uint8_t *buf = fr->buf;
+
+    if (buf == NULL) {
+        return -1;
+    }
+    fr->buf = NULL;
+    return file_read(fr, buf, fr->len);
+}
+
+static void reader_open(file_reader_t *fr, cyw_fw_reader_t *rd,
+                        const char *path, bool async)
+{
+    memset(fr, 0, sizeof(*fr));
+    memset(rd, 0, sizeof(*rd));
+
+    fr->f = fopen(path, "rb");
+    if (fr->f == NULL) {
+        printf("  cannot open %s\n", path);
+        exit(1);
+    }
+    if (async) {
+        rd->read_start = file_read_start;
+        rd->read_wait = file_read_wait;
+    } else {
+        rd->read = file_read;
+    }
+    rd->ctx = fr;
+}
+
+static uint8_t *file_load(const char *path, uint32_t *size)
+{
+    FILE *f = fopen(path, "rb");
+    uint8_t *data;
+    long n;
+
+    if (f == NULL) {
+        printf("  cannot open %s\n", path);
+        exit(1);
+    }
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    rewind(f);
+    data = malloc(n);
+    if (data == NULL || fread(data, 1, n, f) != (size_t)n) {
+        exit(1);
+    }
+    fclose(f);
+    *size = (uint32_t)n;
+    return data;
+}
+
+static void file_save(const char *path, const uint8_t *data, uint32_t size)
+{
+    FILE *f = fopen(path, "wb");
+
+    if (f == NULL || fwrite(data, 1, size, f) != size) {
+        printf("  cannot write %s\n", path);
+        exit(1);
+    }
+    fclose(f);
+}
+
+static uint32_t rd32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+/*============================================================================
+ * Tests
+ *============================================================================*/
+
+/* Raw image and text NVRAM land at their addresses, token behind NVRAM */
+static void test_raw(bool async)
+{
+    file_reader_t ffw, fnv;
+    cyw_fw_reader_t fw, nv;
+    uint8_t *img, *nvram;
+    uint32_t img_size, nv_size, padded;
+
+    printf("raw image, %s reader\n", async ? "async" : "sync");
+
+    img = file_load("tests/fw_stream.bin", &img_size);
+    nvram = file_load(NVRAM_FILE, &nv_size);
+    padded = ALIGN(nv_size, 4);
+
+    device_reset();
+    reader_open(&ffw, &fw, "tests/fw_stream.bin", async);
+    reader_open(&fnv, &nv, NVRAM_FILE, async);
+
+    CHECK(cyw_load_firmware_stream(&fw, &nv) == CYW_OK);
+    CHECK(cyw_get_state() == CYW_STATE_FW_READY);
+
+    CHECK(memcmp(ram + CYW55500_RAM_START, img, img_size) == 0);
+    CHECK(ram[CYW55500_RAM_START + img_size] == 0xEE);
+    CHECK(memcmp(ram + NVRAM_DL_ADDR, nvram, nv_size) == 0);
+    CHECK(rd32(ram + NVRAM_DL_ADDR + padded) ==
+          ((~(padded / 4) << 16) | ((padded / 4) & 0xFFFF)));
+
+    /* Whole chunks except the last one */
+    CHECK(ffw.chunks == (img_size + CYW_FW_CHUNK_SIZE - 1) / CYW_FW_CHUNK_SIZE);
+    CHECK(ffw.max_chunk == CYW_FW_CHUNK_SIZE);
+    CHECK(ffw.buf == NULL);
+
+    fclose(ffw.f);
+    fclose(fnv.f);
+    free(img);
+    free(nvram);
+}
+
+/* TRX image: CRC checked on the fly, a corrupt copy never starts */
+static void test_trx(void)
+{
+    file_reader_t ffw;
+    cyw_fw_reader_t fw;
+    uint8_t *img;
+    uint32_t size;
+
+    printf("TRX image\n");
+
+    device_reset();
+    reader_open(&ffw, &fw, FW_FILE, true);
+    CHECK(cyw_load_firmware_stream(&fw, NULL) == CYW_OK);
+    CHECK(cyw_get_state() == CYW_STATE_FW_READY);
+    fclose(ffw.f);
+
+    img = file_load(FW_FILE, &size);
+    img[size / 2] ^= 0x01;
+    file_save("tests/fw_stream.trx", img, size);
+    free(img);
+
+    device_reset();
+    reader_open(&ffw, &fw, "tests/fw_stream.trx", true);
+    CHECK(cyw_load_firmware_stream(&fw, NULL) == CYW_ERR_FW);
+    CHECK(cyw_get_state() == CYW_STATE_ERROR);
+    fclose(ffw.f);
+    remove("tests/fw_stream.trx");
+}
+
+/* A failing reader aborts the download */
+static int fail_read(void *ctx, uint8_t *buf, uint32_t len)
+{
+    uint32_t *left = ctx;
+
+    if ((*left)-- == 0) {
+        return -1;
+    }
+    memset(buf, 0x5A, len);
+    return (int)len;
+}
+
+static void test_read_error(void)
+{
+    uint32_t left = 3;
+    cyw_fw_reader_t fw = { .read = fail_read, .ctx = &left };
+
+    printf("reader error\n");
+
+    device_reset();
+    CHECK(cyw_load_firmware_stream(&fw, NULL) == CYW_ERR_IO);
+    CHECK(cyw_get_state() == CYW_STATE_ERROR);
+}
+
+/* Backplane writes split at the host limit still land in order */
+static uint32_t small_max_xfer(uint8_t func)
+{
+    (void)func;
+    return 64;
+}
+
+static void test_small_xfer(void)
+{
+    printf("64-byte host transfers\n");
+
+    ops.max_xfer = small_max_xfer;
+    test_raw(false);
+    CHECK(xfer_seen > 0 && xfer_seen <= 64);
+    ops.max_xfer = NULL;
+}
+
+int main(void)
+{
+    uint8_t *img = malloc(IMAGE_SIZE);
+
+    ram = malloc(RAM_SPAN);
+    if (img == NULL || ram == NULL) {
+        return 1;
+    }
+
+    lb_ops = loopback_get_sdio_ops();
+    ops = *lb_ops;
+    ops.cmd52_write = ram_cmd52_write;
+    ops.cmd53_write = ram_cmd53_write;
+
+    srand(1);
+    for (uint32_t i = 0; i < IMAGE_SIZE; i++) {
+        img[i] = (uint8_t)rand();
+    }
+    file_save("tests/fw_stream.bin", img, IMAGE_SIZE);
+    free(img);
+
+    test_raw(false);
+    test_raw(true);
+    test_trx();
+    test_read_error();
+    test_small_xfer();
+
+    remove("tests/fw_stream.bin");
+    free(ram);
+
+    printf("%s: %s\n", __FILE__, failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,606 @@
+/**
+ * Host test: data path against the loopback device model
+ *
+ * Brings the driver up on sdio_loopback.c and checks what comes back:
+ * IOCTL completion, data frames echoed byte for byte, superframes on
+ * transmit, firmware flow control, event delivery, RSSI events for roaming,
+ * background scan slices giving way to TX, transfers split for a host with a small CMD53 limit
+ * reception on a host that cannot report interrupts, IOCTL timeouts
+ * while frames keep arriving and IOCTL batches around a busy arena.
+ *
+ *   make test
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "baremetal.h"
+#include "cyw55500_sdio.h"
+#include "sdio_loopback.h"
+
+#define POLL_MAX            100     /* cyw_poll() calls before giving up */
+#define RX_MAX              16
+
+static int failures;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+        printf("  FAIL %s:%d: %s\n", __FILE__, __LINE__, #cond); \
+        failures++; \
+    } \
+} while (0)
+
+/*============================================================================
+ * Frames
+ *============================================================================*/
+
+static struct {
+    uint8_t data[RX_MAX][1600];
+    uint32_t len[RX_MAX];
+    uint32_t count;
+} rx;
+
+/* Set to keep the next frame at least this long (cyw_pkt_ref()) */
+static uint32_t rx_hold_len;
+static cyw_pkt_t *rx_held;
+
+static void on_rx(void *ctx, cyw_pkt_t *pkt)
+{
+    (void)ctx;
+
+    if (rx_hold_len != 0 && pkt->len >= rx_hold_len && rx_held == NULL) {
+        rx_held = cyw_pkt_ref(pkt);
+    }
+    if (rx.count < RX_MAX && pkt->len <= sizeof(rx.data[0])) {
+        memcpy(rx.data[rx.count], cyw_pkt_data(pkt), pkt->len);
+        rx.len[rx.count] = pkt->len;
+    }
+    rx.count++;
+}
+
+/* Ethernet frame whose bytes depend on its index */
+static void frame_fill(uint8_t *p, uint32_t len, uint32_t id)
+{
+    for (uint32_t i = 0; i < len; i++) {
+        p[i] = (uint8_t)(id * 31 + i);
+    }
+    p[12] = 0x08;                       /* IPv4 */
+    p[13] = 0x00;
+}
+
+static cyw_err_t frame_send(uint32_t len, uint32_t id, uint8_t prio)
+{
+    cyw_pkt_t *pkt = cyw_pkt_alloc(CYW_PKT_DATA_HEADROOM, len);
+
+    if (pkt == NULL) {
+        return CYW_ERR_NOMEM;
+    }
+    frame_fill(cyw_pkt_data(pkt), len, id);
+    pkt->prio = prio;
+    pkt->ifidx = 0;
+    return cyw_tx_ethernet(pkt);
+}
+
+static bool frame_match(uint32_t slot, uint32_t len, uint32_t id)
+{
+    uint8_t expect[1600];
+
+    frame_fill(expect, len, id);
+    return rx.len[slot] == len && memcmp(rx.data[slot], expect, len) == 0;
+}
+
+static void poll_rx(uint32_t count)
+{
+    for (int i = 0; i < POLL_MAX && rx.count < count; i++) {
+        cyw_poll();
+    }
+}
+
+/* A data frame as the firmware sends it: BDC header, Ethernet frame */
+static int frame_inject(uint32_t len, uint32_t id)
+{
+    static uint8_t buf[BDC_HEADER_SIZE + 4096];
+
+    memset(buf, 0, BDC_HEADER_SIZE);
+    buf[0] = BCDC_PROTO_VER << BCDC_FLAG_VER_SHIFT;
+    frame_fill(buf + BDC_HEADER_SIZE, len, id);
+    return loopback_inject(SDPCM_DATA_CHANNEL, buf, BDC_HEADER_SIZE + len);
+}
+
+/*============================================================================
+ * Events
+ *============================================================================*/
+
+static struct {
+    cyw_event_t ev;
+    uint8_t data[32];
+    uint32_t len;
+    uint32_t count;
+} evt;
+
+static void on_event(void *ctx, const cyw_event_t *ev, const uint8_t *data,
+                     uint32_t len)
+{
+    (void)ctx;
+
+    evt.ev = *ev;
+    evt.len = len;
+    memcpy(evt.data, data, MIN(len, sizeof(evt.data)));
+    evt.count++;
+}
+
+static void put_be16(uint8_t *p, uint16_t v)
+{
+    p[0] = v >> 8;
+    p[1] = v & 0xFF;
+}
+
+static void put_be32(uint8_t *p, uint32_t v)
+{
+    put_be16(p, v >> 16);
+    put_be16(p + 2, v & 0xFFFF);
+}
+
+/* Event frame as the firmware sends it: BDC, Ethernet, Broadcom header */
+static int event_inject(uint32_t type, uint32_t status, const void *data,
+                        uint32_t len)
+{
+    uint8_t buf[BDC_HEADER_SIZE + CYW_EVENT_HDR_LEN + 32] = {0};
+    uint8_t *eth = buf + BDC_HEADER_SIZE;
+    uint8_t *bh = eth + CYW_ETH_HDR_LEN;
+    uint8_t *msg = bh + sizeof(bcmeth_header_t);
+
+    buf[0] = BCDC_PROTO_VER << BCDC_FLAG_VER_SHIFT;
+    put_be16(eth + 12, ETHER_TYPE_BRCM);
+    put_be16(bh + offsetof(bcmeth_header_t, subtype), BCMILCP_SUBTYPE_VENDOR_LONG);
+    memcpy(bh + offsetof(bcmeth_header_t, oui), BRCM_OUI, 3);
+    put_be16(bh + offsetof(bcmeth_header_t, usr_subtype), BCMILCP_BCM_SUBTYPE_EVENT);
+    put_be32(msg + offsetof(wl_event_msg_t, event_type), type);
+    put_be32(msg + offsetof(wl_event_msg_t, status), status);
+    put_be32(msg + offsetof(wl_event_msg_t, datalen), len);
+    memcpy(buf + BDC_HEADER_SIZE + CYW_EVENT_HDR_LEN, data, len);
+
+    return loopback_inject(SDPCM_EVENT_CHANNEL, buf,
+                           BDC_HEADER_SIZE + CYW_EVENT_HDR_LEN + len);
+}
+
+/*============================================================================
+ * Tests
+ *============================================================================*/
+
+static void bring_up(const sdio_host_ops_t *ops)
+{
+    static uint8_t image[1024];
+
+    CHECK(cyw_init(ops) == CYW_OK);
+    CHECK(cyw_load_firmware(image, sizeof(image), NULL, 0) == CYW_OK);
+    CHECK(cyw_up() == CYW_OK);
+    CHECK(cyw_get_state() == CYW_STATE_UP);
+    cyw_set_rx_callback(on_rx, NULL);
+}
+
+/* IOCTLs complete, nothing left pending */
+static void test_ioctl(void)
+{
+    uint32_t val = 0x12345678;
+    cyw_stats_t st;
+
+    printf("ioctl\n");
+
+    CHECK(cyw_ioctl(WLC_GET_VAR, &val, sizeof(val), false) == CYW_OK);
+    CHECK(val == 0x12345678);
+    CHECK(cyw_get_stats(&st) == CYW_OK);
+    CHECK(st.ioctl_pending == 0 && st.ioctl_timeout == 0);
+}
+
+/* Frames of every size come back unchanged and in order */
+static void test_echo(void)
+{
+    static const uint32_t lens[] = { 60, 61, 300, 511, 512, 513, 1514 };
+
+    printf("data echo\n");
+
+    rx.count = 0;
+    for (uint32_t i = 0; i < ARRAY_SIZE(lens); i++) {
+        CHECK(frame_send(lens[i], i, 0) == CYW_OK);
+        CHECK(cyw_tx_flush() == CYW_OK);
+    }
+    poll_rx(ARRAY_SIZE(lens));
+
+    CHECK(rx.count == ARRAY_SIZE(lens));
+    for (uint32_t i = 0; i < ARRAY_SIZE(lens) && i < rx.count; i++) {
+        CHECK(frame_match(i, lens[i], i));
+    }
+}
+
+/* Queued frames leave together in one superframe */
+static void test_glom(void)
+{
+    loopback_stats_t before, after;
+    cyw_stats_t st;
+
+    printf("TX superframes\n");
+
+    rx.count = 0;
+    loopback_get_stats(&before);
+    for (uint32_t i = 0; i < 4; i++) {
+        CHECK(frame_send(100 + i, i, 0) == CYW_OK);
+    }
+    CHECK(cyw_tx_flush() == CYW_OK);
+    loopback_get_stats(&after);
+    CHECK(after.tx_superframes == before.tx_superframes + 1);
+    CHECK(after.tx_frames == before.tx_frames + 4);
+    CHECK(after.tx_bad == 0);
+
+    CHECK(cyw_get_stats(&st) == CYW_OK);
+    CHECK(st.tx_glom > 0 && st.tx_queued == 0);
+
+    poll_rx(4);
+    CHECK(rx.count == 4);
+    for (uint32_t i = 0; i < 4 && i < rx.count; i++) {
+        CHECK(frame_match(i, 100 + i, i));
+    }
+}
+
+/* A flow-controlled priority waits, the others keep going */
+static void test_flow_ctrl(void)
+{
+    uint32_t val = 0;
+    cyw_stats_t st;
+
+    printf("flow control\n");
+
+    /* The bitmap arrives with the next frame read */
+    loopback_set_flow_ctrl(1 << 5);
+    CHECK(cyw_ioctl(WLC_GET_VAR, &val, sizeof(val), false) == CYW_OK);
+
+    rx.count = 0;
+    CHECK(frame_send(80, 1, 5) == CYW_OK);
+    CHECK(frame_send(90, 2, 0) == CYW_OK);
+    CHECK(cyw_tx_flush() == CYW_OK);
+    CHECK(cyw_get_stats(&st) == CYW_OK);
+    CHECK(st.flow_ctrl == (1 << 5));
+    CHECK(st.tx_queued == 1);
+
+    poll_rx(1);
+    CHECK(rx.count == 1 && frame_match(0, 90, 2));
+
+    loopback_set_flow_ctrl(0);
+    CHECK(cyw_ioctl(WLC_GET_VAR, &val, sizeof(val), false) == CYW_OK);
+    CHECK(cyw_tx_flush() == CYW_OK);
+    poll_rx(2);
+    CHECK(rx.count == 2 && frame_match(1, 80, 1));
+    CHECK(cyw_get_stats(&st) == CYW_OK);
+    CHECK(st.tx_queued == 0);
+}
+
+/* Events reach their subscriber with status and data */
+static void test_event(void)
+{
+    static const uint16_t types[] = { WLC_E_LINK };
+    static const uint8_t data[6] = { 1, 2, 3, 4, 5, 6 };
+
+    printf("events\n");
+
+    memset(&evt, 0, sizeof(evt));
+    CHECK(cyw_event_register(types, ARRAY_SIZE(types), on_event, NULL) == CYW_OK);
+
+    /* Not subscribed: dropped */
+    CHECK(event_inject(WLC_E_ESCAN_RESULT, 0, data, sizeof(data)) == 0);
+    CHECK(event_inject(WLC_E_LINK, 7, data, sizeof(data)) == 0);
+    for (int i = 0; i < POLL_MAX && evt.count == 0; i++) {
+        cyw_poll();
+    }
+
+    CHECK(evt.count == 1);
+    CHECK(evt.ev.type == WLC_E_LINK && evt.ev.status == 7);
+    CHECK(evt.len == sizeof(data) && memcmp(evt.data, data, sizeof(data)) == 0);
+
+    CHECK(cyw_event_unregister(on_event, NULL) == CYW_OK);
+}
+
+/* The RSSI in WLC_E_RSSI is a big-endian int32, kept within dBm range */
+static int32_t rssi_event(int32_t dbm)
+{
+    uint8_t data[4];
+    cyw_stats_t st;
+
+    put_be32(data, (uint32_t)dbm);
+    CHECK(event_inject(WLC_E_RSSI, 0, data, sizeof(data)) == 0);
+    for (int i = 0; i < POLL_MAX; i++) {
+        cyw_poll();
+    }
+    CHECK(cyw_get_stats(&st) == CYW_OK);
+    return st.rssi;
+}
+
+static void test_roam_rssi(void)
+{
+    printf("RSSI events\n");
+
+    CHECK(cyw_roam_start(NULL) == CYW_OK);
+    CHECK(rssi_event(-70) == -70);
+    CHECK(rssi_event(-100000) == INT8_MIN);
+    CHECK(rssi_event(-55) == -55);
+    CHECK(cyw_roam_stop() == CYW_OK);
+}
+
+/*
+ * A batch with a large setting while a received frame holds the IOCTL
+ * arena: it fails with CYW_ERR_BUSY instead of waiting for ever, and goes
+ * through once the frame is released
+ */
+static void test_batch_arena(void)
+{
+    static uint8_t big[CYW_PKT_BUF_SIZE + 512];
+    uint32_t small = 0x11223344;
+    cyw_ioctl_op_t ops[] = {
+        CYW_IOCTL_SET(WLC_SET_PM, &small, sizeof(small)),
+        CYW_IOVAR_SET("big", big, sizeof(big)),
+        CYW_IOCTL_SET(WLC_SET_PM, &small, sizeof(small)),
+    };
+    cyw_stats_t st;
+
+    printf("IOCTL batch and a busy arena\n");
+
+    CHECK(cyw_ioctl_batch(ops, ARRAY_SIZE(ops)) == CYW_OK);
+    CHECK(ops[1].status == CYW_OK && ops[2].status == CYW_OK);
+
+    /* Too large for an RX buffer: read into the arena and kept there */
+    rx.count = 0;
+    rx_hold_len = CYW_PKT_BUF_SIZE;
+    CHECK(frame_inject(CYW_PKT_BUF_SIZE + 100, 9) == 0);
+    poll_rx(1);
+    CHECK(rx_held != NULL);
+
+    /* The large setting waits for the first to finish, then finds the
+     * arena still taken */
+    CHECK(cyw_ioctl_batch(ops, ARRAY_SIZE(ops)) == CYW_ERR_BUSY);
+    CHECK(ops[0].status == CYW_OK);
+    CHECK(ops[1].status == CYW_ERR_BUSY);
+    CHECK(ops[2].status == CYW_ERR_NOT_READY);
+    CHECK(cyw_get_stats(&st) == CYW_OK);
+    CHECK(st.ioctl_pending == 0);
+
+    cyw_pkt_free(rx_held);
+    rx_held = NULL;
+    rx_hold_len = 0;
+    CHECK(cyw_ioctl_batch(ops, ARRAY_SIZE(ops)) == CYW_OK);
+    CHECK(ops[1].status == CYW_OK && ops[2].status == CYW_OK);
+}
+
+/* A frame queued during a background scan slice aborts the slice */
+static void test_bgscan_tx(void)
+{
+    static const uint16_t ch[] = { 1, 6, 11 };
+    cyw_bgscan_params_t bg = { .channels = ch, .channel_count = ARRAY_SIZE(ch) };
+    uint32_t val = 0;
+    cyw_stats_t st;
+
+    printf("background scan and TX\n");
+
+    CHECK(cyw_bgscan_start(&bg) == CYW_OK);
+    cyw_poll();
+    CHECK(cyw_scan_busy());             /* The model never completes it */
+
+    /* Held back by flow control, the frame stays queued */
+    loopback_set_flow_ctrl(1 << 5);
+    CHECK(cyw_ioctl(WLC_GET_VAR, &val, sizeof(val), false) == CYW_OK);
+    rx.count = 0;
+    CHECK(frame_send(70, 4, 5) == CYW_OK);
+    cyw_poll();
+
+    CHECK(!cyw_scan_busy());
+    CHECK(cyw_get_stats(&st) == CYW_OK);
+    CHECK(st.bgscan_defer == 1 && st.bgscan_slices == 0);
+    cyw_bgscan_stop();
+
+    loopback_set_flow_ctrl(0);
+    CHECK(cyw_ioctl(WLC_GET_VAR, &val, sizeof(val), false) == CYW_OK);
+    CHECK(cyw_tx_flush() == CYW_OK);
+    poll_rx(1);
+    CHECK(rx.count == 1 && frame_match(0, 70, 4));
+}
+
+/* A host that moves at most SPLIT_MAX bytes per CMD53 */
+#define SPLIT_MAX           64
+
+static sdio_host_ops_t split_ops;
+static uint32_t split_seen;
+
+static uint32_t split_max_xfer(uint8_t func)
+{
+    (void)func;
+    return SPLIT_MAX;
+}
+
+static int split_cmd53_read(uint8_t func, uint32_t addr, uint8_t *data,
+                            uint32_t len, bool incr_addr)
+{
+    split_seen = MAX(split_seen, len);
+    return loopback_get_sdio_ops()->cmd53_read(func, addr, data, len, incr_addr);
+}
+
+static int split_cmd53_write(uint8_t func, uint32_t addr, const uint8_t *data,
+                             uint32_t len, bool incr_addr)
+{
+    split_seen = MAX(split_seen, len);
+    return loopback_get_sdio_ops()->cmd53_write(func, addr, data, len, incr_addr);
+}
+
+static int split_cmd53_write_sg(uint8_t func, uint32_t addr, const sdio_sg_t *sg,
+                                uint32_t count, bool incr_addr)
+{
+    uint32_t len = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        len += sg[i].len;
+    }
+    split_seen = MAX(split_seen, len);
+    return loopback_get_sdio_ops()->cmd53_write_sg(func, addr, sg, count, incr_addr);
+}
+
+/* Frames and IOCTLs longer than the host limit go over several CMD53s */
+static void test_split(void)
+{
+    static const uint32_t lens[] = { 60, 300, 1514 };
+    loopback_stats_t lst;
+    uint32_t val = 0x55AA55AA;
+
+    printf("transfers split at %d bytes\n", SPLIT_MAX);
+
+    split_ops = *loopback_get_sdio_ops();
+    split_ops.max_xfer = split_max_xfer;
+    split_ops.cmd53_read = split_cmd53_read;
+    split_ops.cmd53_write = split_cmd53_write;
+    split_ops.cmd53_write_sg = split_cmd53_write_sg;
+    split_seen = 0;
+    bring_up(&split_ops);
+
+    CHECK(cyw_ioctl(WLC_GET_VAR, &val, sizeof(val), false) == CYW_OK);
+    CHECK(val == 0x55AA55AA);
+
+    rx.count = 0;
+    for (uint32_t i = 0; i < ARRAY_SIZE(lens); i++) {
+        CHECK(frame_send(lens[i], i, 0) == CYW_OK);
+    }
+    CHECK(cyw_tx_flush() == CYW_OK);
+    poll_rx(ARRAY_SIZE(lens));
+
+    CHECK(rx.count == ARRAY_SIZE(lens));
+    for (uint32_t i = 0; i < ARRAY_SIZE(lens) && i < rx.count; i++) {
+        CHECK(frame_match(i, lens[i], i));
+    }
+
+    loopback_get_stats(&lst);
+    CHECK(lst.tx_bad == 0);
+    CHECK(split_seen > 0 && split_seen <= SPLIT_MAX);
+}
+
+/* One interrupt for a burst: every frame is read and the interrupt cleared */
+static void test_irq_ack(void)
+{
+    const sdio_host_ops_t *ops = loopback_get_sdio_ops();
+
+    printf("interrupt acknowledge\n");
+
+    rx.count = 0;
+    for (uint32_t i = 0; i < 4; i++) {
+        CHECK(frame_inject(100 + i, i) == 0);
+    }
+    CHECK(ops->irq_pending());
+    poll_rx(4);
+    CHECK(rx.count == 4);
+    for (uint32_t i = 0; i < 4 && i < rx.count; i++) {
+        CHECK(frame_match(i, 100 + i, i));
+    }
+    CHECK(!ops->irq_pending());
+}
+
+/* Without irq_pending cyw_poll() reads the bus: data and events still arrive */
+static void test_no_irq(void)
+{
+    static const uint16_t types[] = { WLC_E_LINK };
+    static const uint8_t data[4] = { 9, 8, 7, 6 };
+    static sdio_host_ops_t ops;
+    cyw_pm_params_t pm = { .bus_sleep = true };
+
+    printf("host without interrupt\n");
+
+    ops = *loopback_get_sdio_ops();
+    ops.irq_pending = NULL;
+    bring_up(&ops);
+
+    rx.count = 0;
+    CHECK(frame_send(200, 3, 0) == CYW_OK);
+    CHECK(cyw_tx_flush() == CYW_OK);
+    poll_rx(1);
+    CHECK(rx.count == 1 && frame_match(0, 200, 3));
+
+    memset(&evt, 0, sizeof(evt));
+    CHECK(cyw_event_register(types, ARRAY_SIZE(types), on_event, NULL) == CYW_OK);
+    CHECK(event_inject(WLC_E_LINK, 0, data, sizeof(data)) == 0);
+    for (int i = 0; i < POLL_MAX && evt.count == 0; i++) {
+        cyw_poll();
+    }
+    CHECK(evt.count == 1 && evt.ev.type == WLC_E_LINK);
+    CHECK(cyw_event_unregister(on_event, NULL) == CYW_OK);
+
+    /* Nothing would wake a sleeping bus */
+    CHECK(cyw_set_power_save(&pm) == CYW_ERR_NOT_READY);
+}
+
+/* Frames queued for the host on every F2 read, until a deadline */
+static struct {
+    bool on;
+    uint32_t until;
+    uint32_t frames;
+} stream;
+
+static int stream_cmd53_read(uint8_t func, uint32_t addr, uint8_t *data,
+                             uint32_t len, bool incr_addr)
+{
+    const sdio_host_ops_t *lb = loopback_get_sdio_ops();
+
+    if (stream.on && func == SDIO_FUNC_2 &&
+        (int32_t)(lb->get_time_us() - stream.until) < 0 &&
+        frame_inject(60, stream.frames) == 0) {
+        stream.frames++;
+    }
+    return lb->cmd53_read(func, addr, data, len, incr_addr);
+}
+
+/* A lost response times out on time while data keeps the bus busy */
+static void test_ioctl_traffic(void)
+{
+    const sdio_host_ops_t *lb = loopback_get_sdio_ops();
+    static sdio_host_ops_t ops;
+    uint32_t val = 0, start;
+    cyw_stats_t st;
+
+    printf("IOCTL timeout under traffic\n");
+
+    ops = *lb;
+    ops.cmd53_read = stream_cmd53_read;
+    bring_up(&ops);
+
+    /* Ten timeouts' worth of frames */
+    rx.count = 0;
+    loopback_drop_ioctl(1);
+    start = lb->get_time_us();
+    stream.until = start + 10 * CYW_IOCTL_TIMEOUT_MS * 1000;
+    stream.frames = 0;
+    stream.on = true;
+    CHECK(cyw_ioctl(WLC_GET_VAR, &val, sizeof(val), false) == CYW_ERR_TIMEOUT);
+    CHECK(lb->get_time_us() - start < 3 * CYW_IOCTL_TIMEOUT_MS * 1000);
+    stream.on = false;
+
+    CHECK(stream.frames > 0 && rx.count > 0);
+    CHECK(cyw_get_stats(&st) == CYW_OK);
+    CHECK(st.ioctl_timeout == 1 && st.ioctl_pending == 0);
+
+    /* The next one goes through once the frames are drained */
+    for (int i = 0; i < POLL_MAX; i++) {
+        cyw_poll();
+    }
+    CHECK(cyw_ioctl(WLC_GET_VAR, &val, sizeof(val), false) == CYW_OK);
+}
+
+int main(void)
+{
+    bring_up(loopback_get_sdio_ops());
+    test_ioctl();
+    test_echo();
+    test_glom();
+    test_flow_ctrl();
+    test_event();
+    test_irq_ack();
+    test_roam_rssi();
+    test_batch_arena();
+    test_bgscan_tx();
+    test_split();
+    test_no_irq();
+    test_ioctl_traffic();
+
+    printf("%s: %s\n", __FILE__, failures ? "FAILED" : "OK");
+    return failures ? 1 : 0;
+}
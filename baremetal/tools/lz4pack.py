@@ -0,0 +1,155 @@
+#!/usr/bin/env python3
+#
+# CYW55500 firmware/NVRAM image packer
+#
+# Compresses an image into the block-framed LZ4 container understood by
+# cyw55500_lz4.c. Every block is compressed independently, so the target
+# only needs one block-sized scratch buffer to stream the image into the
+# chip - never a full-size RAM copy.
+#
+# Container layout (little-endian):
+#   u32 magic       "CYZ1"
+#   u32 raw_size    size of the decompressed image
+#   u32 block_size  decompressed bytes per block (last block may be shorter)
+#   u32 reserved    0
+#   blocks:         u32 header (bit31 = stored, bits 30:0 = payload length)
+#                   payload, padded to 4 bytes
+#
+# Blocks that do not shrink (e.g. encrypted firmware) are stored as-is and
+# are written to the chip straight from the container without a copy.
+#
+# Usage:
+#   lz4pack.py [-b BLOCK_SIZE] [--c-array NAME] input output
+#
+
+import argparse
+import struct
+import sys
+
+MAGIC = b"CYZ1"
+BLOCK_STORED = 0x80000000
+DEFAULT_BLOCK_SIZE = 2048
+
+MIN_MATCH = 4
+LAST_LITERALS = 5       # LZ4 spec: last 5 bytes are always literals
+MF_LIMIT = 12           # LZ4 spec: last match starts >= 12 bytes before end
+MAX_OFFSET = 0xFFFF
+HASH_BITS = 12
+
+
+def _put_length(out, n):
+    while n >= 255:
+        out.append(255)
+        n -= 255
+    out.append(n)
+
+
+def _emit(out, literals, match_len, offset):
+    lit_len = len(literals)
+    token = (min(lit_len, 15) << 4)
+    if match_len is not None:
+        token |= min(match_len - MIN_MATCH, 15)
+    out.append(token)
+    if lit_len >= 15:
+        _put_length(out, lit_len - 15)
+    out += literals
+    if match_len is not None:
+        out += struct.pack("<H", offset)
+        if match_len - MIN_MATCH >= 15:
+            _put_length(out, match_len - MIN_MATCH - 15)
+
+
+def lz4_compress_block(src):
+    """Greedy single-probe LZ4 block compressor (raw block, no frame)."""
+    n = len(src)
+    out = bytearray()
+    table = {}
+    anchor = 0
+    i = 0
+    limit = n - MF_LIMIT
+
+    while i < limit:
+        key = src[i:i + MIN_MATCH]
+        h = ((struct.unpack("<I", key)[0] * 2654435761) & 0xFFFFFFFF) >> (32 - HASH_BITS)
+        cand = table.get(h)
+        table[h] = i
+
+        if cand is None or i - cand > MAX_OFFSET or src[cand:cand + MIN_MATCH] != key:
+            i += 1
+            continue
+
+        # Extend the match, keeping the trailing literals intact
+        m = MIN_MATCH
+        end = n - LAST_LITERALS
+        while i + m < end and src[cand + m] == src[i + m]:
+            m += 1
+
+        _emit(out, src[anchor:i], m, i - cand)
+        i += m
+        anchor = i
+
+    _emit(out, src[anchor:], None, 0)
+    return bytes(out)
+
+
+def pack(data, block_size):
+    out = bytearray(MAGIC)
+    out += struct.pack("<III", len(data), block_size, 0)
+
+    for pos in range(0, len(data), block_size):
+        raw = data[pos:pos + block_size]
+        comp = lz4_compress_block(raw)
+        if len(comp) < len(raw):
+            hdr, payload = len(comp), comp
+        else:
+            hdr, payload = BLOCK_STORED | len(raw), raw
+        out += struct.pack("<I", hdr)
+        out += payload
+        out += b"\0" * (-len(payload) & 3)
+
+    return bytes(out)
+
+
+def write_c_array(path, name, blob):
+    with open(path, "w") as f:
+        f.write("/* Generated by lz4pack.py - do not edit */\n\n")
+        f.write("#include <stdint.h>\n\n")
+        f.write("const uint8_t %s[] __attribute__((aligned(4))) = {\n" % name)
+        for i in range(0, len(blob), 12):
+            chunk = blob[i:i + 12]
+            f.write("  " + ", ".join("0x%02x" % b for b in chunk) + ",\n")
+        f.write("};\n\n")
+        f.write("const uint32_t %s_len = %d;\n" % (name, len(blob)))
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Pack a firmware/NVRAM image "
+                                 "into the CYZ1 block-framed LZ4 container")
+    ap.add_argument("-b", "--block-size", type=int, default=DEFAULT_BLOCK_SIZE,
+                    help="decompressed block size (default %d)" % DEFAULT_BLOCK_SIZE)
+    ap.add_argument("--c-array", metavar="NAME",
+                    help="emit a C source file with array NAME instead of binary")
+    ap.add_argument("input")
+    ap.add_argument("output")
+    args = ap.parse_args()
+
+    if args.block_size <= 0 or args.block_size % 4:
+        sys.exit("block size must be a positive multiple of 4")
+
+    with open(args.input, "rb") as f:
+        data = f.read()
+
+    blob = pack(data, args.block_size)
+
+    if args.c_array:
+        write_c_array(args.output, args.c_array, blob)
+    else:
+        with open(args.output, "wb") as f:
+            f.write(blob)
+
+    print("%s: %d -> %d bytes (%.1f%%)" % (args.input, len(data), len(blob),
+          100.0 * len(blob) / max(len(data), 1)))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,122 @@
+#!/usr/bin/env python3
+#
+# CYW55500 NVRAM packer
+#
+# Converts the NVRAM text file into the binary form the firmware parses:
+# NUL-separated key=value entries, padded to 4 bytes, followed by the
+# length token. cyw_load_firmware() recognises the token and writes the
+# blob verbatim, so no comments or whitespace go over the bus and no
+# parsing happens on the target.
+#
+# Blob layout:
+#   "key=value\0key=value\0...\0"   entries in file order
+#   \0 padding                      to a multiple of 4 bytes
+#   u32 token (little-endian)       (~words << 16) | words,
+#                                   words = padded length / 4
+#
+# Board overrides (applied in order, later wins):
+#   -D key=value        set/replace an entry
+#   -U key              remove an entry
+#   --override FILE     NVRAM-format file; "key=value" lines replace,
+#                       "!key" lines remove
+#
+# Replaced entries keep their original position; new entries are appended.
+#
+# Usage:
+#   nvram_pack.py [--override FILE]... [-D key=value]... [-U key]... input output
+#
+
+import argparse
+import re
+import struct
+import sys
+
+# Same rule as the Linux brcmfmac NVRAM parser: a value ends at the first
+# whitespace, '#' or non-printable character; the rest of the line is comment.
+VALUE_RE = re.compile(r"[!-\"$-}]*")
+
+
+def parse_lines(path, lines, allow_remove=False):
+    """Yield (key, value) pairs; value None means remove."""
+    for num, raw in enumerate(lines, 1):
+        line = raw.strip()
+        if not line or line.startswith("#"):
+            continue
+        if allow_remove and line.startswith("!"):
+            yield line[1:].strip(), None
+            continue
+        key, sep, value = line.partition("=")
+        key = key.strip()
+        if not sep or not key:
+            print("%s:%d: ignoring malformed line: %s" % (path, num, line),
+                  file=sys.stderr)
+            continue
+        yield key, VALUE_RE.match(value.strip()).group(0)
+
+
+def apply(entries, key, value):
+    if value is None:
+        entries.pop(key, None)
+    else:
+        entries[key] = value
+
+
+def pack(entries):
+    blob = bytearray()
+    for key, value in entries.items():
+        blob += ("%s=%s" % (key, value)).encode("ascii")
+        blob += b"\0"
+    blob += b"\0"
+    blob += b"\0" * (-len(blob) & 3)
+
+    words = len(blob) // 4
+    token = ((~words & 0xFFFF) << 16) | (words & 0xFFFF)
+    blob += struct.pack("<I", token)
+    return bytes(blob)
+
+
+def read_text(path):
+    with open(path, "rb") as f:
+        return f.read().decode("ascii", errors="replace").splitlines()
+
+
+def main():
+    ap = argparse.ArgumentParser(description="Pack an NVRAM text file into "
+                                 "the binary blob downloaded to the chip")
+    ap.add_argument("--override", metavar="FILE", action="append", default=[],
+                    help="board override file (repeatable)")
+    ap.add_argument("-D", dest="defines", metavar="KEY=VALUE", action="append",
+                    default=[], help="set an entry (repeatable)")
+    ap.add_argument("-U", dest="undefs", metavar="KEY", action="append",
+                    default=[], help="remove an entry (repeatable)")
+    ap.add_argument("input")
+    ap.add_argument("output")
+    args = ap.parse_args()
+
+    # dict keeps insertion order; duplicate keys in the input: last wins
+    entries = {}
+    for key, value in parse_lines(args.input, read_text(args.input)):
+        apply(entries, key, value)
+
+    for path in args.override:
+        for key, value in parse_lines(path, read_text(path), allow_remove=True):
+            apply(entries, key, value)
+
+    for key, value in parse_lines("-D", args.defines):
+        apply(entries, key, value)
+
+    for key in args.undefs:
+        apply(entries, key, None)
+
+    blob = pack(entries)
+    if len(blob) // 4 > 0xFFFF:
+        sys.exit("packed NVRAM too large for the length token")
+
+    with open(args.output, "wb") as f:
+        f.write(blob)
+
+    print("%s: %d entries, %d bytes" % (args.input, len(entries), len(blob)))
+
+
+if __name__ == "__main__":
+    main()